@@ -0,0 +1,373 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "backend/rawblockdevice.h"
+
+#include "util/report.h"
+
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+#include <KLocalizedString>
+
+#include <cerrno>
+#include <climits>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/** An open device node, shared by all RawBlockDevices on it */
+struct RawBlockDeviceHandle {
+    QString path;
+    int fd;
+    qint64 size;
+    bool claimed;
+    bool writable;
+    qint32 refs;
+};
+
+static QMutex s_HandlesMutex;
+static QHash<QString, RawBlockDeviceHandle*> s_Handles;
+
+/** Creates a new RawBlockDevice. It must be opened before it can be used.
+    @param deviceNode the device node, e.g. /dev/sda
+    @param sectorSize the size of the sectors offsets are given in
+    @param mode whether the device is only read from or also written to
+*/
+RawBlockDevice::RawBlockDevice(const QString& deviceNode, qint32 sectorSize, AccessMode mode) :
+    CoreBackendDevice(deviceNode),
+    m_SectorSize(sectorSize),
+    m_AccessMode(mode),
+    m_Handle(nullptr)
+{
+}
+
+RawBlockDevice::~RawBlockDevice()
+{
+    if (m_Handle)
+        close();
+}
+
+/** Opens the device node for reading and, if the RawBlockDevice is for writing, for writing.
+    @return true on success
+*/
+bool RawBlockDevice::open()
+{
+    Q_ASSERT(m_Handle == nullptr);
+
+    return m_Handle == nullptr && acquire();
+}
+
+/** Opens the device node like open() and allows writing to it if the RawBlockDevice is for writing.
+    @return true on success
+*/
+bool RawBlockDevice::openExclusive()
+{
+    if (!open())
+        return false;
+
+    setExclusive(true);
+    return true;
+}
+
+/** Closes the device. The device node is closed once no RawBlockDevice uses it any more.
+    @return true on success
+*/
+bool RawBlockDevice::close()
+{
+    Q_ASSERT(m_Handle);
+
+    if (m_Handle == nullptr)
+        return false;
+
+    QMutexLocker locker(&s_HandlesMutex);
+
+    bool rval = true;
+
+    if (--m_Handle->refs == 0) {
+        s_Handles.remove(m_Handle->path);
+
+        if (m_Handle->writable && fsync(m_Handle->fd) != 0)
+            rval = false;
+
+        if (::close(m_Handle->fd) != 0)
+            rval = false;
+
+        delete m_Handle;
+    }
+
+    m_Handle = nullptr;
+    setExclusive(false);
+
+    return rval;
+}
+
+/** Opens a device node, with O_EXCL if the kernel allows it.
+    @param name the device node
+    @param flags the flags to open it with
+    @param claimed set to true if it was opened with O_EXCL
+    @return the file descriptor or -1
+*/
+static int openNode(const QByteArray& name, int flags, bool& claimed)
+{
+    claimed = true;
+    int fd = ::open(name.constData(), flags | O_EXCL | O_CLOEXEC);
+
+    if (fd == -1 && errno == EBUSY) {
+        claimed = false;
+        fd = ::open(name.constData(), flags | O_CLOEXEC);
+    }
+
+    return fd;
+}
+
+/** Shares the handle of the device node, opening it if no other RawBlockDevice has.
+    @return true on success
+*/
+bool RawBlockDevice::acquire()
+{
+    const QString path = QFileInfo(deviceNode()).canonicalFilePath();
+
+    if (path.isEmpty())
+        return false;
+
+    QMutexLocker locker(&s_HandlesMutex);
+
+    if (RawBlockDeviceHandle* handle = s_Handles.value(path)) {
+        if (accessMode() == ReadWrite && !handle->writable && !upgrade(handle))
+            return false;
+
+        handle->refs++;
+        m_Handle = handle;
+        return true;
+    }
+
+    bool claimed = false;
+    const int fd = openNode(path.toLocal8Bit(), accessMode() == ReadWrite ? O_RDWR : O_RDONLY, claimed);
+
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    quint64 size = 0;
+
+    if (fstat(fd, &st) != 0 || (S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &size) != 0) || !(S_ISBLK(st.st_mode) || S_ISREG(st.st_mode))) {
+        ::close(fd);
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode))
+        size = st.st_size;
+
+    m_Handle = new RawBlockDeviceHandle{path, fd, static_cast<qint64>(size), claimed, accessMode() == ReadWrite, 1};
+    s_Handles.insert(path, m_Handle);
+
+    return true;
+}
+
+/** Reopens a handle opened read-only for writing.
+
+    The RawBlockDevices sharing the handle and the I/O queued on it keep using the same
+    file descriptor number, which is pointed at the new file description with dup3(2).
+
+    @param handle the handle, whose mutex must be held
+    @return true on success
+*/
+bool RawBlockDevice::upgrade(RawBlockDeviceHandle* handle)
+{
+    const QByteArray name = handle->path.toLocal8Bit();
+
+    // The read-only descriptor may hold the exclusive claim, which a second open with
+    // O_EXCL would collide with, so it is replaced by a plain read-write one first.
+    const int fd = ::open(name.constData(), O_RDWR | O_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+    const bool replaced = dup3(fd, handle->fd, O_CLOEXEC) != -1;
+    ::close(fd);
+
+    if (!replaced)
+        return false;
+
+    handle->writable = true;
+
+    bool claimed = false;
+    const int exclusiveFd = openNode(name, O_RDWR, claimed);
+
+    if (exclusiveFd != -1 && claimed && dup3(exclusiveFd, handle->fd, O_CLOEXEC) != -1)
+        handle->claimed = true;
+    else
+        handle->claimed = false;
+
+    if (exclusiveFd != -1)
+        ::close(exclusiveFd);
+
+    return true;
+}
+
+/** Partition tables are not changed through a RawBlockDevice.
+    @return nullptr
+*/
+CoreBackendPartitionTable* RawBlockDevice::openPartitionTable()
+{
+    return nullptr;
+}
+
+/** Partition tables are not changed through a RawBlockDevice.
+    @param report the Report to write information to
+    @return false
+*/
+bool RawBlockDevice::createPartitionTable(Report& report, const PartitionTable&)
+{
+    report.line() << xi18nc("@info:progress", "Creating partition table failed: <filename>%1</filename> is opened for data only.", deviceNode());
+    return false;
+}
+
+/** Reads sectors from the device.
+    @param buffer the buffer to read into
+    @param offset the sector to start reading at
+    @param numSectors the number of sectors to read
+    @return true on success
+*/
+bool RawBlockDevice::readSectors(void* buffer, qint64 offset, qint64 numSectors)
+{
+    struct iovec iov = { buffer, static_cast<size_t>(numSectors * sectorSize()) };
+    return transfer(&iov, 1, offset, false);
+}
+
+/** Writes sectors to the device. The device must be for writing and have been opened with openExclusive().
+    @param buffer the data to write
+    @param offset the sector to start writing at
+    @param numSectors the number of sectors to write
+    @return true on success
+*/
+bool RawBlockDevice::writeSectors(void* buffer, qint64 offset, qint64 numSectors)
+{
+    struct iovec iov = { buffer, static_cast<size_t>(numSectors * sectorSize()) };
+    return transfer(&iov, 1, offset, true);
+}
+
+/** Reads consecutive sectors from the device into several buffers.
+    @param iov the buffers; each length must be a multiple of the sector size
+    @param iovcnt the number of buffers
+    @param offset the sector to start reading at
+    @return true on success
+*/
+bool RawBlockDevice::readSectors(const struct iovec* iov, int iovcnt, qint64 offset)
+{
+    return transfer(iov, iovcnt, offset, false);
+}
+
+/** Writes consecutive sectors from several buffers to the device.
+    @param iov the buffers; each length must be a multiple of the sector size
+    @param iovcnt the number of buffers
+    @param offset the sector to start writing at
+    @return true on success
+*/
+bool RawBlockDevice::writeSectors(const struct iovec* iov, int iovcnt, qint64 offset)
+{
+    return transfer(iov, iovcnt, offset, true);
+}
+
+/** Carries out a read or write completely, continuing after short transfers and signals.
+    Requests reaching beyond the end of the device fail without any I/O.
+*/
+bool RawBlockDevice::transfer(const struct iovec* iov, int iovcnt, qint64 offset, bool write)
+{
+    if (m_Handle == nullptr || offset < 0 || iovcnt <= 0 || iovcnt > IOV_MAX)
+        return false;
+
+    if (write && !(isExclusive() && accessMode() == ReadWrite && m_Handle->writable))
+        return false;
+
+    qint64 length = 0;
+    for (int i = 0; i < iovcnt; i++)
+        length += iov[i].iov_len;
+
+    qint64 pos = offset * sectorSize();
+
+    if (length % sectorSize() != 0 || pos + length > m_Handle->size)
+        return false;
+
+    // the kernel may transfer fewer bytes than asked for, so the remaining iovecs are adjusted
+    QVector<struct iovec> rest(iov, iov + iovcnt);
+    struct iovec* next = rest.data();
+    int count = iovcnt;
+
+    while (count > 0) {
+        const ssize_t n = write ? pwritev(m_Handle->fd, next, count, pos) : preadv(m_Handle->fd, next, count, pos);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return false;
+
+        pos += n;
+
+        for (size_t done = n; done > 0; ) {
+            if (done >= next->iov_len) {
+                done -= next->iov_len;
+                next++;
+                count--;
+            } else {
+                next->iov_base = static_cast<char*>(next->iov_base) + done;
+                next->iov_len -= done;
+                done = 0;
+            }
+        }
+
+        while (count > 0 && next->iov_len == 0) {
+            next++;
+            count--;
+        }
+    }
+
+    return true;
+}
+
+/** @return the file descriptor of the device node, shared by all RawBlockDevices on it, or -1 */
+int RawBlockDevice::fileDescriptor() const
+{
+    return m_Handle ? m_Handle->fd : -1;
+}
+
+/** @return the size of the device in bytes */
+qint64 RawBlockDevice::size() const
+{
+    return m_Handle ? m_Handle->size : 0;
+}
+
+/** @return true if the device node is opened with O_EXCL */
+bool RawBlockDevice::isClaimed() const
+{
+    return m_Handle && m_Handle->claimed;
+}
+
+/** @return true if the device node is opened for writing */
+bool RawBlockDevice::isWritable() const
+{
+    return m_Handle && m_Handle->writable;
+}
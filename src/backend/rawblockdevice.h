@@ -0,0 +1,106 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(RAWBLOCKDEVICE__H)
+
+#define RAWBLOCKDEVICE__H
+
+#include "backend/corebackenddevice.h"
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QtGlobal>
+
+struct iovec;
+struct RawBlockDeviceHandle;
+
+/** A device accessed directly through its device node.
+
+    RawBlockDevice reads and writes sectors with preadv(2) and pwritev(2), without the
+    retries, exception handlers and sector size assumptions of the backend plugin. Copies
+    use it for all data they move; the plugin's devices are still used to change partition
+    tables, which RawBlockDevice does not support.
+
+    The device node is opened with O_EXCL, so no file system can be mounted from it while
+    it is open. If the kernel refuses the exclusive claim, e.g. because another partition
+    on the same disk is mounted, it is opened without it and isClaimed() returns false.
+
+    A RawBlockDevice created for reading opens the device node read-only. Closing a
+    writable file descriptor of a disk makes udev rescan it, which a backup or the source
+    of a copy must not cause.
+
+    All RawBlockDevices on the same device node share one file descriptor, so a move from
+    one place on a disk to another uses a single handle for reading and writing. If a
+    RawBlockDevice for writing joins a handle opened read-only, the handle is reopened for
+    writing under the same file descriptor number.
+
+    RawBlockDevice is thread-safe as far as opening and closing are concerned; reads and
+    writes do not share any state.
+*/
+class LIBKPMCORE_EXPORT RawBlockDevice : public CoreBackendDevice
+{
+    Q_DISABLE_COPY(RawBlockDevice)
+
+public:
+    /** How a RawBlockDevice accesses its device node */
+    enum AccessMode {
+        ReadOnly,   /**< only read from the device */
+        ReadWrite   /**< read from and write to the device */
+    };
+
+public:
+    RawBlockDevice(const QString& deviceNode, qint32 sectorSize, AccessMode mode);
+    ~RawBlockDevice();
+
+public:
+    bool open() override;
+    bool openExclusive() override;
+    bool close() override;
+
+    CoreBackendPartitionTable* openPartitionTable() override;
+    bool createPartitionTable(Report& report, const PartitionTable& ptable) override;
+
+    bool readSectors(void* buffer, qint64 offset, qint64 numSectors) override;
+    bool writeSectors(void* buffer, qint64 offset, qint64 numSectors) override;
+
+    bool readSectors(const struct iovec* iov, int iovcnt, qint64 offset);
+    bool writeSectors(const struct iovec* iov, int iovcnt, qint64 offset);
+
+    int fileDescriptor() const;
+    qint64 size() const;
+    bool isClaimed() const;
+    bool isWritable() const;
+
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the size of the sectors offsets are given in */
+    }
+    AccessMode accessMode() const {
+        return m_AccessMode;    /**< @return how the device node is accessed */
+    }
+
+protected:
+    bool acquire();
+    bool upgrade(RawBlockDeviceHandle* handle);
+    bool transfer(const struct iovec* iov, int iovcnt, qint64 offset, bool write);
+
+private:
+    const qint32 m_SectorSize;
+    const AccessMode m_AccessMode;
+    RawBlockDeviceHandle* m_Handle;
+};
+
+#endif
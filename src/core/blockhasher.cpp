@@ -0,0 +1,135 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/blockhasher.h"
+
+#include "core/blockindex.h"
+#include "core/copysource.h"
+
+#include <QRunnable>
+#include <QThread>
+
+/** Hashes one block on the thread pool */
+class BlockHashTask : public QRunnable
+{
+public:
+    BlockHashTask(BlockIndex& index, qint64 block, const QByteArray& data, QSemaphore& slots) :
+        m_Index(index),
+        m_Block(block),
+        m_Data(data),
+        m_Slots(slots)
+    {
+    }
+
+    void run() override {
+        m_Index.setHash(m_Block, BlockIndex::hashBlock(m_Data.constData(), m_Data.size()));
+        m_Index.setFlags(m_Block, BlockIndex::Used | BlockIndex::Stored);
+        m_Data = QByteArray();
+        m_Slots.release();
+    }
+
+private:
+    BlockIndex& m_Index;
+    const qint64 m_Block;
+    QByteArray m_Data;
+    QSemaphore& m_Slots;
+};
+
+/** Creates a new BlockHasher.
+    @param index the index to fill, created for the length of the copy
+*/
+BlockHasher::BlockHasher(BlockIndex& index) :
+    m_Index(index),
+    m_Pool(),
+    m_Slots(),
+    m_Pending(),
+    m_Next(0),
+    m_NextBlock(0),
+    m_Failed(false)
+{
+    const int numThreads = qMax(QThread::idealThreadCount(), 1);
+
+    m_Pool.setMaxThreadCount(numThreads);
+
+    // limits the memory held by blocks waiting to be hashed
+    m_Slots.release(2 * numThreads);
+}
+
+BlockHasher::~BlockHasher()
+{
+    m_Pool.waitForDone();
+}
+
+/** Adds the data of the next sectors copied.
+    @param source the CopySource the data has been read from
+    @param readOffset the first sector the data has been read from
+    @param data the data
+    @param numSectors the number of sectors of data
+*/
+void BlockHasher::add(const CopySource& source, qint64 readOffset, const void* data, qint64 numSectors)
+{
+    // blocks can only be hashed if the data comes front to back
+    if (readOffset - source.firstSector() != m_Next) {
+        m_Failed = true;
+        return;
+    }
+
+    const char* p = static_cast<const char*>(data);
+    qint64 left = numSectors * source.sectorSize();
+
+    while (left > 0) {
+        const qint64 n = qMin(left, BlockIndex::blockBytes() - m_Pending.size());
+
+        m_Pending.append(p, n);
+        p += n;
+        left -= n;
+
+        if (m_Pending.size() == BlockIndex::blockBytes())
+            queueBlock(source);
+    }
+
+    m_Next += numSectors;
+}
+
+/** Hashes the last block and waits for all blocks to be hashed.
+    @param source the CopySource the data has been read from
+    @return true if all the data of the copy has been hashed
+*/
+bool BlockHasher::finish(const CopySource& source)
+{
+    if (!m_Pending.isEmpty())
+        queueBlock(source);
+
+    m_Pool.waitForDone();
+
+    return !m_Failed && m_Next == index().length();
+}
+
+void BlockHasher::queueBlock(const CopySource& source)
+{
+    const qint64 block = m_NextBlock++;
+    const qint64 first = block * index().blockSectors();
+    const qint64 numSectors = m_Pending.size() / source.sectorSize();
+
+    // sectors the source does not use have been copied as zeros and are not stored
+    if (!source.isUnused(source.firstSector() + first, numSectors)) {
+        m_Slots.acquire();
+        m_Pool.start(new BlockHashTask(index(), block, m_Pending, m_Slots));
+    }
+
+    m_Pending = QByteArray();
+}
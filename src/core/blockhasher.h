@@ -0,0 +1,66 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLOCKHASHER__H)
+
+#define BLOCKHASHER__H
+
+#include <QByteArray>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtGlobal>
+
+class BlockIndex;
+class CopySource;
+
+/** Fills a BlockIndex from the data of a copy while it is running.
+
+    The data copied is handed to add() in order. Each completed block is hashed on a
+    thread pool, so hashing does not slow down the copy.
+
+    @see BlockIndex, Job::copyBlocks
+*/
+class BlockHasher
+{
+    Q_DISABLE_COPY(BlockHasher)
+
+public:
+    explicit BlockHasher(BlockIndex& index);
+    ~BlockHasher();
+
+public:
+    void add(const CopySource& source, qint64 readOffset, const void* data, qint64 numSectors);
+    bool finish(const CopySource& source);
+
+protected:
+    void queueBlock(const CopySource& source);
+
+    BlockIndex& index() {
+        return m_Index;
+    }
+
+private:
+    BlockIndex& m_Index;
+    QThreadPool m_Pool;
+    QSemaphore m_Slots;
+    QByteArray m_Pending;
+    qint64 m_Next;
+    qint64 m_NextBlock;
+    bool m_Failed;
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/blockindex.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <cstring>
+
+static const char indexMagic[8] = { 'K', 'P', 'M', 'B', 'I', 'D', 'X', '1' };
+static const int hashSize = 16;
+static const int headerSize = 32;
+
+/** Creates a new BlockIndex with all blocks unused.
+    @param sectorsize the sector size of the FileSystem
+    @param length the length of the FileSystem in sectors
+*/
+BlockIndex::BlockIndex(qint32 sectorsize, qint64 length) :
+    m_SectorSize(sectorsize),
+    m_Length(length),
+    m_Parent(),
+    m_Hashes(),
+    m_Flags()
+{
+    if (sectorsize > 0 && length > 0) {
+        const qint64 n = (length + blockSectors() - 1) / blockSectors();
+        m_Hashes = QByteArray(n * hashSize, 0);
+        m_Flags = QByteArray(n, 0);
+    }
+}
+
+/** Reads an index written by save().
+    @param fileName the name of the index file
+    @return true on success
+*/
+bool BlockIndex::load(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray header = file.read(headerSize);
+
+    if (header.size() != headerSize || memcmp(header.constData(), indexMagic, sizeof(indexMagic)) != 0)
+        return false;
+
+    const uchar* p = reinterpret_cast<const uchar*>(header.constData());
+    m_SectorSize = qFromLittleEndian<quint32>(p + 8);
+    m_Length = qFromLittleEndian<qint64>(p + 12);
+    const quint32 blockSize = qFromLittleEndian<quint32>(p + 20);
+    const quint32 parentSize = qFromLittleEndian<quint32>(p + 24);
+
+    if (m_SectorSize <= 0 || blockBytes() % m_SectorSize != 0 || blockSize != blockBytes() || m_Length <= 0)
+        return false;
+
+    const qint64 n = (m_Length + blockSectors() - 1) / blockSectors();
+
+    m_Parent = QString::fromUtf8(file.read(parentSize));
+    m_Hashes = file.read(n * hashSize);
+    m_Flags = file.read(n);
+
+    return m_Hashes.size() == n * hashSize && m_Flags.size() == n;
+}
+
+/** Writes the index to a file.
+
+    The file has a header with the sector size, the FileSystem's length, the block size
+    and the parent's name, followed by the hashes of all blocks and then their flags.
+
+    @param fileName the name of the file to write
+    @return true on success
+*/
+bool BlockIndex::save(const QString& fileName) const
+{
+    QSaveFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    const QByteArray parent = m_Parent.toUtf8();
+    QByteArray header(headerSize, 0);
+    uchar* p = reinterpret_cast<uchar*>(header.data());
+
+    memcpy(p, indexMagic, sizeof(indexMagic));
+    qToLittleEndian<quint32>(m_SectorSize, p + 8);
+    qToLittleEndian<qint64>(m_Length, p + 12);
+    qToLittleEndian<quint32>(blockBytes(), p + 20);
+    qToLittleEndian<quint32>(parent.size(), p + 24);
+
+    if (file.write(header) != header.size() || file.write(parent) != parent.size() ||
+            file.write(m_Hashes) != m_Hashes.size() || file.write(m_Flags) != m_Flags.size())
+        return false;
+
+    return file.commit();
+}
+
+/** Sets the flags of a block.
+
+    May be called from several threads at once for different blocks, as long as the
+    index is not copied meanwhile.
+*/
+void BlockIndex::setFlags(qint64 block, quint8 flags)
+{
+    m_Flags.data()[block] = static_cast<char>(flags);
+}
+
+/** Sets the hash of a block. Like setFlags(), this may be called from several threads. */
+void BlockIndex::setHash(qint64 block, const QByteArray& hash)
+{
+    Q_ASSERT(hash.size() == hashSize);
+
+    memcpy(m_Hashes.data() + block * hashSize, hash.constData(), hashSize);
+}
+
+bool BlockIndex::sameHash(qint64 block, const BlockIndex& other) const
+{
+    return memcmp(m_Hashes.constData() + block * hashSize, other.m_Hashes.constData() + block * hashSize, hashSize) == 0;
+}
+
+/** Finds the blocks that changed since the parent image was made and marks them as stored.
+
+    A block has changed if it is used now and was not used in the parent or has a
+    different hash. All other blocks can be taken from the parent.
+
+    @param parent the index of the parent image
+    @return the changed blocks as extents in bytes from the start of the FileSystem
+*/
+QList<FileSystem::Extent> BlockIndex::changedExtents(const BlockIndex& parent)
+{
+    QList<FileSystem::Extent> rval;
+    const qint64 blockSize = blockBytes();
+    const bool comparable = parent.sectorSize() == sectorSize();
+
+    for (qint64 block = 0; block < numBlocks(); block++) {
+        if (!(flags(block) & Used))
+            continue;
+
+        if (comparable && (parent.flags(block) & Used) && sameHash(block, parent))
+            continue;
+
+        setFlags(block, flags(block) | Stored);
+
+        if (!rval.isEmpty() && rval.last().offset + rval.last().length == block * blockSize)
+            rval.last().length += blockSize;
+        else {
+            FileSystem::Extent extent = { block * blockSize, blockSize };
+            rval.append(extent);
+        }
+    }
+
+    return rval;
+}
+
+/** @return the hash of a block's data */
+QByteArray BlockIndex::hashBlock(const void* data, qint64 size)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData(static_cast<const char*>(data), size), QCryptographicHash::Md5);
+}
+
+/** @return the name of the index file for the given image file */
+QString BlockIndex::fileName(const QString& imageFileName)
+{
+    return imageFileName + QStringLiteral(".blkidx");
+}
@@ -0,0 +1,102 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLOCKINDEX__H)
+
+#define BLOCKINDEX__H
+
+#include "fs/filesystem.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+/** The hashes of the blocks of a backup image.
+
+    Every backup writes an index next to its image with a hash for each block of 1 MiB
+    of the FileSystem. An incremental backup hashes the FileSystem again, compares with
+    the index of its parent image and copies only the blocks that changed into a delta
+    image. The delta image's index names the parent and marks which blocks the delta
+    image holds, so that a restore can put the chain of images back together.
+
+    Blocks the FileSystem does not use are neither hashed nor stored.
+
+    @see CopySourceImageChain, BlockHasher
+*/
+class BlockIndex
+{
+public:
+    /** What is known about a block */
+    enum Flag {
+        Used = 1,       /**< the FileSystem uses the block */
+        Stored = 2      /**< the image holds the block's data */
+    };
+
+public:
+    explicit BlockIndex(qint32 sectorsize = 0, qint64 length = 0);
+
+public:
+    bool load(const QString& fileName);
+    bool save(const QString& fileName) const;
+
+    QList<FileSystem::Extent> changedExtents(const BlockIndex& parent);
+
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the sector size of the FileSystem */
+    }
+    qint64 length() const {
+        return m_Length;    /**< @return the length of the FileSystem in sectors */
+    }
+    qint64 blockSectors() const {
+        return blockBytes() / sectorSize();    /**< @return the size of a block in sectors */
+    }
+    qint64 numBlocks() const {
+        return m_Flags.size();    /**< @return the number of blocks */
+    }
+
+    const QString& parent() const {
+        return m_Parent;    /**< @return the parent image's file name relative to this image, empty for a full image */
+    }
+    void setParent(const QString& parent) {
+        m_Parent = parent;
+    }
+
+    quint8 flags(qint64 block) const {
+        return block < numBlocks() ? static_cast<quint8>(m_Flags[static_cast<int>(block)]) : 0;    /**< @return the flags of the given block */
+    }
+    void setFlags(qint64 block, quint8 flags);
+    void setHash(qint64 block, const QByteArray& hash);
+
+    static qint64 blockBytes() {
+        return 1024 * 1024;    /**< @return the size of a block in bytes */
+    }
+    static QByteArray hashBlock(const void* data, qint64 size);
+    static QString fileName(const QString& imageFileName);
+
+protected:
+    bool sameHash(qint64 block, const BlockIndex& other) const;
+
+private:
+    qint32 m_SectorSize;
+    qint64 m_Length;
+    QString m_Parent;
+    QByteArray m_Hashes;
+    QByteArray m_Flags;
+};
+
+#endif
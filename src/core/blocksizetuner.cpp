@@ -0,0 +1,208 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/blocksizetuner.h"
+
+#include "core/ioqueue.h"
+
+#include <QMutexLocker>
+#include <QString>
+
+/** How long the tuner tries different block sizes for, in milliseconds. */
+static const qint64 tuningTime = 5000;
+
+/** How long each block size is measured for, in nanoseconds. */
+static const qint64 sampleTime = 300 * 1000 * 1000;
+
+/** By how much a block size must be faster than the best one so far to be preferred, in percent. */
+static const qint64 minGain = 5;
+
+/** Rounds up to the next power of two. */
+static qint64 roundUpPowerOfTwo(qint64 n)
+{
+    qint64 rval = 1;
+
+    while (rval < n)
+        rval <<= 1;
+
+    return rval;
+}
+
+/** Creates a new BlockSizeTuner.
+    @param readFd the file descriptor read from or -1
+    @param writeFd the file descriptor written to or -1
+    @param sectorSize the sector size of the copy in bytes
+    @param floorbytes the smallest block size in bytes to choose, whatever the topology
+           suggests or measuring shows; rounded up to a power of two of at least minBytes()
+*/
+BlockSizeTuner::BlockSizeTuner(int readFd, int writeFd, qint32 sectorSize, qint64 floorbytes) :
+    m_SectorSize(sectorSize),
+    m_FloorBytes(qBound(minBytes(), roundUpPowerOfTwo(floorbytes), maxBytes())),
+    m_Mutex(),
+    m_Timer(),
+    m_Size(0),
+    m_BestSize(0),
+    m_BestRate(0),
+    m_Direction(1),
+    m_Turned(false),
+    m_Tuning(true),
+    m_LastDone(0),
+    m_SampleBytes(0),
+    m_SampleNsecs(0),
+    m_SampleBlocks(0)
+{
+    // Several of the largest requests the kernel sends to the slower device keep it busy.
+    const qint64 hint = 4 * qMax(topologyHint(readFd), topologyHint(writeFd));
+
+    m_Size = hint > 0 ? qBound(floorBytes(), roundUpPowerOfTwo(hint), maxBytes()) : qMax(floorBytes(), static_cast<qint64>(4 * 1024 * 1024));
+    m_BestSize = m_Size;
+    m_Timer.start();
+}
+
+/** Finds the I/O size the kernel's topology information suggests for a file descriptor.
+
+    @param fd the file descriptor or -1
+    @return the largest of the optimal I/O size, the physical block size and the maximum
+            request size in bytes, or -1 if none of them are known
+*/
+qint64 BlockSizeTuner::topologyHint(int fd)
+{
+    const qint64 optimalIoSize = IoQueue::queueLimit(fd, QStringLiteral("optimal_io_size"));
+    const qint64 physicalBlockSize = IoQueue::queueLimit(fd, QStringLiteral("physical_block_size"));
+    const qint64 maxSectorsKb = IoQueue::queueLimit(fd, QStringLiteral("max_sectors_kb"));
+
+    return qMax(qMax(optimalIoSize, physicalBlockSize), maxSectorsKb > 0 ? maxSectorsKb * 1024 : -1);
+}
+
+/** @return the size in sectors the next block should have */
+qint64 BlockSizeTuner::blockSize() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Size / m_SectorSize;
+}
+
+/** Records that a block has been copied.
+
+    Only full blocks of the size currently being measured count towards its throughput.
+    The first of them is skipped because blocks of the previous size may still have been
+    in flight while it was copied.
+
+    @param numSectors the number of sectors in the block
+*/
+void BlockSizeTuner::blockDone(qint64 numSectors)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    const qint64 now = m_Timer.nsecsElapsed();
+    const qint64 interval = now - m_LastDone;
+    const qint64 bytes = numSectors * m_SectorSize;
+
+    m_LastDone = now;
+
+    if (!m_Tuning)
+        return;
+
+    if (m_Timer.elapsed() > tuningTime) {
+        settle();
+        return;
+    }
+
+    if (bytes != m_Size)
+        return;
+
+    if (m_SampleBlocks++ == 0)
+        return;
+
+    m_SampleBytes += bytes;
+    m_SampleNsecs += interval;
+
+    if (m_SampleNsecs >= sampleTime && m_SampleBlocks > 2)
+        measured(m_SampleBytes * 1000 * 1000 * 1000 / qMax(m_SampleNsecs, 1LL));
+}
+
+/** Moves on to the next block size to try after the current one has been measured.
+
+    Block sizes are tried in one direction, starting with larger ones, for as long as they
+    are faster. If the first step does not help, smaller sizes are tried instead.
+*/
+void BlockSizeTuner::measured(qint64 bytesPerSecond)
+{
+    m_SampleBytes = 0;
+    m_SampleNsecs = 0;
+    m_SampleBlocks = 0;
+
+    if (bytesPerSecond * 100 > m_BestRate * (100 + minGain)) {
+        // once a step has helped, keep going in its direction
+        m_Turned = m_Turned || m_BestRate > 0;
+        m_BestSize = m_Size;
+        m_BestRate = bytesPerSecond;
+    } else if (!m_Turned) {
+        m_Turned = true;
+        m_Direction = -m_Direction;
+    } else {
+        settle();
+        return;
+    }
+
+    if (nextSize())
+        return;
+
+    if (!m_Turned) {
+        m_Turned = true;
+        m_Direction = -m_Direction;
+
+        if (nextSize())
+            return;
+    }
+
+    settle();
+}
+
+/** Steps from the best block size so far in the current direction.
+    @return false if the next size would be out of range
+*/
+bool BlockSizeTuner::nextSize()
+{
+    const qint64 next = m_Direction > 0 ? m_BestSize * 2 : m_BestSize / 2;
+
+    if (next < floorBytes() || next > maxBytes())
+        return false;
+
+    m_Size = next;
+    return true;
+}
+
+void BlockSizeTuner::settle()
+{
+    m_Size = m_BestSize;
+    m_Tuning = false;
+}
+
+/** @return true while the tuner is still trying different block sizes */
+bool BlockSizeTuner::isTuning() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Tuning;
+}
+
+/** @return the throughput measured for the chosen block size in bytes per second or 0 if it
+            has not been measured */
+qint64 BlockSizeTuner::bytesPerSecond() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_BestRate;
+}
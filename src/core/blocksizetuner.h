@@ -0,0 +1,94 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLOCKSIZETUNER__H)
+
+#define BLOCKSIZETUNER__H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QtGlobal>
+
+/** Chooses the block size for a bulk copy.
+
+    The first block size is derived from the topology the kernel reports for the devices
+    being copied from and to (optimal I/O size, physical block size and the largest request
+    it sends to the device). During the first seconds of the copy BlockSizeTuner then tries
+    larger and smaller power of two block sizes, measures the throughput of each and settles
+    on the fastest one. It never goes below the floor it was created with, which lets a
+    CopyPipeline rule out blocks too small to keep its I/O queue full.
+
+    blockSize() and blockDone() may be called from different threads.
+
+    @see CopyPipeline
+*/
+class BlockSizeTuner
+{
+    Q_DISABLE_COPY(BlockSizeTuner)
+
+public:
+    BlockSizeTuner(int readFd, int writeFd, qint32 sectorSize, qint64 floorbytes = minBytes());
+
+public:
+    qint64 blockSize() const;
+    void blockDone(qint64 numSectors);
+
+    bool isTuning() const;
+    qint64 bytesPerSecond() const;
+
+    qint64 maxBlockSize() const {
+        return maxBytes() / m_SectorSize;    /**< @return the largest block size in sectors the tuner will choose */
+    }
+
+    qint64 floorBytes() const {
+        return m_FloorBytes;    /**< @return the smallest block size in bytes this tuner tries */
+    }
+
+    static qint64 minBytes() {
+        return 256 * 1024;    /**< @return the smallest block size in bytes any tuner tries */
+    }
+    static qint64 maxBytes() {
+        return 64 * 1024 * 1024;    /**< @return the largest block size in bytes the tuner tries */
+    }
+
+    static qint64 topologyHint(int fd);
+
+protected:
+    void measured(qint64 bytesPerSecond);
+    bool nextSize();
+    void settle();
+
+private:
+    const qint32 m_SectorSize;
+    const qint64 m_FloorBytes;
+    mutable QMutex m_Mutex;
+    QElapsedTimer m_Timer;
+
+    qint64 m_Size;
+    qint64 m_BestSize;
+    qint64 m_BestRate;
+    qint32 m_Direction;
+    bool m_Turned;
+    bool m_Tuning;
+
+    qint64 m_LastDone;
+    qint64 m_SampleBytes;
+    qint64 m_SampleNsecs;
+    qint32 m_SampleBlocks;
+};
+
+#endif
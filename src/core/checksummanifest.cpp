@@ -0,0 +1,137 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/checksummanifest.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QStringList>
+#include <QTextStream>
+
+#include <algorithm>
+
+/** Creates a new, empty ChecksumManifest.
+    @param sectorsize the sector size the offsets of the entries are in
+*/
+ChecksumManifest::ChecksumManifest(qint32 sectorsize) :
+    m_SectorSize(sectorsize),
+    m_Entries()
+{
+}
+
+/** Reads checksums from a sidecar file.
+
+    The file starts with a line naming the checksum and the sector size, followed by a
+    line per chunk with its offset, its number of sectors and its checksum in hex.
+
+    @param fileName the name of the file to read
+    @return true on success
+*/
+bool ChecksumManifest::load(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream in(&file);
+    const QStringList header = in.readLine().split(QLatin1Char(' '));
+
+    if (header.size() != 2 || header[0] != QStringLiteral("crc32c"))
+        return false;
+
+    bool ok = false;
+    m_SectorSize = header[1].toInt(&ok);
+    m_Entries.clear();
+
+    if (!ok || m_SectorSize <= 0)
+        return false;
+
+    QString line;
+
+    while (in.readLineInto(&line)) {
+        const QStringList fields = line.split(QLatin1Char(' '));
+
+        if (fields.size() != 3)
+            return false;
+
+        Entry entry;
+        bool offsetOk = false;
+        bool lengthOk = false;
+        bool checksumOk = false;
+
+        entry.offset = fields[0].toLongLong(&offsetOk);
+        entry.numSectors = fields[1].toLongLong(&lengthOk);
+        entry.checksum = fields[2].toUInt(&checksumOk, 16);
+
+        if (!offsetOk || !lengthOk || !checksumOk || entry.offset < 0 || entry.numSectors <= 0)
+            return false;
+
+        m_Entries.append(entry);
+    }
+
+    return true;
+}
+
+/** Writes the checksums to a sidecar file, sorted by offset.
+    @param fileName the name of the file to write
+    @return true on success
+*/
+bool ChecksumManifest::save(const QString& fileName)
+{
+    sort();
+
+    QSaveFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+
+    QTextStream out(&file);
+    out << QStringLiteral("crc32c ") << m_SectorSize << QLatin1Char('\n');
+
+    for (const auto &entry : m_Entries)
+        out << entry.offset << QLatin1Char(' ') << entry.numSectors << QLatin1Char(' ') << QString::number(entry.checksum, 16) << QLatin1Char('\n');
+
+    out.flush();
+
+    return file.commit();
+}
+
+/** Sorts the entries by offset. Copies that run backward record them last to first. */
+void ChecksumManifest::sort()
+{
+    std::sort(m_Entries.begin(), m_Entries.end(), [](const Entry& a, const Entry& b) {
+        return a.offset < b.offset;
+    });
+}
+
+/** @return the number of sectors the checksums cover */
+qint64 ChecksumManifest::numSectors() const
+{
+    qint64 rval = 0;
+
+    for (const auto &entry : m_Entries)
+        rval += entry.numSectors;
+
+    return rval;
+}
+
+/** @return the name of the sidecar file with the checksums for the given image file */
+QString ChecksumManifest::fileName(const QString& imageFileName)
+{
+    return imageFileName + QStringLiteral(".crc32c");
+}
@@ -0,0 +1,77 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(CHECKSUMMANIFEST__H)
+
+#define CHECKSUMMANIFEST__H
+
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+
+/** The checksums of the data a copy has written.
+
+    While copying, Job::copyBlocks() records a CRC-32C checksum for each chunk of
+    sectors it copies. Job::verifyBlocks() then reads the copy back and compares. For
+    backups, the checksums are stored in a sidecar file next to the image, so that a
+    restore can be verified against the data that was originally backed up.
+
+    Chunks the source does not use are not recorded, since they are not copied.
+
+    @see Job::copyBlocks, Job::verifyBlocks
+*/
+class ChecksumManifest
+{
+public:
+    /** The checksum of a chunk of sectors */
+    struct Entry {
+        qint64 offset;      /**< first sector of the chunk, relative to the start of the copy */
+        qint64 numSectors;
+        quint32 checksum;
+    };
+
+public:
+    explicit ChecksumManifest(qint32 sectorsize = 0);
+
+public:
+    bool load(const QString& fileName);
+    bool save(const QString& fileName);
+
+    void append(const Entry& entry) {
+        m_Entries.append(entry);
+    }
+    const QVector<Entry>& entries() const {
+        return m_Entries;    /**< @return the recorded checksums */
+    }
+    bool isEmpty() const {
+        return m_Entries.isEmpty();    /**< @return true if no checksums have been recorded */
+    }
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the sector size the offsets are in */
+    }
+
+    void sort();
+    qint64 numSectors() const;
+
+    static QString fileName(const QString& imageFileName);
+
+private:
+    qint32 m_SectorSize;
+    QVector<Entry> m_Entries;
+};
+
+#endif
@@ -0,0 +1,200 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/chunkrecipe.h"
+
+#include "core/chunkrepository.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+static const char recipeMagic[8] = { 'K', 'P', 'M', 'R', 'C', 'P', 'E', '1' };
+static const int headerSize = 32;
+
+/** Creates an empty recipe.
+    @param sectorsize the sector size of the image
+*/
+ChunkRecipe::ChunkRecipe(qint32 sectorsize) :
+    m_SectorSize(sectorsize),
+    m_Size(0),
+    m_Hashes(),
+    m_Sizes(),
+    m_Offsets()
+{
+}
+
+/** Reads a recipe written by save().
+    @param fileName the name of the recipe file
+    @return true on success
+*/
+bool ChunkRecipe::load(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray header = file.read(headerSize);
+
+    if (header.size() != headerSize || memcmp(header.constData(), recipeMagic, sizeof(recipeMagic)) != 0)
+        return false;
+
+    const uchar* p = reinterpret_cast<const uchar*>(header.constData());
+    const qint64 n = qFromLittleEndian<qint64>(p + 16);
+
+    m_SectorSize = qFromLittleEndian<quint32>(p + 8);
+
+    if (m_SectorSize <= 0 || n < 0 || n > std::numeric_limits<int>::max() / ChunkRepository::hashSize())
+        return false;
+
+    const QByteArray sizes = file.read(n * sizeof(quint32));
+    m_Hashes = file.read(n * ChunkRepository::hashSize());
+
+    if (sizes.size() != n * static_cast<qint64>(sizeof(quint32)) || m_Hashes.size() != n * ChunkRepository::hashSize())
+        return false;
+
+    m_Sizes.resize(n);
+    m_Offsets.resize(n);
+    m_Size = 0;
+
+    for (int i = 0; i < n; i++) {
+        m_Sizes[i] = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(sizes.constData()) + i * sizeof(quint32));
+        m_Offsets[i] = m_Size;
+        m_Size += m_Sizes[i];
+    }
+
+    return true;
+}
+
+/** Writes the recipe to a file.
+
+    The file has a header with the sector size and the number of chunks, followed by the
+    sizes of all chunks and then their hashes, all zero for a run of zeros.
+
+    @param fileName the name of the file to write
+    @return true on success
+*/
+bool ChunkRecipe::save(const QString& fileName) const
+{
+    QSaveFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QByteArray header(headerSize, 0);
+    uchar* p = reinterpret_cast<uchar*>(header.data());
+
+    memcpy(p, recipeMagic, sizeof(recipeMagic));
+    qToLittleEndian<quint32>(m_SectorSize, p + 8);
+    qToLittleEndian<qint64>(count(), p + 16);
+
+    QByteArray sizes(count() * sizeof(quint32), 0);
+
+    for (int i = 0; i < count(); i++)
+        qToLittleEndian<quint32>(m_Sizes[i], reinterpret_cast<uchar*>(sizes.data()) + i * sizeof(quint32));
+
+    if (file.write(header) != header.size() || file.write(sizes) != sizes.size() || file.write(m_Hashes) != m_Hashes.size())
+        return false;
+
+    return file.commit();
+}
+
+/** Adds a chunk to the end of the image.
+    @param hash the chunk's hash, empty for a chunk of zeros
+    @param size the chunk's size in bytes
+*/
+void ChunkRecipe::append(const QByteArray& hash, quint32 size)
+{
+    if (hash.isEmpty()) {
+        appendZeros(size);
+        return;
+    }
+
+    Q_ASSERT(hash.size() == ChunkRepository::hashSize());
+
+    m_Hashes.append(hash);
+    m_Sizes.append(size);
+    m_Offsets.append(m_Size);
+    m_Size += size;
+}
+
+/** Adds zeros to the end of the image, joining them with zeros just before.
+    @param size the number of zero bytes
+*/
+void ChunkRecipe::appendZeros(qint64 size)
+{
+    // a run is at most 1 GiB so that its size fits the recipe
+    const qint64 maxRun = 1024 * 1024 * 1024;
+
+    while (size > 0) {
+        if (count() > 0 && isZero(count() - 1) && m_Sizes.last() < maxRun) {
+            const qint64 n = qMin(size, maxRun - m_Sizes.last());
+            m_Sizes.last() += n;
+            m_Size += n;
+            size -= n;
+            continue;
+        }
+
+        m_Hashes.append(QByteArray(ChunkRepository::hashSize(), 0));
+        m_Sizes.append(0);
+        m_Offsets.append(m_Size);
+    }
+}
+
+/** @return the index of the chunk holding the byte at the given offset, or count() if the
+    offset is past the end */
+int ChunkRecipe::find(qint64 position) const
+{
+    if (position < 0 || position >= size())
+        return count();
+
+    return std::upper_bound(m_Offsets.constBegin(), m_Offsets.constEnd(), position) - m_Offsets.constBegin() - 1;
+}
+
+/** @return true if a chunk is all zeros and not stored */
+bool ChunkRecipe::isZero(int i) const
+{
+    const char* p = m_Hashes.constData() + i * ChunkRepository::hashSize();
+
+    return std::all_of(p, p + ChunkRepository::hashSize(), [](char c) { return c == 0; });
+}
+
+/** @return the hash of a chunk, empty for a chunk of zeros */
+QByteArray ChunkRecipe::hash(int i) const
+{
+    return isZero(i) ? QByteArray() : m_Hashes.mid(i * ChunkRepository::hashSize(), ChunkRepository::hashSize());
+}
+
+/** @return true if the given file is a recipe */
+bool ChunkRecipe::isRecipe(const QString& fileName)
+{
+    QFile file(fileName);
+
+    return file.open(QIODevice::ReadOnly) && file.read(sizeof(recipeMagic)) == QByteArray(recipeMagic, sizeof(recipeMagic));
+}
+
+/** @return true if a backup to the given file name is to be written as a recipe, which is
+    asked for by a name ending in .recipe */
+bool ChunkRecipe::isRecipeName(const QString& fileName)
+{
+    return fileName.endsWith(QStringLiteral(".recipe"), Qt::CaseInsensitive);
+}
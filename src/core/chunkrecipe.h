@@ -0,0 +1,78 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(CHUNKRECIPE__H)
+
+#define CHUNKRECIPE__H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+
+/** The list of chunks a deduplicating backup is made of.
+
+    A backup written to a ChunkRepository is kept as a recipe file that lists the hash
+    and size of each chunk of the image in order. Runs of zeros are listed without
+    storing a chunk for them.
+
+    @see ChunkRepository, CopyTargetRepository, CopySourceRepository
+*/
+class ChunkRecipe
+{
+public:
+    explicit ChunkRecipe(qint32 sectorsize = 0);
+
+public:
+    bool load(const QString& fileName);
+    bool save(const QString& fileName) const;
+
+    void append(const QByteArray& hash, quint32 size);
+    void appendZeros(qint64 size);
+    int find(qint64 position) const;
+
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the sector size of the image */
+    }
+    qint64 size() const {
+        return m_Size;    /**< @return the size of the image in bytes */
+    }
+    int count() const {
+        return m_Sizes.size();    /**< @return the number of chunks */
+    }
+    qint64 offset(int i) const {
+        return m_Offsets[i];    /**< @return the offset of a chunk in the image in bytes */
+    }
+    quint32 chunkSize(int i) const {
+        return m_Sizes[i];    /**< @return the size of a chunk in bytes */
+    }
+
+    bool isZero(int i) const;
+    QByteArray hash(int i) const;
+
+    static bool isRecipe(const QString& fileName);
+    static bool isRecipeName(const QString& fileName);
+
+private:
+    qint32 m_SectorSize;
+    qint64 m_Size;
+    QByteArray m_Hashes;
+    QVector<quint32> m_Sizes;
+    QVector<qint64> m_Offsets;
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/chunkrepository.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <cstring>
+
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+/** Creates a repository in the given directory.
+    @param directory the repository's directory
+*/
+ChunkRepository::ChunkRepository(const QString& directory) :
+    m_Directory(directory)
+{
+}
+
+/** Opens the repository.
+    @param create true to create the repository if it does not exist yet
+    @return true if the repository exists
+*/
+bool ChunkRepository::open(bool create)
+{
+    QDir dir(directory());
+
+    if (!create)
+        return dir.exists();
+
+    // all subdirectories are made up front, so that storing a chunk need not check for them
+    for (int i = 0; i < 256; i++)
+        if (!dir.mkpath(QStringLiteral("%1").arg(i, 2, 16, QLatin1Char('0'))))
+            return false;
+
+    return true;
+}
+
+/** Stores a chunk unless the repository already has it.
+    @param hash the chunk's hash as returned by hashChunk()
+    @param data the chunk's data
+    @param size the chunk's size in bytes
+    @param added set to true if the chunk was new, false if it was already stored
+    @return true on success
+*/
+bool ChunkRepository::store(const QByteArray& hash, const void* data, qint64 size, bool& added) const
+{
+    const QString fileName = chunkFileName(hash);
+
+    added = false;
+
+    if (QFile::exists(fileName))
+        return true;
+
+    QByteArray contents = QByteArray::fromRawData(static_cast<const char*>(data), size);
+
+#if defined(HAVE_ZSTD)
+    QByteArray compressed(ZSTD_compressBound(size), 0);
+    const size_t n = ZSTD_compress(compressed.data(), compressed.size(), data, size, ZSTD_CLEVEL_DEFAULT);
+
+    if (!ZSTD_isError(n) && static_cast<qint64>(n) < size) {
+        compressed.resize(n);
+        contents = compressed;
+    }
+#endif
+
+    // the chunk appears under its name only once it is complete; should another thread
+    // store the same chunk meanwhile, both write the same data
+    QSaveFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size() || !file.commit())
+        return false;
+
+    added = true;
+
+    return true;
+}
+
+/** Reads a chunk and checks that its data matches its hash.
+    @param hash the chunk's hash
+    @param data the buffer to read the chunk to
+    @param size the chunk's size in bytes
+    @return true on success
+*/
+bool ChunkRepository::load(const QByteArray& hash, void* data, qint64 size) const
+{
+    QFile file(chunkFileName(hash));
+
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray contents = file.readAll();
+
+    if (contents.size() == size)
+        memcpy(data, contents.constData(), size);
+    else if (contents.size() < size) {
+#if defined(HAVE_ZSTD)
+        const size_t n = ZSTD_decompress(data, size, contents.constData(), contents.size());
+        if (ZSTD_isError(n) || static_cast<qint64>(n) != size)
+            return false;
+#else
+        return false;
+#endif
+    } else
+        return false;
+
+    return hashChunk(data, size) == hash;
+}
+
+/** @return the name of the file holding the chunk with the given hash */
+QString ChunkRepository::chunkFileName(const QByteArray& hash) const
+{
+    const QString hex = QString::fromLatin1(hash.toHex());
+
+    return directory() + QLatin1Char('/') + hex.left(2) + QLatin1Char('/') + hex;
+}
+
+/** @return the hash of a chunk's data */
+QByteArray ChunkRepository::hashChunk(const void* data, qint64 size)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData(static_cast<const char*>(data), size), QCryptographicHash::Sha256);
+}
+
+/** @return the directory of the repository that holds the chunks of the given recipe,
+    "chunks" next to the recipe so that all recipes in a directory share it */
+QString ChunkRepository::directoryFor(const QString& recipeFileName)
+{
+    return QFileInfo(recipeFileName).absolutePath() + QStringLiteral("/chunks");
+}
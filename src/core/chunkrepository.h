@@ -0,0 +1,64 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(CHUNKREPOSITORY__H)
+
+#define CHUNKREPOSITORY__H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+/** A directory of chunks shared by deduplicating backups.
+
+    Every chunk is kept once in a file named after the hex SHA-256 hash of its data, in a
+    subdirectory named after the first byte of the hash. A chunk is compressed with zstd
+    if that is available and makes it smaller; the file is then shorter than the chunk.
+    Chunks are only ever added, so backups of any number of devices can share a repository
+    and a chunk another backup has already stored is not written again.
+
+    All methods may be called from several threads at once.
+
+    @see ChunkRecipe, CopyTargetRepository, CopySourceRepository
+*/
+class ChunkRepository
+{
+public:
+    explicit ChunkRepository(const QString& directory);
+
+public:
+    bool open(bool create);
+    bool store(const QByteArray& hash, const void* data, qint64 size, bool& added) const;
+    bool load(const QByteArray& hash, void* data, qint64 size) const;
+    QString chunkFileName(const QByteArray& hash) const;
+
+    const QString& directory() const {
+        return m_Directory;    /**< @return the repository's directory */
+    }
+
+    static QByteArray hashChunk(const void* data, qint64 size);
+    static QString directoryFor(const QString& recipeFileName);
+
+    static qint32 hashSize() {
+        return 32;    /**< @return the size of a chunk's hash in bytes */
+    }
+
+private:
+    const QString m_Directory;
+};
+
+#endif
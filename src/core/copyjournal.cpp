@@ -0,0 +1,315 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copyjournal.h"
+
+#include "util/checksum.h"
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// A slot is one sector, so that writing it is as close to atomic as the device allows.
+// It holds the magic, the sequence number, the source and target first sectors, the
+// length, the sectors done, the sector size, the flags, the length of the device node, a
+// checksum over all of that and then the device node itself.
+static const char journalMagic[8] = { 'K', 'P', 'M', 'J', 'R', 'N', 'L', '1' };
+static const int slotSize = 512;
+static const int headerSize = 64;
+static const quint32 flagBackward = 1;
+static const quint32 flagInPlace = 2;
+
+// The staged window follows the two slots: a header with the magic, the sectors done when
+// it was staged, its length and a checksum over all of that and the data, which begins
+// one slot after the header.
+static const char stageMagic[8] = { 'K', 'P', 'M', 'S', 'T', 'G', 'E', '1' };
+static const qint64 stageOffset = 2 * slotSize;
+static const int stageHeaderSize = 32;
+
+CopyJournal::CopyJournal() :
+    m_Fd(-1),
+    m_FileName(),
+    m_DeviceNode(),
+    m_SectorSize(0),
+    m_SourceFirstSector(0),
+    m_TargetFirstSector(0),
+    m_Length(0),
+    m_Backward(false),
+    m_InPlace(false),
+    m_SectorsDone(0),
+    m_Sequence(0)
+{
+}
+
+CopyJournal::~CopyJournal()
+{
+    if (m_Fd >= 0)
+        close(m_Fd);
+}
+
+/** Starts a journal for a new copy, replacing any journal for the device.
+    @param deviceNode the device the copy runs on
+    @param sectorSize the device's sector size
+    @param sourceFirstSector the first sector to copy from
+    @param targetFirstSector the first sector to copy to
+    @param length the number of sectors to copy
+    @param backward true if the copy runs from the last sector to the first
+    @param inPlace true if the copy is a move in place that stages its windows
+    @return true if the journal has been written and flushed
+*/
+bool CopyJournal::create(const QString& deviceNode, qint32 sectorSize, qint64 sourceFirstSector, qint64 targetFirstSector, qint64 length, bool backward, bool inPlace)
+{
+    if (m_Fd >= 0)
+        close(m_Fd);
+
+    m_Fd = -1;
+
+    if (deviceNode.toUtf8().size() > slotSize - headerSize || !QDir().mkpath(directory()))
+        return false;
+
+    m_FileName = fileName(deviceNode);
+    m_DeviceNode = deviceNode;
+    m_SectorSize = sectorSize;
+    m_SourceFirstSector = sourceFirstSector;
+    m_TargetFirstSector = targetFirstSector;
+    m_Length = length;
+    m_Backward = backward;
+    m_InPlace = inPlace;
+    m_SectorsDone = 0;
+    m_Sequence = 0;
+
+    // The new journal replaces an old one for the device only once it is complete, so a
+    // crash never leaves the device without a journal. Both slots are written, so an old
+    // checkpoint can never be mistaken for a new one.
+    const QString newFileName = m_FileName + QStringLiteral(".new");
+    m_Fd = ::open(newFileName.toLocal8Bit().constData(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (m_Fd < 0 || !writeSlot() || !writeSlot() || rename(newFileName.toLocal8Bit().constData(), m_FileName.toLocal8Bit().constData()) != 0) {
+        if (m_Fd >= 0)
+            close(m_Fd);
+
+        m_Fd = -1;
+        QFile::remove(newFileName);
+        return false;
+    }
+
+    // the rename must survive a crash, too
+    const int dirFd = ::open(directory().toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+
+    return true;
+}
+
+/** Reads the last valid checkpoint of a journal.
+    @param fileName the journal file
+    @return true if the journal holds a valid checkpoint
+*/
+bool CopyJournal::load(const QString& fileName)
+{
+    if (m_Fd >= 0)
+        close(m_Fd);
+
+    m_FileName = fileName;
+    m_Fd = ::open(fileName.toLocal8Bit().constData(), O_RDWR | O_CLOEXEC);
+
+    if (m_Fd < 0)
+        return false;
+
+    bool found = false;
+
+    for (int slot = 0; slot < 2; slot++) {
+        uchar data[slotSize];
+
+        if (pread(m_Fd, data, slotSize, slot * slotSize) != slotSize || memcmp(data, journalMagic, sizeof(journalMagic)) != 0)
+            continue;
+
+        const quint32 nameSize = qFromLittleEndian<quint32>(data + 56);
+
+        if (nameSize > static_cast<quint32>(slotSize - headerSize))
+            continue;
+
+        if (crc32c(data + headerSize, nameSize, crc32c(data, 60)) != qFromLittleEndian<quint32>(data + 60))
+            continue;
+
+        const quint64 sequence = qFromLittleEndian<quint64>(data + 8);
+
+        if (found && sequence <= m_Sequence)
+            continue;
+
+        found = true;
+        m_Sequence = sequence;
+        m_SourceFirstSector = qFromLittleEndian<qint64>(data + 16);
+        m_TargetFirstSector = qFromLittleEndian<qint64>(data + 24);
+        m_Length = qFromLittleEndian<qint64>(data + 32);
+        m_SectorsDone = qFromLittleEndian<qint64>(data + 40);
+        m_SectorSize = qFromLittleEndian<quint32>(data + 48);
+        m_Backward = qFromLittleEndian<quint32>(data + 52) & flagBackward;
+        m_InPlace = qFromLittleEndian<quint32>(data + 52) & flagInPlace;
+        m_DeviceNode = QString::fromUtf8(reinterpret_cast<const char*>(data + headerSize), nameSize);
+    }
+
+    return found && m_SectorSize > 0 && m_Length > 0 && m_SectorsDone >= 0 && m_SectorsDone <= m_Length;
+}
+
+/** Records that the given number of sectors have been copied.
+
+    The caller must have flushed these sectors to the device before.
+
+    @param sectorsDone the number of sectors copied so far, counted in copy direction from
+           the start of the whole copy
+    @return true if the checkpoint has been written and flushed
+*/
+bool CopyJournal::checkpoint(qint64 sectorsDone)
+{
+    m_SectorsDone = sectorsDone;
+
+    return writeSlot();
+}
+
+/** Stages the window a move in place is about to write, as read from its source.
+
+    The window is the one following the last checkpoint. The caller must not write it
+    before this has returned true.
+
+    @param data the window's data
+    @param numSectors the window's length in sectors
+    @return true if the window has been written and flushed
+*/
+bool CopyJournal::stage(const void* data, qint64 numSectors)
+{
+    const qint64 size = numSectors * sectorSize();
+    uchar header[stageHeaderSize];
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, stageMagic, sizeof(stageMagic));
+    qToLittleEndian<qint64>(m_SectorsDone, header + 8);
+    qToLittleEndian<qint64>(numSectors, header + 16);
+    qToLittleEndian<quint32>(crc32c(data, size, crc32c(header, 24)), header + 24);
+
+    const char* p = static_cast<const char*>(data);
+
+    for (qint64 done = 0; done < size; ) {
+        const ssize_t n = pwrite(m_Fd, p + done, size - done, stageOffset + slotSize + done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+
+    return pwrite(m_Fd, header, sizeof(header), stageOffset) == sizeof(header) && fdatasync(m_Fd) == 0;
+}
+
+/** Reads the window staged after the last checkpoint.
+    @param data returns the window's data, its length a multiple of the sector size
+    @return true if a complete window was staged after the last checkpoint
+*/
+bool CopyJournal::readStaged(QByteArray& data) const
+{
+    uchar header[stageHeaderSize];
+
+    if (m_Fd < 0 || pread(m_Fd, header, sizeof(header), stageOffset) != sizeof(header) || memcmp(header, stageMagic, sizeof(stageMagic)) != 0)
+        return false;
+
+    // a window staged before the last checkpoint has been written completely
+    const qint64 numSectors = qFromLittleEndian<qint64>(header + 16);
+
+    if (qFromLittleEndian<qint64>(header + 8) != m_SectorsDone || numSectors <= 0 || numSectors > m_Length - m_SectorsDone)
+        return false;
+
+    data.resize(numSectors * sectorSize());
+
+    for (qint64 done = 0; done < data.size(); ) {
+        const ssize_t n = pread(m_Fd, data.data() + done, data.size() - done, stageOffset + slotSize + done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+
+    return crc32c(data.constData(), data.size(), crc32c(header, 24)) == qFromLittleEndian<quint32>(header + 24);
+}
+
+/** Removes the journal once the copy has been completed or rolled back.
+    @return true on success
+*/
+bool CopyJournal::remove()
+{
+    if (m_Fd >= 0)
+        close(m_Fd);
+
+    m_Fd = -1;
+
+    return m_FileName.isEmpty() || QFile::remove(m_FileName);
+}
+
+bool CopyJournal::writeSlot()
+{
+    const QByteArray name = m_DeviceNode.toUtf8();
+    uchar data[slotSize];
+
+    memset(data, 0, sizeof(data));
+    memcpy(data, journalMagic, sizeof(journalMagic));
+    qToLittleEndian<quint64>(++m_Sequence, data + 8);
+    qToLittleEndian<qint64>(m_SourceFirstSector, data + 16);
+    qToLittleEndian<qint64>(m_TargetFirstSector, data + 24);
+    qToLittleEndian<qint64>(m_Length, data + 32);
+    qToLittleEndian<qint64>(m_SectorsDone, data + 40);
+    qToLittleEndian<quint32>(m_SectorSize, data + 48);
+    qToLittleEndian<quint32>((m_Backward ? flagBackward : 0) | (m_InPlace ? flagInPlace : 0), data + 52);
+    qToLittleEndian<quint32>(name.size(), data + 56);
+    memcpy(data + headerSize, name.constData(), name.size());
+    qToLittleEndian<quint32>(crc32c(data + headerSize, name.size(), crc32c(data, 60)), data + 60);
+
+    return pwrite(m_Fd, data, slotSize, (m_Sequence % 2) * slotSize) == slotSize && fdatasync(m_Fd) == 0;
+}
+
+/** @return the directory journals are kept in */
+QString CopyJournal::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QStringLiteral("/kpmcore/journal");
+}
+
+/** @return the name of the journal file for copies on the given device */
+QString CopyJournal::fileName(const QString& deviceNode)
+{
+    QString name = deviceNode;
+    name.replace(QLatin1Char('/'), QLatin1Char('_'));
+
+    return directory() + QLatin1Char('/') + name + QStringLiteral(".journal");
+}
+
+/** @return the journal files of copies that have not been completed or rolled back */
+QStringList CopyJournal::pending()
+{
+    QStringList rval;
+    const QDir dir(directory());
+
+    for (const auto &name : dir.entryList(QStringList() << QStringLiteral("*.journal"), QDir::Files))
+        rval.append(dir.filePath(name));
+
+    return rval;
+}
@@ -0,0 +1,113 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYJOURNAL__H)
+
+#define COPYJOURNAL__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+
+/** The on-disk progress of a copy on a device.
+
+    A CopyJournal records which copy is running on a device and how far it has got, so
+    that a move interrupted by a crash or a power failure can be resumed or rolled back
+    from its last checkpoint instead of leaving the partition half-moved.
+
+    Job::copyBlocks() writes a checkpoint after the sectors it covers have been flushed to
+    the device. A checkpoint alternates between two slots of the journal file, each with a
+    checksum, so that a torn write leaves the previous checkpoint intact.
+
+    A move in place, see Job::moveBlocksInPlace(), also stages the window of sectors it is
+    about to write in the journal before it overwrites their source. A crash while the
+    window is written is then recovered by writing the staged window again.
+
+    @see Job::copyBlocks, Job::moveBlocksInPlace, ResumeCopyJob
+*/
+class LIBKPMCORE_EXPORT CopyJournal
+{
+    Q_DISABLE_COPY(CopyJournal)
+
+public:
+    CopyJournal();
+    ~CopyJournal();
+
+public:
+    bool create(const QString& deviceNode, qint32 sectorSize, qint64 sourceFirstSector, qint64 targetFirstSector, qint64 length, bool backward, bool inPlace = false);
+    bool load(const QString& fileName);
+    bool checkpoint(qint64 sectorsDone);
+    bool stage(const void* data, qint64 numSectors);
+    bool readStaged(QByteArray& data) const;
+    bool remove();
+
+    bool isOpen() const {
+        return m_Fd >= 0;    /**< @return true if the journal file is open */
+    }
+    const QString& fileName() const {
+        return m_FileName;    /**< @return the journal file's name */
+    }
+    const QString& deviceNode() const {
+        return m_DeviceNode;    /**< @return the device the copy runs on */
+    }
+    qint32 sectorSize() const {
+        return m_SectorSize;
+    }
+    qint64 sourceFirstSector() const {
+        return m_SourceFirstSector;    /**< @return the first sector of the whole range copied from */
+    }
+    qint64 targetFirstSector() const {
+        return m_TargetFirstSector;    /**< @return the first sector of the whole range copied to */
+    }
+    qint64 length() const {
+        return m_Length;    /**< @return the number of sectors the whole copy covers */
+    }
+    bool backward() const {
+        return m_Backward;    /**< @return true if the copy runs from the last sector to the first */
+    }
+    bool inPlace() const {
+        return m_InPlace;    /**< @return true if the copy is a move in place that stages its windows */
+    }
+    qint64 sectorsDone() const {
+        return m_SectorsDone;    /**< @return the number of sectors, in copy direction, known to be on the device */
+    }
+
+    static QString directory();
+    static QString fileName(const QString& deviceNode);
+    static QStringList pending();
+
+protected:
+    bool writeSlot();
+
+private:
+    int m_Fd;
+    QString m_FileName;
+    QString m_DeviceNode;
+    qint32 m_SectorSize;
+    qint64 m_SourceFirstSector;
+    qint64 m_TargetFirstSector;
+    qint64 m_Length;
+    bool m_Backward;
+    bool m_InPlace;
+    qint64 m_SectorsDone;
+    quint64 m_Sequence;
+};
+
+#endif
@@ -0,0 +1,646 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copypipeline.h"
+
+#include "core/copysource.h"
+#include "core/copytarget.h"
+
+#include "util/bufferpool.h"
+#include "util/checksum.h"
+#include "util/zeroscan.h"
+
+#include <QMutexLocker>
+
+#include <cstring>
+
+#include <unistd.h>
+
+/** Finds the smallest block size that lets the ring keep a queue of the given depth full.
+    Smaller blocks are never worth measuring: the ring holds fewer requests than could be in flight.
+    @return the size in bytes
+*/
+static qint64 minBlockBytes(qint32 sectorSize, qint32 numBuffers, quint32 queueDepth)
+{
+    const qint64 segmentBytes = qMax(1024 * 1024 / sectorSize, 1) * sectorSize;
+    const qint64 segmentsPerBlock = (queueDepth + qMax(numBuffers, 2) - 1) / qMax(numBuffers, 2);
+
+    return segmentsPerBlock > 1 ? segmentsPerBlock * segmentBytes : BlockSizeTuner::minBytes();
+}
+
+/** Creates a new CopyPipeline.
+    @param source the CopySource to read from
+    @param target the CopyTarget to write to
+    @param numBuffers the number of buffers in the ring, at least two to overlap reads and writes
+    @param queueDepth the maximum number of read and write requests each in flight
+*/
+CopyPipeline::CopyPipeline(CopySource& source, CopyTarget& target, qint32 numBuffers, quint32 queueDepth) :
+    QThread(),
+    m_Source(source),
+    m_Target(target),
+    m_Tuner(source.fileDescriptor(), target.fileDescriptor(), source.sectorSize(), minBlockBytes(source.sectorSize(), numBuffers, queueDepth)),
+    m_SegmentSize(qMax(1024 * 1024 / source.sectorSize(), 1)),
+    m_BufferAlignment(qMax(qMax(source.alignment(), target.alignment()), static_cast<qint32>(sysconf(_SC_PAGESIZE)))),
+    m_Buffers(),
+    m_Blocks(),
+    m_ReadState(),
+    m_WriteState(),
+    m_ReadOffset(0),
+    m_WriteOffset(0),
+    m_Length(0),
+    m_Backward(false),
+    m_Planned(0),
+    m_MaxBlockSize(m_Tuner.maxBlockSize()),
+    m_PreviousWrite(),
+    m_SectorsZeroed(0),
+    m_SectorsSkipped(0),
+    m_ReadQueue(queueDepth),
+    m_WriteQueue(queueDepth),
+    m_WriteDepth(source.overlaps(target) ? 1 : m_WriteQueue.depth()),
+    m_Mutex(),
+    m_BufferFree(),
+    m_BlockRead(),
+    m_NumRead(0),
+    m_NumTaken(0),
+    m_NumWritten(0),
+    m_NumReleased(0),
+    m_ReadDone(false),
+    m_ReadFailed(false),
+    m_WriteFailed(false),
+    m_Cancelled(false),
+    m_ReadDirect(false),
+    m_WriteDirect(false),
+    m_ReadDropBehind(false),
+    m_WriteDropBehind(false),
+    m_Checksums(false),
+    m_IoPriority()
+{
+    Q_ASSERT(numBuffers > 1);
+
+    const qint64 bufferSize = m_Tuner.maxBlockSize() * source.sectorSize();
+    const Block block = { -1, 0, 0, 0, nullptr, QVector<ChecksumManifest::Entry>() };
+    const BlockState state = { 0, false, false };
+
+    for (qint32 i = 0; i < qMax(numBuffers, 2); i++) {
+        m_Buffers.append(BufferPool::instance().acquire(bufferSize, m_BufferAlignment));
+        m_Blocks.append(block);
+        m_ReadState.append(state);
+        m_WriteState.append(state);
+    }
+
+    m_PreviousWrite = block;
+
+    if (!isValid())
+        return;
+
+    if (m_ReadQueue.isAsync() && source.fileDescriptor() >= 0)
+        m_ReadQueue.registerBuffers(m_Buffers, bufferSize);
+
+    if (m_WriteQueue.isAsync() && target.fileDescriptor() >= 0)
+        m_WriteQueue.registerBuffers(m_Buffers, bufferSize);
+}
+
+/** Destroys a CopyPipeline, stopping the reader thread if it is still running */
+CopyPipeline::~CopyPipeline()
+{
+    cancel();
+    wait();
+
+    // the kernel may still be writing from our buffers
+    quintptr tag;
+    bool success;
+    while (m_WriteQueue.wait(tag, success))
+        ;
+
+    for (const auto &buffer : m_Buffers)
+        BufferPool::instance().release(buffer);
+
+    // source and target may go on using their file descriptors for other I/O
+    if (m_ReadDirect)
+        IoQueue::setDirect(source().fileDescriptor(), false);
+
+    if (m_WriteDirect)
+        IoQueue::setDirect(target().fileDescriptor(), false);
+}
+
+/** Sets the sectors to copy. Must not be called after the pipeline has been started.
+    @param readOffset the first sector to read from the CopySource
+    @param writeOffset the first sector to write to on the CopyTarget
+    @param numSectors the number of sectors to copy
+    @param backward true to copy from the last block to the first
+*/
+void CopyPipeline::setRange(qint64 readOffset, qint64 writeOffset, qint64 numSectors, bool backward)
+{
+    Q_ASSERT(!isRunning());
+
+    m_ReadOffset = readOffset;
+    m_WriteOffset = writeOffset;
+    m_Length = numSectors;
+    m_Backward = backward;
+    m_Planned = 0;
+}
+
+/** Sets how the copy uses the page cache.
+
+    With IoQueue::CacheDirect the source and target file descriptors are switched to
+    O_DIRECT if all blocks are aligned to what the device or file system requires. Where
+    that is not possible or O_DIRECT is not supported, IoQueue::CacheDropBehind is used
+    instead: blocks read are dropped from the page cache once they have been written, and
+    blocks written are written back right away and dropped after the next block.
+
+    Must be called after setRange() and before the pipeline is started.
+
+    @param policy the cache policy to use
+*/
+void CopyPipeline::setCachePolicy(IoQueue::CachePolicy policy)
+{
+    Q_ASSERT(!isRunning());
+
+    const int readFd = source().fileDescriptor();
+    const int writeFd = target().fileDescriptor();
+
+    if (policy == IoQueue::CacheDirect && readFd >= 0 && readFd == writeFd) {
+        // Source and target on the same Device share a file descriptor, and O_DIRECT applies to both.
+        m_ReadDirect = m_WriteDirect = isAligned(readFd, true) && isAligned(writeFd, false) && IoQueue::setDirect(readFd, true);
+    } else if (policy == IoQueue::CacheDirect) {
+        m_ReadDirect = readFd >= 0 && isAligned(readFd, true) && IoQueue::setDirect(readFd, true);
+        m_WriteDirect = writeFd >= 0 && isAligned(writeFd, false) && IoQueue::setDirect(writeFd, true);
+    }
+
+    m_ReadDropBehind = policy != IoQueue::CacheBuffered && readFd >= 0 && !m_ReadDirect;
+    m_WriteDropBehind = policy != IoQueue::CacheBuffered && writeFd >= 0 && !m_WriteDirect;
+}
+
+/** Enables computing checksums of the blocks read.
+
+    Each block is split into chunks of the size of a segment, and the checksum of each chunk
+    the source uses is put into the block's checksums. Offsets are relative to the start of
+    the range. Must be called before the pipeline is started.
+
+    @param enabled true to compute checksums
+*/
+void CopyPipeline::setChecksums(bool enabled)
+{
+    Q_ASSERT(!isRunning());
+
+    m_Checksums = enabled;
+}
+
+/** Sets the I/O priority of the reader thread and of the requests submitted through IoQueues.
+    Must be called before the pipeline is started.
+    @param prio the I/O priority
+*/
+void CopyPipeline::setIoPriority(const IoPriority& prio)
+{
+    Q_ASSERT(!isRunning());
+
+    m_IoPriority = prio;
+    m_ReadQueue.setPriority(prio.value());
+    m_WriteQueue.setPriority(prio.value());
+}
+
+/** Limits the size of the blocks, whatever the tuner would choose.
+
+    The limit is rounded down to a power of two bytes. Must be called before
+    setCachePolicy() and before the pipeline is started.
+
+    @param numSectors the largest block size in sectors
+*/
+void CopyPipeline::setMaxBlockSize(qint64 numSectors)
+{
+    Q_ASSERT(!isRunning());
+
+    const qint64 sectorSize = source().sectorSize();
+    qint64 bytes = sectorSize;
+
+    while (bytes * 2 <= numSectors * sectorSize && bytes * 2 <= m_Tuner.maxBlockSize() * sectorSize)
+        bytes *= 2;
+
+    m_MaxBlockSize = bytes / sectorSize;
+}
+
+/** Checks if all requests the pipeline makes on a file descriptor meet the O_DIRECT alignment rules.
+
+    Block sizes are powers of two of at least BlockSizeTuner::minBytes() or the limit set
+    with setMaxBlockSize(), so every block is aligned if the start and the length of the
+    range are.
+*/
+bool CopyPipeline::isAligned(int fd, bool read) const
+{
+    const qint32 alignment = IoQueue::directAlignment(fd);
+    const qint64 sectorSize = read ? m_Source.sectorSize() : m_Target.sectorSize();
+    const qint64 offset = read ? m_ReadOffset : m_WriteOffset;
+
+    const qint64 minBlockBytes = qMin(BlockSizeTuner::minBytes(), m_MaxBlockSize * m_Source.sectorSize());
+
+    if (alignment <= 0 || m_BufferAlignment % alignment != 0 || (m_SegmentSize * sectorSize) % alignment != 0 || minBlockBytes % alignment != 0)
+        return false;
+
+    return (offset * sectorSize) % alignment == 0 && (m_Length * sectorSize) % alignment == 0;
+}
+
+/** Waits for the next block to be read.
+
+    The block stays valid until it has been passed to writeBlock().
+
+    @return the next block in order or nullptr if all blocks have been taken, reading failed
+            or the pipeline has been cancelled
+*/
+CopyPipeline::Block* CopyPipeline::takeBlock()
+{
+    // The reader needs a buffer back before it can read on. If the writer holds all of
+    // them, the blocks' queued writes must complete first, or both would wait forever.
+    // Only the writer releases blocks, so m_NumReleased can be read without the lock here.
+    while (m_NumTaken - m_NumReleased >= numBuffers() && m_WriteQueue.pending() > 0)
+        if (!reapWrite())
+            return nullptr;
+
+    QMutexLocker locker(&m_Mutex);
+
+    while (m_NumTaken == m_NumRead && !m_ReadFailed && !m_Cancelled && !m_ReadDone)
+        m_BlockRead.wait(&m_Mutex);
+
+    if (m_NumTaken == m_NumRead || m_Cancelled)
+        return nullptr;
+
+    return &m_Blocks[slot(m_NumTaken++)];
+}
+
+/** Writes a block taken with takeBlock() to the target.
+
+    Blocks must be written in the order they were taken. If the target provides a file
+    descriptor the block is only queued, and its buffer is handed back to the reader once
+    the write has completed. Either way, @p block must not be used after this returns.
+
+    @param block the block to write
+    @return false if writing this or an earlier block failed
+*/
+bool CopyPipeline::writeBlock(Block* block)
+{
+    const qint32 index = block->index;
+    const int fd = target().fileDescriptor();
+
+    Q_ASSERT(index == m_NumTaken - 1);
+
+    if (m_WriteFailed)
+        return false;
+
+    if (fd < 0) {
+        const bool rval = target().writeSectors(block->buffer, block->writeOffset, block->numSectors);
+
+        if (rval) {
+            blockWritten(index);
+            m_NumWritten++;
+            releaseBlock(index);
+        } else
+            m_WriteFailed = true;
+
+        return rval;
+    }
+
+    const qint32 sectorSize = target().sectorSize();
+    const qint32 segments = numSegments(block->numSectors, fd);
+
+    // more writes than the ring holds segments are never queued, so small blocks are not
+    // kept from the reader waiting for a queue that cannot fill up
+    const quint32 depth = qMin(m_WriteDepth, static_cast<quint32>(numBuffers() * segments));
+
+    m_WriteState[slot(index)].segmentsLeft = segments;
+
+    for (qint64 done = 0; done < block->numSectors; done += m_SegmentSize) {
+        const qint64 n = qMin(m_SegmentSize, block->numSectors - done);
+
+        while (m_WriteQueue.pending() >= depth)
+            if (!reapWrite())
+                return false;
+
+        // Unused segments and segments of zeros the target can zero more cheaply need not be
+        // written, but the one at the very end is so that a file target has the right size.
+        char* data = static_cast<char*>(block->buffer) + done * sectorSize;
+        const qint64 writeOffset = block->writeOffset + done;
+
+        if (writeOffset + n != m_WriteOffset + m_Length) {
+            if (source().isUnused(block->readOffset + done, n)) {
+                m_SectorsSkipped += n;
+                m_WriteState[slot(index)].skipped = true;
+                m_WriteQueue.complete(index, true);
+                continue;
+            }
+
+            if (isAllZero(data, n * sectorSize) && target().zeroSectors(writeOffset, n)) {
+                m_SectorsZeroed += n;
+                m_WriteState[slot(index)].skipped = true;
+                m_WriteQueue.complete(index, true);
+                continue;
+            }
+        }
+
+        if (!m_WriteQueue.write(fd, data, n * sectorSize, writeOffset * sectorSize, index))
+            m_WriteQueue.complete(index, false);
+    }
+
+    if (!m_WriteQueue.submit())
+        m_WriteFailed = true;
+
+    return !m_WriteFailed;
+}
+
+/** Waits for all queued writes to complete.
+    @return true if all blocks written so far have been written successfully
+*/
+bool CopyPipeline::finishWrites()
+{
+    while (m_WriteQueue.pending() > 0)
+        if (!reapWrite())
+            break;
+
+    if (m_WriteDropBehind && m_PreviousWrite.index >= 0) {
+        const qint32 sectorSize = target().sectorSize();
+        IoQueue::dropWritten(target().fileDescriptor(), m_PreviousWrite.writeOffset * sectorSize, m_PreviousWrite.numSectors * sectorSize);
+    }
+
+    return !m_WriteFailed;
+}
+
+bool CopyPipeline::reapWrite()
+{
+    quintptr tag;
+    bool success;
+
+    if (!m_WriteQueue.wait(tag, success)) {
+        m_WriteFailed = true;
+        return false;
+    }
+
+    BlockState& state = m_WriteState[slot(tag)];
+    state.segmentsLeft--;
+    state.failed = state.failed || !success;
+
+    // Only count a block as written once it and all blocks before it are on the target.
+    while (m_NumWritten < m_NumTaken && m_WriteState[slot(m_NumWritten)].segmentsLeft == 0) {
+        if (m_WriteState[slot(m_NumWritten)].failed) {
+            m_WriteFailed = true;
+            break;
+        }
+
+        target().setSectorsWritten(target().sectorsWritten() + m_Blocks[slot(m_NumWritten)].numSectors);
+        blockWritten(m_NumWritten);
+        releaseBlock(m_NumWritten++);
+    }
+
+    return !m_WriteFailed;
+}
+
+/** Measures a block that has just been written and keeps the page cache clean of it if dropping behind. */
+void CopyPipeline::blockWritten(qint32 index)
+{
+    const Block& block = m_Blocks[slot(index)];
+
+    // blocks that were not completely written say nothing about throughput
+    m_Tuner.blockDone(m_WriteState[slot(index)].skipped ? 0 : block.numSectors);
+
+    if (m_WriteDropBehind) {
+        const int fd = target().fileDescriptor();
+        const qint32 sectorSize = target().sectorSize();
+
+        IoQueue::startWriteBack(fd, block.writeOffset * sectorSize, block.numSectors * sectorSize);
+
+        if (m_PreviousWrite.index >= 0)
+            IoQueue::dropWritten(fd, m_PreviousWrite.writeOffset * sectorSize, m_PreviousWrite.numSectors * sectorSize);
+    }
+
+    // the block's slot is reused by the reader once it has been released
+    m_PreviousWrite = block;
+}
+
+/** Hands a block's buffer back to the reader once its data has been written. */
+void CopyPipeline::releaseBlock(qint32 index)
+{
+    if (m_ReadDropBehind) {
+        const Block& block = m_Blocks[slot(index)];
+        const qint32 sectorSize = source().sectorSize();
+        IoQueue::dropCache(source().fileDescriptor(), block.readOffset * sectorSize, block.numSectors * sectorSize);
+    }
+
+    QMutexLocker locker(&m_Mutex);
+
+    Q_ASSERT(index == m_NumReleased);
+    Q_UNUSED(index);
+
+    m_NumReleased++;
+    m_BufferFree.wakeAll();
+}
+
+/** Stops the reader. Blocks already read but not yet taken are discarded. */
+void CopyPipeline::cancel()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    m_Cancelled = true;
+    m_BufferFree.wakeAll();
+    m_BlockRead.wakeAll();
+}
+
+/** @return the number of reads and writes copying a block takes */
+qint32 CopyPipeline::numRequests(const Block* block) const
+{
+    return numSegments(block->numSectors, m_Source.fileDescriptor()) + numSegments(block->numSectors, m_Target.fileDescriptor());
+}
+
+qint32 CopyPipeline::numSegments(qint64 numSectors, int fd) const
+{
+    return fd < 0 ? 1 : (numSectors + m_SegmentSize - 1) / m_SegmentSize;
+}
+
+/** Splits the next block off the range and puts it into its ring slot.
+
+    Only called by the reader, and only for a slot whose previous block has been released,
+    so no lock is needed.
+
+    @param index the index of the new block
+    @return false if the whole range has been planned already
+*/
+bool CopyPipeline::planBlock(qint32 index)
+{
+    if (m_Planned == m_Length)
+        return false;
+
+    const qint64 numSectors = qMin(qMin(m_Tuner.blockSize(), m_MaxBlockSize), m_Length - m_Planned);
+    const qint64 first = m_Backward ? m_Length - m_Planned - numSectors : m_Planned;
+
+    Block& block = m_Blocks[slot(index)];
+    block.index = index;
+    block.readOffset = m_ReadOffset + first;
+    block.writeOffset = m_WriteOffset + first;
+    block.numSectors = numSectors;
+    block.buffer = m_Buffers[slot(index)];
+
+    m_ReadState[slot(index)].segmentsLeft = numSegments(numSectors, source().fileDescriptor());
+    m_ReadState[slot(index)].failed = false;
+    m_ReadState[slot(index)].skipped = false;
+    m_WriteState[slot(index)].segmentsLeft = 0;
+    m_WriteState[slot(index)].failed = false;
+    m_WriteState[slot(index)].skipped = false;
+
+    m_Planned += numSectors;
+
+    return true;
+}
+
+void CopyPipeline::submitRead(qint32 index, qint64 firstSector, qint64 numSectors)
+{
+    const Block& block = m_Blocks[slot(index)];
+    const int fd = source().fileDescriptor();
+    const qint32 sectorSize = source().sectorSize();
+    char* buffer = static_cast<char*>(block.buffer) + firstSector * sectorSize;
+
+    if (source().isUnused(block.readOffset + firstSector, numSectors) || source().isHole(block.readOffset + firstSector, numSectors)) {
+        memset(buffer, 0, numSectors * sectorSize);
+        m_ReadQueue.complete(index, true);
+    } else if (fd < 0)
+        m_ReadQueue.complete(index, source().readSectors(buffer, block.readOffset + firstSector, numSectors));
+    else if (!m_ReadQueue.read(fd, buffer, numSectors * sectorSize, (block.readOffset + firstSector) * sectorSize, index))
+        m_ReadQueue.complete(index, false);
+}
+
+/** Waits for one read to complete and hands all blocks that are now completely read to the writer.
+    @param numSubmitted the number of blocks all segments have been submitted for
+    @return false if waiting failed
+*/
+bool CopyPipeline::reapRead(qint32 numSubmitted)
+{
+    quintptr tag;
+    bool success;
+
+    if (!m_ReadQueue.wait(tag, success))
+        return false;
+
+    BlockState& state = m_ReadState[slot(tag)];
+    state.segmentsLeft--;
+    state.failed = state.failed || !success;
+
+    // the block is not handed to the writer yet, so its buffer can be read without a lock
+    if (m_Checksums && state.segmentsLeft == 0 && !state.failed)
+        computeChecksums(tag);
+
+    QMutexLocker locker(&m_Mutex);
+
+    while (m_NumRead < numSubmitted && m_ReadState[slot(m_NumRead)].segmentsLeft == 0) {
+        if (m_ReadState[slot(m_NumRead)].failed) {
+            m_ReadFailed = true;
+            break;
+        }
+
+        m_NumRead++;
+    }
+
+    m_BlockRead.wakeAll();
+
+    return true;
+}
+
+void CopyPipeline::run()
+{
+    Q_ASSERT(isValid());
+
+    if (m_IoPriority.isSet())
+        m_IoPriority.applyToThread();
+
+    const int fd = source().fileDescriptor();
+
+    qint32 nextBlock = 0; // the block to submit reads for
+    qint64 nextSector = 0; // the first sector within nextBlock not yet submitted
+    bool planned = false; // true once the whole range has been split into blocks
+    bool failed = false;
+
+    while (true) {
+        bool submitted = false;
+
+        while (!failed && !planned && m_ReadQueue.pending() < m_ReadQueue.depth()) {
+            {
+                QMutexLocker locker(&m_Mutex);
+
+                if (m_Cancelled || nextBlock - m_NumReleased >= numBuffers())
+                    break;
+            }
+
+            if (nextSector == 0 && !planBlock(nextBlock)) {
+                planned = true;
+                break;
+            }
+
+            const Block& block = m_Blocks[slot(nextBlock)];
+            const qint64 n = qMin(fd < 0 ? block.numSectors : m_SegmentSize, block.numSectors - nextSector);
+            submitRead(nextBlock, nextSector, n);
+            submitted = true;
+
+            nextSector += n;
+
+            if (nextSector == block.numSectors) {
+                nextBlock++;
+                nextSector = 0;
+            }
+        }
+
+        if (submitted && !m_ReadQueue.submit())
+            failed = true;
+
+        if (m_ReadQueue.pending() > 0) {
+            if (!reapRead(nextBlock))
+                failed = true;
+
+            QMutexLocker locker(&m_Mutex);
+            failed = failed || m_ReadFailed;
+            continue;
+        }
+
+        QMutexLocker locker(&m_Mutex);
+
+        if (failed || m_Cancelled || planned) {
+            // a failure in a request that could not even be waited for
+            if (failed && !m_ReadFailed)
+                m_ReadFailed = true;
+
+            m_ReadDone = true;
+            m_BlockRead.wakeAll();
+            return;
+        }
+
+        while (nextBlock - m_NumReleased >= numBuffers() && !m_Cancelled)
+            m_BufferFree.wait(&m_Mutex);
+    }
+}
+
+/** Computes the checksums of a block that has been read completely. */
+void CopyPipeline::computeChecksums(qint32 index)
+{
+    Block& block = m_Blocks[slot(index)];
+    const qint32 sectorSize = source().sectorSize();
+    const char* data = static_cast<const char*>(block.buffer);
+
+    block.checksums.clear();
+
+    for (qint64 done = 0; done < block.numSectors; done += m_SegmentSize) {
+        const qint64 n = qMin(m_SegmentSize, block.numSectors - done);
+
+        if (source().isUnused(block.readOffset + done, n))
+            continue;
+
+        const ChecksumManifest::Entry entry = { block.readOffset - m_ReadOffset + done, n, crc32c(data + done * sectorSize, n * sectorSize) };
+        block.checksums.append(entry);
+    }
+}
@@ -0,0 +1,203 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYPIPELINE__H)
+
+#define COPYPIPELINE__H
+
+#include "core/blocksizetuner.h"
+#include "core/checksummanifest.h"
+#include "core/ioqueue.h"
+
+#include "util/iopriority.h"
+
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+class CopySource;
+class CopyTarget;
+
+/** Reads blocks from a CopySource ahead of the writer.
+
+    A CopyPipeline owns a ring of buffers and a reader thread that fills them with blocks
+    of the range set with setRange(), strictly in copy direction. The writer takes filled
+    buffers with takeBlock() and passes them to writeBlock(), so reading the next blocks
+    overlaps with writing the previous ones.
+
+    With setChecksums(), the reader thread also computes the checksums of each block it
+    has read, so checksumming overlaps with writing as well.
+
+    Because blocks are read and handed out in order, a block is always read before any
+    block after it is written. This keeps the forward/backward copy direction rules for
+    overlapping source and target intact.
+
+    The range is split into blocks only as they are read, with the size the pipeline's
+    BlockSizeTuner asks for at that time, so the block size can change during the copy.
+
+    Holes in the source are not read, and runs of zeros are not written if the target can
+    zero them more cheaply, e.g. by leaving a hole in a sparse file. Sectors the source
+    reports as unused are neither read nor written.
+
+    If the source or target provide a file descriptor, their I/O is split into segments
+    and submitted through an IoQueue so that several requests are in flight at once.
+    Writes to a target that overlaps the source are never queued more than one at a time,
+    so the target's sectorsWritten() always covers exactly what has been written.
+
+    The buffers come from the BufferPool and are aligned to the physical sector size of
+    source and target. How the copy uses the page cache is chosen with setCachePolicy().
+
+    @see Job::copyBlocks
+*/
+class CopyPipeline : public QThread
+{
+    Q_DISABLE_COPY(CopyPipeline)
+
+public:
+    /** A block of sectors to copy and the buffer holding its data once it is read */
+    struct Block {
+        qint32 index;
+        qint64 readOffset;
+        qint64 writeOffset;
+        qint64 numSectors;
+        void* buffer;
+        QVector<ChecksumManifest::Entry> checksums;  /**< checksums of the block's chunks if enabled with setChecksums() */
+    };
+
+public:
+    CopyPipeline(CopySource& source, CopyTarget& target, qint32 numBuffers, quint32 queueDepth = IoQueue::defaultDepth());
+    ~CopyPipeline();
+
+public:
+    void setRange(qint64 readOffset, qint64 writeOffset, qint64 numSectors, bool backward);
+    void setCachePolicy(IoQueue::CachePolicy policy);
+    void setChecksums(bool enabled);
+    void setMaxBlockSize(qint64 numSectors);
+    void setIoPriority(const IoPriority& prio);
+
+    qint32 numRequests(const Block* block) const;
+
+    Block* takeBlock();
+    bool writeBlock(Block* block);
+    bool finishWrites();
+    void cancel();
+
+    bool isValid() const {
+        return !m_Buffers.contains(nullptr);    /**< @return true if all buffers could be allocated; an invalid pipeline must not be started */
+    }
+    bool readFailed() const {
+        return m_ReadFailed;    /**< @return true if reading a block from the source failed */
+    }
+    qint32 numBuffers() const {
+        return m_Buffers.size();    /**< @return the number of buffers in the ring */
+    }
+    bool readDirect() const {
+        return m_ReadDirect;    /**< @return true if the source is read without the page cache */
+    }
+    bool writeDirect() const {
+        return m_WriteDirect;    /**< @return true if the target is written without the page cache */
+    }
+    qint64 sectorsSkipped() const {
+        return m_SectorsSkipped;    /**< @return the number of sectors not copied because the source does not use them */
+    }
+    qint64 sectorsZeroed() const {
+        return m_SectorsZeroed;    /**< @return the number of sectors of zeros the target did not have to be sent */
+    }
+    const BlockSizeTuner& tuner() const {
+        return m_Tuner;    /**< @return the tuner choosing the block size */
+    }
+
+protected:
+    /** Progress of the requests for a block that has been split into segments */
+    struct BlockState {
+        qint32 segmentsLeft;
+        bool failed;
+        bool skipped;
+    };
+
+    void run() override;
+
+    bool planBlock(qint32 index);
+    void releaseBlock(qint32 index);
+    void blockWritten(qint32 index);
+    bool isAligned(int fd, bool read) const;
+    void submitRead(qint32 index, qint64 firstSector, qint64 numSectors);
+    bool reapRead(qint32 numSubmitted);
+    bool reapWrite();
+    void computeChecksums(qint32 index);
+    qint32 numSegments(qint64 numSectors, int fd) const;
+
+    CopySource& source() {
+        return m_Source;
+    }
+    CopyTarget& target() {
+        return m_Target;
+    }
+
+    qint32 slot(quintptr index) const {
+        return index % m_Buffers.size();    /**< @return the ring slot used by the block with the given index */
+    }
+
+private:
+    CopySource& m_Source;
+    CopyTarget& m_Target;
+    BlockSizeTuner m_Tuner;
+    const qint64 m_SegmentSize;
+    const qint32 m_BufferAlignment;
+    QVector<void*> m_Buffers;
+    QVector<Block> m_Blocks;
+    QVector<BlockState> m_ReadState;
+    QVector<BlockState> m_WriteState;
+
+    qint64 m_ReadOffset;
+    qint64 m_WriteOffset;
+    qint64 m_Length;
+    bool m_Backward;
+    qint64 m_Planned;
+    qint64 m_MaxBlockSize;
+    Block m_PreviousWrite;
+    qint64 m_SectorsZeroed;
+    qint64 m_SectorsSkipped;
+
+    IoQueue m_ReadQueue;
+    IoQueue m_WriteQueue;
+    quint32 m_WriteDepth;
+
+    QMutex m_Mutex;
+    QWaitCondition m_BufferFree;
+    QWaitCondition m_BlockRead;
+
+    qint32 m_NumRead;
+    qint32 m_NumTaken;
+    qint32 m_NumWritten;
+    qint32 m_NumReleased;
+    bool m_ReadDone;
+    bool m_ReadFailed;
+    bool m_WriteFailed;
+    bool m_Cancelled;
+
+    bool m_ReadDirect;
+    bool m_WriteDirect;
+    bool m_ReadDropBehind;
+    bool m_WriteDropBehind;
+    bool m_Checksums;
+    IoPriority m_IoPriority;
+};
+
+#endif
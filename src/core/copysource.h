@@ -49,6 +49,19 @@ public:
     virtual qint64 firstSector() const = 0;
     virtual qint64 lastSector() const = 0;
 
+    virtual int fileDescriptor() const {
+        return -1;    /**< @return a file descriptor to queue reads on or -1 if only readSectors() can be used */
+    }
+    virtual qint32 alignment() const {
+        return sectorSize();    /**< @return the alignment in bytes buffers for bulk reads should have */
+    }
+    virtual bool isHole(qint64, qint64) const {
+        return false;    /**< @return true if the given sectors are known to be zero without reading them */
+    }
+    virtual bool isUnused(qint64, qint64) const {
+        return false;    /**< @return true if the given sectors hold nothing that needs to be copied */
+    }
+
 private:
 };
 
@@ -18,13 +18,12 @@
 
 #include "core/copysourcedevice.h"
 
-#include "backend/corebackend.h"
-#include "backend/corebackendmanager.h"
-#include "backend/corebackenddevice.h"
+#include "backend/rawblockdevice.h"
 
 #include "core/copytarget.h"
 #include "core/copytargetdevice.h"
 #include "core/device.h"
+#include "core/diskdevice.h"
 
 /** Constructs a CopySource on the given Device
     @param d Device from which to copy
@@ -36,7 +35,8 @@ CopySourceDevice::CopySourceDevice(Device& d, qint64 firstsector, qint64 lastsec
     m_Device(d),
     m_FirstSector(firstsector),
     m_LastSector(lastsector),
-    m_BackendDevice(nullptr)
+    m_BackendDevice(nullptr),
+    m_Fd(-1)
 {
 }
 
@@ -51,8 +51,19 @@ CopySourceDevice::~CopySourceDevice()
 */
 bool CopySourceDevice::open()
 {
-    m_BackendDevice = CoreBackendManager::self()->backend()->openDeviceExclusive(device().deviceNode());
-    return m_BackendDevice != nullptr;
+    // Data is moved through the device node itself; the backend plugin only handles partition tables.
+    m_BackendDevice = new RawBlockDevice(device().deviceNode(), sectorSize(), RawBlockDevice::ReadOnly);
+
+    if (!m_BackendDevice->openExclusive()) {
+        delete m_BackendDevice;
+        m_BackendDevice = nullptr;
+        return false;
+    }
+
+    // Bulk reads are queued on the device's file descriptor, shared with a target on the same Device.
+    m_Fd = m_BackendDevice->fileDescriptor();
+
+    return true;
 }
 
 /** Returns the Device's sector size
@@ -63,6 +74,18 @@ qint32 CopySourceDevice::sectorSize() const
     return device().logicalSize();
 }
 
+/** @return the Device's physical sector size if it is known, else its logical sector size */
+qint32 CopySourceDevice::alignment() const
+{
+    if (device().type() == Device::Disk_Device) {
+        const qint32 physicalSize = static_cast<const DiskDevice&>(device()).physicalSectorSize();
+        if (physicalSize > 0)
+            return qMax(physicalSize, sectorSize());
+    }
+
+    return sectorSize();
+}
+
 /** Returns the length of this CopySource
     @return length of the copy source
 */
@@ -26,7 +26,7 @@
 
 class Device;
 class CopyTarget;
-class CoreBackendDevice;
+class RawBlockDevice;
 
 /** A Device to copy from.
 
@@ -45,6 +45,7 @@ public:
 public:
     bool open() override;
     qint32 sectorSize() const override;
+    qint32 alignment() const override;
     bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
     qint64 length() const override;
     bool overlaps(const CopyTarget& target) const override;
@@ -55,6 +56,9 @@ public:
     qint64 lastSector() const override {
         return m_LastSector;    /**< @return last sector to copy */
     }
+    int fileDescriptor() const override {
+        return m_Fd;    /**< @return file descriptor of the opened Device or -1 */
+    }
 
     Device& device() {
         return m_Device;    /**< @return Device to copy from */
@@ -67,8 +71,8 @@ protected:
     Device& m_Device;
     const qint64 m_FirstSector;
     const qint64 m_LastSector;
-    CoreBackendDevice* m_BackendDevice
-    ;
+    RawBlockDevice* m_BackendDevice;
+    int m_Fd;
 };
 
 #endif
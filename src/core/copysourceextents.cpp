@@ -0,0 +1,87 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copysourceextents.h"
+
+#include <algorithm>
+
+/** Creates a new CopySourceExtents.
+    @param source the CopySource to wrap, usually a CopySourceDevice for the FileSystem
+    @param extents the used extents in bytes, sorted and not overlapping
+    @param extentsLength the number of bytes from the start @p extents describe; everything
+           after that is treated as used
+*/
+CopySourceExtents::CopySourceExtents(CopySource& source, const QList<FileSystem::Extent>& extents, qint64 extentsLength) :
+    CopySource(),
+    m_Source(source),
+    m_Used(),
+    m_Known(extentsLength / source.sectorSize())
+{
+    const qint32 sectorSize = source.sectorSize();
+
+    for (const auto &extent : extents) {
+        // round outwards, a partially used sector must be copied
+        Range range = { extent.offset / sectorSize, (extent.offset + extent.length + sectorSize - 1) / sectorSize };
+
+        if (!m_Used.isEmpty() && range.first <= m_Used.last().end)
+            m_Used.last().end = qMax(m_Used.last().end, range.end);
+        else
+            m_Used.append(range);
+    }
+}
+
+bool CopySourceExtents::open()
+{
+    return source().open();
+}
+
+bool CopySourceExtents::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
+{
+    return source().readSectors(buffer, readOffset, numSectors);
+}
+
+/** Checks if the given sectors are all outside the used extents.
+    @param readOffset the first sector to check
+    @param numSectors the number of sectors to check
+    @return true if copying may skip the sectors
+*/
+bool CopySourceExtents::isUnused(qint64 readOffset, qint64 numSectors) const
+{
+    const qint64 first = readOffset - firstSector();
+    const qint64 end = first + numSectors;
+
+    if (first < 0 || end > m_Known)
+        return false;
+
+    // the first used range that ends after the start of the sectors to check
+    auto it = std::upper_bound(m_Used.begin(), m_Used.end(), first, [] (qint64 sector, const Range& range) {
+        return sector < range.end;
+    });
+
+    return it == m_Used.end() || it->first >= end;
+}
+
+/** @return the number of sectors copying will not skip */
+qint64 CopySourceExtents::usedSectors() const
+{
+    qint64 rval = qMax(length() - m_Known, 0LL);
+
+    for (const auto &range : m_Used)
+        rval += qMin(range.end, m_Known) - qMin(range.first, m_Known);
+
+    return rval;
+}
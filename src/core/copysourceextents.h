@@ -0,0 +1,99 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYSOURCEEXTENTS__H)
+
+#define COPYSOURCEEXTENTS__H
+
+#include "core/copysource.h"
+
+#include "fs/filesystem.h"
+
+#include <QList>
+#include <QVector>
+#include <QtGlobal>
+
+class CopyTarget;
+
+/** A CopySource restricted to the parts a FileSystem uses.
+
+    Wraps another CopySource and forwards everything to it, but reports the sectors outside
+    the FileSystem's used extents as unused, so that copying skips them.
+
+    @see FileSystem::readUsedExtents
+*/
+class CopySourceExtents : public CopySource
+{
+    Q_DISABLE_COPY(CopySourceExtents)
+
+public:
+    CopySourceExtents(CopySource& source, const QList<FileSystem::Extent>& extents, qint64 extentsLength);
+
+public:
+    bool open() override;
+    bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
+    bool isUnused(qint64 readOffset, qint64 numSectors) const override;
+
+    qint32 sectorSize() const override {
+        return source().sectorSize();
+    }
+    qint64 length() const override {
+        return source().length();
+    }
+    bool overlaps(const CopyTarget& target) const override {
+        return source().overlaps(target);
+    }
+    qint64 firstSector() const override {
+        return source().firstSector();
+    }
+    qint64 lastSector() const override {
+        return source().lastSector();
+    }
+    int fileDescriptor() const override {
+        return source().fileDescriptor();
+    }
+    qint32 alignment() const override {
+        return source().alignment();
+    }
+    bool isHole(qint64 readOffset, qint64 numSectors) const override {
+        return source().isHole(readOffset, numSectors);
+    }
+
+    qint64 usedSectors() const;
+
+protected:
+    CopySource& source() {
+        return m_Source;
+    }
+    const CopySource& source() const {
+        return m_Source;
+    }
+
+protected:
+    /** A range of used sectors, counted from the first sector of the source */
+    struct Range {
+        qint64 first;
+        qint64 end;
+    };
+
+private:
+    CopySource& m_Source;
+    QVector<Range> m_Used;
+    qint64 m_Known;
+};
+
+#endif
@@ -21,6 +21,9 @@
 #include <QFile>
 #include <QFileInfo>
 
+#include <errno.h>
+#include <unistd.h>
+
 /** Constructs a CopySourceFile from the given @p filename.
     @param filename filename of the file to copy from
     @param sectorsize the sector size to assume for the file, usually the target Device's sector size
@@ -61,3 +64,25 @@ bool CopySourceFile::readSectors(void* buffer, qint64 readOffset, qint64 numSect
 
     return file().read(static_cast<char*>(buffer), numSectors * sectorSize()) == numSectors * sectorSize();
 }
+
+/** Checks if the given sectors lie entirely in a hole of a sparse file.
+    @param readOffset the first sector to check
+    @param numSectors the number of sectors to check
+    @return true if the file has no data in the given sectors
+*/
+bool CopySourceFile::isHole(qint64 readOffset, qint64 numSectors) const
+{
+    const int fd = file().handle();
+
+    if (fd < 0)
+        return false;
+
+    // SEEK_DATA moves the file position, which QFile keeps track of
+    const off_t pos = lseek(fd, 0, SEEK_CUR);
+    const off_t data = lseek(fd, readOffset * sectorSize(), SEEK_DATA);
+    const bool noData = data == -1 && errno == ENXIO;
+
+    lseek(fd, pos, SEEK_SET);
+
+    return noData || (data != -1 && data >= (readOffset + numSectors) * sectorSize());
+}
@@ -42,6 +42,7 @@ public:
     bool open() override;
     bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
     qint64 length() const override;
+    bool isHole(qint64 readOffset, qint64 numSectors) const override;
 
     qint32 sectorSize() const override {
         return m_SectorSize;    /**< @return the file's sector size */
@@ -55,6 +56,9 @@ public:
     qint64 lastSector() const override {
         return length();    /**< @return equal to length for file. @see length() */
     }
+    int fileDescriptor() const override {
+        return file().handle();    /**< @return the file's descriptor or -1 if it is not open */
+    }
 
 protected:
     QFile& file() {
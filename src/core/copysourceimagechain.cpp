@@ -0,0 +1,164 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copysourceimagechain.h"
+
+#include "core/copysourcefile.h"
+#include "core/copysourcezstdfile.h"
+#include "core/zstdimage.h"
+
+#include <QDir>
+#include <QFileInfo>
+
+#include <cstring>
+
+/** Creates a new CopySourceImageChain.
+    @param fileNames the file names of the images, newest first
+    @param indexes the indexes of the images in the same order
+    @param sectorsize the sector size of the images
+*/
+CopySourceImageChain::CopySourceImageChain(const QStringList& fileNames, const QList<BlockIndex>& indexes, qint32 sectorsize) :
+    CopySource(),
+    m_FileNames(fileNames),
+    m_Indexes(indexes),
+    m_SectorSize(sectorsize),
+    m_Images()
+{
+}
+
+CopySourceImageChain::~CopySourceImageChain()
+{
+    qDeleteAll(m_Images);
+}
+
+/** Opens all images of the chain.
+    @return true if all images could be opened
+*/
+bool CopySourceImageChain::open()
+{
+    if (m_Indexes.isEmpty() || m_Indexes.size() != m_FileNames.size())
+        return false;
+
+    for (const auto &index : m_Indexes)
+        if (index.sectorSize() != sectorSize())
+            return false;
+
+    for (const auto &fileName : m_FileNames) {
+        if (ZstdImage::isImage(fileName))
+            m_Images.append(new CopySourceZstdFile(fileName, sectorSize()));
+        else
+            m_Images.append(new CopySourceFile(fileName, sectorSize()));
+
+        if (!m_Images.last()->open())
+            return false;
+    }
+
+    return true;
+}
+
+/** Finds the image a block is to be read from.
+    @param block the block
+    @return the position of the newest image that stores the block in the chain or
+            -1 if the FileSystem does not use the block
+*/
+int CopySourceImageChain::imageFor(qint64 block) const
+{
+    if (!(m_Indexes.first().flags(block) & BlockIndex::Used))
+        return -1;
+
+    for (int i = 0; i < m_Indexes.size(); i++)
+        if (m_Indexes[i].flags(block) & BlockIndex::Stored)
+            return i;
+
+    return -1;
+}
+
+/** Reads the given number of sectors from the chain into the given buffer.
+
+    Consecutive blocks that come from the same image are read with a single request.
+
+    @param buffer output buffer
+    @param readOffset offset in sectors to start reading from
+    @param numSectors number of sectors to read
+    @return true on success
+*/
+bool CopySourceImageChain::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
+{
+    const qint64 blockSectors = m_Indexes.first().blockSectors();
+    const qint64 end = readOffset + numSectors;
+    char* out = static_cast<char*>(buffer);
+    qint64 sector = readOffset;
+
+    while (sector < end) {
+        const int image = imageFor(sector / blockSectors);
+        qint64 runEnd = qMin((sector / blockSectors + 1) * blockSectors, end);
+
+        while (runEnd < end && imageFor(runEnd / blockSectors) == image)
+            runEnd = qMin(runEnd + blockSectors, end);
+
+        char* p = out + (sector - readOffset) * sectorSize();
+
+        if (image < 0)
+            memset(p, 0, (runEnd - sector) * sectorSize());
+        else if (runEnd > m_Images[image]->length() || !m_Images[image]->readSectors(p, sector, runEnd - sector))
+            return false;
+
+        sector = runEnd;
+    }
+
+    return true;
+}
+
+/** @return true if the FileSystem uses none of the given sectors */
+bool CopySourceImageChain::isHole(qint64 readOffset, qint64 numSectors) const
+{
+    const qint64 blockSectors = m_Indexes.first().blockSectors();
+
+    for (qint64 block = readOffset / blockSectors; block * blockSectors < readOffset + numSectors; block++)
+        if (m_Indexes.first().flags(block) & BlockIndex::Used)
+            return false;
+
+    return true;
+}
+
+/** Reads the indexes of an image and all images it depends on.
+    @param fileName the file name of the newest image
+    @param fileNames returns the file names of the images, newest first
+    @param indexes returns the indexes of the images in the same order
+    @return false if an index could not be read or the chain is broken
+*/
+bool CopySourceImageChain::readChain(const QString& fileName, QStringList& fileNames, QList<BlockIndex>& indexes)
+{
+    QString name = fileName;
+
+    while (!name.isEmpty()) {
+        // a chain that long can only be a loop
+        if (fileNames.size() >= 10000 || fileNames.contains(name))
+            return false;
+
+        BlockIndex index;
+        if (!index.load(BlockIndex::fileName(name)))
+            return false;
+
+        fileNames.append(name);
+        indexes.append(index);
+
+        name = index.parent().isEmpty() ? QString() : QFileInfo(name).dir().absoluteFilePath(index.parent());
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYSOURCEIMAGECHAIN__H)
+
+#define COPYSOURCEIMAGECHAIN__H
+
+#include "core/blockindex.h"
+#include "core/copysource.h"
+
+#include <QList>
+#include <QStringList>
+#include <QtGlobal>
+
+class CopyTarget;
+
+/** A chain of backup images to copy from.
+
+    Puts a FileSystem back together from a full image and the delta images of the
+    incremental backups made after it. Each block is read from the newest image that
+    stores it, so restoring the chain takes a single pass.
+
+    @see BlockIndex, CopySourceFile, CopySourceZstdFile
+*/
+class CopySourceImageChain : public CopySource
+{
+    Q_DISABLE_COPY(CopySourceImageChain)
+
+public:
+    CopySourceImageChain(const QStringList& fileNames, const QList<BlockIndex>& indexes, qint32 sectorsize);
+    ~CopySourceImageChain();
+
+public:
+    bool open() override;
+    bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
+    bool isHole(qint64 readOffset, qint64 numSectors) const override;
+
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the images' sector size */
+    }
+    qint64 length() const override {
+        return m_Indexes.isEmpty() ? 0 : m_Indexes.first().length();    /**< @return the length of the newest image in sectors */
+    }
+    bool overlaps(const CopyTarget&) const override {
+        return false;    /**< @return false for file */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return 0 for file */
+    }
+    qint64 lastSector() const override {
+        return length();    /**< @return equal to length for file. @see length() */
+    }
+
+    static bool readChain(const QString& fileName, QStringList& fileNames, QList<BlockIndex>& indexes);
+
+protected:
+    int imageFor(qint64 block) const;
+
+private:
+    const QStringList m_FileNames;
+    const QList<BlockIndex> m_Indexes;
+    qint32 m_SectorSize;
+    QList<CopySource*> m_Images;
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copysourcerepository.h"
+
+#include <QList>
+#include <QRunnable>
+#include <QThread>
+
+#include <cstring>
+
+/** Loads one chunk on the thread pool */
+class ChunkLoadTask : public QRunnable
+{
+public:
+    ChunkLoadTask(const ChunkRepository& repository, const QByteArray& hash, quint32 size, char* output) :
+        m_Repository(repository),
+        m_Hash(hash),
+        m_Size(size),
+        m_Output(output),
+        m_Failed(true)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+        m_Failed = !m_Repository.load(m_Hash, m_Output, m_Size);
+    }
+
+    const ChunkRepository& m_Repository;
+    QByteArray m_Hash;
+    quint32 m_Size;
+    char* m_Output;
+    bool m_Failed;
+};
+
+/** Constructs a CopySourceRepository from the given recipe.
+    @param recipeFileName name of the recipe file to copy from
+    @param sectorsize the sector size to assume for the image, usually the target Device's sector size
+*/
+CopySourceRepository::CopySourceRepository(const QString& recipeFileName, qint32 sectorsize) :
+    CopySource(),
+    m_FileName(recipeFileName),
+    m_SectorSize(sectorsize),
+    m_Repository(ChunkRepository::directoryFor(recipeFileName)),
+    m_Recipe(),
+    m_Pool(),
+    m_CachedChunk(-1),
+    m_Cache()
+{
+    m_Pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+}
+
+/** Reads the recipe and opens the repository.
+    @return true on success
+*/
+bool CopySourceRepository::open()
+{
+    return m_Recipe.load(m_FileName) && m_Repository.open(false);
+}
+
+/** Reads the given number of sectors from the image into the given buffer.
+    @param buffer output buffer
+    @param readOffset offset in sectors to start reading from
+    @param numSectors number of sectors to read
+    @return true on success
+*/
+bool CopySourceRepository::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
+{
+    const qint64 start = readOffset * sectorSize();
+    const qint64 end = start + numSectors * sectorSize();
+
+    if (start < 0 || end > m_Recipe.size())
+        return false;
+
+    char* out = static_cast<char*>(buffer);
+    QList<ChunkLoadTask*> tasks;
+    QList<int> partial;
+
+    for (int i = m_Recipe.find(start); i < m_Recipe.count() && m_Recipe.offset(i) < end; i++) {
+        const qint64 offset = m_Recipe.offset(i);
+        const qint64 size = m_Recipe.chunkSize(i);
+
+        if (m_Recipe.isZero(i)) {
+            const qint64 from = qMax(start, offset);
+            const qint64 to = qMin(end, offset + size);
+            std::memset(out + (from - start), 0, to - from);
+        } else if (offset >= start && offset + size <= end) {
+            tasks.append(new ChunkLoadTask(m_Repository, m_Recipe.hash(i), size, out + (offset - start)));
+            m_Pool.start(tasks.last());
+        } else
+            partial.append(i);
+    }
+
+    // a block boundary cuts at most the first and the last chunk; reads come in order, so
+    // keeping the last one loaded saves loading it again for the next block
+    bool rval = true;
+
+    for (int i : partial) {
+        const qint64 offset = m_Recipe.offset(i);
+
+        if (m_CachedChunk != i) {
+            m_Cache.resize(m_Recipe.chunkSize(i));
+            m_CachedChunk = m_Repository.load(m_Recipe.hash(i), m_Cache.data(), m_Cache.size()) ? i : -1;
+
+            if (m_CachedChunk < 0) {
+                rval = false;
+                break;
+            }
+        }
+
+        const qint64 from = qMax(start, offset);
+        const qint64 to = qMin(end, offset + m_Cache.size());
+        std::memcpy(out + (from - start), m_Cache.constData() + (from - offset), to - from);
+    }
+
+    m_Pool.waitForDone();
+
+    for (ChunkLoadTask* task : tasks) {
+        rval = rval && !task->m_Failed;
+        delete task;
+    }
+
+    return rval;
+}
+
+/** @return true if the given sectors are all in runs of zeros the recipe lists */
+bool CopySourceRepository::isHole(qint64 readOffset, qint64 numSectors) const
+{
+    const qint64 start = readOffset * sectorSize();
+    const qint64 end = start + numSectors * sectorSize();
+
+    for (int i = m_Recipe.find(start); i < m_Recipe.count() && m_Recipe.offset(i) < end; i++)
+        if (!m_Recipe.isZero(i))
+            return false;
+
+    return end <= m_Recipe.size();
+}
@@ -0,0 +1,76 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYSOURCEREPOSITORY__H)
+
+#define COPYSOURCEREPOSITORY__H
+
+#include "core/copysource.h"
+#include "core/chunkrecipe.h"
+#include "core/chunkrepository.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QThreadPool>
+#include <QtGlobal>
+
+class CopyTarget;
+
+/** A deduplicating backup to copy from.
+
+    Reads the image a ChunkRecipe describes from the ChunkRepository next to it. The
+    chunks a read covers are loaded and checked against their hashes in parallel.
+
+    @see CopyTargetRepository, CopySourceZstdFile
+*/
+class CopySourceRepository : public CopySource
+{
+public:
+    CopySourceRepository(const QString& recipeFileName, qint32 sectorsize);
+
+public:
+    bool open() override;
+    bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
+    bool isHole(qint64 readOffset, qint64 numSectors) const override;
+
+    qint64 length() const override {
+        return m_Recipe.size() / sectorSize();    /**< @return the length of the image in sectors */
+    }
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the image's sector size */
+    }
+    bool overlaps(const CopyTarget&) const override {
+        return false;    /**< @return false for an image */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return 0 for an image */
+    }
+    qint64 lastSector() const override {
+        return length();    /**< @return equal to length for an image. @see length() */
+    }
+
+private:
+    const QString m_FileName;
+    qint32 m_SectorSize;
+    ChunkRepository m_Repository;
+    ChunkRecipe m_Recipe;
+    QThreadPool m_Pool;
+    int m_CachedChunk;
+    QByteArray m_Cache;
+};
+
+#endif
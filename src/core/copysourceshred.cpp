@@ -18,16 +18,53 @@
 
 #include "core/copysourceshred.h"
 
+#include <QRunnable>
+#include <QThread>
+
+#include <cstring>
+
+/** Fills part of a buffer with random data on the thread pool */
+class ShredRandomTask : public QRunnable
+{
+public:
+    ShredRandomTask(const ChaCha20& random, char* buffer, qint64 size, quint64 position) :
+        m_Random(random),
+        m_Buffer(buffer),
+        m_Size(size),
+        m_Position(position)
+    {
+    }
+
+    void run() override {
+        m_Random.generate(m_Buffer, m_Size, m_Position);
+    }
+
+private:
+    const ChaCha20& m_Random;
+    char* m_Buffer;
+    const qint64 m_Size;
+    const quint64 m_Position;
+};
+
 /** Constructs a CopySourceShred with the given @p size
     @param s the size the copy source will (pretend to) have
     @param sectorsize the sectorsize the copy source will (pretend to) have
+    @param randomShred true to overwrite with random data, false to overwrite with zeros
 */
 CopySourceShred::CopySourceShred(qint64 s, qint32 sectorsize, bool randomShred) :
     CopySource(),
     m_Size(s),
     m_SectorSize(sectorsize),
-    m_SourceFile(randomShred ? QStringLiteral("/dev/urandom") : QStringLiteral("/dev/zero"))
+    m_RandomShred(randomShred),
+    m_Random(),
+    m_Pool()
 {
+    m_Pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+}
+
+CopySourceShred::~CopySourceShred()
+{
+    m_Pool.waitForDone();
 }
 
 /** Opens the shred source.
@@ -35,7 +72,7 @@ CopySourceShred::CopySourceShred(qint64 s, qint32 sectorsize, bool randomShred)
 */
 bool CopySourceShred::open()
 {
-    return sourceFile().open(QIODevice::ReadOnly);
+    return !m_RandomShred || m_Random.seed();
 }
 
 /** Returns the length of the source in sectors.
@@ -48,13 +85,26 @@ qint64 CopySourceShred::length() const
 
 /** Reads the given number of sectors from the source into the given buffer.
     @param buffer buffer to store the sectors read in
-    @param readOffset offset where to begin reading (unused)
+    @param readOffset offset where to begin reading, random data differs for each offset
     @param numSectors number of sectors to read
     @return true on success
 */
 bool CopySourceShred::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
 {
-    Q_UNUSED(readOffset);
+    if (!m_RandomShred) {
+        memset(buffer, 0, numSectors * sectorSize());
+        return true;
+    }
+
+    // each thread computes a chunk of at least 1 MiB, starting on a block of the stream
+    const qint64 size = numSectors * sectorSize();
+    const qint64 chunkSize = qMax(size / m_Pool.maxThreadCount(), static_cast<qint64>(1024 * 1024)) / ChaCha20::blockSize() * ChaCha20::blockSize();
+    const quint64 position = readOffset * sectorSize();
+
+    for (qint64 done = 0; done < size; done += chunkSize)
+        m_Pool.start(new ShredRandomTask(m_Random, static_cast<char*>(buffer) + done, qMin(chunkSize, size - done), position + done));
+
+    m_Pool.waitForDone();
 
-    return sourceFile().read(static_cast<char*>(buffer), numSectors * sectorSize()) == numSectors * sectorSize();
+    return true;
 }
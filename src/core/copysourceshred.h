@@ -21,7 +21,9 @@
 
 #include "core/copysource.h"
 
-#include <QFile>
+#include "util/chacha20.h"
+
+#include <QThreadPool>
 
 class CopyTarget;
 
@@ -29,12 +31,16 @@ class CopyTarget;
 
     Represents a source of data (random or zeros) to copy from. Used to securely overwrite data on disk.
 
+    Random data is generated with ChaCha20 from a key seeded by the kernel, in parallel on a
+    thread pool, so it can be produced as fast as several disks can take it.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class CopySourceShred : public CopySource
 {
 public:
     CopySourceShred(qint64 size, qint32 sectorsize, bool randomShred);
+    ~CopySourceShred();
 
 public:
     bool open() override;
@@ -55,12 +61,6 @@ public:
     }
 
 protected:
-    QFile& sourceFile() {
-        return m_SourceFile;
-    }
-    const QFile& sourceFile() const {
-        return m_SourceFile;
-    }
     qint32 size() const {
         return m_Size;
     }
@@ -68,7 +68,9 @@ protected:
 private:
     qint64 m_Size;
     qint32 m_SectorSize;
-    QFile m_SourceFile;
+    bool m_RandomShred;
+    ChaCha20 m_Random;
+    QThreadPool m_Pool;
 };
 
 #endif
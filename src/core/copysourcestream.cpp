@@ -0,0 +1,158 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copysourcestream.h"
+#include "core/ioqueue.h"
+
+#include <QByteArray>
+
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/** Constructs a stream to copy from.
+    @param name the name of the stream, see IoQueue::openStream()
+    @param sectorsize the sector size to assume for the stream, usually the target Device's sector size
+    @param maxlength the largest number of sectors to read from the stream
+*/
+CopySourceStream::CopySourceStream(const QString& name, qint32 sectorsize, qint64 maxlength) :
+    CopySource(),
+    m_Name(name),
+    m_SectorSize(sectorsize),
+    m_MaxLength(maxlength),
+    m_Fd(-1),
+    m_OwnsFd(false),
+    m_Position(0),
+    m_Ended(false)
+{
+}
+
+CopySourceStream::~CopySourceStream()
+{
+    if (m_Fd != -1 && m_OwnsFd)
+        close(m_Fd);
+}
+
+/** Opens the stream for reading. Opening a FIFO waits until it is opened for writing.
+    @return true on success
+*/
+bool CopySourceStream::open()
+{
+    m_Fd = IoQueue::openStream(name(), false, m_OwnsFd);
+
+    if (m_Fd == -1)
+        return false;
+
+    // Larger pipe buffers let the writer get ahead for longer without stalling.
+    fcntl(m_Fd, F_SETPIPE_SZ, 1024 * 1024);
+
+    return true;
+}
+
+/** Reads the given sectors from the stream. Sectors after the end of the stream read as zeros.
+    @param buffer buffer to store the sectors read in
+    @param readOffset offset where to begin reading, must not be before the sectors read so far;
+           sectors skipped are read and dropped
+    @param numSectors number of sectors to read
+    @return true on success
+*/
+bool CopySourceStream::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
+{
+    const qint64 offset = readOffset * sectorSize();
+    const qint64 size = numSectors * sectorSize();
+
+    if (offset < m_Position)
+        return false;
+
+    // skip ahead through the buffer itself, it is overwritten afterwards anyway
+    while (!m_Ended && m_Position < offset) {
+        const qint64 n = readAll(static_cast<char*>(buffer), qMin(offset - m_Position, size));
+
+        if (n < 0)
+            return false;
+    }
+
+    qint64 n = 0;
+
+    if (!m_Ended && m_Position == offset && (n = readAll(static_cast<char*>(buffer), size)) < 0)
+        return false;
+
+    memset(static_cast<char*>(buffer) + n, 0, size - n);
+
+    return true;
+}
+
+/** Sectors after the end of the stream hold nothing to copy once the end has been read. */
+bool CopySourceStream::isUnused(qint64 readOffset, qint64 numSectors) const
+{
+    Q_UNUSED(numSectors);
+
+    return m_Ended && readOffset >= streamLength();
+}
+
+/** Checks if the stream has ended, reading from it if its end has not been seen yet.
+
+    Call this after copying to find out if the stream held more than length() sectors.
+
+    @return true if nothing is left to read
+*/
+bool CopySourceStream::atEnd()
+{
+    if (!m_Ended) {
+        char c;
+        const qint64 position = m_Position;
+
+        if (readAll(&c, 1) < 0)
+            return false;
+
+        // the byte belongs past the sectors the copy used and is not counted
+        if (!m_Ended)
+            m_Position = position;
+    }
+
+    return m_Ended;
+}
+
+/** Reads until the given size has been read or the stream has ended.
+    @return the number of bytes read or -1 on error
+*/
+qint64 CopySourceStream::readAll(char* data, qint64 size)
+{
+    qint64 rval = 0;
+
+    while (rval < size) {
+        const ssize_t n = read(m_Fd, data + rval, size - rval);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0)
+            return -1;
+
+        if (n == 0) {
+            m_Ended = true;
+            break;
+        }
+
+        rval += n;
+        m_Position += n;
+    }
+
+    return rval;
+}
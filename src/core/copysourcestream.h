@@ -0,0 +1,96 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYSOURCESTREAM__H)
+
+#define COPYSOURCESTREAM__H
+
+#include "core/copysource.h"
+
+#include <QString>
+#include <QtGlobal>
+
+class CopyTarget;
+
+/** A stream to copy from.
+
+    Reads an image from a file descriptor that cannot seek, so that a backup can be restored
+    straight from a decompressor, a decryptor or a download. The stream is named like for
+    CopyTargetStream, with "-" being standard input.
+
+    The stream is consumed in one pass: sectors must be read front to back, and sectors
+    skipped are read and dropped. Since the length of a stream is not known before it has
+    ended, the source has the length given when it is created, usually that of the target.
+    Once the stream has ended, the sectors after its end read as zeros and are reported as
+    unused, so that they are not copied.
+
+    @see CopyTargetStream, CopySourceFile
+*/
+class CopySourceStream : public CopySource
+{
+    Q_DISABLE_COPY(CopySourceStream)
+
+public:
+    CopySourceStream(const QString& name, qint32 sectorsize, qint64 maxlength);
+    ~CopySourceStream();
+
+public:
+    bool open() override;
+    bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
+    bool isUnused(qint64 readOffset, qint64 numSectors) const override;
+    bool atEnd();
+
+    qint64 length() const override {
+        return m_MaxLength;    /**< @return the largest number of sectors the stream may have */
+    }
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the stream's sector size */
+    }
+    bool overlaps(const CopyTarget&) const override {
+        return false;    /**< @return false for a stream */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return 0 for a stream */
+    }
+    qint64 lastSector() const override {
+        return length() - 1;    /**< @return the last sector the stream may have */
+    }
+
+    bool hasEnded() const {
+        return m_Ended;    /**< @return true if the end of the stream has been read */
+    }
+    qint64 streamLength() const {
+        return (m_Position + sectorSize() - 1) / sectorSize();    /**< @return the number of sectors read from the stream so far, a partial last sector counted */
+    }
+    const QString& name() const {
+        return m_Name;    /**< @return the name of the stream */
+    }
+
+protected:
+    qint64 readAll(char* data, qint64 size);
+
+private:
+    const QString m_Name;
+    const qint32 m_SectorSize;
+    const qint64 m_MaxLength;
+    int m_Fd;
+    bool m_OwnsFd;
+    qint64 m_Position;
+    bool m_Ended;
+};
+
+#endif
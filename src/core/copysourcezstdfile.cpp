@@ -0,0 +1,237 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copysourcezstdfile.h"
+
+#include <QByteArray>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QString>
+#include <QThread>
+
+#include <algorithm>
+#include <cstring>
+
+#include <unistd.h>
+
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+/** Decompresses one frame on the thread pool */
+class ZstdDecompressTask : public QRunnable
+{
+public:
+    ZstdDecompressTask(int fd, const ZstdImage::Frame& frame, QMutex& mutex, QWaitCondition& done) :
+        m_Fd(fd),
+        m_Frame(frame),
+        m_Mutex(mutex),
+        m_Done(done),
+        m_Output(),
+        m_Finished(false),
+        m_Failed(true)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+        const bool failed = !decompress();
+
+        QMutexLocker locker(&m_Mutex);
+        m_Failed = failed;
+        m_Finished = true;
+        m_Done.wakeAll();
+    }
+
+    bool decompress() {
+#if defined(HAVE_ZSTD)
+        QByteArray input(m_Frame.compressedSize, 0);
+        qint64 done = 0;
+
+        while (done < input.size()) {
+            const ssize_t n = pread(m_Fd, input.data() + done, input.size() - done, m_Frame.offset + done);
+            if (n <= 0)
+                return false;
+            done += n;
+        }
+
+        m_Output.resize(m_Frame.size);
+
+        const size_t n = ZSTD_decompress(m_Output.data(), m_Frame.size, input.constData(), input.size());
+        return !ZSTD_isError(n) && n == m_Frame.size;
+#else
+        return false;
+#endif
+    }
+
+    int m_Fd;
+    ZstdImage::Frame m_Frame;
+    QMutex& m_Mutex;
+    QWaitCondition& m_Done;
+    QByteArray m_Output;
+    bool m_Finished;
+    bool m_Failed;
+};
+
+/** Constructs a CopySourceZstdFile from the given @p filename.
+    @param filename filename of the compressed image to copy from
+    @param sectorsize the sector size to assume for the image, usually the target Device's sector size
+*/
+CopySourceZstdFile::CopySourceZstdFile(const QString& filename, qint32 sectorsize) :
+    CopySource(),
+    m_File(filename),
+    m_SectorSize(sectorsize),
+    m_Pool(),
+    m_Frames(),
+    m_Size(0),
+    m_Mutex(),
+    m_FrameDone(),
+    m_Window()
+{
+    m_Pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+}
+
+CopySourceZstdFile::~CopySourceZstdFile()
+{
+    m_Pool.waitForDone();
+    qDeleteAll(m_Window);
+}
+
+/** Opens the image and reads its seek table.
+    @return true on success
+*/
+bool CopySourceZstdFile::open()
+{
+    if (!ZstdImage::isSupported() || !file().open(QIODevice::ReadOnly))
+        return false;
+
+    if (!ZstdImage::readSeekTable(file().handle(), file().size(), m_Frames))
+        return false;
+
+    m_Size = m_Frames.isEmpty() ? 0 : m_Frames.last().position + m_Frames.last().size;
+
+    return true;
+}
+
+/** Returns the uncompressed length of the image in sectors.
+    @return length of the image in sectors.
+*/
+qint64 CopySourceZstdFile::length() const
+{
+    return m_Size / sectorSize();
+}
+
+/** Reads the given number of sectors from the image into the given buffer.
+    @param buffer output buffer
+    @param readOffset offset in sectors to start reading from
+    @param numSectors number of sectors to read
+    @return true on success
+*/
+bool CopySourceZstdFile::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
+{
+    const qint64 start = readOffset * sectorSize();
+    const qint64 end = start + numSectors * sectorSize();
+
+    if (start < 0 || end > m_Size)
+        return false;
+
+    if (start == end)
+        return true;
+
+    auto byPosition = [](const ZstdImage::Frame& frame, qint64 pos) {
+        return frame.position + frame.size <= pos;
+    };
+    const int first = std::lower_bound(m_Frames.constBegin(), m_Frames.constEnd(), start, byPosition) - m_Frames.constBegin();
+
+    int last = first;
+    while (last + 1 < m_Frames.size() && m_Frames[last + 1].position < end)
+        last++;
+
+    // keep every thread busy with the frames after this read, which the next reads want
+    const int ahead = qMin(last + m_Pool.maxThreadCount(), m_Frames.size() - 1);
+
+    dropFrames(first, ahead);
+
+    for (int i = first; i <= ahead; i++)
+        queueFrame(i);
+
+    char* out = static_cast<char*>(buffer);
+
+    for (int i = first; i <= last; i++) {
+        const ZstdImage::Frame& frame = m_Frames[i];
+        const ZstdDecompressTask* task = waitForFrame(i);
+
+        if (task->m_Failed)
+            return false;
+
+        const qint64 from = qMax(start, frame.position);
+        const qint64 to = qMin(end, frame.position + frame.size);
+        std::memcpy(out + (from - start), task->m_Output.constData() + (from - frame.position), to - from);
+    }
+
+    // a block boundary usually cuts the last frame, whose rest the next read wants
+    dropFrames(m_Frames[last].position + m_Frames[last].size <= end ? last + 1 : last, ahead);
+
+    return true;
+}
+
+/** Starts decompressing a frame on the thread pool unless that is already done.
+    @param index the frame's index
+*/
+void CopySourceZstdFile::queueFrame(int index)
+{
+    if (m_Window.contains(index))
+        return;
+
+    ZstdDecompressTask* task = new ZstdDecompressTask(file().handle(), m_Frames[index], m_Mutex, m_FrameDone);
+    m_Window.insert(index, task);
+    m_Pool.start(task);
+}
+
+/** Waits for a queued frame to be decompressed.
+    @param index the frame's index
+    @return the finished task
+*/
+ZstdDecompressTask* CopySourceZstdFile::waitForFrame(int index)
+{
+    ZstdDecompressTask* task = m_Window.value(index);
+    Q_ASSERT(task);
+
+    QMutexLocker locker(&m_Mutex);
+
+    while (!task->m_Finished)
+        m_FrameDone.wait(&m_Mutex);
+
+    return task;
+}
+
+/** Drops the frames outside a range from the window, once their tasks are done.
+    @param first the index of the first frame to keep
+    @param last the index of the last frame to keep
+*/
+void CopySourceZstdFile::dropFrames(int first, int last)
+{
+    for (auto it = m_Window.begin(); it != m_Window.end();) {
+        if (it.key() >= first && it.key() <= last) {
+            ++it;
+            continue;
+        }
+
+        delete waitForFrame(it.key());
+        it = m_Window.erase(it);
+    }
+}
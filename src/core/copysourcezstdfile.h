@@ -0,0 +1,95 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYSOURCEZSTDFILE__H)
+
+#define COPYSOURCEZSTDFILE__H
+
+#include "core/copysource.h"
+#include "core/zstdimage.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+class QString;
+class CopyTarget;
+class ZstdDecompressTask;
+
+/** A compressed image file to copy from.
+
+    Reads a compressed backup image written by CopyTargetZstdFile or by any other tool
+    writing the format described in ZstdImage. The frames are decompressed on a thread
+    pool ahead of the reads, which are expected to come front to back, so that all cores
+    are kept busy however small the blocks read are.
+
+    @see CopyTargetZstdFile, CopySourceFile
+*/
+class CopySourceZstdFile : public CopySource
+{
+    Q_DISABLE_COPY(CopySourceZstdFile)
+
+public:
+    CopySourceZstdFile(const QString& filename, qint32 sectorsize);
+    ~CopySourceZstdFile();
+
+public:
+    bool open() override;
+    bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
+    qint64 length() const override;
+
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the file's sector size */
+    }
+    bool overlaps(const CopyTarget&) const override {
+        return false;    /**< @return false for file */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return 0 for file */
+    }
+    qint64 lastSector() const override {
+        return length();    /**< @return equal to length for file. @see length() */
+    }
+
+protected:
+    QFile& file() {
+        return m_File;
+    }
+    const QFile& file() const {
+        return m_File;
+    }
+
+    void queueFrame(int index);
+    ZstdDecompressTask* waitForFrame(int index);
+    void dropFrames(int first, int last);
+
+private:
+    QFile m_File;
+    qint32 m_SectorSize;
+    QThreadPool m_Pool;
+    QVector<ZstdImage::Frame> m_Frames;
+    qint64 m_Size;
+    QMutex m_Mutex;
+    QWaitCondition m_FrameDone;
+    QHash<int, ZstdDecompressTask*> m_Window;   /**< the frames being or already decompressed, by index */
+};
+
+#endif
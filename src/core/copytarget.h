@@ -34,6 +34,9 @@ class CopyTarget
 {
     Q_DISABLE_COPY(CopyTarget)
 
+    friend class CopyPipeline;
+    friend class KernelCopy;
+
 protected:
     CopyTarget() : m_SectorsWritten(0) {}
     virtual ~CopyTarget() {}
@@ -45,6 +48,22 @@ public:
     virtual qint64 firstSector() const = 0;
     virtual qint64 lastSector() const = 0;
 
+    virtual int fileDescriptor() const {
+        return -1;    /**< @return a file descriptor to queue writes on or -1 if only writeSectors() can be used */
+    }
+    virtual qint32 alignment() const {
+        return sectorSize();    /**< @return the alignment in bytes buffers for bulk writes should have */
+    }
+    virtual bool zeroSectors(qint64, qint64) {
+        return false;    /**< @return true if the given sectors now read as zeros without having been written, false if they must be written */
+    }
+    virtual bool isExclusive() const {
+        return true;    /**< @return true if nothing else can write to the target or mount a file system from it while it is open */
+    }
+    virtual bool finish() {
+        return true;    /**< Completes the target after the last sector has been written. @return true on success */
+    }
+
     qint64 sectorsWritten() const {
         return m_SectorsWritten;
     }
@@ -17,12 +17,18 @@
 
 #include "core/copytargetdevice.h"
 
-#include "backend/corebackend.h"
-#include "backend/corebackendmanager.h"
-#include "backend/corebackenddevice.h"
+#include "backend/rawblockdevice.h"
 
 #include "core/device.h"
+#include "core/diskdevice.h"
+#include "core/ioqueue.h"
 
+#include <QString>
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /** Constructs a device to copy to.
     @param d the Device to copy to
@@ -33,6 +39,8 @@ CopyTargetDevice::CopyTargetDevice(Device& d, qint64 firstsector, qint64 lastsec
     CopyTarget(),
     m_Device(d),
     m_BackendDevice(nullptr),
+    m_Fd(-1),
+    m_CanZeroOut(false),
     m_FirstSector(firstsector),
     m_LastSector(lastsector)
 {
@@ -41,6 +49,9 @@ CopyTargetDevice::CopyTargetDevice(Device& d, qint64 firstsector, qint64 lastsec
 /** Destructs a CopyTargetDevice */
 CopyTargetDevice::~CopyTargetDevice()
 {
+    if (m_Fd != -1)
+        fsync(m_Fd);
+
     delete m_BackendDevice;
 }
 
@@ -49,8 +60,31 @@ CopyTargetDevice::~CopyTargetDevice()
 */
 bool CopyTargetDevice::open()
 {
-    m_BackendDevice = CoreBackendManager::self()->backend()->openDeviceExclusive(device().deviceNode());
-    return m_BackendDevice != nullptr;
+    // Data is moved through the device node itself; the backend plugin only handles partition tables.
+    m_BackendDevice = new RawBlockDevice(device().deviceNode(), sectorSize(), RawBlockDevice::ReadWrite);
+
+    if (!m_BackendDevice->openExclusive() || !m_BackendDevice->isWritable()) {
+        delete m_BackendDevice;
+        m_BackendDevice = nullptr;
+        return false;
+    }
+
+    // Bulk writes are queued on the device's file descriptor, shared with a source on the same Device.
+    m_Fd = m_BackendDevice->fileDescriptor();
+
+    // Only offload zeroing to devices that can do it without being sent the zeros.
+    struct stat st;
+    m_CanZeroOut = m_Fd != -1 && fstat(m_Fd, &st) == 0 && S_ISBLK(st.st_mode) && IoQueue::queueLimit(m_Fd, QStringLiteral("write_zeroes_max_bytes")) > 0;
+
+    return true;
+}
+
+/** @return true if the Device's node could be opened with O_EXCL. If it could not, e.g.
+    because another partition on the Device is mounted, the kernel does not keep a file
+    system from being mounted from the sectors while they are written to. */
+bool CopyTargetDevice::isExclusive() const
+{
+    return m_BackendDevice && m_BackendDevice->isClaimed();
 }
 
 /** @return the Device's sector size */
@@ -59,6 +93,18 @@ qint32 CopyTargetDevice::sectorSize() const
     return device().logicalSize();
 }
 
+/** @return the Device's physical sector size if it is known, else its logical sector size */
+qint32 CopyTargetDevice::alignment() const
+{
+    if (device().type() == Device::Disk_Device) {
+        const qint32 physicalSize = static_cast<const DiskDevice&>(device()).physicalSectorSize();
+        if (physicalSize > 0)
+            return qMax(physicalSize, sectorSize());
+    }
+
+    return sectorSize();
+}
+
 /** Writes the given number of sectors to the Device.
 
     Note that @p writeOffset must be greater or equal than zero.
@@ -78,3 +124,50 @@ bool CopyTargetDevice::writeSectors(void* buffer, qint64 writeOffset, qint64 num
 
     return rval;
 }
+
+/** Zeroes the given sectors on the Device with BLKZEROOUT if the Device supports a
+    write zeroes command, which is much cheaper than writing the zeros.
+    @param writeOffset the first sector to zero
+    @param numSectors the number of sectors to zero
+    @return true if the sectors have been zeroed, false if they must be written instead
+*/
+bool CopyTargetDevice::zeroSectors(qint64 writeOffset, qint64 numSectors)
+{
+    if (!m_CanZeroOut)
+        return false;
+
+    uint64_t range[2] = { static_cast<uint64_t>(writeOffset * sectorSize()), static_cast<uint64_t>(numSectors * sectorSize()) };
+
+    // do not try again if the Device refuses
+    if (ioctl(m_Fd, BLKZEROOUT, range) != 0)
+        m_CanZeroOut = false;
+
+    return m_CanZeroOut;
+}
+
+/** Lets the Device erase the given sectors itself.
+
+    Unlike zeroSectors(), this is tried even if the Device has no write zeroes command,
+    because the kernel then writes the zeros itself, which is still much cheaper than
+    passing them through a buffer.
+
+    @param method how to erase the sectors
+    @param writeOffset the first sector to erase
+    @param numSectors the number of sectors to erase
+    @return true if the sectors have been erased, false if the Device cannot erase them this way
+*/
+bool CopyTargetDevice::eraseSectors(EraseMethod method, qint64 writeOffset, qint64 numSectors)
+{
+    if (m_Fd == -1)
+        return false;
+
+    uint64_t range[2] = { static_cast<uint64_t>(writeOffset * sectorSize()), static_cast<uint64_t>(numSectors * sectorSize()) };
+    const unsigned long request = method == ZeroOut ? BLKZEROOUT : method == Discard ? BLKDISCARD : BLKSECDISCARD;
+
+    if (ioctl(m_Fd, request, range) != 0)
+        return false;
+
+    setSectorsWritten(sectorsWritten() + numSectors);
+
+    return true;
+}
@@ -25,7 +25,7 @@
 #include <QtGlobal>
 
 class Device;
-class CoreBackendDevice;
+class RawBlockDevice;
 
 /** A Device to copy to.
 
@@ -40,6 +40,14 @@ class LIBKPMCORE_EXPORT CopyTargetDevice : public CopyTarget
 {
     Q_DISABLE_COPY(CopyTargetDevice)
 
+public:
+    /** How to erase sectors without writing data to them */
+    enum EraseMethod {
+        ZeroOut,        /**< make the sectors read as zeros (BLKZEROOUT) */
+        Discard,        /**< tell the device that the sectors are no longer in use (BLKDISCARD) */
+        SecureDiscard   /**< discard the sectors and all copies the device keeps of them (BLKSECDISCARD) */
+    };
+
 public:
     CopyTargetDevice(Device& d, qint64 firstsector, qint64 lastsector);
     ~CopyTargetDevice();
@@ -47,13 +55,20 @@ public:
 public:
     bool open() override;
     qint32 sectorSize() const override;
+    qint32 alignment() const override;
     bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool zeroSectors(qint64 writeOffset, qint64 numSectors) override;
+    bool eraseSectors(EraseMethod method, qint64 writeOffset, qint64 numSectors);
+    bool isExclusive() const override;
     qint64 firstSector() const override {
         return m_FirstSector;    /**< @return the first sector to write to */
     }
     qint64 lastSector() const override {
         return m_LastSector;    /**< @return the last sector to write to */
     }
+    int fileDescriptor() const override {
+        return m_Fd;    /**< @return file descriptor of the opened Device or -1 */
+    }
 
     Device& device() {
         return m_Device;    /**< @return the Device to write to */
@@ -64,7 +79,9 @@ public:
 
 protected:
     Device& m_Device;
-    CoreBackendDevice* m_BackendDevice;
+    RawBlockDevice* m_BackendDevice;
+    int m_Fd;
+    bool m_CanZeroOut;
     const qint64 m_FirstSector;
     const qint64 m_LastSector;
 };
@@ -17,6 +17,10 @@
 
 #include "core/copytargetfile.h"
 
+#include "util/zeroscan.h"
+
+#include <fcntl.h>
+
 /** Constructs a file to write to.
     @param filename name of the file to write to
     @param sectorsize the "sector size" of the file to write to, usually the sector size of the CopySourceDevice
@@ -24,7 +28,8 @@
 CopyTargetFile::CopyTargetFile(const QString& filename, qint32 sectorsize) :
     CopyTarget(),
     m_File(filename),
-    m_SectorSize(sectorsize)
+    m_SectorSize(sectorsize),
+    m_KeepContents(false)
 {
 }
 
@@ -33,7 +38,8 @@ CopyTargetFile::CopyTargetFile(const QString& filename, qint32 sectorsize) :
 */
 bool CopyTargetFile::open()
 {
-    return file().open(QIODevice::WriteOnly | QIODevice::Truncate);
+    // WriteOnly alone would truncate the file as well
+    return file().open(m_KeepContents ? QIODevice::ReadWrite : QIODevice::WriteOnly | QIODevice::Truncate);
 }
 
 /** Writes the given number of sectors from the given buffer to the file.
@@ -44,6 +50,17 @@ bool CopyTargetFile::open()
 */
 bool CopyTargetFile::writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors)
 {
+    const qint64 end = (writeOffset + numSectors) * sectorSize();
+
+    // leave a hole, but make sure the file is long enough
+    if (isAllZero(buffer, numSectors * sectorSize()) && zeroSectors(writeOffset, numSectors)) {
+        if (file().size() < end && !file().resize(end))
+            return false;
+
+        setSectorsWritten(sectorsWritten() + numSectors);
+        return true;
+    }
+
     if (!file().seek(writeOffset * sectorSize()))
         return false;
 
@@ -54,3 +71,33 @@ bool CopyTargetFile::writeSectors(void* buffer, qint64 writeOffset, qint64 numSe
 
     return rval;
 }
+
+/** Leaves the given sectors as a hole instead of writing zeros to them.
+
+    A file opened with setKeepContents() may hold data where the zeros go, so the part of
+    the range within the file is punched out with fallocate(2). If the file system cannot
+    do that, the zeros must be written. Note that this does not extend the file: the last
+    sector of the file must always be written.
+
+    @param writeOffset the first sector to leave unwritten
+    @param numSectors the number of sectors
+    @return true if the sectors now read as zeros
+*/
+bool CopyTargetFile::zeroSectors(qint64 writeOffset, qint64 numSectors)
+{
+    // a file that is truncated when it is opened has nothing to punch out
+    if (!m_KeepContents)
+        return true;
+
+    const qint64 start = writeOffset * sectorSize();
+    const qint64 length = qMin(numSectors * sectorSize(), file().size() - start);
+
+    if (length <= 0)
+        return true;
+
+    // what QFile still buffers must not land on the hole afterwards
+    if (!file().flush())
+        return false;
+
+    return fallocate(file().handle(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, length) == 0;
+}
@@ -30,6 +30,8 @@ class QString;
 
     Repesents a target file to copy to. Used to back up a FileSystem to a file.
 
+    The file is created sparse: sectors that are all zeros are left as holes.
+
     @see CopySourceFile, CopyTargetDevice
     @author Volker Lanz <vl@fidra.de>
 */
@@ -41,6 +43,11 @@ public:
 public:
     bool open() override;
     bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool zeroSectors(qint64 writeOffset, qint64 numSectors) override;
+
+    void setKeepContents(bool keep) {
+        m_KeepContents = keep;    /**< @param keep true to write into an existing file instead of replacing its contents */
+    }
 
     qint32 sectorSize() const override {
         return m_SectorSize;    /**< @return the file's sector size */
@@ -51,6 +58,9 @@ public:
     qint64 lastSector() const override {
         return sectorsWritten();    /**< @return the number of sectors written so far */
     }
+    int fileDescriptor() const override {
+        return file().handle();    /**< @return the file's descriptor or -1 if it is not open */
+    }
 
 protected:
     QFile& file() {
@@ -63,6 +73,7 @@ protected:
 protected:
     QFile m_File;
     qint32 m_SectorSize;
+    bool m_KeepContents;
 };
 
 #endif
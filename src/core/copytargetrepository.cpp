@@ -0,0 +1,240 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copytargetrepository.h"
+
+#include "core/fastcdc.h"
+
+#include "util/zeroscan.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QVector>
+
+/** Cuts one segment into chunks and stores them on the thread pool */
+class ChunkTask : public QRunnable
+{
+public:
+    /** A chunk of the segment */
+    struct Chunk {
+        QByteArray hash;    /**< empty for zeros */
+        quint32 size;
+    };
+
+    ChunkTask(const QByteArray& input, const ChunkRepository& repository, QMutex& mutex, QWaitCondition& done) :
+        m_Input(input),
+        m_Repository(repository),
+        m_Mutex(mutex),
+        m_Done(done),
+        m_Chunks(),
+        m_Zeros(0),
+        m_StoredBytes(0),
+        m_AddedBytes(0),
+        m_Finished(false),
+        m_Failed(false)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+        const char* data = m_Input.constData();
+        qint64 left = m_Input.size();
+
+        while (left > 0 && !m_Failed) {
+            const qint64 n = FastCdc::cut(data, left);
+            Chunk chunk = { QByteArray(), static_cast<quint32>(n) };
+
+            if (!isAllZero(data, n)) {
+                bool added = false;
+
+                chunk.hash = ChunkRepository::hashChunk(data, n);
+                m_Failed = !m_Repository.store(chunk.hash, data, n, added);
+                m_StoredBytes += n;
+                m_AddedBytes += added ? n : 0;
+            }
+
+            m_Chunks.append(chunk);
+            data += n;
+            left -= n;
+        }
+
+        m_Input = QByteArray();
+
+        QMutexLocker locker(&m_Mutex);
+        m_Finished = true;
+        m_Done.wakeAll();
+    }
+
+    QByteArray m_Input;
+    const ChunkRepository& m_Repository;
+    QMutex& m_Mutex;
+    QWaitCondition& m_Done;
+    QVector<Chunk> m_Chunks;
+    qint64 m_Zeros;     /**< the number of zero bytes skipped, for a task that is not run */
+    qint64 m_StoredBytes;
+    qint64 m_AddedBytes;
+    bool m_Finished;
+    bool m_Failed;
+};
+
+/** Constructs a deduplicating backup to write to.
+    @param recipeFileName name of the recipe file to write; the chunks are stored in the
+           repository next to it
+    @param sectorsize the "sector size" of the image, usually the sector size of the CopySourceDevice
+*/
+CopyTargetRepository::CopyTargetRepository(const QString& recipeFileName, qint32 sectorsize) :
+    CopyTarget(),
+    m_FileName(recipeFileName),
+    m_SectorSize(sectorsize),
+    m_Repository(ChunkRepository::directoryFor(recipeFileName)),
+    m_Recipe(sectorsize),
+    m_Pool(),
+    m_Mutex(),
+    m_SegmentDone(),
+    m_Pending(),
+    m_Tasks(),
+    m_StoredBytes(0),
+    m_AddedBytes(0)
+{
+    m_Pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+}
+
+CopyTargetRepository::~CopyTargetRepository()
+{
+    m_Pool.waitForDone();
+    qDeleteAll(m_Tasks);
+}
+
+/** Opens the repository, creating it if need be.
+    @return true on success
+*/
+bool CopyTargetRepository::open()
+{
+    return m_Repository.open(true);
+}
+
+/** Adds the given sectors to the image. They are chunked and stored in the background.
+    @param buffer the data to write
+    @param writeOffset where in the image to write, must not be before the sectors written before
+    @param numSectors the number of sectors to write
+    @return true on success
+*/
+bool CopyTargetRepository::writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors)
+{
+    if (writeOffset < sectorsWritten())
+        return false;
+
+    // sectors skipped read as zeros
+    if (writeOffset > sectorsWritten() && !queueZeros((writeOffset - sectorsWritten()) * sectorSize()))
+        return false;
+
+    const char* data = static_cast<const char*>(buffer);
+    qint64 left = numSectors * sectorSize();
+
+    while (left > 0) {
+        const qint64 n = qMin(left, segmentSize() - m_Pending.size());
+
+        m_Pending.append(data, n);
+        data += n;
+        left -= n;
+
+        if (m_Pending.size() == segmentSize() && !queueSegment())
+            return false;
+    }
+
+    setSectorsWritten(writeOffset + numSectors);
+
+    return true;
+}
+
+/** Stores the remaining data, waits for all chunks to be stored and writes the recipe.
+    @return true on success
+*/
+bool CopyTargetRepository::finish()
+{
+    if (!m_Pending.isEmpty() && !queueSegment())
+        return false;
+
+    while (!m_Tasks.isEmpty())
+        if (!writeSegment())
+            return false;
+
+    return m_Recipe.save(m_FileName);
+}
+
+/** Hands the pending segment to the thread pool. */
+bool CopyTargetRepository::queueSegment()
+{
+    // a few segments more than there are threads keep all of them busy
+    while (m_Tasks.size() >= m_Pool.maxThreadCount() + 2)
+        if (!writeSegment())
+            return false;
+
+    ChunkTask* task = new ChunkTask(m_Pending, m_Repository, m_Mutex, m_SegmentDone);
+    m_Pending = QByteArray();
+
+    m_Tasks.append(task);
+    m_Pool.start(task);
+
+    return true;
+}
+
+/** Adds zeros after the pending segment, which is cut off there. */
+bool CopyTargetRepository::queueZeros(qint64 size)
+{
+    if (!m_Pending.isEmpty() && !queueSegment())
+        return false;
+
+    ChunkTask* task = new ChunkTask(QByteArray(), m_Repository, m_Mutex, m_SegmentDone);
+    task->m_Zeros = size;
+    task->m_Finished = true;
+
+    m_Tasks.append(task);
+
+    return true;
+}
+
+/** Waits for the oldest segment to be stored and adds its chunks to the recipe. */
+bool CopyTargetRepository::writeSegment()
+{
+    ChunkTask* task = m_Tasks.first();
+
+    {
+        QMutexLocker locker(&m_Mutex);
+
+        while (!task->m_Finished)
+            m_SegmentDone.wait(&m_Mutex);
+    }
+
+    m_Tasks.removeFirst();
+
+    const bool rval = !task->m_Failed;
+
+    if (rval) {
+        for (const auto &chunk : task->m_Chunks)
+            m_Recipe.append(chunk.hash, chunk.size);
+
+        m_Recipe.appendZeros(task->m_Zeros);
+        m_StoredBytes += task->m_StoredBytes;
+        m_AddedBytes += task->m_AddedBytes;
+    }
+
+    delete task;
+
+    return rval;
+}
@@ -0,0 +1,100 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYTARGETREPOSITORY__H)
+
+#define COPYTARGETREPOSITORY__H
+
+#include "core/copytarget.h"
+#include "core/chunkrecipe.h"
+#include "core/chunkrepository.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+class ChunkTask;
+
+/** A deduplicating backup to copy to.
+
+    Splits the image into content-defined chunks with FastCdc, stores each chunk in a
+    ChunkRepository unless it is already there and writes a ChunkRecipe listing them. The
+    image is cut into segments that are chunked and hashed in parallel on a thread pool;
+    a segment boundary is always a chunk boundary, which costs little deduplication since
+    segments start at the same offsets in every backup. Sectors must be written front to
+    back. Sectors skipped are recorded as zeros without being stored.
+
+    @see CopySourceRepository, CopyTargetZstdFile
+*/
+class CopyTargetRepository : public CopyTarget
+{
+    Q_DISABLE_COPY(CopyTargetRepository)
+
+public:
+    CopyTargetRepository(const QString& recipeFileName, qint32 sectorsize);
+    ~CopyTargetRepository();
+
+public:
+    bool open() override;
+    bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool finish() override;
+
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the image's sector size */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return always 0 for an image */
+    }
+    qint64 lastSector() const override {
+        return sectorsWritten();    /**< @return the number of sectors written so far */
+    }
+
+    qint64 storedBytes() const {
+        return m_StoredBytes;    /**< @return the number of bytes of chunks that are not zeros */
+    }
+    qint64 addedBytes() const {
+        return m_AddedBytes;    /**< @return the number of bytes of chunks that were not in the repository yet */
+    }
+
+    static qint64 segmentSize() {
+        return 8 * 1024 * 1024;    /**< @return the size of the segments chunked in parallel */
+    }
+
+protected:
+    bool queueSegment();
+    bool queueZeros(qint64 size);
+    bool writeSegment();
+
+private:
+    const QString m_FileName;
+    qint32 m_SectorSize;
+    ChunkRepository m_Repository;
+    ChunkRecipe m_Recipe;
+    QThreadPool m_Pool;
+    QMutex m_Mutex;
+    QWaitCondition m_SegmentDone;
+    QByteArray m_Pending;
+    QList<ChunkTask*> m_Tasks;
+    qint64 m_StoredBytes;
+    qint64 m_AddedBytes;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copytargetstream.h"
+#include "core/ioqueue.h"
+
+#include <QByteArray>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Constructs a stream to write to.
+    @param name the name of the stream, see IoQueue::openStream()
+    @param sectorsize the "sector size" of the stream, usually the sector size of the CopySourceDevice
+*/
+CopyTargetStream::CopyTargetStream(const QString& name, qint32 sectorsize) :
+    CopyTarget(),
+    m_Name(name),
+    m_SectorSize(sectorsize),
+    m_Fd(-1),
+    m_OwnsFd(false)
+{
+}
+
+CopyTargetStream::~CopyTargetStream()
+{
+    if (m_Fd != -1 && m_OwnsFd)
+        close(m_Fd);
+}
+
+/** Opens the stream for writing. Opening a FIFO waits until it is opened for reading.
+    @return true on success
+*/
+bool CopyTargetStream::open()
+{
+    m_Fd = IoQueue::openStream(name(), true, m_OwnsFd);
+
+    if (m_Fd == -1)
+        return false;
+
+    // Larger pipe buffers let the reader fall behind for longer without stalling the copy.
+    fcntl(m_Fd, F_SETPIPE_SZ, 1024 * 1024);
+
+    return true;
+}
+
+/** Writes the given sectors to the stream.
+    @param buffer the data to write
+    @param writeOffset where in the image to write, must not be before the sectors written so far;
+           sectors skipped are written as zeros
+    @param numSectors the number of sectors to write
+    @return true on success
+*/
+bool CopyTargetStream::writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors)
+{
+    if (writeOffset < sectorsWritten())
+        return false;
+
+    if (writeOffset > sectorsWritten()) {
+        static const QByteArray zeros(1024 * 1024, '\0');
+
+        for (qint64 left = (writeOffset - sectorsWritten()) * sectorSize(); left > 0; ) {
+            const qint64 n = qMin(left, static_cast<qint64>(zeros.size()));
+
+            if (!writeAll(zeros.constData(), n))
+                return false;
+
+            left -= n;
+        }
+
+        setSectorsWritten(writeOffset);
+    }
+
+    if (!writeAll(static_cast<const char*>(buffer), numSectors * sectorSize()))
+        return false;
+
+    setSectorsWritten(sectorsWritten() + numSectors);
+
+    return true;
+}
+
+/** Closes the stream so that the reader sees its end. Standard output is flushed only.
+    @return true on success
+*/
+bool CopyTargetStream::finish()
+{
+    if (m_Fd == -1)
+        return false;
+
+    if (!m_OwnsFd)
+        return true;
+
+    const bool rval = close(m_Fd) == 0;
+    m_Fd = -1;
+
+    return rval;
+}
+
+/** Writes all of the data, continuing after partial writes and signals.
+
+    A reader that goes away must fail the copy and not kill the process, so SIGPIPE is
+    blocked in the calling thread while writing and a pending one is taken back.
+*/
+bool CopyTargetStream::writeAll(const char* data, qint64 size)
+{
+    sigset_t pipeSignal;
+    sigset_t oldMask;
+
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &oldMask);
+
+    bool rval = true;
+
+    while (rval && size > 0) {
+        const ssize_t n = write(m_Fd, data, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && errno == EPIPE) {
+            const struct timespec noWait = { 0, 0 };
+            sigtimedwait(&pipeSignal, nullptr, &noWait);
+        }
+
+        if (n <= 0)
+            rval = false;
+        else {
+            data += n;
+            size -= n;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+    return rval;
+}
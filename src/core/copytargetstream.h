@@ -0,0 +1,81 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYTARGETSTREAM__H)
+
+#define COPYTARGETSTREAM__H
+
+#include "core/copytarget.h"
+
+#include <QString>
+#include <QtGlobal>
+
+/** A stream to copy to.
+
+    Writes an image to a file descriptor that cannot seek, so that a backup can be piped
+    into a compressor, an encryptor or an upload without being stored locally first. The
+    stream is given by name:
+
+    - "-" is standard output,
+    - "fd:N" is the inherited file descriptor N,
+    - the path of a FIFO is opened for writing,
+    - the path of a UNIX socket is connected to.
+
+    Sectors must be written front to back. Sectors skipped are written as zeros, so the
+    stream is always a complete raw image. Writes are passed on as they come, in blocks as
+    large as the copy uses.
+
+    @see CopySourceStream, CopyTargetFile, IoQueue::openStream
+*/
+class CopyTargetStream : public CopyTarget
+{
+    Q_DISABLE_COPY(CopyTargetStream)
+
+public:
+    CopyTargetStream(const QString& name, qint32 sectorsize);
+    ~CopyTargetStream();
+
+public:
+    bool open() override;
+    bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool finish() override;
+
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the stream's sector size */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return always 0 for a stream */
+    }
+    qint64 lastSector() const override {
+        return sectorsWritten();    /**< @return the number of sectors written so far */
+    }
+
+    const QString& name() const {
+        return m_Name;    /**< @return the name of the stream */
+    }
+
+protected:
+    bool writeAll(const char* data, qint64 size);
+
+private:
+    const QString m_Name;
+    const qint32 m_SectorSize;
+    int m_Fd;
+    bool m_OwnsFd;
+};
+
+#endif
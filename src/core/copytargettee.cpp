@@ -0,0 +1,264 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copytargettee.h"
+
+#include <QByteArray>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QThread>
+
+/** Writes the blocks queued for one target */
+class CopyTargetTeeWriter : public QThread
+{
+public:
+    struct Chunk {
+        QByteArray data;
+        qint64 writeOffset;
+        qint64 numSectors;
+    };
+
+    CopyTargetTeeWriter(CopyTargetTee& tee, CopyTarget& target) :
+        QThread(),
+        m_Tee(tee),
+        m_Target(target),
+        m_Queue(),
+        m_Failed(false)
+    {
+    }
+
+    void run() override {
+        QMutexLocker locker(&m_Tee.m_Mutex);
+
+        while (true) {
+            while (m_Queue.isEmpty() && !m_Tee.m_Stopping)
+                m_Tee.m_Queued.wait(&m_Tee.m_Mutex);
+
+            if (m_Queue.isEmpty())
+                break;
+
+            // the chunk stays queued while it is written so that it counts towards the queue depth
+            const Chunk chunk = m_Queue.head();
+
+            locker.unlock();
+            const bool rval = m_Target.writeSectors(const_cast<char*>(chunk.data.constData()), m_Target.firstSector() + chunk.writeOffset, chunk.numSectors);
+            locker.relock();
+
+            m_Queue.dequeue();
+
+            if (!rval) {
+                m_Failed = true;
+                m_Queue.clear();
+            }
+
+            m_Tee.m_Written.wakeAll();
+
+            if (m_Failed)
+                break;
+        }
+    }
+
+    CopyTargetTee& m_Tee;
+    CopyTarget& m_Target;
+    QQueue<Chunk> m_Queue;
+    bool m_Failed;
+};
+
+/** Constructs a target that copies to several targets at once.
+    @param queuedepth the number of blocks a target may fall behind the fastest one
+*/
+CopyTargetTee::CopyTargetTee(qint32 queuedepth) :
+    CopyTarget(),
+    m_Writers(),
+    m_QueueDepth(qMax(queuedepth, 1)),
+    m_Length(0),
+    m_Mutex(),
+    m_Queued(),
+    m_Written(),
+    m_Stopping(false)
+{
+}
+
+/** Destructs a CopyTargetTee, discarding what has not been written yet */
+CopyTargetTee::~CopyTargetTee()
+{
+    {
+        QMutexLocker locker(&m_Mutex);
+        for (const auto &writer : m_Writers)
+            writer->m_Queue.clear();
+    }
+
+    stop();
+    qDeleteAll(m_Writers);
+}
+
+/** Adds a target. Must be called before open().
+    @param target the opened CopyTarget to copy to as well
+*/
+void CopyTargetTee::addTarget(CopyTarget& target)
+{
+    Q_ASSERT(sectorsWritten() == 0);
+    m_Writers.append(new CopyTargetTeeWriter(*this, target));
+}
+
+/** Starts writing to the targets.
+    @return true if there is at least one target and all targets have the same sector size
+*/
+bool CopyTargetTee::open()
+{
+    if (m_Writers.isEmpty())
+        return false;
+
+    m_Length = m_Writers.first()->m_Target.lastSector() - m_Writers.first()->m_Target.firstSector() + 1;
+
+    for (const auto &writer : m_Writers) {
+        if (writer->m_Target.sectorSize() != sectorSize())
+            return false;
+
+        m_Length = qMin(m_Length, writer->m_Target.lastSector() - writer->m_Target.firstSector() + 1);
+    }
+
+    for (const auto &writer : m_Writers)
+        writer->start();
+
+    return true;
+}
+
+/** @return the sector size of the targets */
+qint32 CopyTargetTee::sectorSize() const
+{
+    return m_Writers.isEmpty() ? 0 : m_Writers.first()->m_Target.sectorSize();
+}
+
+/** @return the largest alignment any of the targets wants */
+qint32 CopyTargetTee::alignment() const
+{
+    qint32 rval = sectorSize();
+
+    for (const auto &writer : m_Writers)
+        rval = qMax(rval, writer->m_Target.alignment());
+
+    return rval;
+}
+
+/** @return true if all targets are opened exclusively */
+bool CopyTargetTee::isExclusive() const
+{
+    for (const auto &writer : m_Writers)
+        if (!writer->m_Target.isExclusive())
+            return false;
+
+    return true;
+}
+
+/** Queues the given sectors for all targets that have not failed.
+
+    Waits until every target has room in its queue. The data is copied, so @p buffer may be
+    reused as soon as this returns.
+
+    @param buffer the data to write
+    @param writeOffset where to start writing, relative to each target's first sector
+    @param numSectors the number of sectors in @p buffer
+    @return false if all targets have failed
+*/
+bool CopyTargetTee::writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors)
+{
+    const CopyTargetTeeWriter::Chunk chunk = { QByteArray(static_cast<const char*>(buffer), numSectors * sectorSize()), writeOffset, numSectors };
+
+    QMutexLocker locker(&m_Mutex);
+
+    while (true) {
+        bool full = false;
+
+        for (const auto &writer : m_Writers)
+            if (!writer->m_Failed && writer->m_Queue.size() >= m_QueueDepth)
+                full = true;
+
+        if (!full)
+            break;
+
+        m_Written.wait(&m_Mutex);
+    }
+
+    bool rval = false;
+
+    for (const auto &writer : m_Writers)
+        if (!writer->m_Failed) {
+            writer->m_Queue.enqueue(chunk);
+            rval = true;
+        }
+
+    if (rval) {
+        m_Queued.wakeAll();
+        setSectorsWritten(sectorsWritten() + numSectors);
+    }
+
+    return rval;
+}
+
+/** Waits until everything queued has been written and completes the targets.
+    @return true if at least one target has been completed
+*/
+bool CopyTargetTee::finish()
+{
+    stop();
+
+    bool rval = false;
+
+    for (const auto &writer : m_Writers) {
+        if (!writer->m_Failed && !writer->m_Target.finish())
+            writer->m_Failed = true;
+
+        rval = rval || !writer->m_Failed;
+    }
+
+    return rval;
+}
+
+/** Lets the writers write what is queued and waits for them to exit */
+void CopyTargetTee::stop()
+{
+    {
+        QMutexLocker locker(&m_Mutex);
+        m_Stopping = true;
+        m_Queued.wakeAll();
+    }
+
+    for (const auto &writer : m_Writers)
+        writer->wait();
+}
+
+/** @param i the number of the target, in the order they were added
+    @return true if writing to the target has failed and it has been dropped
+*/
+bool CopyTargetTee::isFailed(qint32 i) const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Writers[i]->m_Failed;
+}
+
+/** @return the number of targets that have failed */
+qint32 CopyTargetTee::numFailed() const
+{
+    qint32 rval = 0;
+
+    for (qint32 i = 0; i < numTargets(); i++)
+        if (isFailed(i))
+            rval++;
+
+    return rval;
+}
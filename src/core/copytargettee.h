@@ -0,0 +1,89 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYTARGETTEE__H)
+
+#define COPYTARGETTEE__H
+
+#include "core/copytarget.h"
+
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+class CopyTargetTeeWriter;
+
+/** Several targets to copy to at once.
+
+    Writes everything written to it to all of its CopyTargets, so a CopySource only needs to
+    be read once to copy it to many targets. Each target is written on a thread of its own,
+    from a queue of at most a few blocks: A target that falls behind stops the others once its
+    queue is full. A target that fails is dropped, the others go on.
+
+    All targets must have the same sector size. Sectors are numbered from zero and are
+    written to each target relative to its first sector.
+
+    @see CopyTarget
+*/
+class CopyTargetTee : public CopyTarget
+{
+    Q_DISABLE_COPY(CopyTargetTee)
+
+    friend class CopyTargetTeeWriter;
+
+public:
+    explicit CopyTargetTee(qint32 queuedepth = 4);
+    ~CopyTargetTee();
+
+public:
+    void addTarget(CopyTarget& target);
+
+    bool open() override;
+    bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool finish() override;
+
+    qint32 sectorSize() const override;
+    qint32 alignment() const override;
+    bool isExclusive() const override;
+    qint64 firstSector() const override {
+        return 0;    /**< @return always 0, sectors are relative to each target's first sector */
+    }
+    qint64 lastSector() const override {
+        return m_Length - 1;    /**< @return the last sector all targets can be written to */
+    }
+
+    qint32 numTargets() const {
+        return m_Writers.size();    /**< @return the number of targets */
+    }
+    bool isFailed(qint32 i) const;
+    qint32 numFailed() const;
+
+protected:
+    void stop();
+
+private:
+    QList<CopyTargetTeeWriter*> m_Writers;
+    qint32 m_QueueDepth;
+    qint64 m_Length;
+    mutable QMutex m_Mutex;
+    QWaitCondition m_Queued;
+    QWaitCondition m_Written;
+    bool m_Stopping;
+};
+
+#endif
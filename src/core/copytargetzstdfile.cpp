@@ -0,0 +1,196 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copytargetzstdfile.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QString>
+#include <QThread>
+
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+/** Compresses one frame on the thread pool */
+class ZstdCompressTask : public QRunnable
+{
+public:
+    ZstdCompressTask(const QByteArray& input, QMutex& mutex, QWaitCondition& done) :
+        m_Input(input),
+        m_Output(),
+        m_Size(input.size()),
+        m_Mutex(mutex),
+        m_Done(done),
+        m_Finished(false),
+        m_Failed(false)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+#if defined(HAVE_ZSTD)
+        m_Output.resize(ZSTD_compressBound(m_Input.size()));
+        const size_t n = ZSTD_compress(m_Output.data(), m_Output.size(), m_Input.constData(), m_Input.size(), ZSTD_CLEVEL_DEFAULT);
+
+        m_Failed = ZSTD_isError(n);
+        if (!m_Failed)
+            m_Output.resize(n);
+#else
+        m_Failed = true;
+#endif
+        m_Input = QByteArray();
+
+        QMutexLocker locker(&m_Mutex);
+        m_Finished = true;
+        m_Done.wakeAll();
+    }
+
+    QByteArray m_Input;
+    QByteArray m_Output;
+    quint32 m_Size;
+    QMutex& m_Mutex;
+    QWaitCondition& m_Done;
+    bool m_Finished;
+    bool m_Failed;
+};
+
+/** Constructs a compressed image file to write to.
+    @param filename name of the file to write to
+    @param sectorsize the "sector size" of the file to write to, usually the sector size of the CopySourceDevice
+*/
+CopyTargetZstdFile::CopyTargetZstdFile(const QString& filename, qint32 sectorsize) :
+    CopyTarget(),
+    m_File(filename),
+    m_SectorSize(sectorsize),
+    m_Pool(),
+    m_Mutex(),
+    m_FrameDone(),
+    m_Pending(),
+    m_Tasks(),
+    m_Frames(),
+    m_Offset(0),
+    m_Position(0)
+{
+    m_Pool.setMaxThreadCount(qMax(QThread::idealThreadCount(), 1));
+}
+
+CopyTargetZstdFile::~CopyTargetZstdFile()
+{
+    m_Pool.waitForDone();
+    qDeleteAll(m_Tasks);
+}
+
+/** Opens the file for writing.
+    @return true on success
+*/
+bool CopyTargetZstdFile::open()
+{
+    return ZstdImage::isSupported() && file().open(QIODevice::WriteOnly | QIODevice::Truncate);
+}
+
+/** Adds the given sectors to the image. They are compressed and written in the background.
+    @param buffer the data to write
+    @param writeOffset where in the image to write, must follow the sectors written before
+    @param numSectors the number of sectors to write
+    @return true on success
+*/
+bool CopyTargetZstdFile::writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors)
+{
+    if (writeOffset != sectorsWritten())
+        return false;
+
+    const char* data = static_cast<const char*>(buffer);
+    qint64 left = numSectors * sectorSize();
+
+    while (left > 0) {
+        const qint64 n = qMin(left, static_cast<qint64>(ZstdImage::frameSize() - m_Pending.size()));
+
+        m_Pending.append(data, n);
+        data += n;
+        left -= n;
+
+        if (static_cast<quint32>(m_Pending.size()) == ZstdImage::frameSize() && !queueFrame())
+            return false;
+    }
+
+    setSectorsWritten(sectorsWritten() + numSectors);
+
+    return true;
+}
+
+/** Compresses the remaining data, waits for all frames to be written and appends the seek table.
+    @return true on success
+*/
+bool CopyTargetZstdFile::finish()
+{
+    if (!m_Pending.isEmpty() && !queueFrame())
+        return false;
+
+    while (!m_Tasks.isEmpty())
+        if (!writeFrame())
+            return false;
+
+    const QByteArray table = ZstdImage::seekTable(m_Frames);
+
+    return file().write(table) == table.size() && file().flush();
+}
+
+/** Hands the pending frame to the thread pool. */
+bool CopyTargetZstdFile::queueFrame()
+{
+    // a few frames more than there are threads keep all of them busy
+    while (m_Tasks.size() >= m_Pool.maxThreadCount() + 2)
+        if (!writeFrame())
+            return false;
+
+    ZstdCompressTask* task = new ZstdCompressTask(m_Pending, m_Mutex, m_FrameDone);
+    m_Pending = QByteArray();
+
+    m_Tasks.append(task);
+    m_Pool.start(task);
+
+    return true;
+}
+
+/** Waits for the oldest frame to be compressed and writes it to the file. */
+bool CopyTargetZstdFile::writeFrame()
+{
+    ZstdCompressTask* task = m_Tasks.first();
+
+    {
+        QMutexLocker locker(&m_Mutex);
+
+        while (!task->m_Finished)
+            m_FrameDone.wait(&m_Mutex);
+    }
+
+    m_Tasks.removeFirst();
+
+    const bool rval = !task->m_Failed && file().write(task->m_Output) == task->m_Output.size();
+
+    if (rval) {
+        ZstdImage::Frame frame = { m_Offset, m_Position, static_cast<quint32>(task->m_Output.size()), task->m_Size };
+        m_Frames.append(frame);
+        m_Offset += frame.compressedSize;
+        m_Position += frame.size;
+    }
+
+    delete task;
+
+    return rval;
+}
@@ -0,0 +1,88 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYTARGETZSTDFILE__H)
+
+#define COPYTARGETZSTDFILE__H
+
+#include "core/copytarget.h"
+#include "core/zstdimage.h"
+
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+class QString;
+class ZstdCompressTask;
+
+/** A compressed image file to copy to.
+
+    Writes a compressed backup image in the format described in ZstdImage. Frames are
+    compressed in parallel on a thread pool and written to the file in order. Sectors must
+    be written front to back.
+
+    @see CopySourceZstdFile, CopyTargetFile
+*/
+class CopyTargetZstdFile : public CopyTarget
+{
+    Q_DISABLE_COPY(CopyTargetZstdFile)
+
+public:
+    CopyTargetZstdFile(const QString& filename, qint32 sectorsize);
+    ~CopyTargetZstdFile();
+
+public:
+    bool open() override;
+    bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool finish() override;
+
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the file's sector size */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return always 0 for a file */
+    }
+    qint64 lastSector() const override {
+        return sectorsWritten();    /**< @return the number of sectors written so far */
+    }
+
+protected:
+    bool queueFrame();
+    bool writeFrame();
+
+    QFile& file() {
+        return m_File;
+    }
+
+private:
+    QFile m_File;
+    qint32 m_SectorSize;
+    QThreadPool m_Pool;
+    QMutex m_Mutex;
+    QWaitCondition m_FrameDone;
+    QByteArray m_Pending;
+    QList<ZstdCompressTask*> m_Tasks;
+    QVector<ZstdImage::Frame> m_Frames;
+    qint64 m_Offset;
+    qint64 m_Position;
+};
+
+#endif
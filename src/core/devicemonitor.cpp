@@ -0,0 +1,589 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/devicemonitor.h"
+
+#include "backend/corebackend.h"
+#include "backend/corebackendmanager.h"
+
+#include "core/device.h"
+#include "core/devicescanner.h"
+#include "core/lvmdevice.h"
+#include "core/operationstack.h"
+#include "core/partition.h"
+#include "core/partitiontable.h"
+
+#include "fs/filesystem.h"
+#include "fs/luks.h"
+
+#include "util/helpers.h"
+#include "util/topologysnapshot.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QReadLocker>
+#include <QSocketNotifier>
+#include <QWriteLocker>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+// uevents carry at most a few KiB of properties
+static const qint32 ueventBufferSize = 8192;
+
+// device stacks deeper than this (LUKS on LVM on RAID on ...) are not followed further down
+static const qint32 maxStackDepth = 8;
+
+/** Reads the first line of a sysfs attribute. */
+static QString readSysfs(const QString& name, const QString& attribute)
+{
+    QFile file(QStringLiteral("/sys/class/block/%1/%2").arg(QString(name).replace(QLatin1Char('/'), QLatin1Char('!')), attribute));
+
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    return QString::fromLatin1(file.readLine()).trimmed();
+}
+
+/** Describes everything a scan finds out about the Partitions below a node, so that two
+    scans of the same disk can be compared. */
+static QString describe(const PartitionNode* node)
+{
+    QString result;
+
+    if (node == nullptr)
+        return result;
+
+    for (const auto &p : node->children()) {
+        const FileSystem& fs = p->fileSystem();
+        result += QStringLiteral("%1:%2:%3:%4:%5:%6:%7:%8:%9:")
+                  .arg(p->firstSector()).arg(p->lastSector()).arg(fs.type()).arg(p->mountPoint())
+                  .arg(p->isMounted()).arg(fs.label()).arg(fs.uuid()).arg(fs.sectorsUsed())
+                  .arg(static_cast<int>(p->activeFlags()));
+        result += p->label() + QLatin1Char(':') + p->uuid();
+        result += QLatin1Char('{') + describe(p) + QStringLiteral("};");
+    }
+
+    return result;
+}
+
+/** Describes a Device with its partition table and Partitions. */
+static QString describe(const Device* d)
+{
+    if (d == nullptr)
+        return QString();
+
+    return QStringLiteral("%1:%2:%3:%4:").arg(d->name()).arg(d->logicalSize()).arg(d->totalLogical())
+           .arg(d->partitionTable() ? d->partitionTable()->typeName() : QString()) + describe(d->partitionTable());
+}
+
+/** @return true if a Partition below @p node is an LVM physical volume */
+static bool hasPhysicalVolumes(const PartitionNode* node)
+{
+    if (node == nullptr)
+        return false;
+
+    for (const auto &p : node->children())
+        if (p->fileSystem().type() == FileSystem::Lvm2_PV || p->roles().has(PartitionRole::Luks) || hasPhysicalVolumes(p))
+            return true;
+
+    return false;
+}
+
+/** Creates a new DeviceMonitor. Call start() to begin monitoring.
+    @param parent the parent object
+    @param ostack the OperationStack whose Devices are kept up to date
+*/
+DeviceMonitor::DeviceMonitor(QObject* parent, OperationStack& ostack) :
+    QObject(parent),
+    m_OperationStack(ostack),
+    m_UeventFd(-1),
+    m_MountFd(-1),
+    m_UeventNotifier(nullptr),
+    m_MountNotifier(nullptr),
+    m_CheckMounts(false),
+    m_AllPending(false),
+    m_LvmPending(false)
+{
+    m_SettleTimer.setSingleShot(true);
+    m_SettleTimer.setInterval(settleTime());
+
+    connect(&m_SettleTimer, &QTimer::timeout, this, &DeviceMonitor::applyPending);
+
+    // held back changes are applied once the user has applied or undone all operations
+    connect(&operationStack(), &OperationStack::operationsChanged, this, [this] {
+        if (operationStack().size() == 0 && (m_AllPending || m_CheckMounts || m_LvmPending || !m_Pending.isEmpty()))
+            m_SettleTimer.start();
+    });
+}
+
+DeviceMonitor::~DeviceMonitor()
+{
+    stop();
+}
+
+/** Subscribes to the kernel's uevents and starts watching the mount table.
+    @return true on success; false if the netlink socket could not be set up
+*/
+bool DeviceMonitor::start()
+{
+    if (isRunning())
+        return true;
+
+    m_UeventFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+
+    if (m_UeventFd < 0)
+        return false;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; // the kernel's own events, not those udev forwards after processing
+
+    if (bind(m_UeventFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        stop();
+        return false;
+    }
+
+    // a disk with many partitions coming and going sends a burst of events; losing some
+    // only costs a full rescan, but a larger buffer avoids that
+    const int bufferSize = 1024 * 1024;
+    if (setsockopt(m_UeventFd, SOL_SOCKET, SO_RCVBUFFORCE, &bufferSize, sizeof(bufferSize)) != 0)
+        setsockopt(m_UeventFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    m_UeventNotifier = new QSocketNotifier(m_UeventFd, QSocketNotifier::Read, this);
+    connect(m_UeventNotifier, &QSocketNotifier::activated, this, &DeviceMonitor::readUevents);
+
+    // the kernel flags the mount table with POLLPRI whenever something is mounted or unmounted
+    m_MountFd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+
+    if (m_MountFd >= 0) {
+        readMountChange();
+        m_CheckMounts = false;
+        m_SettleTimer.stop();
+
+        m_MountNotifier = new QSocketNotifier(m_MountFd, QSocketNotifier::Exception, this);
+        connect(m_MountNotifier, &QSocketNotifier::activated, this, &DeviceMonitor::readMountChange);
+    }
+
+    return true;
+}
+
+/** Stops monitoring. Changes not yet applied are dropped. */
+void DeviceMonitor::stop()
+{
+    m_SettleTimer.stop();
+
+    delete m_UeventNotifier;
+    m_UeventNotifier = nullptr;
+
+    delete m_MountNotifier;
+    m_MountNotifier = nullptr;
+
+    if (m_UeventFd >= 0)
+        close(m_UeventFd);
+    m_UeventFd = -1;
+
+    if (m_MountFd >= 0)
+        close(m_MountFd);
+    m_MountFd = -1;
+
+    m_Pending.clear();
+    m_CheckMounts = false;
+    m_AllPending = false;
+    m_LvmPending = false;
+}
+
+/** Reads all uevents the kernel has queued. */
+void DeviceMonitor::readUevents()
+{
+    QByteArray buffer(ueventBufferSize, 0);
+
+    while (true) {
+        struct sockaddr_nl sender;
+        socklen_t senderLength = sizeof(sender);
+
+        const ssize_t n = recvfrom(m_UeventFd, buffer.data(), buffer.size(), 0, reinterpret_cast<struct sockaddr*>(&sender), &senderLength);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            // the socket buffer overflowed and events were lost
+            if (errno == ENOBUFS)
+                queueAll();
+
+            break;
+        }
+
+        // only the kernel itself is trusted to describe devices
+        if (senderLength != sizeof(sender) || sender.nl_pid != 0)
+            continue;
+
+        handleUevent(QByteArray(buffer.constData(), static_cast<int>(n)));
+    }
+}
+
+/** Queues the disks a uevent is about.
+
+    A uevent is a header "action@devpath" followed by KEY=VALUE pairs, all terminated by
+    null bytes.
+
+    @param message the uevent
+*/
+void DeviceMonitor::handleUevent(const QByteArray& message)
+{
+    const QList<QByteArray> fields = message.split('\0');
+
+    QString subsystem;
+    QString devType;
+    QString devName;
+    QString devPath;
+    quint32 major = 0;
+
+    for (const QByteArray& field : fields) {
+        if (field.startsWith("SUBSYSTEM="))
+            subsystem = QString::fromLatin1(field.mid(10));
+        else if (field.startsWith("DEVTYPE="))
+            devType = QString::fromLatin1(field.mid(8));
+        else if (field.startsWith("DEVNAME="))
+            devName = QString::fromLocal8Bit(field.mid(8));
+        else if (field.startsWith("DEVPATH="))
+            devPath = QString::fromLocal8Bit(field.mid(8));
+        else if (field.startsWith("MAJOR="))
+            major = field.mid(6).toUInt();
+    }
+
+    if (subsystem != QStringLiteral("block") || devName.isEmpty())
+        return;
+
+    if (devType == QStringLiteral("partition")) {
+        // the parent directory of a partition in sysfs is its disk
+        const QString disk = devPath.section(QLatin1Char('/'), -2, -2).replace(QLatin1Char('!'), QLatin1Char('/'));
+        queue({ QStringLiteral("/dev/") + disk });
+    } else if (devType == QStringLiteral("disk")) {
+        const QStringList disks = disksFor(devName);
+
+        // a loop device, RAM disk or CD-ROM is not one of the Devices a scan lists
+        if (disks == QStringList(QStringLiteral("/dev/") + devName) && !TopologySnapshot::isScannableMajor(major))
+            return;
+
+        // a removed device mapper device no longer tells what it was stacked on
+        if (disks.isEmpty())
+            queueAll();
+        else
+            queue(disks);
+    }
+}
+
+/** Finds the disks a block device ultimately lives on.
+    @param name the kernel name of a disk, a partition or a stacked device like dm-0
+    @param depth how deep in a device stack this call is
+    @return the device nodes of the disks; for a plain disk that is the disk itself
+*/
+QStringList DeviceMonitor::disksFor(const QString& name, qint32 depth) const
+{
+    const QString sysfsName = QString(name).replace(QLatin1Char('/'), QLatin1Char('!'));
+    const QStringList slaves = QDir(QStringLiteral("/sys/class/block/%1/slaves").arg(sysfsName)).entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+
+    QStringList result;
+
+    if (slaves.isEmpty()) {
+        if (QFile::exists(QStringLiteral("/sys/class/block/%1/partition").arg(sysfsName)))
+            result.append(QStringLiteral("/dev/") + QFileInfo(QFileInfo(QStringLiteral("/sys/class/block/%1").arg(sysfsName)).canonicalFilePath()).dir().dirName().replace(QLatin1Char('!'), QLatin1Char('/')));
+        else if (!readSysfs(name, QStringLiteral("dm/name")).isEmpty() || name.startsWith(QStringLiteral("md")))
+            return result; // a stacked device that is being torn down
+        else
+            result.append(QStringLiteral("/dev/") + name);
+    } else if (depth < maxStackDepth) {
+        for (const QString& slave : slaves)
+            result.append(disksFor(slave, depth + 1));
+    }
+
+    return result;
+}
+
+/** Notes that something was mounted or unmounted. */
+void DeviceMonitor::readMountChange()
+{
+    // reading the table to its end re-arms the notification
+    char buffer[4096];
+    lseek(m_MountFd, 0, SEEK_SET);
+    while (read(m_MountFd, buffer, sizeof(buffer)) > 0)
+        ;
+
+    m_CheckMounts = true;
+    m_SettleTimer.start();
+}
+
+/** Queues disks for rescanning once the events have settled.
+    @param disks the device nodes of the disks
+*/
+void DeviceMonitor::queue(const QStringList& disks)
+{
+    for (const QString& disk : disks)
+        m_Pending.insert(disk);
+
+    m_SettleTimer.start();
+}
+
+/** Queues every disk, for when events were lost. */
+void DeviceMonitor::queueAll()
+{
+    m_AllPending = true;
+    m_SettleTimer.start();
+}
+
+/** Rescans the queued disks once the events have settled. */
+void DeviceMonitor::applyPending()
+{
+    // only a hint: the OperationStack checks again under its lock before it swaps a Device
+    if (operationStack().size() > 0)
+        return;
+
+    // one snapshot answers the mount check and the lookups of every rescanned partition
+    TopologySnapshot::Scope topologyScope;
+
+    if (m_AllPending) {
+        const QSharedPointer<const TopologySnapshot> topology = TopologySnapshot::current();
+
+        {
+            QReadLocker lockDevices(&operationStack().lock());
+            for (const auto &d : operationStack().previewDevices())
+                if (d->type() == Device::Disk_Device)
+                    m_Pending.insert(d->deviceNode());
+        }
+
+        for (const auto &d : topology->scannableDisks(false))
+            if (d->slaves.isEmpty())
+                m_Pending.insert(d->deviceNode());
+
+        m_AllPending = false;
+        m_CheckMounts = false;
+    }
+
+    if (m_CheckMounts) {
+        checkMounts();
+        m_CheckMounts = false;
+    }
+
+    bool lvmChanged = m_LvmPending;
+    bool changed = false;
+    bool deferred = false;
+
+    QStringList disks = m_Pending.toList();
+    std::sort(disks.begin(), disks.end());
+    m_Pending.clear();
+
+    for (const QString& disk : disks) {
+        // once the OperationStack refuses a change, the remaining disks wait with it
+        if (deferred || !rescanDisk(disk, lvmChanged, changed)) {
+            m_Pending.insert(disk);
+            deferred = true;
+        }
+    }
+
+    m_LvmPending = lvmChanged;
+
+    if (!deferred && lvmChanged && rescanLvm(changed))
+        m_LvmPending = false;
+
+    if (changed) {
+        {
+            QWriteLocker lockDevices(&operationStack().lock());
+            DeviceScanner::updatePhysicalVolumes(operationStack().previewDevices());
+        }
+
+        // the signals about the change have been emitted, so the old Devices can go once
+        // the OperationStack's thread has delivered them
+        QMetaObject::invokeMethod(&operationStack(), "deleteRetiredDevices", Qt::QueuedConnection);
+    }
+}
+
+/** Queues the disks with Partitions whose mount state no longer matches the system's. */
+void DeviceMonitor::checkMounts()
+{
+    QReadLocker lockDevices(&operationStack().lock());
+
+    for (const auto &d : operationStack().previewDevices()) {
+        if (d->type() != Device::Disk_Device || d->partitionTable() == nullptr)
+            continue;
+
+        QList<const Partition*> partitions;
+        for (const auto &p : d->partitionTable()->children()) {
+            partitions.append(p);
+            for (const auto &child : p->children())
+                partitions.append(child);
+        }
+
+        for (const auto &p : partitions) {
+            // the mount point of a physical volume is its volume group, which mounting does not change
+            if (p->fileSystem().type() == FileSystem::Lvm2_PV || p->roles().has(PartitionRole::Unallocated))
+                continue;
+
+            QString node = p->deviceNode();
+            if (p->roles().has(PartitionRole::Luks))
+                node = static_cast<const FS::luks*>(&p->fileSystem())->mapperName();
+
+            // a LUKS container opened or closed elsewhere also shows up here as a changed mapper node
+            if (p->roles().has(PartitionRole::Luks) && TopologySnapshot::current()->mapperNode(p->deviceNode()) != node) {
+                m_Pending.insert(d->deviceNode());
+                break;
+            }
+
+            if (node.isEmpty())
+                continue;
+
+            if (isMounted(node) != p->isMounted() || (p->isMounted() && TopologySnapshot::current()->mountPoint(node) != p->mountPoint())) {
+                m_Pending.insert(d->deviceNode());
+                break;
+            }
+        }
+    }
+}
+
+/** Rescans a disk and puts the result into the OperationStack if it differs.
+    @param deviceNode the disk's device node
+    @param lvmChanged set to true if the disk has or had LVM physical volumes (or LUKS
+           containers that may hold them) and changed, so that the volume groups must be
+           rescanned as well
+    @param changed set to true if the OperationStack was changed
+    @return false if the OperationStack refused the change because Operations are pending
+*/
+bool DeviceMonitor::rescanDisk(const QString& deviceNode, bool& lvmChanged, bool& changed)
+{
+    Device* oldDevice = nullptr;
+
+    {
+        QReadLocker lockDevices(&operationStack().lock());
+        for (const auto &d : operationStack().previewDevices())
+            if (d->type() == Device::Disk_Device && d->deviceNode() == deviceNode)
+                oldDevice = d;
+    }
+
+    // an empty card reader has a size of zero; stacked devices are not disks, and loop
+    // devices, RAM disks and the like are left out just like a full scan leaves them out
+    const QString name = deviceNode.mid(5);
+    const bool present = readSysfs(name, QStringLiteral("size")).toLongLong() > 0 &&
+            TopologySnapshot::current()->isScannableDisk(deviceNode, false) &&
+            QDir(QStringLiteral("/sys/class/block/%1/slaves").arg(QString(name).replace(QLatin1Char('/'), QLatin1Char('!')))).entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot).isEmpty();
+
+    Device* newDevice = present ? CoreBackendManager::self()->backend()->scanDevice(deviceNode) : nullptr;
+
+    if (oldDevice == nullptr && newDevice == nullptr)
+        return true;
+
+    if (oldDevice && newDevice && describe(oldDevice) == describe(newDevice)) {
+        delete newDevice;
+        return true;
+    }
+
+    const bool lvm = (oldDevice && hasPhysicalVolumes(oldDevice->partitionTable())) ||
+                     (newDevice && hasPhysicalVolumes(newDevice->partitionTable()));
+
+    if (oldDevice == nullptr) {
+        if (!operationStack().insertDevice(newDevice)) {
+            delete newDevice;
+            return false;
+        }
+
+        emit deviceAdded(newDevice);
+    } else if (newDevice == nullptr) {
+        if (!operationStack().removeDevice(oldDevice))
+            return false;
+
+        emit deviceRemoved(deviceNode);
+    } else {
+        if (!operationStack().replaceDevice(oldDevice, newDevice)) {
+            delete newDevice;
+            return false;
+        }
+
+        emit deviceChanged(newDevice);
+    }
+
+    lvmChanged = lvmChanged || lvm;
+    changed = true;
+
+    return true;
+}
+
+/** Rescans the LVM volume groups and updates those in the OperationStack.
+    @param changed set to true if the OperationStack was changed
+    @return false if the OperationStack refused a change because Operations are pending
+*/
+bool DeviceMonitor::rescanLvm(bool& changed)
+{
+    QList<LvmDevice*> lvmList = LvmDevice::scanSystemLVM();
+    QList<Device*> oldList;
+
+    {
+        QReadLocker lockDevices(&operationStack().lock());
+        for (const auto &d : operationStack().previewDevices())
+            if (d->type() == Device::LVM_Device)
+                oldList.append(d);
+    }
+
+    bool rval = true;
+
+    for (const auto &oldDevice : oldList) {
+        LvmDevice* newDevice = nullptr;
+        for (const auto &d : lvmList)
+            if (d->deviceNode() == oldDevice->deviceNode())
+                newDevice = d;
+
+        if (newDevice == nullptr) {
+            const QString deviceNode = oldDevice->deviceNode();
+
+            if (rval && operationStack().removeDevice(oldDevice)) {
+                changed = true;
+                emit deviceRemoved(deviceNode);
+            } else {
+                rval = false;
+            }
+
+            continue;
+        }
+
+        lvmList.removeOne(newDevice);
+
+        if (describe(oldDevice) == describe(newDevice)) {
+            delete newDevice;
+        } else if (rval && operationStack().replaceDevice(oldDevice, newDevice)) {
+            changed = true;
+            emit deviceChanged(newDevice);
+        } else {
+            delete newDevice;
+            rval = false;
+        }
+    }
+
+    for (const auto &d : lvmList) {
+        operationStack().addDevice(d);
+        changed = true;
+        emit deviceAdded(d);
+    }
+
+    return rval;
+}
@@ -0,0 +1,108 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(DEVICEMONITOR__H)
+
+#define DEVICEMONITOR__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+class Device;
+class OperationStack;
+class QSocketNotifier;
+
+/** Keeps the Devices of an OperationStack up to date as the system changes.
+
+    DeviceScanner builds the list of Devices from scratch. DeviceMonitor subscribes to the
+    kernel's block device uevents and watches /proc/self/mountinfo, and rescans only the
+    disks an event was about: a disk that was plugged in or removed, a partition that was
+    added, removed or resized, a device mapper device that was set up on top of a
+    partition, or a file system that was mounted or unmounted.
+
+    Events are collected for settleTime() milliseconds so that the burst a partition
+    table change causes leads to one rescan per disk. A rescanned Device that does not
+    differ from the one in the OperationStack is discarded; otherwise it replaces the old
+    one and deviceChanged() is emitted. The old Device is deleted in the OperationStack's
+    thread after the signals have been delivered there, so views can let go of it first.
+    LVM volume groups are rescanned when a disk with physical volumes on it changes.
+
+    While the OperationStack holds Operations, their previews must not be swapped away, so
+    changes are held back until the stack is empty again. The OperationStack checks this
+    under its lock, so an Operation pushed while a rescan runs defers the rest of it.
+
+    The monitor does its rescans in the thread it lives in. Move it to a worker thread
+    before calling start() if scanning must not block that thread.
+
+    @see DeviceScanner
+*/
+class LIBKPMCORE_EXPORT DeviceMonitor : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(DeviceMonitor)
+
+public:
+    DeviceMonitor(QObject* parent, OperationStack& ostack);
+    ~DeviceMonitor();
+
+public:
+    bool start();
+    void stop();
+    bool isRunning() const { return m_UeventFd >= 0; } /**< @return true if the monitor receives events */
+
+    static qint32 settleTime() { return 100; } /**< @return how long events are collected before rescanning, in milliseconds */
+
+Q_SIGNALS:
+    void deviceAdded(Device* d);
+    void deviceChanged(Device* d);
+    void deviceRemoved(const QString& deviceNode);
+
+protected:
+    void readUevents();
+    void readMountChange();
+    void handleUevent(const QByteArray& message);
+    void queue(const QStringList& disks);
+    void queueAll();
+    void applyPending();
+    void checkMounts();
+    bool rescanDisk(const QString& deviceNode, bool& lvmChanged, bool& changed);
+    bool rescanLvm(bool& changed);
+
+    QStringList disksFor(const QString& name, qint32 depth = 0) const;
+
+    OperationStack& operationStack() { return m_OperationStack; }
+    const OperationStack& operationStack() const { return m_OperationStack; }
+
+private:
+    OperationStack& m_OperationStack;
+    int m_UeventFd;
+    int m_MountFd;
+    QSocketNotifier* m_UeventNotifier;
+    QSocketNotifier* m_MountNotifier;
+    QTimer m_SettleTimer;
+    QSet<QString> m_Pending;
+    bool m_CheckMounts;
+    bool m_AllPending;
+    bool m_LvmPending;
+};
+
+#endif
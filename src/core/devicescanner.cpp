@@ -29,6 +29,7 @@
 #include "fs/lvm2_pv.h"
 
 #include "util/externalcommand.h"
+#include "util/topologysnapshot.h"
 
 #include <QRegularExpression>
 
@@ -64,24 +65,48 @@ void DeviceScanner::scan()
 
     clear();
 
+    // the backend and the LVM scan below share one view of mounts, holders and disks
+    TopologySnapshot::Scope topologyScope;
+
     const QList<Device*> deviceList = CoreBackendManager::self()->backend()->scanDevices();
     const QList<LvmDevice*> lvmList = LvmDevice::scanSystemLVM();
-    LVM::pvList = FS::lvm2_pv::getPVs(deviceList);
 
     for (const auto &d : deviceList)
         operationStack().addDevice(d);
 
     operationStack().sortDevices();
 
-    for (const auto &d : lvmList) {
+    for (const auto &d : lvmList)
         operationStack().addDevice(d);
-        LVM::pvList.append(FS::lvm2_pv::getPVinNode(d->partitionTable()));
+
+    updatePhysicalVolumes(operationStack().previewDevices());
+}
+
+/** Rebuilds LVM::pvList and the physical volumes of every LvmDevice.
+    @param devices all Devices, disks as well as volume groups
+*/
+void DeviceScanner::updatePhysicalVolumes(const QList<Device*>& devices)
+{
+    QList<Device*> disks;
+    QList<LvmDevice*> lvmList;
+
+    for (const auto &d : devices) {
+        if (d->type() == Device::LVM_Device)
+            lvmList.append(static_cast<LvmDevice*>(d));
+        else
+            disks.append(d);
     }
 
-    // Store list of physical volumes in LvmDevice
+    LVM::pvList = FS::lvm2_pv::getPVs(disks);
+
     for (const auto &d : lvmList)
+        LVM::pvList.append(FS::lvm2_pv::getPVinNode(d->partitionTable()));
+
+    // Store list of physical volumes in LvmDevice
+    for (const auto &d : lvmList) {
+        d->physicalVolumes().clear();
         for (const auto &p : LVM::pvList) // FIXME: qAsConst
             if (p.vgName() == d->name())
                 d->physicalVolumes().append(p.partition());
+    }
 }
-
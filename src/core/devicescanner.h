@@ -22,6 +22,7 @@
 
 #include <QThread>
 
+class Device;
 class OperationStack;
 
 /** Thread to scan for all available Devices on this computer.
@@ -42,6 +43,8 @@ public:
     void scan(); /**< do the actual scanning; blocks if called directly */
     void setupConnections();
 
+    static void updatePhysicalVolumes(const QList<Device*>& devices);
+
 Q_SIGNALS:
     void progress(const QString& deviceNode, int progress);
 
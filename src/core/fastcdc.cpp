@@ -0,0 +1,80 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/fastcdc.h"
+
+/** The random values the gear hash adds for each byte value, always the same so that
+    chunks are cut at the same places by every backup */
+struct GearTable
+{
+    GearTable() {
+        // splitmix64 with a fixed seed
+        quint64 x = 0x6b706d636f726531ULL;
+
+        for (quint64& value : values) {
+            x += 0x9e3779b97f4a7c15ULL;
+            quint64 z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            value = z ^ (z >> 31);
+        }
+    }
+
+    quint64 values[256];
+};
+
+/** Finds the end of the first chunk of the given data.
+
+    If the data is shorter than the maximum chunk size and has no boundary, all of it
+    is one chunk, so that the end of the data is always a boundary.
+
+    @param data the data to cut
+    @param size the size of the data in bytes
+    @return the size of the first chunk in bytes
+*/
+qint64 FastCdc::cut(const void* data, qint64 size)
+{
+    static const GearTable gear;
+
+    // the hash shifts left, so its top bits depend on the most bytes; 18 bits before the
+    // average size of 2^16 bytes and 14 bits after it, as FastCDC's normalization level 2
+    const quint64 maskSmall = ~0ULL << (64 - 18);
+    const quint64 maskLarge = ~0ULL << (64 - 14);
+
+    if (size <= minimumSize())
+        return size;
+
+    const uchar* p = static_cast<const uchar*>(data);
+    const qint64 end = qMin(size, maximumSize());
+    const qint64 normal = qMin(averageSize(), end);
+    quint64 hash = 0;
+    qint64 i = minimumSize();
+
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear.values[p[i]];
+        if (!(hash & maskSmall))
+            return i + 1;
+    }
+
+    for (; i < end; i++) {
+        hash = (hash << 1) + gear.values[p[i]];
+        if (!(hash & maskLarge))
+            return i + 1;
+    }
+
+    return end;
+}
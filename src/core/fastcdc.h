@@ -0,0 +1,50 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(FASTCDC__H)
+
+#define FASTCDC__H
+
+#include <QtGlobal>
+
+/** Content-defined chunking with FastCDC.
+
+    Splits data into chunks whose boundaries depend on the data itself and not on its
+    offset, so that data inserted or removed before a chunk does not change the chunk.
+    A gear hash rolls over the data; a boundary is placed where the hash has enough zero
+    bits. Before the average chunk size more bits must be zero than after it, which keeps
+    the chunk sizes close to the average.
+
+    @see ChunkRepository, CopyTargetRepository
+*/
+class FastCdc
+{
+public:
+    static qint64 cut(const void* data, qint64 size);
+
+    static qint64 minimumSize() {
+        return 16 * 1024;    /**< @return the smallest size a chunk is cut at */
+    }
+    static qint64 averageSize() {
+        return 64 * 1024;    /**< @return the size chunks have on average */
+    }
+    static qint64 maximumSize() {
+        return 256 * 1024;    /**< @return the largest size a chunk can have */
+    }
+};
+
+#endif
@@ -0,0 +1,538 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/ioqueue.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QString>
+
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+quint32 IoQueue::s_DefaultDepth = 8;
+IoQueue::CachePolicy IoQueue::s_DefaultCachePolicy = IoQueue::CacheDirect;
+
+/** Creates a new IoQueue.
+    @param depth the maximum number of requests in flight
+*/
+IoQueue::IoQueue(quint32 depth) :
+    m_Depth(qMax(depth, 1u)),
+    m_Pending(0),
+    m_Priority(0),
+    m_Ring(nullptr),
+    m_Requests(),
+    m_FreeSlots(),
+    m_Completions(),
+    m_RegisteredBuffers(),
+    m_RegisteredSize(0)
+{
+#if defined(HAVE_LIBURING)
+    io_uring* ring = new io_uring;
+
+    if (io_uring_queue_init(m_Depth, ring, 0) == 0) {
+        io_uring_probe* probe = io_uring_get_probe_ring(ring);
+
+        // IORING_OP_READ and IORING_OP_WRITE need Linux 5.6. Fall back to pread/pwrite on older kernels.
+        if (probe && io_uring_opcode_supported(probe, IORING_OP_READ) && io_uring_opcode_supported(probe, IORING_OP_WRITE))
+            m_Ring = ring;
+        else
+            io_uring_queue_exit(ring);
+
+        if (probe)
+            io_uring_free_probe(probe);
+    }
+
+    if (m_Ring == nullptr)
+        delete ring;
+#endif
+
+    m_Requests.resize(m_Depth);
+
+    for (qint32 i = m_Depth - 1; i >= 0; i--)
+        m_FreeSlots.append(i);
+}
+
+/** Destroys the IoQueue. All requests should have been waited for before. */
+IoQueue::~IoQueue()
+{
+    Q_ASSERT(pending() == 0);
+
+#if defined(HAVE_LIBURING)
+    if (m_Ring) {
+        quintptr tag;
+        bool success;
+
+        while (pending() > 0 && wait(tag, success))
+            ;
+
+        if (!m_RegisteredBuffers.isEmpty())
+            io_uring_unregister_buffers(m_Ring);
+
+        io_uring_queue_exit(m_Ring);
+        delete m_Ring;
+    }
+#endif
+}
+
+/** Sets the queue depth used by IoQueues created without an explicit depth.
+    @param depth the new default queue depth
+*/
+void IoQueue::setDefaultDepth(quint32 depth)
+{
+    s_DefaultDepth = qMax(depth, 1u);
+}
+
+/** Opens a block device or regular file for queued I/O.
+    @param path the path to open
+    @param flags flags for open(2), usually O_RDONLY or O_WRONLY
+    @return the file descriptor or -1 if @p path could not be opened or is neither a
+            block device nor a regular file
+*/
+int IoQueue::openFile(const QString& path, int flags)
+{
+    const int fd = ::open(path.toLocal8Bit().constData(), flags | O_CLOEXEC);
+
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !(S_ISBLK(st.st_mode) || S_ISREG(st.st_mode))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/** Checks if a name given for an image stands for a stream that cannot seek.
+    @param name "-", "fd:N" or the path of a FIFO or UNIX socket for a stream
+    @return true if @p name is a stream
+    @see openStream
+*/
+bool IoQueue::isStream(const QString& name)
+{
+    if (name == QStringLiteral("-") || name.startsWith(QStringLiteral("fd:")))
+        return true;
+
+    struct stat st;
+
+    return stat(name.toLocal8Bit().constData(), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+}
+
+/** Opens a stream for reading or writing.
+    @param name "-" for standard input or output, "fd:N" for the inherited file descriptor N,
+           or the path of a FIFO or UNIX socket
+    @param write true to open the stream for writing
+    @param owned returns true if the file descriptor must be closed by the caller; standard
+           input and output are not
+    @return the file descriptor or -1
+*/
+int IoQueue::openStream(const QString& name, bool write, bool& owned)
+{
+    owned = false;
+
+    if (name == QStringLiteral("-"))
+        return write ? STDOUT_FILENO : STDIN_FILENO;
+
+    if (name.startsWith(QStringLiteral("fd:"))) {
+        bool ok = false;
+        const int fd = name.mid(3).toInt(&ok);
+
+        owned = ok && fd > STDERR_FILENO;
+        return ok && fcntl(fd, F_GETFD) != -1 ? fd : -1;
+    }
+
+    struct stat st;
+    const QByteArray path = name.toLocal8Bit();
+
+    if (stat(path.constData(), &st) != 0)
+        return -1;
+
+    if (S_ISSOCK(st.st_mode)) {
+        struct sockaddr_un addr;
+
+        if (static_cast<size_t>(path.size()) >= sizeof(addr.sun_path))
+            return -1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.constData(), path.size());
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (fd == -1 || ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            if (fd != -1)
+                close(fd);
+
+            return -1;
+        }
+
+        owned = true;
+        return fd;
+    }
+
+    if (!S_ISFIFO(st.st_mode))
+        return -1;
+
+    const int fd = ::open(path.constData(), (write ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+    owned = fd != -1;
+
+    return fd;
+}
+
+/** Reads one of the request queue limits the kernel exports in sysfs.
+
+    For block devices the device's own queue is used, for regular files the queue of the
+    device the file system is on. Partitions share the queue of their disk.
+
+    @param fd the file descriptor or -1
+    @param name the name of the limit, e.g. "max_sectors_kb"
+    @return the limit or -1 if it is not known
+*/
+qint64 IoQueue::queueLimit(int fd, const QString& name)
+{
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+        return -1;
+
+    const dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    const QString base = QStringLiteral("/sys/dev/block/%1:%2/").arg(major(dev)).arg(minor(dev));
+
+    QFile file(base + QStringLiteral("queue/") + name);
+
+    if (!file.exists())
+        file.setFileName(base + QStringLiteral("../queue/") + name);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    bool ok = false;
+    const qint64 rval = file.readAll().trimmed().toLongLong(&ok);
+
+    return ok ? rval : -1;
+}
+
+/** Finds the alignment unbuffered I/O on a file descriptor needs.
+
+    For block devices this is the logical block size. For regular files the file system's
+    preferred block size is used, which is at least what O_DIRECT requires.
+
+    @param fd the file descriptor
+    @return the alignment in bytes offsets and lengths must have or -1 if unknown
+*/
+qint32 IoQueue::directAlignment(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+        return -1;
+
+    if (S_ISBLK(st.st_mode)) {
+        int size = 0;
+        return ioctl(fd, BLKSSZGET, &size) == 0 && size > 0 ? size : -1;
+    }
+
+    return S_ISREG(st.st_mode) && st.st_blksize > 0 ? static_cast<qint32>(st.st_blksize) : -1;
+}
+
+/** Switches unbuffered I/O on or off for a file descriptor.
+    @param fd the file descriptor
+    @param direct true to set O_DIRECT, false to clear it
+    @return true if the flag could be changed; some file systems do not support O_DIRECT
+*/
+bool IoQueue::setDirect(int fd, bool direct)
+{
+    const int flags = fcntl(fd, F_GETFL);
+
+    if (flags == -1)
+        return false;
+
+    return fcntl(fd, F_SETFL, direct ? flags | O_DIRECT : flags & ~O_DIRECT) == 0;
+}
+
+/** Tells the kernel that a range that has been read will not be needed again.
+    @param fd the file descriptor the range was read from
+    @param offset the offset of the range in bytes
+    @param length the length of the range in bytes
+*/
+void IoQueue::dropCache(int fd, qint64 offset, qint64 length)
+{
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+}
+
+/** Starts writing back a range that has just been written without waiting for it.
+    @param fd the file descriptor the range was written to
+    @param offset the offset of the range in bytes
+    @param length the length of the range in bytes
+*/
+void IoQueue::startWriteBack(int fd, qint64 offset, qint64 length)
+{
+    sync_file_range(fd, offset, length, SYNC_FILE_RANGE_WRITE);
+}
+
+/** Waits for a range passed to startWriteBack() earlier to reach the disk and drops it from the page cache.
+
+    Calling this for the previous range after starting write back of the current one keeps
+    the amount of dirty data a copy leaves in the page cache to a window of two ranges.
+
+    @param fd the file descriptor the range was written to
+    @param offset the offset of the range in bytes
+    @param length the length of the range in bytes
+*/
+void IoQueue::dropWritten(int fd, qint64 offset, qint64 length)
+{
+    sync_file_range(fd, offset, length, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+}
+
+/** Queues a read.
+
+    The caller must not queue more than depth() requests without waiting for one of them.
+
+    @param fd the file descriptor to read from
+    @param buffer the buffer to read into
+    @param length the number of bytes to read
+    @param offset the offset in bytes to start reading at
+    @param tag identifies the request in wait()
+    @return true if the request could be queued
+*/
+bool IoQueue::read(int fd, void* buffer, qint64 length, qint64 offset, quintptr tag)
+{
+    Request request = { fd, static_cast<char*>(buffer), length, offset, false, -1, tag };
+    return queue(request);
+}
+
+/** Queues a write. See read() for the parameters.
+    @return true if the request could be queued
+*/
+bool IoQueue::write(int fd, const void* buffer, qint64 length, qint64 offset, quintptr tag)
+{
+    Request request = { fd, static_cast<char*>(const_cast<void*>(buffer)), length, offset, true, -1, tag };
+    return queue(request);
+}
+
+/** Adds a completion for a request the caller carried out on its own, for example through
+    CopySource::readSectors(). It is returned by wait() like any other completion.
+    @param tag identifies the request in wait()
+    @param success true if the request was successful
+*/
+void IoQueue::complete(quintptr tag, bool success)
+{
+    Completion completion = { tag, success };
+    m_Completions.append(completion);
+    m_Pending++;
+}
+
+bool IoQueue::queue(const Request& request)
+{
+    Q_ASSERT(pending() < depth());
+
+    if (m_Ring == nullptr) {
+        complete(request.tag, transfer(request, 0));
+        return true;
+    }
+
+#if defined(HAVE_LIBURING)
+    if (m_FreeSlots.isEmpty())
+        return false;
+
+    io_uring_sqe* sqe = io_uring_get_sqe(m_Ring);
+
+    if (sqe == nullptr) {
+        io_uring_submit(m_Ring);
+        sqe = io_uring_get_sqe(m_Ring);
+
+        if (sqe == nullptr)
+            return false;
+    }
+
+    const qint32 slot = m_FreeSlots.takeLast();
+    Request& r = m_Requests[slot];
+    r = request;
+    r.bufferIndex = findRegisteredBuffer(r.buffer, r.length);
+
+    if (r.isWrite && r.bufferIndex >= 0)
+        io_uring_prep_write_fixed(sqe, r.fd, r.buffer, r.length, r.offset, r.bufferIndex);
+    else if (r.isWrite)
+        io_uring_prep_write(sqe, r.fd, r.buffer, r.length, r.offset);
+    else if (r.bufferIndex >= 0)
+        io_uring_prep_read_fixed(sqe, r.fd, r.buffer, r.length, r.offset, r.bufferIndex);
+    else
+        io_uring_prep_read(sqe, r.fd, r.buffer, r.length, r.offset);
+
+    sqe->ioprio = m_Priority;
+    sqe->user_data = slot;
+    m_Pending++;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+/** Submits all queued requests to the kernel.
+    @return true on success
+*/
+bool IoQueue::submit()
+{
+#if defined(HAVE_LIBURING)
+    if (m_Ring && io_uring_submit(m_Ring) < 0)
+        return false;
+#endif
+
+    return true;
+}
+
+/** Waits for one request to complete.
+    @param tag set to the tag of the completed request
+    @param success set to true if the request transferred all its bytes
+    @return false if there are no pending requests or waiting failed
+*/
+bool IoQueue::wait(quintptr& tag, bool& success)
+{
+    if (pending() == 0)
+        return false;
+
+    if (!m_Completions.isEmpty()) {
+        const Completion completion = m_Completions.takeFirst();
+        tag = completion.tag;
+        success = completion.success;
+        m_Pending--;
+        return true;
+    }
+
+#if defined(HAVE_LIBURING)
+    io_uring_cqe* cqe = nullptr;
+    int ret;
+
+    while ((ret = io_uring_wait_cqe(m_Ring, &cqe)) == -EINTR)
+        ;
+
+    if (ret < 0 || cqe == nullptr) {
+        qWarning() << "io_uring_wait_cqe failed:" << ret;
+        return false;
+    }
+
+    const qint32 slot = static_cast<qint32>(cqe->user_data);
+    const qint64 res = cqe->res;
+    io_uring_cqe_seen(m_Ring, cqe);
+
+    const Request& r = m_Requests[slot];
+    tag = r.tag;
+
+    // Finish short transfers synchronously, they are rare enough not to be worth requeueing.
+    if (res < 0)
+        success = false;
+    else
+        success = res == r.length || transfer(r, res);
+
+    m_FreeSlots.append(slot);
+    m_Pending--;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+/** Registers buffers with the kernel so that it does not have to map them for every request.
+    Requests whose buffer lies within a registered buffer use them automatically.
+    @param buffers the buffers to register
+    @param size the size of each buffer in bytes
+    @return true if the buffers could be registered
+*/
+bool IoQueue::registerBuffers(const QVector<void*>& buffers, qint64 size)
+{
+#if defined(HAVE_LIBURING)
+    if (m_Ring == nullptr || !m_RegisteredBuffers.isEmpty() || pending() > 0)
+        return false;
+
+    QVector<iovec> iov;
+
+    for (const auto &buffer : buffers) {
+        iovec v = { buffer, static_cast<size_t>(size) };
+        iov.append(v);
+    }
+
+    if (io_uring_register_buffers(m_Ring, iov.data(), iov.size()) != 0)
+        return false;
+
+    m_RegisteredBuffers = buffers;
+    m_RegisteredSize = size;
+
+    return true;
+#else
+    Q_UNUSED(buffers);
+    Q_UNUSED(size);
+
+    return false;
+#endif
+}
+
+qint32 IoQueue::findRegisteredBuffer(const char* buffer, qint64 length) const
+{
+    for (qint32 i = 0; i < m_RegisteredBuffers.size(); i++) {
+        const char* start = static_cast<const char*>(m_RegisteredBuffers[i]);
+
+        if (buffer >= start && buffer + length <= start + m_RegisteredSize)
+            return i;
+    }
+
+    return -1;
+}
+
+/** Carries out a request with pread()/pwrite().
+    @param request the request
+    @param done the number of bytes of the request already transferred
+    @return true if all bytes could be transferred
+*/
+bool IoQueue::transfer(const Request& request, qint64 done)
+{
+    while (done < request.length) {
+        const ssize_t n = request.isWrite ?
+                          pwrite(request.fd, request.buffer + done, request.length - done, request.offset + done) :
+                          pread(request.fd, request.buffer + done, request.length - done, request.offset + done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        // zero means end of file for reads; a write that makes no progress will not make any later either
+        if (n <= 0)
+            return false;
+
+        done += n;
+    }
+
+    return true;
+}
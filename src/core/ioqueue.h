@@ -0,0 +1,143 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(IOQUEUE__H)
+
+#define IOQUEUE__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QVector>
+#include <QtGlobal>
+
+class QString;
+
+struct io_uring;
+
+/** A queue of reads and writes on file descriptors.
+
+    IoQueue keeps up to depth() requests in flight. If kpmcore was built with liburing and
+    the running kernel supports it, requests are submitted through io_uring. Otherwise each
+    request is carried out with a plain pread()/pwrite() when it is queued and only its
+    completion is deferred, so callers can use the same code for both cases.
+
+    Requests are identified by a caller chosen tag. Completions may arrive in any order.
+
+    An IoQueue must only be used from one thread at a time.
+
+    @see CopyPipeline
+*/
+class LIBKPMCORE_EXPORT IoQueue
+{
+    Q_DISABLE_COPY(IoQueue)
+
+public:
+    /** How bulk I/O interacts with the kernel's page cache */
+    enum CachePolicy {
+        CacheBuffered = 0,    /**< read and write through the page cache */
+        CacheDropBehind = 1,  /**< use the page cache but write back and drop copied data as soon as possible */
+        CacheDirect = 2       /**< bypass the page cache with O_DIRECT where alignment allows, else drop behind */
+    };
+
+public:
+    explicit IoQueue(quint32 depth = defaultDepth());
+    ~IoQueue();
+
+public:
+    bool read(int fd, void* buffer, qint64 length, qint64 offset, quintptr tag);
+    bool write(int fd, const void* buffer, qint64 length, qint64 offset, quintptr tag);
+    void complete(quintptr tag, bool success);
+    bool submit();
+    bool wait(quintptr& tag, bool& success);
+
+    bool registerBuffers(const QVector<void*>& buffers, qint64 size);
+
+    quint32 depth() const {
+        return m_Depth;    /**< @return the maximum number of requests in flight */
+    }
+    quint32 pending() const {
+        return m_Pending;    /**< @return the number of requests that have not been waited for yet */
+    }
+    bool isAsync() const {
+        return m_Ring != nullptr;    /**< @return true if requests are submitted through io_uring */
+    }
+    quint16 priority() const {
+        return m_Priority;    /**< @return the I/O priority requests are submitted with, 0 for that of the submitting thread */
+    }
+    void setPriority(quint16 ioprio) {
+        m_Priority = ioprio;    /**< @param ioprio the I/O priority, encoded as for ioprio_set(2), to submit requests with */
+    }
+
+    static int openFile(const QString& path, int flags);
+    static bool isStream(const QString& name);
+    static int openStream(const QString& name, bool write, bool& owned);
+
+    static quint32 defaultDepth() {
+        return s_DefaultDepth;    /**< @return the queue depth used if none is given */
+    }
+    static void setDefaultDepth(quint32 depth);
+
+    static CachePolicy defaultCachePolicy() {
+        return s_DefaultCachePolicy;    /**< @return the cache policy copies use if none is given */
+    }
+    static void setDefaultCachePolicy(CachePolicy policy) {
+        s_DefaultCachePolicy = policy;    /**< @param policy the cache policy copies are to use if none is given */
+    }
+
+    static qint64 queueLimit(int fd, const QString& name);
+    static qint32 directAlignment(int fd);
+    static bool setDirect(int fd, bool direct);
+    static void dropCache(int fd, qint64 offset, qint64 length);
+    static void startWriteBack(int fd, qint64 offset, qint64 length);
+    static void dropWritten(int fd, qint64 offset, qint64 length);
+
+protected:
+    struct Request {
+        int fd;
+        char* buffer;
+        qint64 length;
+        qint64 offset;
+        bool isWrite;
+        qint32 bufferIndex;
+        quintptr tag;
+    };
+
+    struct Completion {
+        quintptr tag;
+        bool success;
+    };
+
+    bool queue(const Request& request);
+    static bool transfer(const Request& request, qint64 done);
+    qint32 findRegisteredBuffer(const char* buffer, qint64 length) const;
+
+private:
+    const quint32 m_Depth;
+    quint32 m_Pending;
+    quint16 m_Priority;
+    io_uring* m_Ring;
+    QVector<Request> m_Requests;
+    QVector<qint32> m_FreeSlots;
+    QVector<Completion> m_Completions;
+    QVector<void*> m_RegisteredBuffers;
+    qint64 m_RegisteredSize;
+
+    static quint32 s_DefaultDepth;
+    static CachePolicy s_DefaultCachePolicy;
+};
+
+#endif
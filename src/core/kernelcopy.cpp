@@ -0,0 +1,307 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/kernelcopy.h"
+
+#include "core/copysource.h"
+#include "core/copytarget.h"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** @return true if an error means that a method does not work for the descriptors at all */
+static bool isUnsupported(int error)
+{
+    return error == EINVAL || error == EXDEV || error == ENOSYS || error == EOPNOTSUPP || error == ENOTTY || error == EBADF || error == EPERM;
+}
+
+/** Creates a new KernelCopy.
+    @param source the opened CopySource to read from
+    @param target the opened CopyTarget to write to
+*/
+KernelCopy::KernelCopy(CopySource& source, CopyTarget& target) :
+    m_Source(source),
+    m_Target(target),
+    m_Methods(NoMethod),
+    m_Used(NoMethod),
+    m_CloneAlignment(0),
+    m_Pipe(),
+    m_PipeSize(0),
+    m_SectorsSkipped(0),
+    m_SectorsZeroed(0)
+{
+    m_Pipe[0] = m_Pipe[1] = -1;
+
+    if (!isPossible())
+        return;
+
+    struct stat in;
+    struct stat out;
+
+    if (fstat(source.fileDescriptor(), &in) != 0 || fstat(target.fileDescriptor(), &out) != 0)
+        return;
+
+    m_Methods = Splice;
+
+    // copy_file_range() and reflinks only work between regular files
+    if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode)) {
+        m_Methods |= CopyFileRange;
+
+        // ranges to clone must be aligned to the file system's blocks
+        if (in.st_dev == out.st_dev) {
+            m_Methods |= Clone;
+            m_CloneAlignment = qMax(static_cast<qint64>(out.st_blksize), static_cast<qint64>(source.sectorSize()));
+        }
+    }
+}
+
+KernelCopy::~KernelCopy()
+{
+    if (m_Pipe[0] != -1) {
+        close(m_Pipe[0]);
+        close(m_Pipe[1]);
+    }
+}
+
+/** @return true if the source and the target both have file descriptors to copy between */
+bool KernelCopy::isPossible() const
+{
+    return m_Source.fileDescriptor() >= 0 && m_Target.fileDescriptor() >= 0 && m_Source.sectorSize() == m_Target.sectorSize();
+}
+
+/** @return true if the source or the target is a regular file, where the kernel can clone
+            or copy within the file system rather than moving the data through a pipe */
+bool KernelCopy::involvesFile() const
+{
+    struct stat st;
+
+    return (fstat(m_Source.fileDescriptor(), &st) == 0 && S_ISREG(st.st_mode)) ||
+           (fstat(m_Target.fileDescriptor(), &st) == 0 && S_ISREG(st.st_mode));
+}
+
+/** Copies sectors from the source to the target.
+
+    If this fails and isSupported() returns false afterwards, none of the methods works for
+    the source and the target, and the sectors can be copied some other way.
+
+    @param readOffset the first sector to read
+    @param writeOffset the first sector to write
+    @param numSectors the number of sectors to copy
+    @param last true if these are the last sectors of the copy, which are always written so that a file target has the right size
+    @return true on success
+*/
+bool KernelCopy::copySectors(qint64 readOffset, qint64 writeOffset, qint64 numSectors, bool last)
+{
+    const qint32 sectorSize = source().sectorSize();
+    const qint64 segmentSize = qMax(1024 * 1024 / sectorSize, 1);
+
+    // runs of sectors that are to be copied are collected and copied at once
+    qint64 runStart = 0;
+    qint64 runLength = 0;
+
+    for (qint64 done = 0; done < numSectors; done += segmentSize) {
+        const qint64 n = qMin(segmentSize, numSectors - done);
+        const bool isLast = last && done + n == numSectors;
+
+        bool skip = false;
+
+        if (!isLast) {
+            if (source().isUnused(readOffset + done, n)) {
+                m_SectorsSkipped += n;
+                skip = true;
+            } else if (source().isHole(readOffset + done, n) && target().zeroSectors(writeOffset + done, n)) {
+                m_SectorsZeroed += n;
+                skip = true;
+            }
+        }
+
+        if (!skip) {
+            if (runLength == 0)
+                runStart = done;
+            runLength += n;
+            continue;
+        }
+
+        if (runLength > 0 && !copyBytes((readOffset + runStart) * sectorSize, (writeOffset + runStart) * sectorSize, runLength * sectorSize))
+            return false;
+
+        runLength = 0;
+    }
+
+    if (runLength > 0 && !copyBytes((readOffset + runStart) * sectorSize, (writeOffset + runStart) * sectorSize, runLength * sectorSize))
+        return false;
+
+    target().setSectorsWritten(target().sectorsWritten() + numSectors);
+
+    return true;
+}
+
+bool KernelCopy::copyBytes(qint64 readPos, qint64 writePos, qint64 size)
+{
+    while (size > 0 && m_Methods != NoMethod) {
+        if ((m_Methods & Clone) && !clone(readPos, writePos, size))
+            return false;
+
+        if (size > 0 && (m_Methods & CopyFileRange) && !copyFileRange(readPos, writePos, size))
+            return false;
+
+        if (size > 0 && (m_Methods & Splice) && !splice(readPos, writePos, size))
+            return false;
+    }
+
+    return size == 0;
+}
+
+/** Shares the extents of the aligned part of a range with the target.
+    @return false on an error other than cloning not being supported
+*/
+bool KernelCopy::clone(qint64& readPos, qint64& writePos, qint64& size)
+{
+#if defined(FICLONERANGE)
+    if (readPos % m_CloneAlignment != 0 || writePos % m_CloneAlignment != 0)
+        return true;
+
+    const qint64 n = size / m_CloneAlignment * m_CloneAlignment;
+
+    if (n == 0)
+        return true;
+
+    struct file_clone_range range;
+    range.src_fd = source().fileDescriptor();
+    range.src_offset = readPos;
+    range.src_length = n;
+    range.dest_offset = writePos;
+
+    if (ioctl(target().fileDescriptor(), FICLONERANGE, &range) != 0) {
+        // nothing has been written if cloning fails, so copying can always go on another way
+        m_Methods &= ~Clone;
+        return true;
+    }
+
+    readPos += n;
+    writePos += n;
+    size -= n;
+    m_Used |= Clone;
+#else
+    Q_UNUSED(readPos)
+    Q_UNUSED(writePos)
+    Q_UNUSED(size)
+    m_Methods &= ~Clone;
+#endif
+
+    return true;
+}
+
+/** Copies a range with copy_file_range().
+    @return false on an error other than copy_file_range() not being supported
+*/
+bool KernelCopy::copyFileRange(qint64& readPos, qint64& writePos, qint64& size)
+{
+#if defined(SYS_copy_file_range)
+    while (size > 0) {
+        loff_t in = readPos;
+        loff_t out = writePos;
+        const long n = syscall(SYS_copy_file_range, source().fileDescriptor(), &in, target().fileDescriptor(), &out, static_cast<size_t>(size), 0);
+
+        if (n > 0) {
+            readPos += n;
+            writePos += n;
+            size -= n;
+            m_Used |= CopyFileRange;
+        } else if (n == 0)
+            return false;
+        else if (errno == EINTR)
+            continue;
+        else if (isUnsupported(errno)) {
+            m_Methods &= ~CopyFileRange;
+            return true;
+        } else
+            return false;
+    }
+#else
+    Q_UNUSED(readPos)
+    Q_UNUSED(writePos)
+    Q_UNUSED(size)
+    m_Methods &= ~CopyFileRange;
+#endif
+
+    return true;
+}
+
+/** Copies a range with splice() through a pipe.
+    @return false on an error other than splice() not being supported
+*/
+bool KernelCopy::splice(qint64& readPos, qint64& writePos, qint64& size)
+{
+    if (m_Pipe[0] == -1) {
+        if (pipe2(m_Pipe, O_CLOEXEC) != 0) {
+            m_Pipe[0] = m_Pipe[1] = -1;
+            m_Methods &= ~Splice;
+            return true;
+        }
+
+        // larger pipes need fewer calls, but the default size is all that is guaranteed
+        fcntl(m_Pipe[1], F_SETPIPE_SZ, 1024 * 1024);
+        m_PipeSize = fcntl(m_Pipe[1], F_GETPIPE_SZ);
+
+        if (m_PipeSize <= 0)
+            m_PipeSize = 64 * 1024;
+    }
+
+    while (size > 0) {
+        loff_t in = readPos;
+        const ssize_t n = ::splice(source().fileDescriptor(), &in, m_Pipe[1], nullptr, qMin(size, m_PipeSize), SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && isUnsupported(errno) && !(m_Used & Splice)) {
+            m_Methods &= ~Splice;
+            return true;
+        }
+
+        if (n <= 0)
+            return false;
+
+        // once data is in the pipe, it must go to the target or the copy has failed
+        for (ssize_t left = n; left > 0; ) {
+            loff_t out = writePos;
+            const ssize_t written = ::splice(m_Pipe[0], nullptr, target().fileDescriptor(), &out, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+            if (written < 0 && errno == EINTR)
+                continue;
+
+            if (written <= 0)
+                return false;
+
+            writePos += written;
+            left -= written;
+        }
+
+        readPos += n;
+        size -= n;
+        m_Used |= Splice;
+    }
+
+    return true;
+}
@@ -0,0 +1,101 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(KERNELCOPY__H)
+
+#define KERNELCOPY__H
+
+#include <QtGlobal>
+
+class CopySource;
+class CopyTarget;
+
+/** Copies between the file descriptors of a CopySource and a CopyTarget inside the kernel.
+
+    The data never passes through a buffer of ours. Reflinks (FICLONERANGE) are tried
+    first, so that image files on btrfs or XFS share their extents instead of being copied.
+    Then copy_file_range(), which may also be offloaded to the storage, and finally splice()
+    through a pipe, which works for block devices as well. Each method is dropped for good
+    once it turns out not to be supported for the two descriptors.
+
+    Sectors the source does not use are skipped, and holes in the source are zeroed on
+    the target where the target can do that without being sent the zeros, just like
+    CopyPipeline does.
+
+    @see CopyPipeline
+*/
+class KernelCopy
+{
+    Q_DISABLE_COPY(KernelCopy)
+
+public:
+    /** How data is copied */
+    enum Method {
+        NoMethod = 0,
+        Clone = 1,          /**< by sharing extents (FICLONERANGE) */
+        CopyFileRange = 2,  /**< with copy_file_range() */
+        Splice = 4          /**< with splice() through a pipe */
+    };
+
+public:
+    KernelCopy(CopySource& source, CopyTarget& target);
+    ~KernelCopy();
+
+public:
+    bool isPossible() const;
+    bool involvesFile() const;
+    bool copySectors(qint64 readOffset, qint64 writeOffset, qint64 numSectors, bool last);
+
+    bool isSupported() const {
+        return m_Methods != NoMethod;    /**< @return false if no method has worked for the source and target */
+    }
+    qint32 methodsUsed() const {
+        return m_Used;    /**< @return the Methods data has been copied with */
+    }
+    qint64 sectorsSkipped() const {
+        return m_SectorsSkipped;    /**< @return the number of sectors not copied because the source does not use them */
+    }
+    qint64 sectorsZeroed() const {
+        return m_SectorsZeroed;    /**< @return the number of sectors the target has zeroed without being sent the zeros */
+    }
+
+protected:
+    CopySource& source() {
+        return m_Source;
+    }
+    CopyTarget& target() {
+        return m_Target;
+    }
+
+    bool copyBytes(qint64 readPos, qint64 writePos, qint64 size);
+    bool clone(qint64& readPos, qint64& writePos, qint64& size);
+    bool copyFileRange(qint64& readPos, qint64& writePos, qint64& size);
+    bool splice(qint64& readPos, qint64& writePos, qint64& size);
+
+private:
+    CopySource& m_Source;
+    CopyTarget& m_Target;
+    qint32 m_Methods;
+    qint32 m_Used;
+    qint64 m_CloneAlignment;
+    int m_Pipe[2];
+    qint64 m_PipeSize;
+    qint64 m_SectorsSkipped;
+    qint64 m_SectorsZeroed;
+};
+
+#endif
@@ -19,9 +19,14 @@
 #include "core/operationrunner.h"
 
 #include "core/operationstack.h"
+#include "core/ratelimiter.h"
 
+#include "ops/copyoperation.h"
 #include "ops/operation.h"
 
+#include "jobs/job.h"
+
+#include "util/bufferpool.h"
 #include "util/report.h"
 
 #include <QMutex>
@@ -55,19 +60,40 @@ void OperationRunner::run()
             break;
         }
 
-        Operation* op = operationStack().operations()[i];
-        op->setStatus(Operation::StatusRunning);
+        // Copies of the same source that follow each other read the source only once.
+        const QList<CopyOperation*> copyOps = copyOperations(i);
+
+        if (copyOps.size() > 1) {
+            for (qint32 j = 0; j < copyOps.size(); j++) {
+                copyOps[j]->setStatus(Operation::StatusRunning);
+                emit opStarted(i + j + 1, copyOps[j]);
+                connect(copyOps[j], &Operation::progress, this, &OperationRunner::progressSub);
+            }
+
+            status = CopyOperation::execute(report(), copyOps);
+
+            for (qint32 j = 0; j < copyOps.size(); j++) {
+                copyOps[j]->preview();
+                disconnect(copyOps[j], &Operation::progress, this, &OperationRunner::progressSub);
+                emit opFinished(i + j + 1, copyOps[j]);
+            }
+
+            i += copyOps.size() - 1;
+        } else {
+            Operation* op = operationStack().operations()[i];
+            op->setStatus(Operation::StatusRunning);
 
-        emit opStarted(i + 1, op);
+            emit opStarted(i + 1, op);
 
-        connect(op, &Operation::progress, this, &OperationRunner::progressSub);
+            connect(op, &Operation::progress, this, &OperationRunner::progressSub);
 
-        status = op->execute(report());
-        op->preview();
+            status = op->execute(report());
+            op->preview();
 
-        disconnect(op, &Operation::progress, this, &OperationRunner::progressSub);
+            disconnect(op, &Operation::progress, this, &OperationRunner::progressSub);
 
-        emit opFinished(i + 1, op);
+            emit opFinished(i + 1, op);
+        }
 
         suspendMutex().unlock();
 
@@ -77,6 +103,9 @@ void OperationRunner::run()
         msleep(5);
     }
 
+    // copy buffers are reused between the jobs of one run but not kept around afterwards
+    BufferPool::instance().trim();
+
     if (!status)
         emit error();
     else if (isCancelling())
@@ -85,6 +114,33 @@ void OperationRunner::run()
         emit finished();
 }
 
+/** Finds the CopyOperations that can be run together, starting with a given Operation.
+    @param first the number of the first Operation
+    @return the CopyOperations from @p first on that copy the same source, empty if @p first is no CopyOperation
+*/
+QList<CopyOperation*> OperationRunner::copyOperations(qint32 first) const
+{
+    QList<CopyOperation*> rval;
+
+    for (qint32 i = first; i < numOperations(); i++) {
+        CopyOperation* copyOp = dynamic_cast<CopyOperation*>(operationStack().operations()[i]);
+
+        if (copyOp == nullptr)
+            break;
+
+        bool canCopyWith = true;
+        for (const auto &op : rval)
+            canCopyWith = canCopyWith && op->canCopyWith(*copyOp);
+
+        if (!canCopyWith)
+            break;
+
+        rval.append(copyOp);
+    }
+
+    return rval;
+}
+
 /** @return the number of Operations to run */
 qint32 OperationRunner::numOperations() const
 {
@@ -112,3 +168,39 @@ QString OperationRunner::description(qint32 op) const
 
     return operationStack().operations()[op]->description();
 }
+
+/** Limits how fast the Jobs copy. May be called while running; copies in progress adapt at once.
+    @param bytesPerSecond the maximum number of bytes to copy per second, 0 for no limit
+    @param opsPerSecond the maximum number of reads and writes per second, 0 for no limit
+*/
+void OperationRunner::setRateLimit(qint64 bytesPerSecond, qint64 opsPerSecond)
+{
+    RateLimiter::instance().setLimits(bytesPerSecond, opsPerSecond);
+}
+
+/** @return the maximum number of bytes copied per second, 0 for no limit */
+qint64 OperationRunner::bytesPerSecondLimit() const
+{
+    return RateLimiter::instance().bytesPerSecond();
+}
+
+/** @return the maximum number of reads and writes per second, 0 for no limit */
+qint64 OperationRunner::opsPerSecondLimit() const
+{
+    return RateLimiter::instance().opsPerSecond();
+}
+
+/** Sets the I/O priority the Jobs run at, and the commands they run. May be called while
+    running; the priority applies from the next Job on.
+    @param prio the I/O priority, unset for the system's default
+*/
+void OperationRunner::setIoPriority(const IoPriority& prio)
+{
+    Job::setDefaultIoPriority(prio);
+}
+
+/** @return the I/O priority the Jobs run at */
+IoPriority OperationRunner::ioPriority() const
+{
+    return Job::defaultIoPriority();
+}
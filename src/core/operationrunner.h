@@ -19,12 +19,15 @@
 
 #define OPERATIONRUNNER__H
 
+#include "util/iopriority.h"
 #include "util/libpartitionmanagerexport.h"
 
+#include <QList>
 #include <QThread>
 #include <QMutex>
 #include <QtGlobal>
 
+class CopyOperation;
 class Operation;
 class OperationStack;
 class Report;
@@ -62,6 +65,12 @@ public:
         m_Report = report;    /**< @param report the Report to use while running */
     }
 
+    void setRateLimit(qint64 bytesPerSecond, qint64 opsPerSecond);
+    qint64 bytesPerSecondLimit() const;
+    qint64 opsPerSecondLimit() const;
+    void setIoPriority(const IoPriority& prio);
+    IoPriority ioPriority() const;
+
 Q_SIGNALS:
     void progressSub(int);
     void opStarted(int, Operation*);
@@ -77,6 +86,7 @@ protected:
     const OperationStack& operationStack() const {
         return m_OperationStack;
     }
+    QList<CopyOperation*> copyOperations(qint32 first) const;
     void setCancelling(bool b) {
         m_Cancelling = b;
     }
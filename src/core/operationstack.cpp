@@ -50,6 +50,7 @@ OperationStack::OperationStack(QObject* parent) :
     QObject(parent),
     m_Operations(),
     m_PreviewDevices(),
+    m_RetiredDevices(),
     m_Lock(QReadWriteLock::Recursive)
 {
 }
@@ -422,6 +423,9 @@ void OperationStack::push(Operation* o)
 {
     Q_ASSERT(o);
 
+    // a DeviceMonitor must not swap Devices while the Operation's preview is set up
+    QWriteLocker lockDevices(&lock());
+
     if (mergeResizeVolumeGroupResizeOperation(o))
         return;
 
@@ -452,6 +456,8 @@ void OperationStack::push(Operation* o)
         o->setStatus(Operation::StatusPending);
     }
 
+    lockDevices.unlock();
+
     // emit operationsChanged even if o is nullptr because it has been merged: merging might
     // have led to an existing operation changing.
     emit operationsChanged();
@@ -460,9 +466,15 @@ void OperationStack::push(Operation* o)
 /** Removes the topmost Operation from the OperationStack, calls Operation::undo() on it and deletes it. */
 void OperationStack::pop()
 {
+    QWriteLocker lockDevices(&lock());
+
     Operation* o = operations().takeLast();
     o->undo();
     delete o;
+
+    lockDevices.unlock();
+
+    deleteRetiredDevices();
     emit operationsChanged();
 }
 
@@ -492,6 +504,8 @@ bool OperationStack::contains(const Partition* p) const
 /** Removes all Operations from the OperationStack, calling Operation::undo() on them and deleting them. */
 void OperationStack::clearOperations()
 {
+    QWriteLocker lockDevices(&lock());
+
     while (!operations().isEmpty()) {
         Operation* o = operations().takeLast();
         if (o->status() == Operation::StatusPending)
@@ -499,6 +513,9 @@ void OperationStack::clearOperations()
         delete o;
     }
 
+    lockDevices.unlock();
+
+    deleteRetiredDevices();
     emit operationsChanged();
 }
 
@@ -509,6 +526,8 @@ void OperationStack::clearDevices()
 
     qDeleteAll(previewDevices());
     previewDevices().clear();
+    qDeleteAll(m_RetiredDevices);
+    m_RetiredDevices.clear();
     emit devicesChanged();
 }
 
@@ -552,6 +571,98 @@ void OperationStack::addDevice(Device* d)
     emit devicesChanged();
 }
 
+/** Inserts a disk Device in order, after all disks with lower device nodes and before any
+    volume manager Devices.
+    @param d pointer to the Device to insert. Must not be nullptr.
+    @return true if the Device was inserted; false if Operations are pending, which were
+            planned without it, or if it is already in the OperationStack
+*/
+bool OperationStack::insertDevice(Device* d)
+{
+    Q_ASSERT(d);
+
+    QWriteLocker lockDevices(&lock());
+
+    if (!operations().isEmpty() || previewDevices().contains(d))
+        return false;
+
+    int i = 0;
+    while (i < previewDevices().size() && previewDevices()[i]->type() == Device::Disk_Device && previewDevices()[i]->deviceNode() < d->deviceNode())
+        i++;
+
+    previewDevices().insert(i, d);
+
+    lockDevices.unlock();
+
+    emit devicesChanged();
+    return true;
+}
+
+/** Replaces a Device with a newly scanned one.
+
+    The old Device is not deleted right away, since views may still hold pointers to it or
+    its Partitions until they have handled devicesChanged(). Call deleteRetiredDevices()
+    through the event loop once all signals about the change have been emitted.
+
+    @param oldDevice the Device to replace
+    @param newDevice the Device to take its place. Must not be nullptr.
+    @return true if the Device was replaced; false if Operations are pending, which may
+            refer to the old Device, or if it is no longer in the OperationStack
+*/
+bool OperationStack::replaceDevice(Device* oldDevice, Device* newDevice)
+{
+    Q_ASSERT(newDevice);
+
+    QWriteLocker lockDevices(&lock());
+
+    const int i = previewDevices().indexOf(oldDevice);
+
+    if (!operations().isEmpty() || i < 0)
+        return false;
+
+    previewDevices()[i] = newDevice;
+    m_RetiredDevices.append(oldDevice);
+
+    lockDevices.unlock();
+
+    emit devicesChanged();
+    return true;
+}
+
+/** Removes a Device from the OperationStack. Like replaceDevice(), it is deleted later.
+    @param d the Device to remove
+    @return true if the Device was removed; false if Operations are pending or it is not
+            in the OperationStack
+*/
+bool OperationStack::removeDevice(Device* d)
+{
+    QWriteLocker lockDevices(&lock());
+
+    if (!operations().isEmpty() || !previewDevices().removeOne(d))
+        return false;
+
+    m_RetiredDevices.append(d);
+
+    lockDevices.unlock();
+
+    emit devicesChanged();
+    return true;
+}
+
+/** Deletes the Devices replaced or removed since the last call. Operations pushed in the
+    meantime may refer to them, so they are kept until the OperationStack is empty again.
+*/
+void OperationStack::deleteRetiredDevices()
+{
+    QWriteLocker lockDevices(&lock());
+
+    if (!operations().isEmpty())
+        return;
+
+    qDeleteAll(m_RetiredDevices);
+    m_RetiredDevices.clear();
+}
+
 static bool deviceLessThan(const Device* d1, const Device* d2)
 {
     return d1->deviceNode() <= d2->deviceNode();
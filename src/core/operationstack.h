@@ -30,6 +30,7 @@
 class Device;
 class Partition;
 class Operation;
+class DeviceMonitor;
 class DeviceScanner;
 
 /** The list of Operations the user wants to have performed.
@@ -44,6 +45,7 @@ class LIBKPMCORE_EXPORT OperationStack : public QObject
     Q_OBJECT
     Q_DISABLE_COPY(OperationStack)
 
+    friend class DeviceMonitor;
     friend class DeviceScanner;
 
 public:
@@ -90,8 +92,13 @@ public:
 protected:
     void clearDevices();
     void addDevice(Device* d);
+    bool insertDevice(Device* d);
+    bool replaceDevice(Device* oldDevice, Device* newDevice);
+    bool removeDevice(Device* d);
     void sortDevices();
 
+    Q_INVOKABLE void deleteRetiredDevices();
+
     bool mergeNewOperation(Operation*& currentOp, Operation*& pushedOp);
     bool mergeCopyOperation(Operation*& currentOp, Operation*& pushedOp);
     bool mergeRestoreOperation(Operation*& currentOp, Operation*& pushedOp);
@@ -103,6 +110,7 @@ protected:
 private:
     Operations m_Operations;
     mutable Devices m_PreviewDevices;
+    Devices m_RetiredDevices;
     QReadWriteLock m_Lock;
 };
 
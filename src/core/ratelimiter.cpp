@@ -0,0 +1,138 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/ratelimiter.h"
+
+#include <QMutexLocker>
+#include <QThread>
+
+RateLimiter::RateLimiter() :
+    m_Mutex(),
+    m_Timer(),
+    m_LastRefill(0),
+    m_BytesPerSecond(0),
+    m_OpsPerSecond(0),
+    m_ByteTokens(0),
+    m_OpTokens(0)
+{
+    m_Timer.start();
+}
+
+/** @return the RateLimiter all copies share */
+RateLimiter& RateLimiter::instance()
+{
+    static RateLimiter limiter;
+    return limiter;
+}
+
+/** Sets the limits.
+    @param bytesPerSecond the maximum number of bytes to copy per second, 0 for no limit
+    @param opsPerSecond the maximum number of reads and writes per second, 0 for no limit
+*/
+void RateLimiter::setLimits(qint64 bytesPerSecond, qint64 opsPerSecond)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    refill();
+
+    m_BytesPerSecond = qMax(bytesPerSecond, static_cast<qint64>(0));
+    m_OpsPerSecond = qMax(opsPerSecond, static_cast<qint64>(0));
+
+    // debt under the old limits is forgiven, so that lifting a limit takes effect at once
+    m_ByteTokens = qMax(m_ByteTokens, 0.0);
+    m_OpTokens = qMax(m_OpTokens, 0.0);
+}
+
+/** @return the maximum number of bytes to copy per second, 0 for no limit */
+qint64 RateLimiter::bytesPerSecond() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_BytesPerSecond;
+}
+
+/** @return the maximum number of reads and writes per second, 0 for no limit */
+qint64 RateLimiter::opsPerSecond() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_OpsPerSecond;
+}
+
+/** @return true if any limit is set */
+bool RateLimiter::isLimited() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_BytesPerSecond > 0 || m_OpsPerSecond > 0;
+}
+
+/** Takes tokens for I/O about to be submitted, waiting as long as the limits require.
+    @param bytes the number of bytes to be transferred
+    @param ops the number of reads and writes to be submitted
+*/
+void RateLimiter::acquire(qint64 bytes, qint64 ops)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    refill();
+
+    if (m_BytesPerSecond > 0)
+        m_ByteTokens -= bytes;
+
+    if (m_OpsPerSecond > 0)
+        m_OpTokens -= ops;
+
+    // Wait in short slices, so that changed limits apply to a copy that is waiting.
+    for (qint64 wait = debtMilliseconds(); wait > 0; wait = debtMilliseconds()) {
+        locker.unlock();
+        QThread::msleep(qMin(wait, static_cast<qint64>(100)));
+        locker.relock();
+
+        refill();
+    }
+}
+
+/** Adds the tokens earned since the last refill. Buckets hold at most a quarter second's worth. */
+void RateLimiter::refill()
+{
+    const qint64 now = m_Timer.elapsed();
+    const double seconds = (now - m_LastRefill) / 1000.0;
+
+    m_LastRefill = now;
+
+    if (m_BytesPerSecond > 0)
+        m_ByteTokens = qMin(m_ByteTokens + seconds * m_BytesPerSecond, m_BytesPerSecond / 4.0);
+    else
+        m_ByteTokens = 0;
+
+    if (m_OpsPerSecond > 0)
+        m_OpTokens = qMin(m_OpTokens + seconds * m_OpsPerSecond, m_OpsPerSecond / 4.0);
+    else
+        m_OpTokens = 0;
+}
+
+/** @return how long to wait until the buckets are out of debt */
+qint64 RateLimiter::debtMilliseconds() const
+{
+    qint64 rval = 0;
+
+    if (m_BytesPerSecond > 0 && m_ByteTokens < 0)
+        rval = qMax(rval, static_cast<qint64>(-m_ByteTokens * 1000 / m_BytesPerSecond) + 1);
+
+    if (m_OpsPerSecond > 0 && m_OpTokens < 0)
+        rval = qMax(rval, static_cast<qint64>(-m_OpTokens * 1000 / m_OpsPerSecond) + 1);
+
+    return rval;
+}
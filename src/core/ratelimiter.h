@@ -0,0 +1,73 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(RATELIMITER__H)
+
+#define RATELIMITER__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QtGlobal>
+
+/** Limits the bandwidth and the I/O operations per second of copies.
+
+    A token bucket for bytes and one for operations are filled at the configured rates.
+    Callers take tokens before they submit I/O and are made to wait while the buckets are
+    in debt, so that the average rates stay within the limits while short bursts of up
+    to a quarter of a second are let through.
+
+    The limits can be changed at any time, also while a copy is waiting. A limit of zero
+    means no limit.
+
+    RateLimiter is thread-safe.
+
+    @see Job::copyBlocks, OperationRunner::setRateLimit
+*/
+class LIBKPMCORE_EXPORT RateLimiter
+{
+    Q_DISABLE_COPY(RateLimiter)
+
+protected:
+    RateLimiter();
+
+public:
+    static RateLimiter& instance();
+
+    void setLimits(qint64 bytesPerSecond, qint64 opsPerSecond);
+    qint64 bytesPerSecond() const;
+    qint64 opsPerSecond() const;
+    bool isLimited() const;
+
+    void acquire(qint64 bytes, qint64 ops);
+
+protected:
+    void refill();
+    qint64 debtMilliseconds() const;
+
+private:
+    mutable QMutex m_Mutex;
+    QElapsedTimer m_Timer;
+    qint64 m_LastRefill;
+    qint64 m_BytesPerSecond;
+    qint64 m_OpsPerSecond;
+    double m_ByteTokens;
+    double m_OpTokens;
+};
+
+#endif
@@ -0,0 +1,225 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/rescuemap.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QTextStream>
+
+/** Creates a new, empty RescueMap. */
+RescueMap::RescueMap() :
+    m_SourceName(),
+    m_SectorSize(0),
+    m_Length(0),
+    m_Runs()
+{
+}
+
+/** Starts a new map with all sectors not tried yet.
+    @param sourceName the name of the source, e.g. its device node
+    @param sectorSize the source's sector size
+    @param length the number of sectors of the source
+*/
+void RescueMap::reset(const QString& sourceName, qint32 sectorSize, qint64 length)
+{
+    m_SourceName = sourceName;
+    m_SectorSize = sectorSize;
+    m_Length = length;
+    m_Runs.clear();
+
+    if (length > 0)
+        m_Runs.insert(0, NonTried);
+}
+
+/** @return true if the map is for the given source */
+bool RescueMap::matches(const QString& sourceName, qint32 sectorSize, qint64 length) const
+{
+    return m_SourceName == sourceName && m_SectorSize == sectorSize && m_Length == length;
+}
+
+/** Reads a map from a file.
+    @param fileName the name of the file to read
+    @return true if the file holds a complete map
+*/
+bool RescueMap::load(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream in(&file);
+    const QStringList header = in.readLine().split(QLatin1Char(' '));
+
+    if (header.size() != 4 || header[0] != QStringLiteral("rescue"))
+        return false;
+
+    bool sectorSizeOk = false;
+    bool lengthOk = false;
+
+    m_SourceName = header[1];
+    m_SectorSize = header[2].toInt(&sectorSizeOk);
+    m_Length = header[3].toLongLong(&lengthOk);
+    m_Runs.clear();
+
+    if (!sectorSizeOk || !lengthOk || m_SectorSize <= 0 || m_Length < 0)
+        return false;
+
+    qint64 next = 0;
+    QString line;
+
+    while (in.readLineInto(&line)) {
+        const QStringList fields = line.split(QLatin1Char(' '));
+
+        if (fields.size() != 3 || fields[2].size() != 1)
+            return false;
+
+        bool offsetOk = false;
+        bool numSectorsOk = false;
+        const qint64 offset = fields[0].toLongLong(&offsetOk);
+        const qint64 numSectors = fields[1].toLongLong(&numSectorsOk);
+        const char c = fields[2][0].toLatin1();
+
+        // runs must cover the source without gaps or overlaps
+        if (!offsetOk || !numSectorsOk || offset != next || numSectors <= 0 || (c != NonTried && c != NonSplit && c != BadSector && c != Finished))
+            return false;
+
+        setState(offset, numSectors, static_cast<State>(c));
+        next = offset + numSectors;
+    }
+
+    return next == m_Length;
+}
+
+/** Writes the map to a file, replacing it atomically.
+    @param fileName the name of the file to write
+    @return true on success
+*/
+bool RescueMap::save(const QString& fileName) const
+{
+    if (!QDir().mkpath(QFileInfo(fileName).absolutePath()))
+        return false;
+
+    QSaveFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+
+    QTextStream out(&file);
+    out << QStringLiteral("rescue ") << m_SourceName << QLatin1Char(' ') << m_SectorSize << QLatin1Char(' ') << m_Length << QLatin1Char('\n');
+
+    for (auto it = m_Runs.constBegin(); it != m_Runs.constEnd(); ++it) {
+        const qint64 end = it + 1 == m_Runs.constEnd() ? m_Length : (it + 1).key();
+        out << it.key() << QLatin1Char(' ') << end - it.key() << QLatin1Char(' ') << QLatin1Char(static_cast<char>(it.value())) << QLatin1Char('\n');
+    }
+
+    out.flush();
+
+    return file.commit();
+}
+
+/** Sets the state of a range of sectors, merging it with neighbouring runs in the same state.
+    @param offset the first sector, relative to the start of the source
+    @param numSectors the number of sectors
+    @param state the new state
+*/
+void RescueMap::setState(qint64 offset, qint64 numSectors, State state)
+{
+    const qint64 end = qMin(offset + numSectors, m_Length);
+
+    if (offset < 0 || offset >= end)
+        return;
+
+    // the run after the range keeps the state it has now
+    const bool hasAfter = end < m_Length && !m_Runs.isEmpty();
+    const State after = hasAfter ? this->state(end) : state;
+
+    auto it = m_Runs.lowerBound(offset);
+    while (it != m_Runs.end() && it.key() < end)
+        it = m_Runs.erase(it);
+
+    if (hasAfter)
+        m_Runs.insert(end, after);
+
+    if (offset > 0 && !m_Runs.isEmpty() && this->state(offset - 1) == state)
+        ; // the run before the range already has the state and now extends over it
+    else
+        m_Runs.insert(offset, state);
+
+    if (hasAfter && after == state)
+        m_Runs.remove(end);
+}
+
+/** @return the state of a sector
+    @param offset the sector, relative to the start of the source
+*/
+RescueMap::State RescueMap::state(qint64 offset) const
+{
+    auto it = m_Runs.upperBound(offset);
+
+    if (it == m_Runs.constBegin())
+        return NonTried;
+
+    return (--it).value();
+}
+
+/** @return all runs in the given state, first to last */
+QVector<RescueMap::Run> RescueMap::runs(State state) const
+{
+    QVector<Run> rval;
+
+    for (auto it = m_Runs.constBegin(); it != m_Runs.constEnd(); ++it) {
+        if (it.value() != state)
+            continue;
+
+        const qint64 end = it + 1 == m_Runs.constEnd() ? m_Length : (it + 1).key();
+        rval.append(Run{ it.key(), end - it.key(), state });
+    }
+
+    return rval;
+}
+
+/** @return the number of sectors in the given state */
+qint64 RescueMap::count(State state) const
+{
+    qint64 rval = 0;
+
+    for (const auto &run : runs(state))
+        rval += run.numSectors;
+
+    return rval;
+}
+
+/** @return the directory rescue maps are kept in */
+QString RescueMap::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QStringLiteral("/kpmcore/rescue");
+}
+
+/** @return the name of the map file for rescuing a source to a target */
+QString RescueMap::fileName(const QString& sourceName, const QString& targetName)
+{
+    QString name = sourceName + QStringLiteral("-to-") + targetName;
+    name.replace(QLatin1Char('/'), QLatin1Char('_'));
+
+    return directory() + QLatin1Char('/') + name + QStringLiteral(".map");
+}
@@ -0,0 +1,92 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(RESCUEMAP__H)
+
+#define RESCUEMAP__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QMap>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+
+/** Which sectors of a failing source a rescue copy has got off it so far.
+
+    A RescueMap splits the source into runs of sectors in the same state. Job::rescueBlocks()
+    updates it as it goes and saves it regularly, so that an interrupted rescue continues
+    where it stopped and never reads a sector again that has already been copied.
+
+    The map is saved as a text file: a header line with the source's name, sector size and
+    length, followed by a line per run with its offset, its number of sectors and its state.
+
+    @see Job::rescueBlocks
+*/
+class LIBKPMCORE_EXPORT RescueMap
+{
+public:
+    /** State of a run of sectors. The values are the characters used in the map file. */
+    enum State {
+        NonTried = '?',     /**< not read yet */
+        NonSplit = '*',     /**< failed to read as part of a larger block, not split up yet */
+        BadSector = '-',    /**< failed to read on its own */
+        Finished = '+'      /**< read and written to the target */
+    };
+
+    /** A run of sectors in the same state */
+    struct Run {
+        qint64 offset;      /**< first sector of the run, relative to the start of the source */
+        qint64 numSectors;
+        State state;
+    };
+
+public:
+    RescueMap();
+
+public:
+    void reset(const QString& sourceName, qint32 sectorSize, qint64 length);
+    bool load(const QString& fileName);
+    bool save(const QString& fileName) const;
+    bool matches(const QString& sourceName, qint32 sectorSize, qint64 length) const;
+
+    void setState(qint64 offset, qint64 numSectors, State state);
+    State state(qint64 offset) const;
+    QVector<Run> runs(State state) const;
+    qint64 count(State state) const;
+
+    const QString& sourceName() const {
+        return m_SourceName;    /**< @return the name of the source the map is for */
+    }
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the sector size offsets are in */
+    }
+    qint64 length() const {
+        return m_Length;    /**< @return the number of sectors of the source */
+    }
+
+    static QString directory();
+    static QString fileName(const QString& sourceName, const QString& targetName);
+
+private:
+    QString m_SourceName;
+    qint32 m_SectorSize;
+    qint64 m_Length;
+    QMap<qint64, State> m_Runs; // first sector of each run and its state; a run ends where the next begins
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/zstdimage.h"
+
+#include <QFile>
+#include <QString>
+#include <QtEndian>
+
+#include <errno.h>
+#include <unistd.h>
+
+static const quint32 zstdMagic = 0xfd2fb528;
+static const quint32 skippableMagic = 0x184d2a5e;
+static const quint32 seekableMagic = 0x8f92eab1;
+static const qint32 footerSize = 9;
+static const quint8 checksumFlag = 0x80;
+
+static bool readFully(int fd, void* buffer, qint64 length, qint64 offset)
+{
+    char* p = static_cast<char*>(buffer);
+
+    while (length > 0) {
+        const ssize_t n = pread(fd, p, length, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return false;
+
+        p += n;
+        length -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+/** @return true if kpmcore was built with zstd and can read and write compressed images */
+bool ZstdImage::isSupported()
+{
+#if defined(HAVE_ZSTD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/** Checks if a file is a compressed image by looking at the magic numbers at its start and end.
+    @param fileName the name of the file
+    @return true if the file starts with a zstd frame and ends with a seek table
+*/
+bool ZstdImage::isImage(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly) || file.size() < 4 + 8 + footerSize)
+        return false;
+
+    uchar head[4];
+    uchar tail[4];
+
+    if (!readFully(file.handle(), head, sizeof(head), 0) || !readFully(file.handle(), tail, sizeof(tail), file.size() - sizeof(tail)))
+        return false;
+
+    return qFromLittleEndian<quint32>(head) == zstdMagic && qFromLittleEndian<quint32>(tail) == seekableMagic;
+}
+
+/** Reads the seek table of a compressed image.
+    @param fd the file descriptor of the image file
+    @param fileSize the size of the image file
+    @param frames set to the frames in the image
+    @return true on success, false if the seek table is missing or not valid
+*/
+bool ZstdImage::readSeekTable(int fd, qint64 fileSize, QVector<Frame>& frames)
+{
+    uchar footer[footerSize];
+
+    if (fileSize < 8 + footerSize || !readFully(fd, footer, footerSize, fileSize - footerSize))
+        return false;
+
+    const quint32 numFrames = qFromLittleEndian<quint32>(footer);
+    const quint8 descriptor = footer[4];
+
+    // all bits but the checksum flag are reserved or unused
+    if (qFromLittleEndian<quint32>(footer + 5) != seekableMagic || (descriptor & ~checksumFlag) != 0)
+        return false;
+
+    const qint64 entrySize = (descriptor & checksumFlag) ? 12 : 8;
+    const qint64 tableSize = numFrames * entrySize + footerSize;
+    const qint64 tableStart = fileSize - tableSize - 8;
+
+    if (tableStart < 0)
+        return false;
+
+    QByteArray table(tableSize + 8 - footerSize, 0);
+    const uchar* p = reinterpret_cast<const uchar*>(table.constData());
+
+    if (!readFully(fd, table.data(), table.size(), tableStart))
+        return false;
+
+    if (qFromLittleEndian<quint32>(p) != skippableMagic || qFromLittleEndian<quint32>(p + 4) != tableSize)
+        return false;
+
+    frames.clear();
+    frames.reserve(numFrames);
+
+    qint64 offset = 0;
+    qint64 position = 0;
+
+    for (quint32 i = 0; i < numFrames; i++) {
+        const uchar* entry = p + 8 + i * entrySize;
+        Frame frame = { offset, position, qFromLittleEndian<quint32>(entry), qFromLittleEndian<quint32>(entry + 4) };
+
+        frames.append(frame);
+        offset += frame.compressedSize;
+        position += frame.size;
+    }
+
+    // the frames must fill the file up to the seek table
+    return offset == tableStart;
+}
+
+/** Builds the seek table for a compressed image.
+    @param frames the frames in the image, in order
+    @return the skippable frame holding the seek table, to be appended to the image
+*/
+QByteArray ZstdImage::seekTable(const QVector<Frame>& frames)
+{
+    const quint32 tableSize = frames.size() * 8 + footerSize;
+    QByteArray rval(tableSize + 8, 0);
+    uchar* p = reinterpret_cast<uchar*>(rval.data());
+
+    qToLittleEndian<quint32>(skippableMagic, p);
+    qToLittleEndian<quint32>(tableSize, p + 4);
+    p += 8;
+
+    for (const auto &frame : frames) {
+        qToLittleEndian<quint32>(frame.compressedSize, p);
+        qToLittleEndian<quint32>(frame.size, p + 4);
+        p += 8;
+    }
+
+    qToLittleEndian<quint32>(frames.size(), p);
+    p[4] = 0;
+    qToLittleEndian<quint32>(seekableMagic, p + 5);
+
+    return rval;
+}
@@ -0,0 +1,61 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(ZSTDIMAGE__H)
+
+#define ZSTDIMAGE__H
+
+#include <QByteArray>
+#include <QVector>
+#include <QtGlobal>
+
+class QString;
+
+/** Helpers for compressed backup images.
+
+    A compressed image is a file in the zstd seekable format: The image data is split into
+    frames of frameSize() bytes, each compressed independently into its own zstd frame, and
+    a seek table in a skippable frame at the end lists the compressed and uncompressed size
+    of every frame. Any part of the image can thus be decompressed without reading what
+    comes before it, and the file can still be decompressed with the plain zstd tool.
+
+    @see CopyTargetZstdFile, CopySourceZstdFile
+*/
+class ZstdImage
+{
+public:
+    /** A compressed frame in an image */
+    struct Frame {
+        qint64 offset;          /**< offset of the compressed frame in the file */
+        qint64 position;        /**< offset of the frame's data in the uncompressed image */
+        quint32 compressedSize;
+        quint32 size;
+    };
+
+public:
+    static bool isSupported();
+    static bool isImage(const QString& fileName);
+
+    static bool readSeekTable(int fd, qint64 fileSize, QVector<Frame>& frames);
+    static QByteArray seekTable(const QVector<Frame>& frames);
+
+    static quint32 frameSize() {
+        return 4 * 1024 * 1024;    /**< @return the uncompressed size of all frames but the last */
+    }
+};
+
+#endif
@@ -18,6 +18,8 @@
 
 #include "fs/ext2.h"
 
+#include "fs/superblockreader.h"
+
 #include "util/externalcommand.h"
 #include "util/capacity.h"
 
@@ -27,6 +29,7 @@
 namespace FS
 {
 FileSystem::CommandSupportType ext2::m_GetUsed = FileSystem::cmdSupportNone;
+FileSystem::CommandSupportType ext2::m_GetUsedExtents = FileSystem::cmdSupportNone;
 FileSystem::CommandSupportType ext2::m_GetLabel = FileSystem::cmdSupportNone;
 FileSystem::CommandSupportType ext2::m_Create = FileSystem::cmdSupportNone;
 FileSystem::CommandSupportType ext2::m_Grow = FileSystem::cmdSupportNone;
@@ -46,7 +49,9 @@ ext2::ext2(qint64 firstsector, qint64 lastsector, qint64 sectorsused, const QStr
 
 void ext2::init()
 {
-    m_GetUsed = findExternal(QStringLiteral("dumpe2fs")) ? cmdSupportFileSystem : cmdSupportNone;
+    // the used capacity is read from the superblock, dumpe2fs is only the fallback
+    m_GetUsed = cmdSupportFileSystem;
+    m_GetUsedExtents = findExternal(QStringLiteral("dumpe2fs")) ? cmdSupportFileSystem : cmdSupportNone;
     m_GetLabel = cmdSupportCore;
     m_SetLabel = findExternal(QStringLiteral("e2label")) ? cmdSupportFileSystem : cmdSupportNone;
     m_Create = findExternal(QStringLiteral("mkfs.ext2")) ? cmdSupportFileSystem : cmdSupportNone;
@@ -94,6 +99,10 @@ qint64 ext2::maxLabelLength() const
 
 qint64 ext2::readUsedCapacity(const QString& deviceNode) const
 {
+    const qint64 used = SuperblockReader(deviceNode).ext2UsedCapacity();
+    if (used >= 0)
+        return used;
+
     ExternalCommand cmd(QStringLiteral("dumpe2fs"), { QStringLiteral("-h"), deviceNode });
 
     if (cmd.run()) {
@@ -125,6 +134,80 @@ qint64 ext2::readUsedCapacity(const QString& deviceNode) const
     return -1;
 }
 
+qint64 ext2::readUsedExtents(const QString& deviceNode, QList<Extent>& extents) const
+{
+    ExternalCommand cmd(QStringLiteral("dumpe2fs"), { deviceNode });
+
+    if (!cmd.run() || cmd.exitCode() != 0)
+        return -1;
+
+    const QString output = cmd.output();
+
+    // The bitmaps cannot be trusted if the journal still has to be replayed or the file
+    // system is not clean.
+    QRegularExpression re(QStringLiteral("^Filesystem features:.*\\bneeds_recovery\\b"), QRegularExpression::MultilineOption);
+    if (re.match(output).hasMatch())
+        return -1;
+
+    re.setPattern(QStringLiteral("^Filesystem state:\\s+clean$"));
+    if (!re.match(output).hasMatch())
+        return -1;
+
+    qint64 blockCount = -1;
+    re.setPattern(QStringLiteral("^Block count:\\s+(\\d+)"));
+    QRegularExpressionMatch reBlockCount = re.match(output);
+
+    if (reBlockCount.hasMatch())
+        blockCount = reBlockCount.captured(1).toLongLong();
+
+    qint64 blockSize = -1;
+    re.setPattern(QStringLiteral("^Block size:\\s+(\\d+)"));
+    QRegularExpressionMatch reBlockSize = re.match(output);
+
+    if (reBlockSize.hasMatch())
+        blockSize = reBlockSize.captured(1).toLongLong();
+
+    if (blockCount < 0 || blockSize <= 0)
+        return -1;
+
+    // Each group lists its free blocks as "  Free blocks: 1-5, 9, 12-20". The summary in
+    // the header has the same name, but is not indented.
+    extents.clear();
+    qint64 nextUsed = 0;
+
+    re.setPattern(QStringLiteral("^[ \\t]+Free blocks: (.*)$"));
+    QRegularExpressionMatchIterator groups = re.globalMatch(output);
+
+    while (groups.hasNext()) {
+        const QStringList ranges = groups.next().captured(1).split(QStringLiteral(","), QString::SkipEmptyParts);
+
+        for (const auto &range : ranges) {
+            const QStringList bounds = range.trimmed().split(QStringLiteral("-"));
+            bool ok = false;
+            bool okLast = false;
+            const qint64 first = bounds[0].toLongLong(&ok);
+            const qint64 last = bounds.size() > 1 ? bounds[1].toLongLong(&okLast) : first;
+
+            if (!ok || (bounds.size() > 1 && !okLast) || first < nextUsed || last < first || last >= blockCount)
+                return -1;
+
+            if (first > nextUsed) {
+                Extent extent = { nextUsed * blockSize, (first - nextUsed) * blockSize };
+                extents.append(extent);
+            }
+
+            nextUsed = last + 1;
+        }
+    }
+
+    if (nextUsed < blockCount) {
+        Extent extent = { nextUsed * blockSize, (blockCount - nextUsed) * blockSize };
+        extents.append(extent);
+    }
+
+    return blockCount * blockSize;
+}
+
 bool ext2::check(Report& report, const QString& deviceNode) const
 {
     ExternalCommand cmd(report, QStringLiteral("e2fsck"), { QStringLiteral("-f"), QStringLiteral("-y"), QStringLiteral("-v"), deviceNode });
@@ -43,6 +43,7 @@ public:
     void init() override;
 
     qint64 readUsedCapacity(const QString& deviceNode) const override;
+    qint64 readUsedExtents(const QString& deviceNode, QList<Extent>& extents) const override;
     bool check(Report& report, const QString& deviceNode) const override;
     bool create(Report& report, const QString& deviceNode) override;
     bool resize(Report& report, const QString& deviceNode, qint64 length) const override;
@@ -53,6 +54,9 @@ public:
     CommandSupportType supportGetUsed() const override {
         return m_GetUsed;
     }
+    CommandSupportType supportGetUsedExtents() const override {
+        return m_GetUsedExtents;
+    }
     CommandSupportType supportGetLabel() const override {
         return m_GetLabel;
     }
@@ -97,6 +101,7 @@ public:
 
 public:
     static CommandSupportType m_GetUsed;
+    static CommandSupportType m_GetUsedExtents;
     static CommandSupportType m_GetLabel;
     static CommandSupportType m_Create;
     static CommandSupportType m_Grow;
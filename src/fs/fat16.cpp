@@ -18,6 +18,8 @@
 
 #include "fs/fat16.h"
 
+#include "fs/superblockreader.h"
+
 #include "util/externalcommand.h"
 #include "util/capacity.h"
 #include "util/report.h"
@@ -52,7 +54,8 @@ fat16::fat16(qint64 firstsector, qint64 lastsector, qint64 sectorsused, const QS
 
 void fat16::init()
 {
-    m_Create = m_GetUsed = m_Check = findExternal(QStringLiteral("mkfs.fat"), {}, 1) ? cmdSupportFileSystem : cmdSupportNone;
+    m_Create = m_Check = findExternal(QStringLiteral("mkfs.fat"), {}, 1) ? cmdSupportFileSystem : cmdSupportNone;
+    m_GetUsed = cmdSupportFileSystem;
     m_GetLabel = cmdSupportCore;
     m_SetLabel = findExternal(QStringLiteral("fatlabel")) ? cmdSupportFileSystem : cmdSupportNone;
     m_Move = cmdSupportCore;
@@ -103,6 +106,10 @@ qint64 fat16::maxLabelLength() const
 
 qint64 fat16::readUsedCapacity(const QString& deviceNode) const
 {
+    const qint64 used = SuperblockReader(deviceNode).fatUsedCapacity();
+    if (used >= 0)
+        return used;
+
     ExternalCommand cmd(QStringLiteral("fsck.fat"), { QStringLiteral("-n"), QStringLiteral("-v"), deviceNode });
 
     // Exit code 1 is returned when FAT dirty bit is set
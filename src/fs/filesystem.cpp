@@ -23,13 +23,12 @@
 #include "backend/corebackend.h"
 #include "backend/corebackendmanager.h"
 
+#include "util/blkidprobe.h"
 #include "util/externalcommand.h"
 #include "util/capacity.h"
 #include "util/helpers.h"
+#include "util/topologysnapshot.h"
 
-#include <blkid/blkid.h>
-
-#include <KMountPoint>
 #include <KLocalizedString>
 
 #include <QDebug>
@@ -95,25 +94,22 @@ qint64 FileSystem::readUsedCapacity(const QString& deviceNode) const
     return -1;
 }
 
-static QString readBlkIdValue(const QString& deviceNode, const QString& tag)
-{
-    blkid_cache cache;
-    QString rval;
-
-    if (blkid_get_cache(&cache, nullptr) == 0) {
-        blkid_dev dev;
+/** Reads which parts of the FileSystem are in use.
 
-        char* label = nullptr;
-        if ((dev = blkid_get_dev(cache, deviceNode.toLocal8Bit().constData(), BLKID_DEV_NORMAL)) != nullptr &&
-                (label = blkid_get_tag_value(cache, tag.toLocal8Bit().constData(), deviceNode.toLocal8Bit().constData()))) {
-            rval = QString::fromUtf8(label);
-            free(label);
-        }
+    Copying a FileSystem only needs to transfer these, the rest may be skipped.
 
-        blkid_put_cache(cache);
-    }
+    @param deviceNode the device node for the Partition the FileSystem is on
+    @param extents set to the used extents, sorted by offset and not overlapping
+    @return the number of bytes from the start of the FileSystem @p extents describe or -1
+            on failure. Everything in that range that is not in @p extents is unused;
+            everything after it must be treated as used.
+*/
+qint64 FileSystem::readUsedExtents(const QString& deviceNode, QList<Extent>& extents) const
+{
+    Q_UNUSED(deviceNode);
+    Q_UNUSED(extents);
 
-    return rval;
+    return -1;
 }
 
 FileSystem::Type FileSystem::detectFileSystem(const QString& partitionPath)
@@ -123,19 +119,10 @@ FileSystem::Type FileSystem::detectFileSystem(const QString& partitionPath)
 
 QString FileSystem::detectMountPoint(FileSystem* fs, const QString& partitionPath)
 {
-    QString mountPoint = QString();
-
-    KMountPoint::List mountPoints = KMountPoint::currentMountPoints(KMountPoint::NeedRealDeviceName);
-    mountPoints.append(KMountPoint::possibleMountPoints(KMountPoint::NeedRealDeviceName));
+    if (fs->type() == FileSystem::Lvm2_PV)
+        return FS::lvm2_pv::getVGName(partitionPath);
 
-    if (fs->type() == FileSystem::Lvm2_PV) {
-        mountPoint = FS::lvm2_pv::getVGName(partitionPath);
-    } else {
-        mountPoint = mountPoints.findByDevice(partitionPath) ?
-                     mountPoints.findByDevice(partitionPath)->mountPoint() :
-                     QString();
-    }
-    return mountPoint;
+    return TopologySnapshot::current()->mountPoint(partitionPath);
 }
 
 bool FileSystem::detectMountStatus(FileSystem* fs, const QString& partitionPath)
@@ -156,7 +143,7 @@ bool FileSystem::detectMountStatus(FileSystem* fs, const QString& partitionPath)
 */
 QString FileSystem::readLabel(const QString& deviceNode) const
 {
-    return readBlkIdValue(deviceNode, QStringLiteral("LABEL"));
+    return BlkidProbe::of(deviceNode).label();
 }
 
 /** Creates a new FileSystem
@@ -336,7 +323,7 @@ bool FileSystem::updateUUID(Report& report, const QString& deviceNode) const
  */
 QString FileSystem::readUUID(const QString& deviceNode) const
 {
-    return readBlkIdValue(deviceNode, QStringLiteral("UUID"));
+    return BlkidProbe::of(deviceNode).uuid();
 }
 
 /** Give implementations of FileSystem a chance to update the boot sector after the
@@ -96,6 +96,12 @@ public:
         cmdSupportBackend = 4           /**< supported by the backend */
     };
 
+    /** A range of bytes, counted from the start of the FileSystem */
+    struct Extent {
+        qint64 offset;
+        qint64 length;
+    };
+
     static const std::array< QColor, __lastType > defaultColorCode;
 
     Q_DECLARE_FLAGS(CommandSupportTypes, CommandSupportType)
@@ -110,6 +116,7 @@ public:
     virtual void init() {};
     virtual void scan(const QString& deviceNode);
     virtual qint64 readUsedCapacity(const QString& deviceNode) const;
+    virtual qint64 readUsedExtents(const QString& deviceNode, QList<Extent>& extents) const;
     virtual QString readLabel(const QString& deviceNode) const;
     virtual bool create(Report& report, const QString& deviceNode);
     virtual bool resize(Report& report, const QString& deviceNode, qint64 newLength) const;
@@ -128,6 +135,9 @@ public:
     virtual CommandSupportType supportGetUsed() const {
         return cmdSupportNone;    /**< @return CommandSupportType for getting used capacity */
     }
+    virtual CommandSupportType supportGetUsedExtents() const {
+        return cmdSupportNone;    /**< @return CommandSupportType for getting the used extents */
+    }
     virtual CommandSupportType supportGetLabel() const {
         return cmdSupportNone;    /**< @return CommandSupportType for reading label*/
     }
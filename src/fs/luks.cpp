@@ -26,6 +26,7 @@
 #include "util/capacity.h"
 #include "util/helpers.h"
 #include "util/report.h"
+#include "util/topologysnapshot.h"
 
 #include <QDebug>
 #include <QDialog>
@@ -558,20 +559,7 @@ bool luks::updateUUID(Report& report, const QString& deviceNode) const
 
 void luks::getMapperName(const QString& deviceNode)
 {
-    ExternalCommand cmd(QStringLiteral("lsblk"),
-                        { QStringLiteral("--list"),
-                          QStringLiteral("--noheadings"),
-                          QStringLiteral("--output"),
-                          QStringLiteral("name"),
-                          deviceNode });
-    if (cmd.run(-1) && cmd.exitCode() == 0) {
-        QStringList output=cmd.output().split(QStringLiteral("\n"));
-        output.removeFirst();
-        if (!output.first().isEmpty())
-            m_MapperName = QStringLiteral("/dev/mapper/") + output.first();
-    }
-    else
-        m_MapperName = QString();
+    m_MapperName = TopologySnapshot::current()->mapperNode(deviceNode);
 }
 
 void luks::getLuksInfo(const QString& deviceNode)
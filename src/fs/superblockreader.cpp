@@ -0,0 +1,423 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "fs/superblockreader.h"
+
+#include "util/checksum.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QtAlgorithms>
+#include <QtEndian>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// how much of an allocation bitmap or table is read at a time
+static const qint64 chunkSize = 1024 * 1024;
+
+static quint16 le16(const uchar* p) { return qFromLittleEndian<quint16>(p); }
+static quint32 le32(const uchar* p) { return qFromLittleEndian<quint32>(p); }
+static quint64 le64(const uchar* p) { return qFromLittleEndian<quint64>(p); }
+static quint32 be32(const uchar* p) { return qFromBigEndian<quint32>(p); }
+static quint64 be64(const uchar* p) { return qFromBigEndian<quint64>(p); }
+
+/** The CRC-32 of the F2FS checksums: the reflected IEEE polynomial, seeded and not inverted. */
+static quint32 f2fsCrc32(quint32 crc, const uchar* p, qint64 size)
+{
+    while (size-- > 0) {
+        crc ^= *p++;
+        for (qint32 i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+    }
+
+    return crc;
+}
+
+/** Opens a device for reading its metadata.
+    @param deviceNode the device the file system is on
+*/
+SuperblockReader::SuperblockReader(const QString& deviceNode) :
+    m_Fd(::open(deviceNode.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC))
+{
+}
+
+SuperblockReader::~SuperblockReader()
+{
+    if (m_Fd >= 0)
+        ::close(m_Fd);
+}
+
+/** Reads exactly @p size bytes, failing on short reads.
+    @param buffer where to store the data
+    @param size the number of bytes to read
+    @param offset where on the device to read from
+    @return true on success
+*/
+bool SuperblockReader::read(void* buffer, qint64 size, qint64 offset) const
+{
+    if (m_Fd < 0 || offset < 0)
+        return false;
+
+    char* p = static_cast<char*>(buffer);
+
+    while (size > 0) {
+        const ssize_t n = pread(m_Fd, p, size, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return false;
+
+        p += n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+/** Counts the set bits of an on-disk bitmap.
+    @param offset where on the device the bitmap (or this run of it) starts
+    @param size the number of bytes to read
+    @param bitsLeft the number of bits still to count; bits past it are padding and ignored
+    @return the number of set bits or -1 on a read error
+*/
+qint64 SuperblockReader::countBits(qint64 offset, qint64 size, qint64& bitsLeft) const
+{
+    QByteArray buffer(static_cast<int>(qMin(size, chunkSize)), 0);
+    qint64 count = 0;
+
+    while (size > 0 && bitsLeft > 0) {
+        const qint64 n = qMin(size, static_cast<qint64>(buffer.size()));
+
+        if (!read(buffer.data(), n, offset))
+            return -1;
+
+        const uchar* p = reinterpret_cast<const uchar*>(buffer.constData());
+
+        for (qint64 i = 0; i < n && bitsLeft > 0; i++) {
+            const quint8 mask = bitsLeft >= 8 ? 0xff : static_cast<quint8>((1 << bitsLeft) - 1);
+            count += qPopulationCount(static_cast<quint8>(p[i] & mask));
+            bitsLeft -= 8;
+        }
+
+        size -= n;
+        offset += n;
+    }
+
+    return count;
+}
+
+/** @return the bytes used in an ext2, ext3 or ext4 file system, as dumpe2fs -h reports them */
+qint64 SuperblockReader::ext2UsedCapacity() const
+{
+    uchar sb[1024];
+
+    if (!read(sb, sizeof(sb), 1024) || le16(sb + 56) != 0xef53)
+        return -1;
+
+    const quint32 logBlockSize = le32(sb + 24);
+    if (logBlockSize > 6)
+        return -1;
+
+    quint64 blocks = le32(sb + 4);
+    quint64 freeBlocks = le32(sb + 12);
+
+    // INCOMPAT_64BIT adds the high halves of the block counts
+    if (le32(sb + 96) & 0x80) {
+        blocks |= static_cast<quint64>(le32(sb + 0x150)) << 32;
+        freeBlocks |= static_cast<quint64>(le32(sb + 0x158)) << 32;
+    }
+
+    if (freeBlocks > blocks)
+        return -1;
+
+    return (blocks - freeBlocks) * (1024 << logBlockSize);
+}
+
+/** @return the bytes used in an XFS file system, from the data block counts of the primary superblock */
+qint64 SuperblockReader::xfsUsedCapacity() const
+{
+    uchar sb[512];
+
+    if (!read(sb, sizeof(sb), 0) || memcmp(sb, "XFSB", 4) != 0)
+        return -1;
+
+    const quint32 blockSize = be32(sb + 4);
+    const quint64 dataBlocks = be64(sb + 8);
+    const quint64 freeDataBlocks = be64(sb + 144);
+
+    if (blockSize < 512 || blockSize > 65536 || freeDataBlocks > dataBlocks)
+        return -1;
+
+    return (dataBlocks - freeDataBlocks) * blockSize;
+}
+
+/** @return the bytes Btrfs has allocated on this device, as btrfs filesystem show reports them */
+qint64 SuperblockReader::btrfsUsedCapacity() const
+{
+    uchar sb[4096];
+
+    if (!read(sb, sizeof(sb), 64 * 1024) || memcmp(sb + 0x40, "_BHRfS_M", 8) != 0)
+        return -1;
+
+    // only crc32c superblocks are verified, newer checksum types are left to the btrfs tool
+    if (le16(sb + 0xc4) != 0 || crc32c(sb + 0x20, sizeof(sb) - 0x20) != le32(sb))
+        return -1;
+
+    // dev_item.bytes_used: what this device, not the whole file system, has in chunks
+    return static_cast<qint64>(le64(sb + 0xd9));
+}
+
+/** @return the bytes in clusters the NTFS $Bitmap marks as in use */
+qint64 SuperblockReader::ntfsUsedCapacity() const
+{
+    uchar boot[512];
+
+    if (!read(boot, sizeof(boot), 0) || memcmp(boot + 3, "NTFS    ", 8) != 0)
+        return -1;
+
+    const quint16 bytesPerSector = le16(boot + 0x0b);
+    if (bytesPerSector < 256 || bytesPerSector > 4096 || (bytesPerSector & (bytesPerSector - 1)) != 0)
+        return -1;
+
+    // values above 0x80 are negative powers of two
+    const quint8 spc = boot[0x0d];
+    const qint64 sectorsPerCluster = spc <= 0x80 ? spc : Q_INT64_C(1) << (256 - spc);
+    if (sectorsPerCluster == 0 || sectorsPerCluster > 4096)
+        return -1;
+
+    const qint64 clusterSize = bytesPerSector * sectorsPerCluster;
+    const qint64 clusters = static_cast<qint64>(le64(boot + 0x28)) / sectorsPerCluster;
+    const qint64 mftOffset = static_cast<qint64>(le64(boot + 0x30)) * clusterSize;
+
+    const qint8 cpr = static_cast<qint8>(boot[0x40]);
+    const qint64 recordSize = cpr > 0 ? cpr * clusterSize : Q_INT64_C(1) << -cpr;
+    if (recordSize < 512 || recordSize > 65536)
+        return -1;
+
+    // record 6 of the MFT is $Bitmap; the first records of the MFT are always contiguous
+    QVector<uchar> record(static_cast<int>(recordSize));
+    uchar* r = record.data();
+
+    if (!read(r, recordSize, mftOffset + 6 * recordSize) || memcmp(r, "FILE", 4) != 0)
+        return -1;
+
+    // undo the update sequence: the last two bytes of every 512 bytes were swapped for a marker
+    const quint16 usaOffset = le16(r + 4);
+    const quint16 usaCount = le16(r + 6);
+    if (usaCount == 0 || usaOffset + 2 * usaCount > recordSize || (usaCount - 1) * 512 > recordSize)
+        return -1;
+
+    for (qint32 i = 1; i < usaCount; i++) {
+        uchar* end = r + i * 512 - 2;
+        if (memcmp(end, r + usaOffset, 2) != 0)
+            return -1;
+        memcpy(end, r + usaOffset + 2 * i, 2);
+    }
+
+    qint64 bitsLeft = clusters;
+    qint64 used = -1;
+
+    for (qint64 off = le16(r + 0x14); off + 16 <= recordSize; ) {
+        const quint32 type = le32(r + off);
+        const quint32 length = le32(r + off + 4);
+
+        if (type == 0xffffffff)
+            break;
+
+        if (length < 16 || off + length > recordSize)
+            return -1;
+
+        // the unnamed $DATA attribute holds the bitmap
+        if (type == 0x80 && r[off + 9] == 0) {
+            used = 0;
+
+            if (r[off + 8] == 0) {
+                const quint32 valueLength = le32(r + off + 0x10);
+                const quint16 valueOffset = le16(r + off + 0x14);
+                if (valueOffset + valueLength > length)
+                    return -1;
+
+                for (quint32 i = 0; i < valueLength && bitsLeft > 0; i++, bitsLeft -= 8)
+                    used += qPopulationCount(static_cast<quint8>(r[off + valueOffset + i] & (bitsLeft >= 8 ? 0xff : (1 << bitsLeft) - 1)));
+            } else {
+                qint64 bytesLeft = static_cast<qint64>(le64(r + off + 0x30));
+                qint64 lcn = 0;
+                qint64 p = off + le16(r + off + 0x20);
+                const qint64 end = off + length;
+
+                // the mapping pairs: a header byte with the sizes of a run length and a signed LCN delta
+                while (p < end && r[p] != 0 && bytesLeft > 0 && bitsLeft > 0) {
+                    const qint32 lengthBytes = r[p] & 0x0f;
+                    const qint32 offsetBytes = r[p] >> 4;
+                    p++;
+
+                    if (lengthBytes == 0 || lengthBytes > 8 || offsetBytes > 8 || p + lengthBytes + offsetBytes > end)
+                        return -1;
+
+                    qint64 runLength = 0;
+                    for (qint32 i = lengthBytes - 1; i >= 0; i--)
+                        runLength = (runLength << 8) | r[p + i];
+                    p += lengthBytes;
+
+                    const qint64 runBytes = qMin(runLength * clusterSize, bytesLeft);
+
+                    if (offsetBytes == 0) {
+                        // a sparse run reads as zeros
+                        bitsLeft -= runBytes * 8;
+                    } else {
+                        qint64 delta = static_cast<qint8>(r[p + offsetBytes - 1]);
+                        for (qint32 i = offsetBytes - 2; i >= 0; i--)
+                            delta = (delta << 8) | r[p + i];
+                        lcn += delta;
+
+                        const qint64 bits = countBits(lcn * clusterSize, runBytes, bitsLeft);
+                        if (bits < 0)
+                            return -1;
+                        used += bits;
+                    }
+
+                    p += offsetBytes;
+                    bytesLeft -= runBytes;
+                }
+            }
+
+            break;
+        }
+
+        off += length;
+    }
+
+    return used < 0 ? -1 : used * clusterSize;
+}
+
+/** @return the bytes in clusters the first FAT of a FAT12, FAT16 or FAT32 file system marks as in use,
+            as fsck.fat reports them */
+qint64 SuperblockReader::fatUsedCapacity() const
+{
+    uchar bs[512];
+
+    if (!read(bs, sizeof(bs), 0) || le16(bs + 510) != 0xaa55)
+        return -1;
+
+    const quint32 bytesPerSector = le16(bs + 11);
+    const quint32 sectorsPerCluster = bs[13];
+    const quint32 reservedSectors = le16(bs + 14);
+    const quint32 fats = bs[16];
+    const quint32 rootEntries = le16(bs + 17);
+    const quint32 totalSectors = le16(bs + 19) ? le16(bs + 19) : le32(bs + 32);
+    const quint32 fatSectors = le16(bs + 22) ? le16(bs + 22) : le32(bs + 36);
+
+    if (bytesPerSector < 512 || bytesPerSector > 4096 || (bytesPerSector & (bytesPerSector - 1)) != 0 ||
+            sectorsPerCluster == 0 || (sectorsPerCluster & (sectorsPerCluster - 1)) != 0 ||
+            reservedSectors == 0 || fats == 0 || fatSectors == 0)
+        return -1;
+
+    const quint64 dataStart = reservedSectors + static_cast<quint64>(fats) * fatSectors + (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+    if (dataStart >= totalSectors)
+        return -1;
+
+    const qint64 clusters = (totalSectors - dataStart) / sectorsPerCluster;
+    const qint64 clusterSize = bytesPerSector * sectorsPerCluster;
+
+    // the cluster count alone decides the FAT type; entries 0 and 1 are reserved
+    const qint32 entryBits = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+    const qint64 fatBytes = qMin(static_cast<qint64>(fatSectors) * bytesPerSector, ((clusters + 2) * entryBits + 7) / 8);
+    const qint64 entries = qMin(clusters + 2, fatBytes * 8 / entryBits);
+
+    // FAT12 entries straddle byte boundaries, so the table (at most 6 KiB) is read in one piece
+    QByteArray buffer(static_cast<int>(entryBits == 12 ? fatBytes : qMin(fatBytes, chunkSize)), 0);
+    const uchar* p = reinterpret_cast<const uchar*>(buffer.constData());
+    const qint64 perChunk = buffer.size() * 8 / entryBits;
+
+    qint64 used = 0;
+
+    for (qint64 first = 0; first < entries; first += perChunk) {
+        const qint64 count = qMin(perChunk, entries - first);
+
+        if (!read(buffer.data(), (count * entryBits + 7) / 8, reservedSectors * static_cast<qint64>(bytesPerSector) + first * entryBits / 8))
+            return -1;
+
+        for (qint64 i = qMax(Q_INT64_C(0), 2 - first); i < count; i++) {
+            quint32 entry;
+
+            if (entryBits == 12)
+                entry = (i & 1) ? le16(p + i * 3 / 2) >> 4 : le16(p + i * 3 / 2) & 0x0fff;
+            else if (entryBits == 16)
+                entry = le16(p + i * 2);
+            else
+                entry = le32(p + i * 4) & 0x0fffffff;
+
+            if (entry != 0)
+                used++;
+        }
+    }
+
+    return used * clusterSize;
+}
+
+/** @return the bytes in valid blocks recorded by the newest valid F2FS checkpoint */
+qint64 SuperblockReader::f2fsUsedCapacity() const
+{
+    static const quint32 f2fsMagic = 0xf2f52010;
+
+    uchar sb[512];
+
+    if (!read(sb, sizeof(sb), 1024) || le32(sb) != f2fsMagic)
+        return -1;
+
+    const quint32 logBlockSize = le32(sb + 16);
+    const quint32 logBlocksPerSegment = le32(sb + 20);
+    const quint64 cpBlockAddress = le32(sb + 76);
+
+    if (logBlockSize != 12 || logBlocksPerSegment > 16)
+        return -1;
+
+    const qint64 blockSize = 1 << logBlockSize;
+    QVector<uchar> cp(static_cast<int>(blockSize));
+    quint64 newestVersion = 0;
+    qint64 used = -1;
+
+    // the two checkpoint packs are a segment apart, the newer valid one counts
+    for (qint32 pack = 0; pack < 2; pack++) {
+        const quint64 address = cpBlockAddress + (static_cast<quint64>(pack) << logBlocksPerSegment);
+
+        if (!read(cp.data(), blockSize, address * blockSize))
+            continue;
+
+        const quint32 checksumOffset = le32(cp.constData() + 164);
+        if (checksumOffset < 168 || checksumOffset > blockSize - 4)
+            continue;
+
+        if (f2fsCrc32(f2fsMagic, cp.constData(), checksumOffset) != le32(cp.constData() + checksumOffset))
+            continue;
+
+        const quint64 version = le64(cp.constData());
+        if (used < 0 || version > newestVersion) {
+            newestVersion = version;
+            used = static_cast<qint64>(le64(cp.constData() + 16)) * blockSize;
+        }
+    }
+
+    return used;
+}
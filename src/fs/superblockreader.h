@@ -0,0 +1,65 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(SUPERBLOCKREADER__H)
+
+#define SUPERBLOCKREADER__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QtGlobal>
+
+class QString;
+
+/** Reads how much of a file system is in use straight from its on-disk metadata.
+
+    Asking dumpe2fs, xfs_db, btrfs, ntfsresize or fsck.fat costs a process spawn and a
+    parse of its output for every unmounted file system a scan finds. SuperblockReader
+    gets the same numbers from the superblock (ext2/3/4, XFS, Btrfs), the checkpoint
+    (F2FS) or the allocation bitmap or table (NTFS, FAT) instead.
+
+    Every reader checks magic numbers and, where the format has them, checksums, and
+    returns -1 for anything it does not understand. The FileSystem subclasses fall back
+    to their external tools in that case.
+*/
+class LIBKPMCORE_EXPORT SuperblockReader
+{
+    Q_DISABLE_COPY(SuperblockReader)
+
+public:
+    explicit SuperblockReader(const QString& deviceNode);
+    ~SuperblockReader();
+
+public:
+    bool isOpen() const { return m_Fd >= 0; } /**< @return true if the device could be opened */
+
+    qint64 ext2UsedCapacity() const;
+    qint64 xfsUsedCapacity() const;
+    qint64 btrfsUsedCapacity() const;
+    qint64 ntfsUsedCapacity() const;
+    qint64 fatUsedCapacity() const;
+    qint64 f2fsUsedCapacity() const;
+
+protected:
+    bool read(void* buffer, qint64 size, qint64 offset) const;
+    qint64 countBits(qint64 offset, qint64 size, qint64& bitsLeft) const;
+
+private:
+    int m_Fd;
+};
+
+#endif
@@ -18,27 +18,50 @@
 
 #include "jobs/backupfilesystemjob.h"
 
+#include "core/blockhasher.h"
+#include "core/blockindex.h"
+#include "core/checksummanifest.h"
+#include "core/chunkrecipe.h"
 #include "core/partition.h"
 #include "core/device.h"
 #include "core/copysourcedevice.h"
+#include "core/copysourceextents.h"
+#include "core/copysourcefile.h"
+#include "core/copysourcerepository.h"
+#include "core/copysourcezstdfile.h"
+#include "core/ioqueue.h"
 #include "core/copytargetfile.h"
+#include "core/copytargetrepository.h"
+#include "core/copytargetstream.h"
+#include "core/copytargetzstdfile.h"
+#include "core/rescuemap.h"
+#include "core/zstdimage.h"
 
 #include "fs/filesystem.h"
 
+#include "util/capacity.h"
 #include "util/report.h"
 
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
 #include <KLocalizedString>
 
 /** Creates a new BackupFileSystemJob
     @param sourcedevice the device the FileSystem to back up is on
     @param sourcepartition the Partition the FileSystem to back up is on
     @param filename name of the file to backup to
+    @param parentfilename name of the file of the previous backup for an incremental backup, empty for a full backup
+    @param indexed false to not write checksums and a block index for a full backup that is not verified
 */
-BackupFileSystemJob::BackupFileSystemJob(Device& sourcedevice, Partition& sourcepartition, const QString& filename) :
+BackupFileSystemJob::BackupFileSystemJob(Device& sourcedevice, Partition& sourcepartition, const QString& filename, const QString& parentfilename, bool indexed) :
     Job(),
     m_SourceDevice(sourcedevice),
     m_SourcePartition(sourcepartition),
-    m_FileName(filename)
+    m_FileName(filename),
+    m_ParentFileName(parentfilename),
+    m_Indexed(indexed)
 {
 }
 
@@ -57,14 +80,84 @@ bool BackupFileSystemJob::run(Report& parent)
         rval = sourcePartition().fileSystem().backup(*report, sourceDevice(), sourcePartition().deviceNode(), fileName());
     else if (sourcePartition().fileSystem().supportBackup() == FileSystem::cmdSupportCore) {
         CopySourceDevice copySource(sourceDevice(), sourcePartition().fileSystem().firstSector(), sourcePartition().fileSystem().lastSector());
-        CopyTargetFile copyTarget(fileName(), sourceDevice().logicalSize());
+        // a stream gets a raw image, to be compressed or encrypted by whoever reads it
+        const bool stream = IoQueue::isStream(fileName());
+        // a file name ending in .recipe asks for a deduplicating backup into the repository
+        // next to it
+        const bool repository = ChunkRecipe::isRecipeName(fileName()) && !stream;
+        // a file name ending in .zst asks for a compressed image, which a rescue cannot
+        // write because it does not write the image in order
+        const bool compress = fileName().endsWith(QStringLiteral(".zst"), Qt::CaseInsensitive) && ZstdImage::isSupported() && !rescue() && !stream;
+        // a rescue skips sectors that cannot be read, so its checksums would not describe the
+        // source; a stream has no place to keep them next to it
+        const bool sidecars = indexed() && !rescue() && !stream;
+        CopyTargetFile rawTarget(fileName(), sourceDevice().logicalSize());
+        CopyTargetZstdFile zstdTarget(fileName(), sourceDevice().logicalSize());
+        CopyTargetStream streamTarget(fileName(), sourceDevice().logicalSize());
+        CopyTargetRepository repositoryTarget(fileName(), sourceDevice().logicalSize());
+        CopyTarget& copyTarget = stream ? static_cast<CopyTarget&>(streamTarget) : repository ? static_cast<CopyTarget&>(repositoryTarget) :
+                                 compress ? static_cast<CopyTarget&>(zstdTarget) : rawTarget;
+        const QString rescueMapFileName = RescueMap::fileName(sourcePartition().deviceNode(), fileName());
+        RescueMap rescueMap;
+
+        // an image a rescue has begun to write is continued, not written anew
+        if (rescue() && rescueMap.load(rescueMapFileName) && rescueMap.matches(sourcePartition().deviceNode(), sourceDevice().logicalSize(), copySource.length()))
+            rawTarget.setKeepContents(true);
 
-        if (!copySource.open())
+        if (stream && (rescue() || !parentFileName().isEmpty()))
+            report->line() << xi18nc("@info:progress", "Rescues and incremental backups cannot be written to the stream <filename>%1</filename>.", fileName());
+        else if (repository && (rescue() || !parentFileName().isEmpty()))
+            report->line() << xi18nc("@info:progress", "Rescues and incremental backups cannot be written to the repository of <filename>%1</filename>.", fileName());
+        else if (!copySource.open())
             report->line() << xi18nc("@info:progress", "Could not open file system on source partition <filename>%1</filename> for backup.", sourcePartition().deviceNode());
         else if (!copyTarget.open())
             report->line() << xi18nc("@info:progress", "Could not create backup file <filename>%1</filename>.", fileName());
-        else
-            rval = copyBlocks(*report, copyTarget, copySource);
+        else {
+            // the checksums are cheap enough to keep them next to the image unless the
+            // data is to stay in the kernel
+            ChecksumManifest checksums(copySource.sectorSize());
+            BlockIndex index(copySource.sectorSize(), copySource.length());
+            if (!stream) {
+                QFile::remove(ChecksumManifest::fileName(fileName()));
+                QFile::remove(BlockIndex::fileName(fileName()));
+            }
+
+            if (rescue())
+                rval = rescueBlocks(*report, copyTarget, copySource, sourcePartition().deviceNode(), rescueMapFileName);
+            else if (!sidecars)
+                rval = copyUsedBlocks(*report, copyTarget, copySource, sourcePartition());
+            else if (parentFileName().isEmpty())
+                rval = backupFull(*report, copyTarget, copySource, checksums, index);
+            else
+                rval = backupIncremental(*report, copyTarget, copySource, checksums, index);
+
+            if (rval && repository)
+                report->line() << xi18nc("@info:progress", "%1 of data were backed up, %2 of it new to the repository.", Capacity::formatByteSize(repositoryTarget.storedBytes()), Capacity::formatByteSize(repositoryTarget.addedBytes()));
+
+            if (rval && sidecars && !checksums.save(ChecksumManifest::fileName(fileName())))
+                report->line() << xi18nc("@info:progress", "Could not write checksums file <filename>%1</filename>.", ChecksumManifest::fileName(fileName()));
+
+            if (rval && sidecars && !index.save(BlockIndex::fileName(fileName()))) {
+                report->line() << xi18nc("@info:progress", "Could not write block index file <filename>%1</filename>.", BlockIndex::fileName(fileName()));
+                rval = false;
+            }
+
+            if (rval && stream && verify())
+                report->line() << xi18nc("@info:progress", "The backup was written to a stream and cannot be read back to verify it.");
+
+            if (rval && sidecars && verify()) {
+                CopySourceFile rawImage(fileName(), sourceDevice().logicalSize());
+                CopySourceZstdFile zstdImage(fileName(), sourceDevice().logicalSize());
+                CopySourceRepository repositoryImage(fileName(), sourceDevice().logicalSize());
+                CopySource& image = repository ? static_cast<CopySource&>(repositoryImage) : compress ? static_cast<CopySource&>(zstdImage) : rawImage;
+
+                if (!image.open()) {
+                    report->line() << xi18nc("@info:progress", "Could not open backup file <filename>%1</filename> for verifying.", fileName());
+                    rval = false;
+                } else
+                    rval = verifyBlocks(*report, image, checksums);
+            }
+        }
     }
 
     jobFinished(*report, rval);
@@ -72,7 +165,59 @@ bool BackupFileSystemJob::run(Report& parent)
     return rval;
 }
 
+/** Copies the whole FileSystem to the image, hashing its blocks on the way. */
+bool BackupFileSystemJob::backupFull(Report& report, CopyTarget& target, CopySource& source, ChecksumManifest& checksums, BlockIndex& index)
+{
+    BlockHasher hasher(index);
+
+    return copyUsedBlocks(report, target, source, sourcePartition(), &checksums, &hasher);
+}
+
+/** Copies the blocks that changed since the parent backup to a delta image.
+
+    The FileSystem is hashed first and compared with the parent's index. Then only the
+    changed blocks are read again and written to the image; the others are left as holes.
+*/
+bool BackupFileSystemJob::backupIncremental(Report& report, CopyTarget& target, CopySource& source, ChecksumManifest& checksums, BlockIndex& index)
+{
+    BlockIndex parentIndex;
+
+    if (!parentIndex.load(BlockIndex::fileName(parentFileName()))) {
+        report.line() << xi18nc("@info:progress", "Could not read the block index of the previous backup <filename>%1</filename>.", parentFileName());
+        return false;
+    }
+
+    QList<FileSystem::Extent> extents;
+    qint64 extentsLength = 0;
+
+    if (!readUsedExtents(report, sourcePartition(), extents, extentsLength))
+        extentsLength = 0;
+
+    CopySourceExtents usedSource(source, extents, extentsLength);
+
+    if (!hashBlocks(report, usedSource, index))
+        return false;
+
+    const QList<FileSystem::Extent> changed = index.changedExtents(parentIndex);
+    qint64 changedBytes = 0;
+
+    for (const auto &extent : changed)
+        changedBytes += extent.length;
+
+    report.line() << xi18nc("@info:progress", "%1 changed since the previous backup.", Capacity::formatByteSize(qMin(changedBytes, source.length() * source.sectorSize())));
+
+    // the parent is found relative to this image, so the backups can be moved together
+    index.setParent(QFileInfo(fileName()).dir().relativeFilePath(QFileInfo(parentFileName()).absoluteFilePath()));
+
+    CopySourceExtents changedSource(source, changed, source.length() * source.sectorSize());
+
+    return copyBlocks(report, target, changedSource, &checksums);
+}
+
 QString BackupFileSystemJob::description() const
 {
+    if (!parentFileName().isEmpty())
+        return xi18nc("@info:progress", "Back up the changes to the file system on partition <filename>%1</filename> since <filename>%2</filename> to <filename>%3</filename>", sourcePartition().deviceNode(), parentFileName(), fileName());
+
     return xi18nc("@info:progress", "Back up file system on partition <filename>%1</filename> to <filename>%2</filename>", sourcePartition().deviceNode(), fileName());
 }
@@ -23,6 +23,10 @@
 
 #include <QString>
 
+class BlockIndex;
+class ChecksumManifest;
+class CopySource;
+class CopyTarget;
 class Partition;
 class Device;
 class Report;
@@ -31,12 +35,20 @@ class Report;
 
     Backs up a FileSystem from a given Device and Partition to a file with the given filename.
 
+    If the file name of a previous backup is given, the backup is incremental: only the
+    blocks that changed since the previous backup are written to the file.
+
+    A full backup that is not indexed writes neither checksums nor a block index next to
+    the image. Nothing then needs to see the data, so it can be copied inside the kernel,
+    or even shared with the source by a file system that supports reflinks. Such a backup
+    cannot be verified or be the previous backup of an incremental one.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class BackupFileSystemJob : public Job
 {
 public:
-    BackupFileSystemJob(Device& sourcedevice, Partition& sourcepartition, const QString& filename);
+    BackupFileSystemJob(Device& sourcedevice, Partition& sourcepartition, const QString& filename, const QString& parentfilename = QString(), bool indexed = true);
 
 public:
     bool run(Report& parent) override;
@@ -44,6 +56,9 @@ public:
     QString description() const override;
 
 protected:
+    bool backupFull(Report& report, CopyTarget& target, CopySource& source, ChecksumManifest& checksums, BlockIndex& index);
+    bool backupIncremental(Report& report, CopyTarget& target, CopySource& source, ChecksumManifest& checksums, BlockIndex& index);
+
     Partition& sourcePartition() {
         return m_SourcePartition;
     }
@@ -61,11 +76,19 @@ protected:
     const QString& fileName() const {
         return m_FileName;
     }
+    const QString& parentFileName() const {
+        return m_ParentFileName;
+    }
+    bool indexed() const {
+        return m_Indexed || !parentFileName().isEmpty() || verify();    /**< @return true if checksums and a block index are written */
+    }
 
 private:
     Device& m_SourceDevice;
     Partition& m_SourcePartition;
     QString m_FileName;
+    QString m_ParentFileName;
+    bool m_Indexed;
 };
 
 #endif
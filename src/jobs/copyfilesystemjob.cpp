@@ -18,15 +18,20 @@
 
 #include "jobs/copyfilesystemjob.h"
 
+#include "core/checksummanifest.h"
 #include "core/partition.h"
 #include "core/device.h"
 #include "core/copysourcedevice.h"
 #include "core/copytargetdevice.h"
+#include "core/copytargettee.h"
+#include "core/rescuemap.h"
 
 #include "fs/filesystem.h"
 
 #include "util/report.h"
 
+#include <QStringList>
+
 #include <KLocalizedString>
 
 /** Creates a new CopyFileSystemJob
@@ -49,49 +54,178 @@ qint32 CopyFileSystemJob::numSteps() const
     return 100;
 }
 
-bool CopyFileSystemJob::run(Report& parent)
+/** Adds another target to copy the FileSystem to.
+    @param targetdevice the Device the FileSystem is to be copied to
+    @param targetpartition the Partition the FileSystem is to be copied to
+*/
+void CopyFileSystemJob::addTarget(Device& targetdevice, Partition& targetpartition)
 {
-    bool rval = false;
+    m_MoreTargets.append(Target(&targetdevice, &targetpartition));
+}
 
+/** Removes all targets added with addTarget() */
+void CopyFileSystemJob::resetTargets()
+{
+    m_MoreTargets.clear();
+}
+
+/** @param targetpartition one of the target Partitions
+    @return true if the FileSystem has been copied to @p targetpartition in the last run
+*/
+bool CopyFileSystemJob::isCopied(const Partition& targetpartition) const
+{
+    return m_Copied.contains(&targetpartition);
+}
+
+bool CopyFileSystemJob::run(Report& parent)
+{
     Report* report = jobStarted(parent);
 
-    if (targetPartition().fileSystem().length() < sourcePartition().fileSystem().length())
-        report->line() << xi18nc("@info:progress", "Cannot copy file system: File system on target partition <filename>%1</filename> is smaller than the file system on source partition <filename>%2</filename>.", targetPartition().deviceNode(), sourcePartition().deviceNode());
-    else if (sourcePartition().fileSystem().supportCopy() == FileSystem::cmdSupportFileSystem)
-        rval = sourcePartition().fileSystem().copy(*report, targetPartition().deviceNode(), sourcePartition().deviceNode());
-    else if (sourcePartition().fileSystem().supportCopy() == FileSystem::cmdSupportCore) {
-        CopySourceDevice copySource(sourceDevice(), sourcePartition().fileSystem().firstSector(), sourcePartition().fileSystem().lastSector());
-        CopyTargetDevice copyTarget(targetDevice(), targetPartition().fileSystem().firstSector(), targetPartition().fileSystem().lastSector());
-
-        if (!copySource.open())
-            report->line() << xi18nc("@info:progress", "Could not open file system on source partition <filename>%1</filename> for copying.", sourcePartition().deviceNode());
-        else if (!copyTarget.open())
-            report->line() << xi18nc("@info:progress", "Could not open file system on target partition <filename>%1</filename> for copying.", targetPartition().deviceNode());
-        else {
-            rval = copyBlocks(*report, copyTarget, copySource);
-            report->line() << xi18nc("@info:progress", "Closing device. This may take a while, especially on slow devices like Memory Sticks.");
-        }
+    m_Copied.clear();
+
+    QList<Target> targets;
+
+    for (const auto &target : QList<Target>() << Target(&targetDevice(), &targetPartition()) << m_MoreTargets) {
+        if (target.second->fileSystem().length() < sourcePartition().fileSystem().length())
+            report->line() << xi18nc("@info:progress", "Cannot copy file system: File system on target partition <filename>%1</filename> is smaller than the file system on source partition <filename>%2</filename>.", target.second->deviceNode(), sourcePartition().deviceNode());
+        else
+            targets.append(target);
+    }
+
+    if (sourcePartition().fileSystem().supportCopy() == FileSystem::cmdSupportFileSystem) {
+        for (const auto &target : targets)
+            if (sourcePartition().fileSystem().copy(*report, target.second->deviceNode(), sourcePartition().deviceNode()))
+                m_Copied.append(target.second);
+    } else if (sourcePartition().fileSystem().supportCopy() == FileSystem::cmdSupportCore && !targets.isEmpty())
+        copyCore(*report, targets);
+
+    for (const auto &target : targets)
+        if (isCopied(*target.second) && !finishTarget(*report, target))
+            m_Copied.removeAll(target.second);
+
+    const bool rval = !m_Copied.isEmpty();
+
+    jobFinished(*report, rval);
+
+    return rval;
+}
+
+/** Copies the FileSystem to the given targets, reading it only once.
+    @param report the Report to write information to
+    @param targets the targets to copy to
+    @return true if the FileSystem has been copied to at least one of the targets
+*/
+bool CopyFileSystemJob::copyCore(Report& report, const QList<Target>& targets)
+{
+    CopySourceDevice copySource(sourceDevice(), sourcePartition().fileSystem().firstSector(), sourcePartition().fileSystem().lastSector());
+
+    if (!copySource.open()) {
+        report.line() << xi18nc("@info:progress", "Could not open file system on source partition <filename>%1</filename> for copying.", sourcePartition().deviceNode());
+        return false;
     }
 
-    if (rval) {
-        // set the target file system to the length of the source
-        const qint64 newLastSector = targetPartition().fileSystem().firstSector() + sourcePartition().fileSystem().length() - 1;
+    QList<Target> opened;
+    QList<CopyTargetDevice*> copyTargets;
 
-        targetPartition().fileSystem().setLastSector(newLastSector);
+    for (const auto &target : targets) {
+        CopyTargetDevice* copyTarget = new CopyTargetDevice(*target.first, target.second->fileSystem().firstSector(), target.second->fileSystem().lastSector());
 
-        // and set a new UUID, if the target filesystem supports UUIDs
-        if (targetPartition().fileSystem().supportUpdateUUID() == FileSystem::cmdSupportFileSystem) {
-            targetPartition().fileSystem().updateUUID(*report, targetPartition().deviceNode());
-            targetPartition().fileSystem().setUUID(targetPartition().fileSystem().readUUID(targetPartition().deviceNode()));
+        if (!copyTarget->open()) {
+            report.line() << xi18nc("@info:progress", "Could not open file system on target partition <filename>%1</filename> for copying.", target.second->deviceNode());
+            delete copyTarget;
+        } else {
+            opened.append(target);
+            copyTargets.append(copyTarget);
         }
     }
 
+    ChecksumManifest checksums(copySource.sectorSize());
+    const bool verifying = verify() && !rescue();
+    bool rval = false;
+
+    // A rescue can only be continued on the very same targets, so they all name its map.
+    QStringList targetNames;
+
+    for (const auto &target : opened)
+        targetNames.append(QStringLiteral("%1@%2").arg(target.second->deviceNode()).arg(target.second->fileSystem().firstSector()));
+
+    // A rescue goes on past sectors that cannot be read, so what it copied cannot be verified.
+    auto copyTo = [&](CopyTarget& target) {
+        if (rescue())
+            return rescueBlocks(report, target, copySource, sourcePartition().deviceNode(), RescueMap::fileName(sourcePartition().deviceNode(), targetNames.join(QLatin1Char('+'))));
+
+        return copyUsedBlocks(report, target, copySource, sourcePartition(), verifying ? &checksums : nullptr);
+    };
+
+    // A single target is written directly, several are written by a tee.
+    if (copyTargets.size() == 1)
+        rval = copyTo(*copyTargets.first());
+    else if (copyTargets.size() > 1) {
+        CopyTargetTee tee;
+
+        for (const auto &copyTarget : copyTargets)
+            tee.addTarget(*copyTarget);
+
+        report.line() << xi18nc("@info:progress", "Copying to %1 target partitions at once.", copyTargets.size());
+
+        if (!tee.open())
+            report.line() << xi18nc("@info:progress", "Could not start copying to the target partitions.");
+        else
+            rval = copyTo(tee);
+
+        for (qint32 i = 0; i < copyTargets.size(); i++)
+            if (tee.isFailed(i))
+                report.line() << xi18nc("@info:progress", "Writing to target partition <filename>%1</filename> failed. Copying to the other target partitions continued without it.", opened[i].second->deviceNode());
+
+        for (qint32 i = copyTargets.size() - 1; i >= 0; i--)
+            if (tee.isFailed(i)) {
+                opened.removeAt(i);
+                delete copyTargets.takeAt(i);
+            }
+    }
+
     if (rval)
-        rval = targetPartition().fileSystem().updateBootSector(*report, targetPartition().deviceNode());
+        for (const auto &target : opened)
+            m_Copied.append(target.second);
 
-    jobFinished(*report, rval);
+    for (qint32 i = 0; rval && verifying && i < opened.size(); i++) {
+        CopySourceDevice copied(*opened[i].first, opened[i].second->fileSystem().firstSector(), opened[i].second->fileSystem().lastSector());
 
-    return rval;
+        if (!copied.open()) {
+            report.line() << xi18nc("@info:progress", "Could not open file system on target partition <filename>%1</filename> for verifying.", opened[i].second->deviceNode());
+            m_Copied.removeAll(opened[i].second);
+        } else if (!verifyBlocks(report, copied, checksums))
+            m_Copied.removeAll(opened[i].second);
+    }
+
+    report.line() << xi18nc("@info:progress", "Closing device. This may take a while, especially on slow devices like Memory Sticks.");
+
+    qDeleteAll(copyTargets);
+
+    return !m_Copied.isEmpty();
+}
+
+/** Updates a target's FileSystem after it has been copied to.
+    @param report the Report to write information to
+    @param target the target to update
+    @return true on success
+*/
+bool CopyFileSystemJob::finishTarget(Report& report, const Target& target)
+{
+    Partition& partition = *target.second;
+
+    // set the target file system to the length of the source
+    const qint64 newLastSector = partition.fileSystem().firstSector() + sourcePartition().fileSystem().length() - 1;
+
+    partition.fileSystem().setLastSector(newLastSector);
+
+    // and set a new UUID, if the target filesystem supports UUIDs
+    if (partition.fileSystem().supportUpdateUUID() == FileSystem::cmdSupportFileSystem) {
+        partition.fileSystem().updateUUID(report, partition.deviceNode());
+        partition.fileSystem().setUUID(partition.fileSystem().readUUID(partition.deviceNode()));
+    }
+
+    return partition.fileSystem().updateBootSector(report, partition.deviceNode());
 }
 
 QString CopyFileSystemJob::description() const
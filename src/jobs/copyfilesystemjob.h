@@ -21,6 +21,8 @@
 
 #include "jobs/job.h"
 
+#include <QList>
+#include <QPair>
 #include <QtGlobal>
 
 class Partition;
@@ -33,6 +35,9 @@ class QString;
 
     Copy a FileSystem on a given Partition and Device to another Partition on a (possibly other) Device.
 
+    More targets can be added to copy the FileSystem to all of them while reading it only once.
+    If copying to one of them fails, the others are copied anyway.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class CopyFileSystemJob : public Job
@@ -45,7 +50,16 @@ public:
     qint32 numSteps() const override;
     QString description() const override;
 
+    void addTarget(Device& targetdevice, Partition& targetpartition);
+    void resetTargets();
+    bool isCopied(const Partition& targetpartition) const;
+
 protected:
+    typedef QPair<Device*, Partition*> Target;
+
+    bool copyCore(Report& report, const QList<Target>& targets);
+    bool finishTarget(Report& report, const Target& target);
+
     Partition& targetPartition() {
         return m_TargetPartition;
     }
@@ -79,6 +93,8 @@ private:
     Partition& m_TargetPartition;
     Device& m_SourceDevice;
     Partition& m_SourcePartition;
+    QList<Target> m_MoreTargets;
+    QList<const Partition*> m_Copied;
 };
 
 #endif
@@ -23,6 +23,7 @@
 #include "backend/corebackenddevice.h"
 #include "backend/corebackendpartitiontable.h"
 
+#include "core/copytargetdevice.h"
 #include "core/partition.h"
 #include "core/device.h"
 #include "core/lvmdevice.h"
@@ -36,11 +37,13 @@
 /** Creates a new DeletePartitionJob
     @param d the Device the Partition to delete is on
     @param p the Partition to delete
+    @param discard true to let the device discard the Partition's sectors before deleting it
 */
-DeletePartitionJob::DeletePartitionJob(Device& d, Partition& p) :
+DeletePartitionJob::DeletePartitionJob(Device& d, Partition& p, bool discard) :
     Job(),
     m_Device(d),
-    m_Partition(p)
+    m_Partition(p),
+    m_Discard(discard)
 {
 }
 
@@ -58,6 +61,14 @@ bool DeletePartitionJob::run(Report& parent)
     Report* report = jobStarted(parent);
 
     if (device().type() == Device::Disk_Device) {
+        // Discarding is only a hint to the device, so the Partition is deleted even if it fails.
+        if (discard()) {
+            CopyTargetDevice target(device(), partition().firstSector(), partition().lastSector());
+
+            if (!target.open() || !eraseBlocks(*report, target, CopyTargetDevice::Discard))
+                report->line() << xi18nc("@info:progress", "Could not discard the sectors of partition <filename>%1</filename>.", partition().deviceNode());
+        }
+
         CoreBackendDevice* backendDevice = CoreBackendManager::self()->backend()->openDevice(device().deviceNode());
 
         if (backendDevice) {
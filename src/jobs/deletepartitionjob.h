@@ -28,17 +28,25 @@ class Report;
 class QString;
 
 /** Delete a Partition.
+
+    Optionally lets the device discard the Partition's sectors first, so that SSDs and thinly
+    provisioned storage can reclaim them.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class DeletePartitionJob : public Job
 {
 public:
-    DeletePartitionJob(Device& d, Partition& p);
+    DeletePartitionJob(Device& d, Partition& p, bool discard = false);
 
 public:
     bool run(Report& parent) override;
     QString description() const override;
 
+    bool discard() const {
+        return m_Discard;    /**< @return true if the Partition's sectors are discarded before it is deleted */
+    }
+
 protected:
     Partition& partition() {
         return m_Partition;
@@ -57,6 +65,7 @@ protected:
 private:
     Device& m_Device;
     Partition& m_Partition;
+    bool m_Discard;
 };
 
 #endif
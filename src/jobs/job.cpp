@@ -18,27 +18,212 @@
 
 #include "jobs/job.h"
 
+#include "core/blockhasher.h"
+#include "core/blockindex.h"
+#include "core/checksummanifest.h"
+#include "core/copyjournal.h"
 #include "core/device.h"
 #include "core/copysource.h"
 #include "core/copytarget.h"
 #include "core/copysourcedevice.h"
+#include "core/copysourceextents.h"
 #include "core/copytargetdevice.h"
+#include "core/copypipeline.h"
+#include "core/ioqueue.h"
+#include "core/kernelcopy.h"
+#include "core/partition.h"
+#include "core/ratelimiter.h"
+#include "core/rescuemap.h"
 
+#include "util/bufferpool.h"
+#include "util/capacity.h"
+#include "util/checksum.h"
 #include "util/report.h"
 
+#include <QAtomicInteger>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QIcon>
+#include <QList>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
 #include <QTime>
 
 #include <KIconLoader>
 #include <KLocalizedString>
 
+#include <algorithm>
+
+#include <unistd.h>
+
+/** Tells the user if the kernel does not keep others from using a target while it is written to.
+    @param report the Report to write to
+    @param target the CopyTarget about to be written to
+*/
+static void reportShared(Report& report, const CopyTarget& target)
+{
+    if (!target.isExclusive())
+        report.line() << xi18nc("@info:progress", "The target device is in use and could not be opened exclusively. No file system on it must be mounted until this operation has finished.");
+}
+
+bool Job::s_DefaultVerify = false;
+QAtomicInteger<quint16> Job::s_DefaultIoPriority(0);
+
+/** Reads every n-th chunk of a copy back and compares it with its checksum */
+class VerifyTask : public QRunnable
+{
+public:
+    VerifyTask(int fd, qint64 firstSector, const ChecksumManifest& checksums, qint32 first, qint32 step, qint32 alignment, QAtomicInteger<qint64>& sectorsVerified) :
+        m_Fd(fd),
+        m_FirstSector(firstSector),
+        m_Checksums(checksums),
+        m_First(first),
+        m_Step(step),
+        m_Alignment(alignment),
+        m_SectorsVerified(sectorsVerified),
+        m_Mismatches(),
+        m_ReadFailed(false)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+        const qint32 sectorSize = m_Checksums.sectorSize();
+        const QVector<ChecksumManifest::Entry>& entries = m_Checksums.entries();
+        qint64 bufferSize = 0;
+
+        for (qint32 i = m_First; i < entries.size(); i += m_Step)
+            bufferSize = qMax(bufferSize, entries[i].numSectors * sectorSize);
+
+        char* buffer = static_cast<char*>(BufferPool::instance().acquire(qMax(bufferSize, static_cast<qint64>(m_Alignment)), m_Alignment));
+
+        for (qint32 i = m_First; i < entries.size() && !m_ReadFailed; i += m_Step) {
+            const ChecksumManifest::Entry& entry = entries[i];
+            const qint64 size = entry.numSectors * sectorSize;
+            const qint64 offset = (m_FirstSector + entry.offset) * sectorSize;
+            qint64 done = 0;
+
+            while (done < size) {
+                const ssize_t n = pread(m_Fd, buffer + done, size - done, offset + done);
+                if (n <= 0) {
+                    m_ReadFailed = true;
+                    break;
+                }
+                done += n;
+            }
+
+            if (!m_ReadFailed && crc32c(buffer, size) != entry.checksum)
+                m_Mismatches.append(entry.offset);
+
+            m_SectorsVerified.fetchAndAddRelaxed(entry.numSectors);
+        }
+
+        BufferPool::instance().release(buffer);
+    }
+
+    const int m_Fd;
+    const qint64 m_FirstSector;
+    const ChecksumManifest& m_Checksums;
+    const qint32 m_First;
+    const qint32 m_Step;
+    const qint32 m_Alignment;
+    QAtomicInteger<qint64>& m_SectorsVerified;
+    QVector<qint64> m_Mismatches;
+    bool m_ReadFailed;
+};
+
+/** Reads every n-th block of a source and puts its hash into a BlockIndex */
+class HashTask : public QRunnable
+{
+public:
+    HashTask(CopySource& source, BlockIndex& index, qint64 first, qint64 step, qint32 alignment, bool dropCache, QAtomicInteger<qint64>& sectorsHashed) :
+        m_Source(source),
+        m_Index(index),
+        m_First(first),
+        m_Step(step),
+        m_Alignment(alignment),
+        m_DropCache(dropCache),
+        m_SectorsHashed(sectorsHashed),
+        m_ReadFailed(false)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+        const int fd = m_Source.fileDescriptor();
+        const qint32 sectorSize = m_Source.sectorSize();
+        char* buffer = static_cast<char*>(BufferPool::instance().acquire(BlockIndex::blockBytes(), m_Alignment));
+
+        for (qint64 block = m_First; block < m_Index.numBlocks() && !m_ReadFailed; block += m_Step) {
+            const qint64 first = m_Source.firstSector() + block * m_Index.blockSectors();
+            const qint64 numSectors = qMin(m_Index.blockSectors(), m_Source.lastSector() + 1 - first);
+
+            if (!m_Source.isUnused(first, numSectors)) {
+                const qint64 size = numSectors * sectorSize;
+                qint64 done = 0;
+
+                while (done < size) {
+                    const ssize_t n = pread(fd, buffer + done, size - done, first * sectorSize + done);
+                    if (n <= 0) {
+                        m_ReadFailed = true;
+                        break;
+                    }
+                    done += n;
+                }
+
+                if (m_DropCache)
+                    IoQueue::dropCache(fd, first * sectorSize, size);
+
+                m_Index.setHash(block, BlockIndex::hashBlock(buffer, size));
+                m_Index.setFlags(block, BlockIndex::Used);
+            }
+
+            m_SectorsHashed.fetchAndAddRelaxed(numSectors);
+        }
+
+        BufferPool::instance().release(buffer);
+    }
+
+    CopySource& m_Source;
+    BlockIndex& m_Index;
+    const qint64 m_First;
+    const qint64 m_Step;
+    const qint32 m_Alignment;
+    const bool m_DropCache;
+    QAtomicInteger<qint64>& m_SectorsHashed;
+    bool m_ReadFailed;
+};
+
 Job::Job() :
-    m_Status(Pending)
+    m_Status(Pending),
+    m_IoQueueDepth(IoQueue::defaultDepth()),
+    m_CachePolicy(IoQueue::defaultCachePolicy()),
+    m_Verify(defaultVerify()),
+    m_Rescue(false),
+    m_IoPriority(),
+    m_PreviousIoPriority()
 {
 }
 
-bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source)
+/** @return the I/O priority the Job runs at, defaultIoPriority() unless one has been set */
+IoPriority Job::ioPriority() const
+{
+    return m_IoPriority.isSet() ? m_IoPriority : defaultIoPriority();
+}
+
+/** Copies all sectors of a CopySource to a CopyTarget.
+    @param report the Report to write to
+    @param target the CopyTarget to copy to
+    @param source the CopySource to copy from
+    @param checksums if not nullptr, the checksums of the sectors copied are added to it
+    @param hasher if not nullptr, the data copied is handed to it to fill a BlockIndex
+    @param journal if not nullptr, the journal to record checkpoints in; it must describe
+           this copy, or the whole copy this one is the rest of
+    @return true on success
+*/
+bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source, ChecksumManifest* checksums, BlockHasher* hasher, CopyJournal* journal)
 {
     /** @todo copyBlocks() assumes that source.sectorSize() == target.sectorSize(). */
 
@@ -47,41 +232,139 @@ bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source)
         return false;
     }
 
+    reportShared(report, target);
+
+    // Nothing needs to see the data if there are no checksums, hashes or checkpoints to
+    // take, so it can stay in the kernel if source and target both have file descriptors
+    // and copyBlocksInKernel() finds that worthwhile.
+    if (checksums == nullptr && hasher == nullptr && journal == nullptr && !source.overlaps(target)) {
+        bool supported = true;
+        const bool copied = copyBlocksInKernel(report, target, source, supported);
+
+        if (supported)
+            return copied;
+    }
+
     bool rval = true;
-    const qint64 blockSize = 16065 * 8; // number of sectors per block to copy
-    const qint64 blocksToCopy = source.length() / blockSize;
+    const qint32 numBuffers = 4; // number of blocks that may be read ahead of the writer
+    // Only a copy whose target overlaps its source has to run backward, so as not to overwrite
+    // sectors it has yet to read. A journaled copy runs the way its journal records. All other
+    // copies run forward, which streams need.
+    const bool backward = target.firstSector() > source.firstSector() && (journal != nullptr || source.overlaps(target));
+
+    report.line() << xi18nc("@info:progress", "Copying %1 sectors from %2 to %3, direction: %4.", source.length(), source.firstSector(), target.firstSector(), backward ? -1 : 1);
+
+    // A throttled copy is held back by the rate limit rather than the device, so it gains
+    // nothing from a deep queue, and its small blocks would let the queue hold more
+    // requests than the ring holds segments.
+    const quint32 queueDepth = RateLimiter::instance().bytesPerSecond() > 0 ? qMin(ioQueueDepth(), static_cast<quint32>(numBuffers)) : ioQueueDepth();
+
+    // The reader thread reads the blocks in the same order they are written in, so
+    // overlapping moves are safe: no block is read after a block behind it was written.
+    CopyPipeline pipeline(source, target, numBuffers, queueDepth);
+
+    if (!pipeline.isValid()) {
+        report.line() << xi18nc("@info:progress", "Could not allocate memory for copying.");
+        return false;
+    }
+
+    pipeline.setRange(source.firstSector(), target.firstSector(), source.length(), backward);
+
+    // A checkpoint can only be trusted once what it covers has been flushed to the device.
+    if (journal && target.fileDescriptor() < 0) {
+        report.line() << xi18nc("@info:progress", "The copy cannot be journaled. It cannot be resumed if it is interrupted.");
+        journal = nullptr;
+    }
+
+    // Sectors written after the last checkpoint must not overwrite source sectors that the
+    // checkpoint does not cover yet, or resuming would read data that is already gone. So an
+    // overlapping copy writes at most as many sectors between checkpoints as source and
+    // target are apart, in blocks no larger than that.
+    const qint64 distance = qAbs(target.firstSector() - source.firstSector());
+    const bool overlapping = source.overlaps(target) && distance > 0;
+    const qint64 journalBase = journal ? journal->sectorsDone() : 0;
+    qint64 checkpointed = 0;
+    QElapsedTimer checkpointTimer;
 
-    qint64 readOffset = source.firstSector();
-    qint64 writeOffset = target.firstSector();
-    qint32 copyDir = 1;
+    // A throttled copy waits for each block before writing it, so blocks are kept small
+    // enough to be let through a few times a second rather than in long bursts.
+    qint64 maxBlockSize = journal && overlapping ? distance : 0;
+    const qint64 bytesPerSecond = RateLimiter::instance().bytesPerSecond();
 
-    if (target.firstSector() > source.firstSector()) {
-        readOffset = source.firstSector() + source.length() - blockSize;
-        writeOffset = target.firstSector() + source.length() - blockSize;
-        copyDir = -1;
+    if (bytesPerSecond > 0) {
+        const qint64 throttledBlockSize = qMax(bytesPerSecond / 4, static_cast<qint64>(256 * 1024)) / source.sectorSize();
+        maxBlockSize = maxBlockSize > 0 ? qMin(maxBlockSize, throttledBlockSize) : throttledBlockSize;
     }
 
-    report.line() << xi18nc("@info:progress", "Copying %1 blocks (%2 sectors) from %3 to %4, direction: %5.", blocksToCopy, source.length(), readOffset, writeOffset, copyDir);
+    if (maxBlockSize > 0)
+        pipeline.setMaxBlockSize(maxBlockSize);
+
+    pipeline.setCachePolicy(cachePolicy());
+    pipeline.setChecksums(checksums != nullptr);
+    pipeline.setIoPriority(ioPriority());
+
+    if (pipeline.readDirect())
+        report.line() << xi18nc("@info:progress", "Reading without the page cache.");
+
+    if (pipeline.writeDirect())
+        report.line() << xi18nc("@info:progress", "Writing without the page cache.");
+
+    report.line() << xi18nc("@info:progress", "Starting with a block size of %1.", Capacity::formatByteSize(pipeline.tuner().blockSize() * source.sectorSize()));
 
     qint64 blocksCopied = 0;
+    qint64 sectorsCopied = 0;
+    bool tuned = false;
 
-    void* buffer = malloc(blockSize * source.sectorSize());
     int percent = 0;
     QTime t;
     t.start();
 
-    while (blocksCopied < blocksToCopy) {
-        if (!(rval = source.readSectors(buffer, readOffset + blockSize * blocksCopied * copyDir, blockSize)))
-            break;
+    auto checkpoint = [&]() {
+        if (!pipeline.finishWrites() || fdatasync(target.fileDescriptor()) != 0 || !journal->checkpoint(journalBase + target.sectorsWritten())) {
+            report.line() << xi18nc("@info:progress", "Could not record the progress of copying in the journal.");
+            return false;
+        }
 
-        if (!(rval = target.writeSectors(buffer, writeOffset + blockSize * blocksCopied * copyDir, blockSize)))
+        checkpointed = target.sectorsWritten();
+        checkpointTimer.restart();
+        return true;
+    };
+
+    checkpointTimer.start();
+    pipeline.start();
+
+    while (CopyPipeline::Block* block = pipeline.takeBlock()) {
+        const qint64 numSectors = block->numSectors;
+
+        if (journal && sectorsCopied > checkpointed && (checkpointTimer.elapsed() >= 1000 || (overlapping && sectorsCopied + numSectors - checkpointed > distance)))
+            if (!(rval = checkpoint()))
+                break;
+
+        if (checksums)
+            for (const auto &entry : block->checksums)
+                checksums->append(entry);
+
+        if (hasher)
+            hasher->add(source, block->readOffset, block->buffer, numSectors);
+
+        RateLimiter::instance().acquire(numSectors * source.sectorSize(), pipeline.numRequests(block));
+
+        if (!(rval = pipeline.writeBlock(block)))
             break;
 
-        if (++blocksCopied * 100 / blocksToCopy != percent) {
-            percent = blocksCopied * 100 / blocksToCopy;
+        blocksCopied++;
+        sectorsCopied += numSectors;
+
+        if (!tuned && !pipeline.tuner().isTuning()) {
+            tuned = true;
+            report.line() << xi18nc("@info:progress", "Using a block size of %1, measured %2 MiB/second.", Capacity::formatByteSize(pipeline.tuner().blockSize() * source.sectorSize()), pipeline.tuner().bytesPerSecond() / 1024 / 1024);
+        }
+
+        if (sectorsCopied * 100 / source.length() != percent) {
+            percent = sectorsCopied * 100 / source.length();
 
             if (percent % 5 == 0 && t.elapsed() > 1000) {
-                const qint64 mibsPerSec = (blocksCopied * blockSize * source.sectorSize() / 1024 / 1024) / (t.elapsed() / 1000);
+                const qint64 mibsPerSec = (sectorsCopied * source.sectorSize() / 1024 / 1024) / (t.elapsed() / 1000);
                 const qint64 estSecsLeft = (100 - percent) * t.elapsed() / percent / 1000;
                 report.line() << xi18nc("@info:progress", "Copying %1 MiB/second, estimated time left: %2", mibsPerSec, QTime(0, 0).addSecs(estSecsLeft).toString());
             }
@@ -89,34 +372,792 @@ bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source)
         }
     }
 
-    const qint64 lastBlock = source.length() % blockSize;
+    if (!pipeline.finishWrites() || pipeline.readFailed())
+        rval = false;
 
-    // copy the remainder
-    if (rval && lastBlock > 0) {
-        Q_ASSERT(lastBlock < blockSize);
+    if (rval && journal)
+        rval = checkpoint();
 
-        const qint64 lastBlockReadOffset = copyDir > 0 ? readOffset + blockSize * blocksCopied : source.firstSector();
-        const qint64 lastBlockWriteOffset = copyDir > 0 ? writeOffset + blockSize * blocksCopied : target.firstSector();
+    pipeline.cancel();
+    pipeline.wait();
 
-        report.line() << xi18nc("@info:progress", "Copying remainder of block size %1 from %2 to %3.", lastBlock, lastBlockReadOffset, lastBlockWriteOffset);
+    if (rval && !target.finish()) {
+        report.line() << xi18nc("@info:progress", "Could not complete the copy target.");
+        rval = false;
+    }
+
+    if (rval && hasher && !hasher->finish(source)) {
+        report.line() << xi18nc("@info:progress", "Could not compute the block hashes of the copy.");
+        rval = false;
+    }
+
+    if (!tuned && rval)
+        report.line() << xi18nc("@info:progress", "Copying finished before the block size was tuned.");
+
+    if (pipeline.sectorsSkipped() > 0)
+        report.line() << xi18nc("@info:progress", "%1 not used by the file system were skipped.", Capacity::formatByteSize(pipeline.sectorsSkipped() * source.sectorSize()));
+
+    if (pipeline.sectorsZeroed() > 0)
+        report.line() << xi18nc("@info:progress", "%1 of zeros were not written.", Capacity::formatByteSize(pipeline.sectorsZeroed() * source.sectorSize()));
+
+    report.line() << xi18ncp("@info:progress argument 2 is a string such as 7 sectors (localized accordingly)", "Copying 1 block (%2) finished.", "Copying %1 blocks (%2) finished.", blocksCopied, i18np("1 sector", "%1 sectors", target.sectorsWritten()));
+
+    return rval;
+}
+
+/** Copies all sectors of a CopySource to a CopyTarget without reading them into a buffer.
+    @param report the Report to write to
+    @param target the CopyTarget to copy to
+    @param source the CopySource to copy from
+    @param supported returns false if the source and target cannot be copied between this
+           way, or should not be because neither is a file and the copy is not to use the
+           page cache; nothing has been written then and they must be copied with copyBlocks()
+    @return true on success
+*/
+bool Job::copyBlocksInKernel(Report& report, CopyTarget& target, CopySource& source, bool& supported)
+{
+    KernelCopy kernelCopy(source, target);
+
+    // Between two devices the data would only be spliced through a pipe, bypassing the cache
+    // policy, the block size tuning and the I/O queue of copyBlocks(), so that is only done
+    // if the page cache is to be used anyway.
+    if (!(supported = kernelCopy.isPossible() && (kernelCopy.involvesFile() || cachePolicy() == IoQueue::CacheBuffered)))
+        return false;
+
+    qint64 sectorsCopied = 0;
+    qint64 blocksCopied = 0;
+    bool rval = true;
 
-        rval = source.readSectors(buffer, lastBlockReadOffset, lastBlock);
+    int percent = 0;
+    QTime t;
+    t.start();
 
-        if (rval)
-            rval = target.writeSectors(buffer, lastBlockWriteOffset, lastBlock);
+    while (sectorsCopied < source.length()) {
+        // Blocks are smaller while throttled, so that the limit is kept a few times a second.
+        const qint64 bytesPerSecond = RateLimiter::instance().bytesPerSecond();
+        const qint64 blockBytes = bytesPerSecond > 0 ? qBound(static_cast<qint64>(1024 * 1024), bytesPerSecond / 4, static_cast<qint64>(64 * 1024 * 1024)) : 64 * 1024 * 1024;
+        const qint64 blockSize = qMax(blockBytes / source.sectorSize(), static_cast<qint64>(1));
+        const qint64 numSectors = qMin(blockSize, source.length() - sectorsCopied);
+        const bool last = sectorsCopied + numSectors == source.length();
+
+        // the kernel splits the block as it sees fit; count it as one read and one write
+        RateLimiter::instance().acquire(numSectors * source.sectorSize(), 2);
+
+        if (!kernelCopy.copySectors(source.firstSector() + sectorsCopied, target.firstSector() + sectorsCopied, numSectors, last)) {
+            // only the first block can be copied again by other means, or it would be counted twice
+            if (sectorsCopied == 0 && !kernelCopy.isSupported()) {
+                supported = false;
+                return false;
+            }
 
-        if (rval)
-            emit progress(100);
+            report.line() << xi18nc("@info:progress", "Copying sectors from %1 to %2 failed.", source.firstSector() + sectorsCopied, source.firstSector() + sectorsCopied + numSectors - 1);
+            rval = false;
+            break;
+        }
+
+        if (blocksCopied++ == 0)
+            report.line() << xi18nc("@info:progress", "Copying %1 sectors from %2 to %3 without reading them into memory.", source.length(), source.firstSector(), target.firstSector());
+
+        sectorsCopied += numSectors;
+
+        if (sectorsCopied * 100 / source.length() != percent) {
+            percent = sectorsCopied * 100 / source.length();
+
+            if (percent % 5 == 0 && t.elapsed() > 1000) {
+                const qint64 mibsPerSec = (sectorsCopied * source.sectorSize() / 1024 / 1024) / (t.elapsed() / 1000);
+                const qint64 estSecsLeft = (100 - percent) * t.elapsed() / percent / 1000;
+                report.line() << xi18nc("@info:progress", "Copying %1 MiB/second, estimated time left: %2", mibsPerSec, QTime(0, 0).addSecs(estSecsLeft).toString());
+            }
+            emit progress(percent);
+        }
     }
 
-    free(buffer);
+    if (rval && !target.finish()) {
+        report.line() << xi18nc("@info:progress", "Could not complete the copy target.");
+        rval = false;
+    }
+
+    if (kernelCopy.methodsUsed() & KernelCopy::Clone)
+        report.line() << xi18nc("@info:progress", "The target shares data with the source instead of copying it.");
+
+    if (kernelCopy.methodsUsed() & KernelCopy::CopyFileRange)
+        report.line() << xi18nc("@info:progress", "Data was copied by the file system.");
+
+    if (kernelCopy.methodsUsed() & KernelCopy::Splice)
+        report.line() << xi18nc("@info:progress", "Data was moved through a kernel pipe.");
+
+    if (kernelCopy.sectorsSkipped() > 0)
+        report.line() << xi18nc("@info:progress", "%1 not used by the file system were skipped.", Capacity::formatByteSize(kernelCopy.sectorsSkipped() * source.sectorSize()));
+
+    if (kernelCopy.sectorsZeroed() > 0)
+        report.line() << xi18nc("@info:progress", "%1 of zeros were not written.", Capacity::formatByteSize(kernelCopy.sectorsZeroed() * source.sectorSize()));
 
     report.line() << xi18ncp("@info:progress argument 2 is a string such as 7 sectors (localized accordingly)", "Copying 1 block (%2) finished.", "Copying %1 blocks (%2) finished.", blocksCopied, i18np("1 sector", "%1 sectors", target.sectorsWritten()));
 
     return rval;
 }
 
-bool Job::rollbackCopyBlocks(Report& report, CopyTarget& origTarget, CopySource& origSource)
+/** Copies as much as can be read from a failing source, going on past sectors that cannot.
+
+    Works in passes like ddrescue, so that the good data is off the source before the
+    failing areas are worn further by reading them again and again:
+
+    -# Copy in large blocks. A block that cannot be read is left for later, and sectors
+       after it are skipped by a distance that doubles with each failed block in a row.
+    -# Copy the skipped sectors, last to first, without skipping.
+    -# Split each failed block in halves until the sectors that cannot be read are found.
+    -# Try each of those a few more times.
+
+    What has been copied is kept in a RescueMap that is saved while copying, after the data
+    it covers has been flushed. If a map for the same source is found, the rescue continues
+    from it, so that no sector is ever read again once it has been copied. Sectors that
+    cannot be read are not written to on the target.
+
+    @param report the Report to write to
+    @param target the CopyTarget to copy to; it must allow writing in any order
+    @param source the CopySource to copy from
+    @param sourceName the name of the source the map is recorded for
+    @param mapFileName the file to keep the RescueMap in
+    @return true if the target could be written to, even if not all of the source could be read
+*/
+bool Job::rescueBlocks(Report& report, CopyTarget& target, CopySource& source, const QString& sourceName, const QString& mapFileName)
+{
+    if (source.sectorSize() != target.sectorSize()) {
+        report.line() << xi18nc("@info:progress", "The logical sector sizes in the source and target for copying are not the same. This is currently unsupported.");
+        return false;
+    }
+
+    reportShared(report, target);
+
+    const qint32 sectorSize = source.sectorSize();
+    const qint64 blockSize = qMax(1024 * 1024 / sectorSize, 1);
+    const qint64 maxSkip = qBound(blockSize, source.length() / 100, qMax(static_cast<qint64>(1024 * 1024 * 1024 / sectorSize), blockSize));
+    const qint32 retries = 3;
+
+    RescueMap map;
+
+    if (map.load(mapFileName) && map.matches(sourceName, sectorSize, source.length()))
+        report.line() << xi18nc("@info:progress", "Continuing the rescue recorded in <filename>%1</filename>: %2 copied already.", mapFileName, Capacity::formatByteSize(map.count(RescueMap::Finished) * sectorSize));
+    else
+        map.reset(sourceName, sectorSize, source.length());
+
+    // Reading around the page cache keeps the kernel from reading ahead into failing areas.
+    const int fd = source.fileDescriptor();
+    const qint32 alignment = fd >= 0 ? IoQueue::directAlignment(fd) : -1;
+    const bool direct = alignment > 0 && sectorSize % alignment == 0 && IoQueue::setDirect(fd, true);
+
+    void* buffer = BufferPool::instance().acquire(blockSize * sectorSize, qMax(qMax(alignment, source.alignment()), static_cast<qint32>(sysconf(_SC_PAGESIZE))));
+
+    if (buffer == nullptr) {
+        report.line() << xi18nc("@info:progress", "Could not allocate memory for copying.");
+
+        if (direct)
+            IoQueue::setDirect(fd, false);
+
+        return false;
+    }
+
+    bool writeFailed = false;
+    bool saveFailed = false;
+    qint64 readErrors = 0;
+    int percent = 0;
+    QElapsedTimer saveTimer;
+    saveTimer.start();
+
+    // The map must never claim sectors the target has not safely got yet.
+    auto saveMap = [&](bool force) {
+        if (saveFailed || (!force && saveTimer.elapsed() < 1000))
+            return;
+
+        if (target.fileDescriptor() >= 0)
+            fdatasync(target.fileDescriptor());
+
+        if (!map.save(mapFileName)) {
+            report.line() << xi18nc("@info:progress", "Could not write the rescue map <filename>%1</filename>. The rescue cannot be continued if it is interrupted.", mapFileName);
+            saveFailed = true;
+        }
+
+        saveTimer.restart();
+    };
+
+    auto copyRange = [&](qint64 offset, qint64 numSectors) {
+        const qint64 readOffset = source.firstSector() + offset;
+
+        if (!source.isUnused(readOffset, numSectors)) {
+            if (!source.readSectors(buffer, readOffset, numSectors)) {
+                readErrors++;
+                return false;
+            }
+
+            if (!target.writeSectors(buffer, target.firstSector() + offset, numSectors)) {
+                report.line() << xi18nc("@info:progress", "Writing sectors from %1 to %2 to the target failed.", target.firstSector() + offset, target.firstSector() + offset + numSectors - 1);
+                writeFailed = true;
+                return false;
+            }
+        }
+
+        map.setState(offset, numSectors, RescueMap::Finished);
+        return true;
+    };
+
+    auto reportProgress = [&]() {
+        saveMap(false);
+
+        const qint64 done = map.count(RescueMap::Finished) + map.count(RescueMap::BadSector);
+
+        if (done * 100 / source.length() != percent) {
+            percent = done * 100 / source.length();
+            emit progress(percent);
+        }
+    };
+
+    // Pass 1: copy in blocks, skipping ahead after blocks that cannot be read.
+    report.line() << xi18nc("@info:progress", "Rescuing %1 sectors from %2 to %3.", source.length(), source.firstSector(), target.firstSector());
+
+    for (const auto &run : map.runs(RescueMap::NonTried)) {
+        qint64 skip = 0;
+
+        for (qint64 pos = run.offset; pos < run.offset + run.numSectors && !writeFailed; reportProgress()) {
+            const qint64 numSectors = qMin(blockSize, run.offset + run.numSectors - pos);
+
+            if (copyRange(pos, numSectors)) {
+                skip = 0;
+                pos += numSectors;
+            } else if (!writeFailed) {
+                // the sectors skipped stay untried for the next pass
+                map.setState(pos, numSectors, RescueMap::NonSplit);
+                skip = skip == 0 ? blockSize : qMin(skip * 2, maxSkip);
+                pos += numSectors + skip;
+            }
+        }
+    }
+
+    // Pass 2: copy what was skipped, from the other side of the failing areas.
+    QVector<RescueMap::Run> skipped = map.runs(RescueMap::NonTried);
+
+    if (!writeFailed && !skipped.isEmpty())
+        report.line() << xi18nc("@info:progress", "Copying the %1 skipped after read errors.", Capacity::formatByteSize(map.count(RescueMap::NonTried) * sectorSize));
+
+    for (auto run = skipped.crbegin(); run != skipped.crend() && !writeFailed; ++run) {
+        for (qint64 end = run->offset + run->numSectors; end > run->offset && !writeFailed; reportProgress()) {
+            const qint64 numSectors = qMin(blockSize, end - run->offset);
+
+            if (!copyRange(end - numSectors, numSectors) && !writeFailed)
+                map.setState(end - numSectors, numSectors, RescueMap::NonSplit);
+
+            end -= numSectors;
+        }
+    }
+
+    // Pass 3: split the blocks that failed until the sectors that cannot be read are found.
+    QVector<RescueMap::Run> failed = map.runs(RescueMap::NonSplit);
+
+    if (!writeFailed && !failed.isEmpty())
+        report.line() << xi18nc("@info:progress", "Looking for the sectors that cannot be read in %1 that failed.", Capacity::formatByteSize(map.count(RescueMap::NonSplit) * sectorSize));
+
+    for (const auto &run : failed) {
+        struct Range {
+            qint64 offset;
+            qint64 numSectors;
+            bool tried;
+        };
+
+        // a stack, with the first range on top, so that the source is read first to last
+        QVector<Range> ranges;
+
+        for (qint64 end = run.offset + run.numSectors; end > run.offset; end -= blockSize) {
+            const qint64 offset = qMax(end - blockSize, run.offset);
+            ranges.append(Range{ offset, end - offset, true });
+        }
+
+        while (!ranges.isEmpty() && !writeFailed) {
+            const Range range = ranges.takeLast();
+            const bool copied = !range.tried && copyRange(range.offset, range.numSectors);
+
+            if (!copied && !writeFailed && range.numSectors == 1)
+                map.setState(range.offset, 1, RescueMap::BadSector);
+            else if (!copied && !writeFailed) {
+                const qint64 half = range.numSectors / 2;
+                ranges.append(Range{ range.offset + half, range.numSectors - half, false });
+                ranges.append(Range{ range.offset, half, false });
+            }
+
+            reportProgress();
+        }
+    }
+
+    // Pass 4: try the sectors that cannot be read a few more times.
+    for (qint32 attempt = 0; attempt < retries && !writeFailed && map.count(RescueMap::BadSector) > 0; attempt++) {
+        report.line() << xi18nc("@info:progress", "Trying to read %1 bad sectors again, attempt %2 of %3.", map.count(RescueMap::BadSector), attempt + 1, retries);
+
+        for (const auto &run : map.runs(RescueMap::BadSector))
+            for (qint64 sector = run.offset; sector < run.offset + run.numSectors && !writeFailed; sector++) {
+                copyRange(sector, 1);
+                reportProgress();
+            }
+    }
+
+    BufferPool::instance().release(buffer);
+
+    if (direct)
+        IoQueue::setDirect(fd, false);
+
+    if (!writeFailed && !target.finish()) {
+        report.line() << xi18nc("@info:progress", "Could not complete the copy target.");
+        writeFailed = true;
+    }
+
+    saveMap(true);
+
+    const qint64 badSectors = map.count(RescueMap::BadSector);
+
+    if (readErrors > 0)
+        report.line() << xi18ncp("@info:progress", "Reading failed 1 time.", "Reading failed %1 times.", readErrors);
+
+    if (!writeFailed && badSectors == 0) {
+        report.line() << xi18nc("@info:progress", "All %1 could be read.", Capacity::formatByteSize(source.length() * sectorSize));
+        QFile::remove(mapFileName);
+    } else if (!writeFailed)
+        report.line() << xi18nc("@info:progress", "%1 could not be read, %2 were copied. The sectors that could not be read are listed in <filename>%3</filename>.", Capacity::formatByteSize(badSectors * sectorSize), Capacity::formatByteSize(map.count(RescueMap::Finished) * sectorSize), mapFileName);
+
+    return !writeFailed;
+}
+
+/** Reads which parts of the FileSystem on a Partition are used.
+    @param report the Report to write to
+    @param partition the Partition the FileSystem is on
+    @param extents returns the used extents in bytes
+    @param extentsLength returns the number of bytes from the start @p extents describe
+    @return false if the FileSystem cannot tell which parts it uses
+*/
+bool Job::readUsedExtents(Report& report, const Partition& partition, QList<FileSystem::Extent>& extents, qint64& extentsLength)
+{
+    const FileSystem& fs = partition.fileSystem();
+
+    // The used extents are read through the Partition's device node, which only shows the
+    // FileSystem if that starts at the Partition's start (it does not in the middle of a move).
+    if (fs.supportGetUsedExtents() == FileSystem::cmdSupportNone || fs.firstSector() != partition.firstSector())
+        return false;
+
+    extentsLength = fs.readUsedExtents(partition.deviceNode(), extents);
+
+    if (extentsLength < 0) {
+        report.line() << xi18nc("@info:progress", "Could not read which parts of the file system are used. Copying all of it.");
+        return false;
+    }
+
+    return true;
+}
+
+/** Copies the FileSystem on a Partition, skipping the parts it does not use if it can tell which those are.
+
+    Falls back to copyBlocks() for the whole source if the FileSystem cannot report its used
+    extents.
+
+    @param report the Report to write to
+    @param target the CopyTarget to copy to
+    @param source the CopySource for the FileSystem
+    @param partition the Partition the FileSystem is on
+    @param checksums if not nullptr, the checksums of the sectors copied are added to it
+    @param hasher if not nullptr, the data copied is handed to it to fill a BlockIndex
+    @param journal if not nullptr, the journal to record checkpoints in
+    @return true on success
+*/
+bool Job::copyUsedBlocks(Report& report, CopyTarget& target, CopySource& source, const Partition& partition, ChecksumManifest* checksums, BlockHasher* hasher, CopyJournal* journal)
+{
+    QList<FileSystem::Extent> extents;
+    qint64 extentsLength = 0;
+
+    if (readUsedExtents(report, partition, extents, extentsLength)) {
+        CopySourceExtents usedSource(source, extents, extentsLength);
+        report.line() << xi18nc("@info:progress", "Copying only the %1 used by the file system.", Capacity::formatByteSize(usedSource.usedSectors() * source.sectorSize()));
+
+        return copyBlocks(report, target, usedSource, checksums, hasher, journal);
+    }
+
+    return copyBlocks(report, target, source, checksums, hasher, journal);
+}
+
+/** Reads a copy back and compares it with the checksums recorded while copying.
+
+    If the copy can be read through a file descriptor, the chunks are read by several
+    threads at once, bypassing the page cache so that what is compared is what is on the
+    disk and not what is still cached from writing it.
+
+    @param report the Report to write to
+    @param copy the copy to read back, already opened
+    @param checksums the checksums to compare with, offsets relative to the copy's first sector
+    @return true if every chunk could be read and matches its checksum
+*/
+bool Job::verifyBlocks(Report& report, CopySource& copy, const ChecksumManifest& checksums)
+{
+    if (checksums.sectorSize() != copy.sectorSize()) {
+        report.line() << xi18nc("@info:progress", "The checksums were recorded for a different sector size. The copy cannot be verified.");
+        return false;
+    }
+
+    const QVector<ChecksumManifest::Entry>& entries = checksums.entries();
+    const qint32 sectorSize = copy.sectorSize();
+    const qint64 totalSectors = checksums.numSectors();
+    const int fd = copy.fileDescriptor();
+
+    report.line() << xi18nc("@info:progress", "Verifying %1 of the copy.", Capacity::formatByteSize(totalSectors * sectorSize));
+
+    QAtomicInteger<qint64> sectorsVerified(0);
+    QVector<qint64> mismatches;
+    bool readFailed = false;
+
+    if (fd >= 0) {
+        const qint32 alignment = IoQueue::directAlignment(fd);
+        bool aligned = alignment > 0 && (copy.firstSector() * sectorSize) % alignment == 0;
+
+        for (const auto &entry : entries)
+            aligned = aligned && (entry.offset * sectorSize) % alignment == 0 && (entry.numSectors * sectorSize) % alignment == 0;
+
+        const bool direct = aligned && IoQueue::setDirect(fd, true);
+
+        if (!direct) {
+            fdatasync(fd);
+            IoQueue::dropCache(fd, copy.firstSector() * sectorSize, copy.length() * sectorSize);
+        }
+
+        // interleaving the chunks keeps the threads reading close to each other
+        QThreadPool pool;
+        QList<VerifyTask*> tasks;
+        const qint32 numThreads = qBound(1, QThread::idealThreadCount(), 8);
+
+        pool.setMaxThreadCount(numThreads);
+
+        for (qint32 i = 0; i < numThreads; i++) {
+            tasks.append(new VerifyTask(fd, copy.firstSector(), checksums, i, numThreads, qMax(alignment, static_cast<qint32>(sysconf(_SC_PAGESIZE))), sectorsVerified));
+            pool.start(tasks.last());
+        }
+
+        while (!pool.waitForDone(500))
+            if (totalSectors > 0)
+                emit progress(sectorsVerified.load() * 100 / totalSectors);
+
+        for (VerifyTask* task : tasks) {
+            mismatches += task->m_Mismatches;
+            readFailed = readFailed || task->m_ReadFailed;
+            delete task;
+        }
+
+        if (direct)
+            IoQueue::setDirect(fd, false);
+    } else {
+        QByteArray buffer;
+
+        for (const auto &entry : entries) {
+            buffer.resize(entry.numSectors * sectorSize);
+
+            if (!copy.readSectors(buffer.data(), copy.firstSector() + entry.offset, entry.numSectors)) {
+                readFailed = true;
+                break;
+            }
+
+            if (crc32c(buffer.constData(), buffer.size()) != entry.checksum)
+                mismatches.append(entry.offset);
+
+            sectorsVerified.store(sectorsVerified.load() + entry.numSectors);
+
+            if (totalSectors > 0)
+                emit progress(sectorsVerified.load() * 100 / totalSectors);
+        }
+    }
+
+    if (readFailed) {
+        report.line() << xi18nc("@info:progress", "Could not read the copy back for verifying.");
+        return false;
+    }
+
+    if (!mismatches.isEmpty()) {
+        std::sort(mismatches.begin(), mismatches.end());
+
+        for (qint32 i = 0; i < qMin(mismatches.size(), 10); i++)
+            report.line() << xi18nc("@info:progress", "The copy differs from what was copied at sector %1.", copy.firstSector() + mismatches[i]);
+
+        report.line() << xi18ncp("@info:progress", "Verifying failed: 1 chunk of the copy differs.", "Verifying failed: %1 chunks of the copy differ.", mismatches.size());
+        return false;
+    }
+
+    report.line() << xi18nc("@info:progress", "The copy has been verified.");
+
+    return true;
+}
+
+/** Hashes all blocks of a source the source uses and puts the hashes into a BlockIndex.
+
+    If the source can be read through a file descriptor, the blocks are read and hashed by
+    several threads at once.
+
+    @param report the Report to write to
+    @param source the CopySource to hash, already opened
+    @param index the index to fill, created for the source's length
+    @return true on success
+*/
+bool Job::hashBlocks(Report& report, CopySource& source, BlockIndex& index)
+{
+    const qint32 sectorSize = source.sectorSize();
+    const int fd = source.fileDescriptor();
+    QAtomicInteger<qint64> sectorsHashed(0);
+    bool readFailed = false;
+
+    report.line() << xi18nc("@info:progress", "Looking for blocks that changed since the last backup.");
+
+    if (fd >= 0) {
+        const qint32 alignment = IoQueue::directAlignment(fd);
+        const bool aligned = alignment > 0 && (source.firstSector() * sectorSize) % alignment == 0 && (source.length() * sectorSize) % alignment == 0;
+        const bool direct = cachePolicy() == IoQueue::CacheDirect && aligned && IoQueue::setDirect(fd, true);
+
+        QThreadPool pool;
+        QList<HashTask*> tasks;
+        const qint32 numThreads = qBound(1, QThread::idealThreadCount(), 8);
+
+        pool.setMaxThreadCount(numThreads);
+
+        for (qint32 i = 0; i < numThreads; i++) {
+            tasks.append(new HashTask(source, index, i, numThreads, qMax(alignment, static_cast<qint32>(sysconf(_SC_PAGESIZE))), !direct && cachePolicy() != IoQueue::CacheBuffered, sectorsHashed));
+            pool.start(tasks.last());
+        }
+
+        while (!pool.waitForDone(500))
+            emit progress(sectorsHashed.load() * 100 / source.length());
+
+        for (HashTask* task : tasks) {
+            readFailed = readFailed || task->m_ReadFailed;
+            delete task;
+        }
+
+        if (direct)
+            IoQueue::setDirect(fd, false);
+    } else {
+        QByteArray buffer;
+
+        for (qint64 block = 0; block < index.numBlocks() && !readFailed; block++) {
+            const qint64 first = source.firstSector() + block * index.blockSectors();
+            const qint64 numSectors = qMin(index.blockSectors(), source.lastSector() + 1 - first);
+
+            if (!source.isUnused(first, numSectors)) {
+                buffer.resize(numSectors * sectorSize);
+                readFailed = !source.readSectors(buffer.data(), first, numSectors);
+
+                index.setHash(block, BlockIndex::hashBlock(buffer.constData(), buffer.size()));
+                index.setFlags(block, BlockIndex::Used);
+            }
+
+            emit progress((block + 1) * 100 / index.numBlocks());
+        }
+    }
+
+    if (readFailed) {
+        report.line() << xi18nc("@info:progress", "Could not read the source to look for changed blocks.");
+        return false;
+    }
+
+    return true;
+}
+
+/** Lets the device erase all sectors of a target itself instead of writing data to them.
+
+    Erases in chunks, so that progress can be shown and a slow device does not block in
+    a single call for a long time.
+
+    @param report the report to write information to
+    @param target the target to erase
+    @param method how to erase
+    @return true if all sectors have been erased, false if the device cannot erase them this way
+*/
+bool Job::eraseBlocks(Report& report, CopyTargetDevice& target, CopyTargetDevice::EraseMethod method)
+{
+    reportShared(report, target);
+
+    const qint64 length = target.lastSector() - target.firstSector() + 1;
+    const qint64 chunkSize = qMax(1024 * 1024 * 1024 / target.sectorSize(), 1);
+
+    int percent = 0;
+
+    for (qint64 done = 0; done < length; ) {
+        const qint64 n = qMin(chunkSize, length - done);
+
+        if (!target.eraseSectors(method, target.firstSector() + done, n)) {
+            if (done == 0)
+                report.line() << xi18nc("@info:progress", "The device cannot erase the sectors itself.");
+            else
+                report.line() << xi18nc("@info:progress", "The device could not erase the sectors from %1 on.", target.firstSector() + done);
+
+            return false;
+        }
+
+        done += n;
+
+        if (done * 100 / length != percent) {
+            percent = done * 100 / length;
+            emit progress(percent);
+        }
+    }
+
+    report.line() << xi18ncp("@info:progress", "The device erased 1 sector.", "The device erased %1 sectors.", length);
+
+    return true;
+}
+
+/** Moves sectors to a target that overlaps them closely, in large windows.
+
+    Copying to an overlapping target a short distance away in blocks no larger than the
+    distance, so that every checkpoint can be resumed from, takes many small writes and
+    flushes. This moves the sectors in windows of inPlaceWindow() instead: Each window is
+    read into memory and staged in the journal, which is all of the source the window's
+    write can destroy, before it is written to the target. A move interrupted by a crash
+    is completed by writing the staged window again and going on from there, or rolled
+    back by writing it back to the source, rather than by a copy in small blocks.
+
+    The move begins after the sectors the journal has recorded as done. A window whose
+    sectors the source does not use is skipped.
+
+    @param report the Report to write to
+    @param target the CopyTarget to move to
+    @param source the CopySource to move from
+    @param journal the journal of the move, created for it as a move in place
+    @param checksums if not nullptr, the checksums of the sectors moved are added to it
+    @return true on success
+*/
+bool Job::moveBlocksInPlace(Report& report, CopyTarget& target, CopySource& source, CopyJournal& journal, ChecksumManifest* checksums)
+{
+    if (source.sectorSize() != target.sectorSize()) {
+        report.line() << xi18nc("@info:progress", "The logical sector sizes in the source and target for copying are not the same. This is currently unsupported.");
+        return false;
+    }
+
+    reportShared(report, target);
+
+    const qint32 sectorSize = source.sectorSize();
+    const qint64 length = source.length();
+    const qint64 windowSize = qMax(inPlaceWindow() / sectorSize, static_cast<qint64>(1));
+    const bool backward = journal.backward();
+    const int fd = target.fileDescriptor();
+
+    // the offset of the window of the given length that begins the given number of
+    // sectors into the move in its direction
+    auto windowOffset = [&](qint64 done, qint64 numSectors) {
+        return backward ? length - done - numSectors : done;
+    };
+
+    auto writeWindow = [&](void* data, qint64 offset, qint64 numSectors) {
+        return target.writeSectors(data, target.firstSector() + offset, numSectors) && (fd < 0 || fdatasync(fd) == 0);
+    };
+
+    QByteArray staged;
+
+    if (journal.readStaged(staged)) {
+        const qint64 numSectors = staged.size() / sectorSize;
+        report.line() << xi18nc("@info:progress", "Writing the %1 staged before the move was interrupted again.", Capacity::formatByteSize(staged.size()));
+
+        if (!writeWindow(staged.data(), windowOffset(journal.sectorsDone(), numSectors), numSectors) || !journal.checkpoint(journal.sectorsDone() + numSectors)) {
+            report.line() << xi18nc("@info:progress", "Could not write the staged sectors to the target.");
+            return false;
+        }
+
+        staged = QByteArray();
+    }
+
+    void* buffer = BufferPool::instance().acquire(qMin(windowSize, length) * sectorSize, qMax(qMax(source.alignment(), target.alignment()), static_cast<qint32>(sysconf(_SC_PAGESIZE))));
+
+    if (buffer == nullptr) {
+        report.line() << xi18nc("@info:progress", "Could not allocate memory for copying.");
+        return false;
+    }
+
+    report.line() << xi18nc("@info:progress", "Moving %1 sectors from %2 to %3 in place in windows of %4, direction: %5.", length, source.firstSector(), target.firstSector(), Capacity::formatByteSize(qMin(windowSize, length) * sectorSize), backward ? -1 : 1);
+
+    // the checksums are taken in pieces as small as copyBlocks() takes them
+    const qint64 checksumSectors = qMax(1024 * 1024 / sectorSize, 1);
+    bool rval = true;
+    qint64 sectorsMoved = 0;
+    int percent = 0;
+
+    while (journal.sectorsDone() < length) {
+        const qint64 done = journal.sectorsDone();
+        const qint64 numSectors = qMin(windowSize, length - done);
+        const qint64 offset = windowOffset(done, numSectors);
+
+        if (source.isUnused(source.firstSector() + offset, numSectors)) {
+            if (!(rval = journal.checkpoint(done + numSectors))) {
+                report.line() << xi18nc("@info:progress", "Could not record the progress of copying in the journal.");
+                break;
+            }
+
+            continue;
+        }
+
+        if (!source.readSectors(buffer, source.firstSector() + offset, numSectors)) {
+            report.line() << xi18nc("@info:progress", "Reading sectors from %1 to %2 from the source failed.", source.firstSector() + offset, source.firstSector() + offset + numSectors - 1);
+            rval = false;
+            break;
+        }
+
+        if (checksums)
+            for (qint64 piece = 0; piece < numSectors; piece += checksumSectors) {
+                const qint64 n = qMin(checksumSectors, numSectors - piece);
+
+                if (!source.isUnused(source.firstSector() + offset + piece, n)) {
+                    const ChecksumManifest::Entry entry = { offset + piece, n, crc32c(static_cast<const char*>(buffer) + piece * sectorSize, n * sectorSize) };
+                    checksums->append(entry);
+                }
+            }
+
+        RateLimiter::instance().acquire(numSectors * sectorSize, 1);
+
+        if (!journal.stage(buffer, numSectors)) {
+            report.line() << xi18nc("@info:progress", "Could not stage sectors from %1 to %2 in the journal.", source.firstSector() + offset, source.firstSector() + offset + numSectors - 1);
+            rval = false;
+            break;
+        }
+
+        // what a failed write destroys of the source is still staged for rolling back
+        if (!writeWindow(buffer, offset, numSectors)) {
+            report.line() << xi18nc("@info:progress", "Writing sectors from %1 to %2 to the target failed.", target.firstSector() + offset, target.firstSector() + offset + numSectors - 1);
+            rval = false;
+            break;
+        }
+
+        if (!journal.checkpoint(done + numSectors)) {
+            report.line() << xi18nc("@info:progress", "Could not record the progress of copying in the journal.");
+            rval = false;
+            break;
+        }
+
+        sectorsMoved += numSectors;
+
+        if (journal.sectorsDone() * 100 / length != percent) {
+            percent = journal.sectorsDone() * 100 / length;
+            emit progress(percent);
+        }
+    }
+
+    BufferPool::instance().release(buffer);
+
+    if (rval && !target.finish()) {
+        report.line() << xi18nc("@info:progress", "Could not complete the copy target.");
+        rval = false;
+    }
+
+    if (rval && sectorsMoved < length)
+        report.line() << xi18nc("@info:progress", "%1 not used by the file system were skipped.", Capacity::formatByteSize((length - sectorsMoved) * sectorSize));
+
+    report.line() << xi18ncp("@info:progress argument 2 is a string such as 7 sectors (localized accordingly)", "Moving in place 1 window (%2) finished.", "Moving in place %1 windows (%2) finished.", (sectorsMoved + windowSize - 1) / windowSize, i18np("1 sector", "%1 sectors", sectorsMoved));
+
+    return rval;
+}
+
+/** Copies back what an interrupted copy has written to an overlapping target.
+    @param report the Report to write to
+    @param origTarget the target of the copy to roll back
+    @param origSource the source of the copy to roll back
+    @param journal if not nullptr, the journal of the copy; it is replaced by one for rolling back
+    @return true on success
+*/
+bool Job::rollbackCopyBlocks(Report& report, CopyTarget& origTarget, CopySource& origSource, CopyJournal* journal)
 {
     if (!origSource.overlaps(origTarget)) {
         report.line() << xi18nc("@info:progress", "Source and target for copying do not overlap: Rollback is not required.");
@@ -127,19 +1168,44 @@ bool Job::rollbackCopyBlocks(Report& report, CopyTarget& origTarget, CopySource&
         CopySourceDevice& csd = dynamic_cast<CopySourceDevice&>(origSource);
         CopyTargetDevice& ctd = dynamic_cast<CopyTargetDevice&>(origTarget);
 
+        // a move in place knows what it has done from its journal, not from what it has written
+        const bool inPlace = journal && journal->inPlace();
+        const qint64 done = inPlace ? journal->sectorsDone() : origTarget.sectorsWritten();
+        const bool backward = origTarget.firstSector() > origSource.firstSector();
+
+        // A window staged but not completely written may have destroyed part of its source,
+        // so the staged window goes back there first.
+        QByteArray staged;
+
+        if (inPlace && journal->readStaged(staged)) {
+            const qint64 numSectors = staged.size() / origSource.sectorSize();
+            const qint64 first = backward ? origSource.lastSector() - done - numSectors + 1 : origSource.firstSector() + done;
+            CopyTargetDevice stagedTarget(csd.device(), first, first + numSectors - 1);
+
+            report.line() << xi18nc("@info:progress", "Writing the %1 staged for moving back to sectors %2 to %3.", Capacity::formatByteSize(staged.size()), first, first + numSectors - 1);
+
+            if (!stagedTarget.open() || !stagedTarget.writeSectors(staged.data(), first, numSectors) || fdatasync(stagedTarget.fileDescriptor()) != 0) {
+                report.line() << xi18nc("@info:progress", "Could not write the staged sectors back to the source.");
+                return false;
+            }
+        }
+
+        if (inPlace && done == 0)
+            return true;
+
         // default: use values as if we were copying from front to back.
         qint64 undoSourceFirstSector = origTarget.firstSector();
-        qint64 undoSourceLastSector = origTarget.firstSector() + origTarget.sectorsWritten() - 1;
+        qint64 undoSourceLastSector = origTarget.firstSector() + done - 1;
 
         qint64 undoTargetFirstSector = origSource.firstSector();
-        qint64 undoTargetLastSector = origSource.firstSector() + origTarget.sectorsWritten() - 1;
+        qint64 undoTargetLastSector = origSource.firstSector() + done - 1;
 
-        if (origTarget.firstSector() > origSource.firstSector()) {
+        if (backward) {
             // we were copying from back to front
-            undoSourceFirstSector = origTarget.firstSector() + origSource.length() - origTarget.sectorsWritten();
+            undoSourceFirstSector = origTarget.firstSector() + origSource.length() - done;
             undoSourceLastSector = origTarget.firstSector() + origSource.length() - 1;
 
-            undoTargetFirstSector = origSource.lastSector() - origTarget.sectorsWritten() + 1;
+            undoTargetFirstSector = origSource.lastSector() - done + 1;
             undoTargetLastSector = origSource.lastSector();
         }
 
@@ -158,7 +1224,18 @@ bool Job::rollbackCopyBlocks(Report& report, CopyTarget& origTarget, CopySource&
             return false;
         }
 
-        return copyBlocks(report, undoTarget, undoSource);
+        // from here on, a resume continues rolling back
+        if (journal && !journal->create(csd.device().deviceNode(), undoSource.sectorSize(), undoSourceFirstSector, undoTargetFirstSector, undoSource.length(), undoTargetFirstSector > undoSourceFirstSector, inPlace)) {
+            // the old journal would describe a state the rollback is about to change
+            report.line() << xi18nc("@info:progress", "Could not create a journal for the rollback. It cannot be resumed if it is interrupted.");
+            journal->remove();
+            journal = nullptr;
+        }
+
+        if (journal && inPlace)
+            return moveBlocksInPlace(report, undoTarget, undoSource, *journal);
+
+        return copyBlocks(report, undoTarget, undoSource, nullptr, nullptr, journal);
     } catch (...) {
         report.line() << xi18nc("@info:progress", "Rollback failed: Source or target are not devices.");
     }
@@ -175,11 +1252,20 @@ Report* Job::jobStarted(Report& parent)
 {
     emit started();
 
+    // The Job's I/O, and that of the commands it runs, happens on the calling thread.
+    m_PreviousIoPriority = IoPriority::ofThread();
+
+    if (ioPriority().isSet())
+        ioPriority().applyToThread();
+
     return parent.newChild(xi18nc("@info:progress", "Job: %1", description()));
 }
 
 void Job::jobFinished(Report& report, bool b)
 {
+    if (ioPriority().isSet())
+        m_PreviousIoPriority.applyToThread();
+
     setStatus(b ? Success : Error);
     emit progress(numSteps());
     emit finished();
@@ -19,18 +19,28 @@
 
 #define JOB__H
 
+#include "core/copytargetdevice.h"
+#include "core/ioqueue.h"
+
 #include "fs/filesystem.h"
 
+#include "util/iopriority.h"
 #include "util/libpartitionmanagerexport.h"
 
+#include <QAtomicInteger>
 #include <QObject>
 #include <QtGlobal>
 
 class QString;
 class QIcon;
 
+class BlockHasher;
+class BlockIndex;
+class ChecksumManifest;
+class CopyJournal;
 class CopySource;
 class CopyTarget;
+class Partition;
 class Report;
 
 /** Base class for all Jobs.
@@ -82,9 +92,64 @@ public:
 
     void emitProgress(int i);
 
+    quint32 ioQueueDepth() const {
+        return m_IoQueueDepth;    /**< @return the number of reads and writes copying keeps in flight */
+    }
+    void setIoQueueDepth(quint32 depth) {
+        m_IoQueueDepth = depth;    /**< @param depth the number of reads and writes copying is to keep in flight */
+    }
+    IoQueue::CachePolicy cachePolicy() const {
+        return m_CachePolicy;    /**< @return how copying uses the page cache */
+    }
+    void setCachePolicy(IoQueue::CachePolicy policy) {
+        m_CachePolicy = policy;    /**< @param policy how copying is to use the page cache */
+    }
+    bool rescue() const {
+        return m_Rescue;    /**< @return true if copies go on past sectors that cannot be read */
+    }
+    void setRescue(bool rescue) {
+        m_Rescue = rescue;    /**< @param rescue true to go on past sectors that cannot be read, copying everything else */
+    }
+    bool verify() const {
+        return m_Verify;    /**< @return true if copies are read back and compared with their checksums */
+    }
+    void setVerify(bool verify) {
+        m_Verify = verify;    /**< @param verify true to read copies back and compare them with their checksums */
+    }
+
+    IoPriority ioPriority() const;
+    void setIoPriority(const IoPriority& prio) {
+        m_IoPriority = prio;    /**< @param prio the I/O priority to run at, unset to follow defaultIoPriority() */
+    }
+
+    static bool defaultVerify() {
+        return s_DefaultVerify;    /**< @return true if new Jobs verify their copies */
+    }
+    static void setDefaultVerify(bool verify) {
+        s_DefaultVerify = verify;    /**< @param verify true if new Jobs are to verify their copies */
+    }
+    static IoPriority defaultIoPriority() {
+        return IoPriority::fromValue(s_DefaultIoPriority.loadAcquire());    /**< @return the I/O priority Jobs run at unless one is set for them */
+    }
+    static void setDefaultIoPriority(const IoPriority& prio) {
+        s_DefaultIoPriority.storeRelease(prio.value());    /**< @param prio the I/O priority Jobs are to run at unless one is set for them */
+    }
+
 protected:
-    bool copyBlocks(Report& report, CopyTarget& target, CopySource& source);
-    bool rollbackCopyBlocks(Report& report, CopyTarget& origTarget, CopySource& origSource);
+    bool copyBlocks(Report& report, CopyTarget& target, CopySource& source, ChecksumManifest* checksums = nullptr, BlockHasher* hasher = nullptr, CopyJournal* journal = nullptr);
+    bool copyBlocksInKernel(Report& report, CopyTarget& target, CopySource& source, bool& supported);
+    bool rescueBlocks(Report& report, CopyTarget& target, CopySource& source, const QString& sourceName, const QString& mapFileName);
+    bool copyUsedBlocks(Report& report, CopyTarget& target, CopySource& source, const Partition& partition, ChecksumManifest* checksums = nullptr, BlockHasher* hasher = nullptr, CopyJournal* journal = nullptr);
+    bool verifyBlocks(Report& report, CopySource& copy, const ChecksumManifest& checksums);
+    bool hashBlocks(Report& report, CopySource& source, BlockIndex& index);
+    bool eraseBlocks(Report& report, CopyTargetDevice& target, CopyTargetDevice::EraseMethod method);
+    bool readUsedExtents(Report& report, const Partition& partition, QList<FileSystem::Extent>& extents, qint64& extentsLength);
+    bool moveBlocksInPlace(Report& report, CopyTarget& target, CopySource& source, CopyJournal& journal, ChecksumManifest* checksums = nullptr);
+    bool rollbackCopyBlocks(Report& report, CopyTarget& origTarget, CopySource& origSource, CopyJournal* journal = nullptr);
+
+    static qint64 inPlaceWindow() {
+        return 64 * 1024 * 1024;    /**< @return the size in bytes of the windows a move in place moves at a time */
+    }
 
     Report* jobStarted(Report& parent);
     void jobFinished(Report& report, bool b);
@@ -95,6 +160,15 @@ protected:
 
 private:
     JobStatus m_Status;
+    quint32 m_IoQueueDepth;
+    IoQueue::CachePolicy m_CachePolicy;
+    bool m_Verify;
+    bool m_Rescue;
+    IoPriority m_IoPriority;
+    IoPriority m_PreviousIoPriority;
+
+    static bool s_DefaultVerify;
+    static QAtomicInteger<quint16> s_DefaultIoPriority;
 };
 
 #endif
@@ -18,11 +18,15 @@
 
 #include "jobs/movefilesystemjob.h"
 
+#include "core/checksummanifest.h"
+#include "core/copyjournal.h"
 #include "core/partition.h"
 #include "core/device.h"
 #include "core/copysourcedevice.h"
+#include "core/copysourceextents.h"
 #include "core/copytargetdevice.h"
 
+#include "util/capacity.h"
 #include "util/report.h"
 
 #include <KLocalizedString>
@@ -63,13 +67,51 @@ bool MoveFileSystemJob::run(Report& parent)
         else if (!moveTarget.open())
             report->line() << xi18nc("@info:progress", "Could not create target for moving file system on partition <filename>%1</filename>.", partition().deviceNode());
         else {
-            rval = copyBlocks(*report, moveTarget, moveSource);
+            // A move by less than a window is done in place: a journaled copy would have to
+            // checkpoint after every few sectors, as many as the file system moves by.
+            const qint64 distance = qAbs(moveTarget.firstSector() - moveSource.firstSector());
+            const bool inPlace = moveSource.overlaps(moveTarget) && distance * moveSource.sectorSize() < inPlaceWindow();
+
+            // a journal lets a ResumeCopyJob finish or roll back the move after a crash
+            CopyJournal journal;
+            if (!journal.create(device().deviceNode(), moveSource.sectorSize(), moveSource.firstSector(), moveTarget.firstSector(), moveSource.length(), moveTarget.firstSector() > moveSource.firstSector(), inPlace))
+                report->line() << xi18nc("@info:progress", "Could not create a journal for moving. The move cannot be resumed if it is interrupted.");
+
+            ChecksumManifest checksums(moveSource.sectorSize());
+
+            if (inPlace && journal.isOpen()) {
+                QList<FileSystem::Extent> extents;
+                qint64 extentsLength = 0;
+                const bool used = readUsedExtents(*report, partition(), extents, extentsLength);
+                CopySourceExtents usedSource(moveSource, extents, used ? extentsLength : moveSource.length() * moveSource.sectorSize());
+
+                if (used)
+                    report->line() << xi18nc("@info:progress", "Copying only the %1 used by the file system.", Capacity::formatByteSize(usedSource.usedSectors() * moveSource.sectorSize()));
+
+                rval = moveBlocksInPlace(*report, moveTarget, used ? static_cast<CopySource&>(usedSource) : moveSource, journal, verify() ? &checksums : nullptr);
+            } else
+                rval = copyUsedBlocks(*report, moveTarget, moveSource, partition(), verify() ? &checksums : nullptr, nullptr, journal.isOpen() ? &journal : nullptr);
 
             if (rval) {
+                journal.remove();
+
                 const qint64 savedLength = partition().fileSystem().length() - 1;
                 partition().fileSystem().setFirstSector(newStart());
                 partition().fileSystem().setLastSector(newStart() + savedLength);
-            } else if (!rollbackCopyBlocks(*report, moveTarget, moveSource))
+
+                // the source has been overwritten in part, so there is nothing to roll back to
+                if (verify()) {
+                    CopySourceDevice moved(device(), newStart(), newStart() + savedLength);
+
+                    if (!moved.open()) {
+                        report->line() << xi18nc("@info:progress", "Could not open file system on partition <filename>%1</filename> for verifying.", partition().deviceNode());
+                        rval = false;
+                    } else
+                        rval = verifyBlocks(*report, moved, checksums);
+                }
+            } else if (rollbackCopyBlocks(*report, moveTarget, moveSource, journal.isOpen() ? &journal : nullptr))
+                journal.remove();
+            else
                 report->line() << xi18nc("@info:progress", "Rollback for file system on partition <filename>%1</filename> failed.", partition().deviceNode());
 
             report->line() << xi18nc("@info:progress", "Closing device. This may take a few seconds.");
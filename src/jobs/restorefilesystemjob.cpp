@@ -23,10 +23,20 @@
 #include "backend/corebackenddevice.h"
 #include "backend/corebackendpartitiontable.h"
 
+#include "core/blockindex.h"
+#include "core/checksummanifest.h"
+#include "core/chunkrecipe.h"
 #include "core/partition.h"
 #include "core/device.h"
 #include "core/copysourcefile.h"
+#include "core/copysourceimagechain.h"
+#include "core/copysourcerepository.h"
+#include "core/copysourcestream.h"
+#include "core/copysourcezstdfile.h"
+#include "core/copysourcedevice.h"
 #include "core/copytargetdevice.h"
+#include "core/ioqueue.h"
+#include "core/zstdimage.h"
 
 #include "fs/filesystem.h"
 #include "fs/filesystemfactory.h"
@@ -67,18 +77,66 @@ bool RestoreFileSystemJob::run(Report& parent)
     {
         // FileSystems are restored to _partitions_, so don't use first and last sector of file system here
         CopyTargetDevice copyTarget(targetDevice(), targetPartition().firstSector(), targetPartition().lastSector());
-        CopySourceFile copySource(fileName(), copyTarget.sectorSize());
 
-        if (!copySource.open())
+        // a stream can only be read once, so it is not looked into before restoring and is
+        // taken to be a raw image; anything next to it is not looked for either
+        const bool stream = IoQueue::isStream(fileName());
+        const bool compressed = !stream && ZstdImage::isImage(fileName());
+        const bool repository = !stream && ChunkRecipe::isRecipe(fileName());
+
+        // the image of an incremental backup only holds what changed since its parent
+        BlockIndex index;
+        const bool incremental = !stream && index.load(BlockIndex::fileName(fileName())) && !index.parent().isEmpty();
+        QStringList chainFileNames;
+        QList<BlockIndex> chainIndexes;
+        const bool chainComplete = !incremental || CopySourceImageChain::readChain(fileName(), chainFileNames, chainIndexes);
+
+        CopySourceFile rawSource(fileName(), copyTarget.sectorSize());
+        CopySourceZstdFile zstdSource(fileName(), copyTarget.sectorSize());
+        CopySourceImageChain chainSource(chainFileNames, chainIndexes, copyTarget.sectorSize());
+        CopySourceStream streamSource(fileName(), copyTarget.sectorSize(), targetPartition().length());
+        CopySourceRepository repositorySource(fileName(), copyTarget.sectorSize());
+        CopySource& copySource = stream ? static_cast<CopySource&>(streamSource) : repository ? static_cast<CopySource&>(repositorySource) :
+                                 incremental ? static_cast<CopySource&>(chainSource) : compressed ? static_cast<CopySource&>(zstdSource) : rawSource;
+
+        if (!chainComplete)
+            report->line() << xi18nc("@info:progress", "Could not read all the backups that backup file <filename>%1</filename> builds on.", fileName());
+        else if (compressed && !ZstdImage::isSupported())
+            report->line() << xi18nc("@info:progress", "Backup file <filename>%1</filename> is compressed, but support for compressed images is not available.", fileName());
+        else if (!copySource.open())
             report->line() << xi18nc("@info:progress", "Could not open backup file <filename>%1</filename> to restore from.", fileName());
         else if (!copyTarget.open())
             report->line() << xi18nc("@info:progress", "Could not open target partition <filename>%1</filename> to restore to.", targetPartition().deviceNode());
         else {
-            rval = copyBlocks(*report, copyTarget, copySource);
+            // Compare with the checksums of the file system that was backed up if there are
+            // any, so that a damaged image is noticed, too. Otherwise record them while restoring.
+            ChecksumManifest checksums(copySource.sectorSize());
+            const bool verifyRestored = verify() && !stream;
+            const bool backedUpChecksums = verifyRestored && checksums.load(ChecksumManifest::fileName(fileName()));
+
+            if (verify() && stream)
+                report->line() << xi18nc("@info:progress", "Backup file <filename>%1</filename> is a stream and cannot be verified.", fileName());
+
+            rval = copyBlocks(*report, copyTarget, copySource, verifyRestored && !backedUpChecksums ? &checksums : nullptr);
+
+            if (rval && stream && !streamSource.atEnd()) {
+                report->line() << xi18nc("@info:progress", "The stream <filename>%1</filename> is larger than the target partition <filename>%2</filename>.", fileName(), targetPartition().deviceNode());
+                rval = false;
+            }
 
             if (rval) {
-                // create a new file system for what was restored with the length of the image file
-                const qint64 newLastSector = targetPartition().firstSector() + copySource.length() - 1;
+                // create a new file system for what was restored with the length of the image
+                const qint64 newLastSector = targetPartition().firstSector() + (stream ? streamSource.streamLength() : copySource.length()) - 1;
+
+                if (verifyRestored) {
+                    CopySourceDevice restored(targetDevice(), targetPartition().firstSector(), newLastSector);
+
+                    if (!restored.open()) {
+                        report->line() << xi18nc("@info:progress", "Could not open target partition <filename>%1</filename> for verifying.", targetPartition().deviceNode());
+                        rval = false;
+                    } else
+                        rval = verifyBlocks(*report, restored, checksums);
+                }
 
                 CoreBackendDevice* backendDevice = CoreBackendManager::self()->backend()->openDevice(targetDevice().deviceNode());
 
@@ -0,0 +1,121 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "jobs/resumecopyjob.h"
+
+#include "core/copyjournal.h"
+#include "core/copysourcedevice.h"
+#include "core/copytargetdevice.h"
+#include "core/device.h"
+
+#include "util/report.h"
+
+#include <KLocalizedString>
+
+/** Creates a new ResumeCopyJob
+    @param d the Device the copy was running on
+    @param journalfilename the file name of the copy's journal
+    @param rollback true to roll the copy back instead of completing it
+*/
+ResumeCopyJob::ResumeCopyJob(Device& d, const QString& journalfilename, bool rollback) :
+    Job(),
+    m_Device(d),
+    m_JournalFileName(journalfilename),
+    m_Rollback(rollback)
+{
+}
+
+qint32 ResumeCopyJob::numSteps() const
+{
+    return 100;
+}
+
+bool ResumeCopyJob::run(Report& parent)
+{
+    bool rval = false;
+
+    Report* report = jobStarted(parent);
+
+    CopyJournal journal;
+
+    if (!journal.load(journalFileName()))
+        report->line() << xi18nc("@info:progress", "Could not read the journal <filename>%1</filename>.", journalFileName());
+    else if (journal.deviceNode() != device().deviceNode() || journal.sectorSize() != device().logicalSize())
+        report->line() << xi18nc("@info:progress", "The journal <filename>%1</filename> is not for device <filename>%2</filename>.", journalFileName(), device().deviceNode());
+    else {
+        report->line() << xi18nc("@info:progress", "Copying %1 sectors from %2 to %3 was interrupted after %4 sectors.", journal.length(), journal.sourceFirstSector(), journal.targetFirstSector(), journal.sectorsDone());
+
+        // A backward copy has done the sectors at the end of the range, a forward copy those at the start.
+        const qint64 done = journal.sectorsDone();
+        const qint64 doneFirst = journal.backward() ? journal.length() - done : 0;
+        const qint64 leftFirst = journal.backward() ? 0 : done;
+        const qint64 left = journal.length() - done;
+        const bool overlapping = qAbs(journal.targetFirstSector() - journal.sourceFirstSector()) < journal.length();
+
+        if (!rollback() && left == 0)
+            rval = true;
+        else if (journal.inPlace()) {
+            // a move in place picks up a window it has staged itself, so it is given the whole move
+            CopySourceDevice source(device(), journal.sourceFirstSector(), journal.sourceFirstSector() + journal.length() - 1);
+            CopyTargetDevice target(device(), journal.targetFirstSector(), journal.targetFirstSector() + journal.length() - 1);
+
+            if (!source.open() || !target.open())
+                report->line() << xi18nc("@info:progress", "Could not open device <filename>%1</filename> to resume copying.", device().deviceNode());
+            else if (rollback())
+                rval = rollbackCopyBlocks(*report, target, source, &journal);
+            else
+                rval = moveBlocksInPlace(*report, target, source, journal);
+        } else if (rollback() && (done == 0 || !overlapping)) {
+            report->line() << xi18nc("@info:progress", "Source and target for copying do not overlap: Rollback is not required.");
+            rval = true;
+        } else if (!rollback()) {
+            // A scope for source and target. See MoveFileSystemJob::run()
+            CopySourceDevice source(device(), journal.sourceFirstSector() + leftFirst, journal.sourceFirstSector() + leftFirst + left - 1);
+            CopyTargetDevice target(device(), journal.targetFirstSector() + leftFirst, journal.targetFirstSector() + leftFirst + left - 1);
+
+            if (!source.open() || !target.open())
+                report->line() << xi18nc("@info:progress", "Could not open device <filename>%1</filename> to resume copying.", device().deviceNode());
+            else
+                rval = copyBlocks(*report, target, source, nullptr, nullptr, &journal);
+        } else {
+            CopySourceDevice undoSource(device(), journal.targetFirstSector() + doneFirst, journal.targetFirstSector() + doneFirst + done - 1);
+            CopyTargetDevice undoTarget(device(), journal.sourceFirstSector() + doneFirst, journal.sourceFirstSector() + doneFirst + done - 1);
+
+            if (!undoSource.open() || !undoTarget.open())
+                report->line() << xi18nc("@info:progress", "Could not open device <filename>%1</filename> to rollback copying.", device().deviceNode());
+            else if (!journal.create(device().deviceNode(), undoSource.sectorSize(), undoSource.firstSector(), undoTarget.firstSector(), done, undoTarget.firstSector() > undoSource.firstSector()))
+                report->line() << xi18nc("@info:progress", "Could not create a journal for the rollback.");
+            else
+                rval = copyBlocks(*report, undoTarget, undoSource, nullptr, nullptr, &journal);
+        }
+
+        if (rval)
+            journal.remove();
+    }
+
+    jobFinished(*report, rval);
+
+    return rval;
+}
+
+QString ResumeCopyJob::description() const
+{
+    if (rollback())
+        return xi18nc("@info:progress", "Roll back the interrupted copy on device <filename>%1</filename>", device().deviceNode());
+
+    return xi18nc("@info:progress", "Resume the interrupted copy on device <filename>%1</filename>", device().deviceNode());
+}
@@ -0,0 +1,68 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(RESUMECOPYJOB__H)
+
+#define RESUMECOPYJOB__H
+
+#include "jobs/job.h"
+
+#include <QString>
+
+class Device;
+class Report;
+
+/** Resume or roll back an interrupted copy.
+
+    Continues a copy on a Device that has been interrupted by a crash or a power failure
+    from the last checkpoint in its CopyJournal, or copies back what it had written so far.
+    Once the copy has been completed or rolled back, the journal is removed.
+
+    @see CopyJournal::pending
+*/
+class LIBKPMCORE_EXPORT ResumeCopyJob : public Job
+{
+public:
+    ResumeCopyJob(Device& d, const QString& journalfilename, bool rollback);
+
+public:
+    bool run(Report& parent) override;
+    qint32 numSteps() const override;
+    QString description() const override;
+
+protected:
+    Device& device() {
+        return m_Device;
+    }
+    const Device& device() const {
+        return m_Device;
+    }
+
+    const QString& journalFileName() const {
+        return m_JournalFileName;
+    }
+    bool rollback() const {
+        return m_Rollback;
+    }
+
+private:
+    Device& m_Device;
+    QString m_JournalFileName;
+    bool m_Rollback;
+};
+
+#endif
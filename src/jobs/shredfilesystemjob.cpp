@@ -20,27 +20,45 @@
 
 #include "core/partition.h"
 #include "core/device.h"
+#include "core/checksummanifest.h"
+#include "core/copysourcedevice.h"
 #include "core/copysourceshred.h"
 #include "core/copytargetdevice.h"
 
 #include "fs/filesystem.h"
 #include "fs/filesystemfactory.h"
 
+#include "util/checksum.h"
 #include "util/report.h"
 
 #include <QDebug>
+#include <QStringList>
 
 #include <KLocalizedString>
 
 /** Creates a new ShredFileSystemJob
     @param d the Device the FileSystem is on
     @param p the Partition the FileSystem is in
+    @param randomShred true to overwrite with random data, false to overwrite with zeros
 */
 ShredFileSystemJob::ShredFileSystemJob(Device& d, Partition& p, bool randomShred) :
     Job(),
     m_Device(d),
     m_Partition(p),
-    m_RandomShred(randomShred)
+    m_Passes(QList<Pass>() << (randomShred ? RandomPass : ZeroPass))
+{
+}
+
+/** Creates a new ShredFileSystemJob that runs several passes
+    @param d the Device the FileSystem is on
+    @param p the Partition the FileSystem is in
+    @param passes the passes to run, in order
+*/
+ShredFileSystemJob::ShredFileSystemJob(Device& d, Partition& p, const QList<Pass>& passes) :
+    Job(),
+    m_Device(d),
+    m_Partition(p),
+    m_Passes(passes)
 {
 }
 
@@ -65,14 +83,42 @@ bool ShredFileSystemJob::run(Report& parent)
     // Again, a scope for copyTarget and copySource. See MoveFileSystemJob::run()
     {
         CopyTargetDevice copyTarget(device(), partition().fileSystem().firstSector(), partition().fileSystem().lastSector());
-        CopySourceShred copySource(partition().capacity(), copyTarget.sectorSize(), m_RandomShred);
+        ChecksumManifest checksums;
 
-        if (!copySource.open())
-            report->line() << xi18nc("@info:progress", "Could not open random data source to overwrite file system.");
+        if (passes().isEmpty())
+            report->line() << xi18nc("@info:progress", "No passes to overwrite the file system with have been given.");
         else if (!copyTarget.open())
             report->line() << xi18nc("@info:progress", "Could not open target partition <filename>%1</filename> to restore to.", partition().deviceNode());
         else {
-            rval = copyBlocks(*report, copyTarget, copySource);
+            rval = true;
+
+            for (qint32 i = 0; rval && i < passes().size(); i++) {
+                if (passes()[i] == VerifyPass) {
+                    if (checksums.isEmpty()) {
+                        report->line() << xi18nc("@info:progress", "Pass %1 of %2: Nothing has been written to verify.", i + 1, passes().size());
+                        continue;
+                    }
+
+                    report->line() << xi18nc("@info:progress", "Pass %1 of %2: Verifying the data written.", i + 1, passes().size());
+
+                    CopySourceDevice written(device(), partition().fileSystem().firstSector(), partition().fileSystem().lastSector());
+
+                    if (!written.open()) {
+                        report->line() << xi18nc("@info:progress", "Could not open partition <filename>%1</filename> for verifying.", partition().deviceNode());
+                        rval = false;
+                    } else
+                        rval = verifyBlocks(*report, written, checksums);
+
+                    continue;
+                }
+
+                // checksums are only needed if the next pass verifies this one
+                const bool verifyNext = i + 1 < passes().size() && passes()[i + 1] == VerifyPass;
+                checksums = ChecksumManifest(copyTarget.sectorSize());
+
+                rval = overwrite(*report, copyTarget, i, verifyNext ? &checksums : nullptr);
+            }
+
             report->line() << i18nc("@info:progress", "Closing device. This may take a few seconds.");
         }
     }
@@ -82,6 +128,98 @@ bool ShredFileSystemJob::run(Report& parent)
     return rval;
 }
 
+/** Runs one pass that overwrites the FileSystem.
+
+    Zeroing and discarding are left to the device if it can do that itself. Otherwise,
+    the zeros are written.
+
+    @param report the Report to write information to
+    @param copyTarget the opened target to overwrite
+    @param i the number of the pass to run, which must not be a VerifyPass
+    @param checksums if not nullptr, the checksums of what has been written are put here
+    @return true on success
+*/
+bool ShredFileSystemJob::overwrite(Report& report, CopyTargetDevice& copyTarget, qint32 i, ChecksumManifest* checksums)
+{
+    Pass pass = passes()[i];
+
+    if (pass == DiscardPass || pass == SecureDiscardPass) {
+        report.line() << xi18nc("@info:progress", "Pass %1 of %2: Discarding the data.", i + 1, passes().size());
+
+        if (eraseBlocks(report, copyTarget, pass == DiscardPass ? CopyTargetDevice::Discard : CopyTargetDevice::SecureDiscard))
+            return true;
+
+        report.line() << xi18nc("@info:progress", "Overwriting with zeros instead.");
+        pass = ZeroPass;
+    }
+
+    if (pass == ZeroPass) {
+        report.line() << xi18nc("@info:progress", "Pass %1 of %2: Overwriting with zeros.", i + 1, passes().size());
+
+        if (eraseBlocks(report, copyTarget, CopyTargetDevice::ZeroOut)) {
+            if (checksums)
+                appendZeroChecksums(*checksums, copyTarget.lastSector() - copyTarget.firstSector() + 1);
+
+            return true;
+        }
+    } else
+        report.line() << xi18nc("@info:progress", "Pass %1 of %2: Overwriting with random data.", i + 1, passes().size());
+
+    CopySourceShred copySource(partition().capacity(), copyTarget.sectorSize(), pass == RandomPass);
+
+    if (!copySource.open()) {
+        report.line() << xi18nc("@info:progress", "Could not open random data source to overwrite file system.");
+        return false;
+    }
+
+    return copyBlocks(report, copyTarget, copySource, checksums);
+}
+
+/** Records the checksums of sectors that are all zeros, as the pipeline would have while copying them.
+    @param checksums the checksums to append to
+    @param numSectors the number of sectors that have been zeroed
+*/
+void ShredFileSystemJob::appendZeroChecksums(ChecksumManifest& checksums, qint64 numSectors)
+{
+    const qint64 chunkSectors = qMax(1024 * 1024 / checksums.sectorSize(), 1);
+    const QByteArray zeros(chunkSectors * checksums.sectorSize(), 0);
+    const quint32 chunkChecksum = crc32c(zeros.constData(), zeros.size());
+
+    for (qint64 offset = 0; offset < numSectors; offset += chunkSectors) {
+        const qint64 n = qMin(chunkSectors, numSectors - offset);
+        const ChecksumManifest::Entry entry = { offset, n, n == chunkSectors ? chunkChecksum : crc32c(zeros.constData(), n * checksums.sectorSize()) };
+        checksums.append(entry);
+    }
+}
+
+/** Parses a pattern of passes.
+    @param s a comma separated list of the passes "zero", "random", "discard", "secure-discard" and "verify", e.g. "random,zero,verify"
+    @return the passes, or an empty list if @p s is not a valid pattern
+*/
+QList<ShredFileSystemJob::Pass> ShredFileSystemJob::passesFromString(const QString& s)
+{
+    QList<Pass> rval;
+
+    for (const auto &pass : s.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const QString name = pass.trimmed().toLower();
+
+        if (name == QStringLiteral("zero"))
+            rval.append(ZeroPass);
+        else if (name == QStringLiteral("random"))
+            rval.append(RandomPass);
+        else if (name == QStringLiteral("discard"))
+            rval.append(DiscardPass);
+        else if (name == QStringLiteral("secure-discard"))
+            rval.append(SecureDiscardPass);
+        else if (name == QStringLiteral("verify"))
+            rval.append(VerifyPass);
+        else
+            return QList<Pass>();
+    }
+
+    return rval;
+}
+
 QString ShredFileSystemJob::description() const
 {
     return xi18nc("@info:progress", "Shred the file system on <filename>%1</filename>", partition().deviceNode());
@@ -21,8 +21,10 @@
 
 #include "jobs/job.h"
 
+#include <QList>
 #include <QString>
 
+class ChecksumManifest;
 class Partition;
 class Device;
 class Report;
@@ -31,19 +33,44 @@ class Report;
 
     Shreds (overwrites with random data) a FileSystem on given Partition and Device.
 
+    The FileSystem can be overwritten several times with a pattern of passes. A verify pass
+    reads back what the pass before it has written and checks that it is on the disk.
+
+    Zeroing and discarding are done by the device itself where it supports that.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class ShredFileSystemJob : public Job
 {
+public:
+    /** A pass over the FileSystem */
+    enum Pass {
+        ZeroPass,       /**< overwrite with zeros */
+        RandomPass,     /**< overwrite with random data */
+        VerifyPass,     /**< check what the previous pass has written */
+        DiscardPass,    /**< let the device discard the data, or overwrite with zeros if it cannot */
+        SecureDiscardPass   /**< let the device securely discard the data, or overwrite with zeros if it cannot */
+    };
+
 public:
     ShredFileSystemJob(Device& d, Partition& p, bool randomShred);
+    ShredFileSystemJob(Device& d, Partition& p, const QList<Pass>& passes);
 
 public:
     bool run(Report& parent) override;
     qint32 numSteps() const override;
     QString description() const override;
 
+    const QList<Pass>& passes() const {
+        return m_Passes;    /**< @return the passes to run */
+    }
+
+    static QList<Pass> passesFromString(const QString& s);
+
 protected:
+    bool overwrite(Report& report, CopyTargetDevice& copyTarget, qint32 i, ChecksumManifest* checksums);
+    static void appendZeroChecksums(ChecksumManifest& checksums, qint64 numSectors);
+
     Partition& partition() {
         return m_Partition;
     }
@@ -61,7 +88,7 @@ protected:
 private:
     Device& m_Device;
     Partition& m_Partition;
-    bool m_RandomShred;
+    QList<Pass> m_Passes;
 };
 
 #endif
@@ -33,13 +33,15 @@
     @param d the Device where the FileSystem to back up is on
     @param p the Partition where the FileSystem to back up is in
     @param filename the name of the file to back up to
+    @param parentFileName the name of the file of a previous backup to back up only the changes since, empty for a full backup
+    @param indexed false to not write checksums and a block index for a full backup, see BackupFileSystemJob
 */
-BackupOperation::BackupOperation(Device& d, Partition& p, const QString& filename) :
+BackupOperation::BackupOperation(Device& d, Partition& p, const QString& filename, const QString& parentFileName, bool indexed) :
     Operation(),
     m_TargetDevice(d),
     m_BackupPartition(p),
     m_FileName(filename),
-    m_BackupJob(new BackupFileSystemJob(targetDevice(), backupPartition(), fileName()))
+    m_BackupJob(new BackupFileSystemJob(targetDevice(), backupPartition(), fileName(), parentFileName, indexed))
 {
     addJob(backupJob());
 }
@@ -49,6 +51,25 @@ QString BackupOperation::description() const
     return xi18nc("@info:status", "Backup partition <filename>%1</filename> (%2, %3) to <filename>%4</filename>", backupPartition().deviceNode(), Capacity::formatByteSize(backupPartition().capacity()), backupPartition().fileSystem().name(), fileName());
 }
 
+/** @return true if the backup goes on past sectors of the source that cannot be read */
+bool BackupOperation::rescue() const
+{
+    return m_BackupJob->rescue();
+}
+
+/** Makes the backup go on past sectors of the source that cannot be read.
+
+    The image is then written uncompressed and without checksums or a block index, and
+    running the backup again continues where it stopped.
+
+    @param rescue true to rescue a failing source
+    @see Job::rescueBlocks
+*/
+void BackupOperation::setRescue(bool rescue)
+{
+    m_BackupJob->setRescue(rescue);
+}
+
 /** Can the given Partition be backed up?
     @param p The Partition in question, may be nullptr.
     @return true if @p p can be backed up.
@@ -38,7 +38,7 @@ class LIBKPMCORE_EXPORT BackupOperation : public Operation
     Q_DISABLE_COPY(BackupOperation)
 
 public:
-    BackupOperation(Device& targetDevice, Partition& backupPartition, const QString& filename);
+    BackupOperation(Device& targetDevice, Partition& backupPartition, const QString& filename, const QString& parentFileName = QString(), bool indexed = true);
 
 public:
     QString iconName() const override {
@@ -55,6 +55,9 @@ public:
         return false;
     }
 
+    bool rescue() const;
+    void setRescue(bool rescue);
+
     static bool canBackup(const Partition* p);
 
 protected:
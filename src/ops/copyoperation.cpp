@@ -33,7 +33,9 @@
 #include "util/report.h"
 
 #include <QDebug>
+#include <QList>
 #include <QString>
+#include <QVector>
 
 #include <KLocalizedString>
 
@@ -119,69 +121,178 @@ void CopyOperation::undo()
 
 bool CopyOperation::execute(Report& parent)
 {
-    bool rval = false;
-    bool warning = false;
+    return execute(parent, QList<CopyOperation*>() << this);
+}
 
-    Report* report = parent.newChild(description());
+/** Runs several CopyOperations of the same source Partition at once.
 
-    // check the source first
-    if ((rval = checkSourceJob()->run(*report))) {
-        // At this point, if the target partition is to be created and not overwritten, it
-        // will still have the wrong device path (the one of the source device). We need
-        // to adjust that before we're creating it.
-        copiedPartition().setDevicePath(targetDevice().deviceNode());
-
-        // either we have no partition to create (because we're overwriting) or creating
-        // must be successful
-        if (!createPartitionJob() || (rval = createPartitionJob()->run(*report))) {
-            // set the state of the target partition from StateCopy to StateNone or checking
-            // it will fail (because its deviceNode() will still be "Copy of sdXn"). This is
-            // only required for overwritten partitions, but doesn't hurt in any case.
-            copiedPartition().setState(Partition::StateNone);
-
-            // if we have overwritten a partition, reset device path and number
-            if (overwrittenPartition()) {
-                copiedPartition().setDevicePath(overwrittenPartition()->devicePath());
-                copiedPartition().setPartitionPath(overwrittenPartition()->partitionPath());
-            }
+    The source is checked once and its FileSystem read once while it is copied to all
+    targets. A target that cannot be created or copied to fails its own CopyOperation only.
 
-            // now run the copy job itself
-            if ((rval = copyFSJob()->run(*report))) {
-                // and if the copy job succeeded, check the target
-                if ((rval = checkTargetJob()->run(*report))) {
-                    // ok, everything went well
-                    rval = true;
+    @param parent the parent Report
+    @param ops the CopyOperations to run, each must be able to run together with the first
+    @return true if all CopyOperations succeeded
+*/
+bool CopyOperation::execute(Report& parent, const QList<CopyOperation*>& ops)
+{
+    Q_ASSERT(!ops.isEmpty());
 
+    QList<Report*> reports;
+    QVector<bool> ok(ops.size(), false);
+    QVector<bool> warning(ops.size(), false);
+
+    for (const auto &op : ops)
+        reports.append(parent.newChild(op->description()));
+
+    // A failing source is not checked, so that nothing but the copy itself reads it.
+    const bool rescue = ops.first()->rescue();
+
+    if (rescue)
+        reports.first()->line() << xi18nc("@info:status", "Rescuing partition <filename>%1</filename>: The source is not checked, and sectors that cannot be read are skipped.", ops.first()->sourcePartition().deviceNode());
+
+    // check the source first
+    if (rescue || ops.first()->checkSourceJob()->run(*reports.first())) {
+        CopyFileSystemJob* copyJob = nullptr;
+        qint32 copyReport = -1;
+
+        for (qint32 i = 0; i < ops.size(); i++) {
+            if (!(ok[i] = ops[i]->createTarget(*reports[i])))
+                continue;
+
+            // the first operation that has a target copies to all of them
+            if (copyJob == nullptr) {
+                copyJob = ops[i]->copyFSJob();
+                copyReport = i;
+            } else
+                copyJob->addTarget(ops[i]->targetDevice(), ops[i]->copiedPartition());
+        }
+
+        // now run the copy job itself
+        if (copyJob) {
+            copyJob->run(*reports[copyReport]);
+            copyJob->resetTargets();
+        }
+
+        for (qint32 i = 0; i < ops.size(); i++) {
+            if (!ok[i])
+                continue;
+
+            if (copyJob->isCopied(ops[i]->copiedPartition())) {
+                // and if the copy job succeeded, check the target
+                if ((ok[i] = ops[i]->checkTargetJob()->run(*reports[i]))) {
                     // if maximizing doesn't work, just warn the user, don't fail
-                    if (!maximizeJob()->run(*report)) {
-                        report->line() << xi18nc("@info:status", "<warning>Maximizing file system on target partition <filename>%1</filename> to the size of the partition failed.</warning>", copiedPartition().deviceNode());
-                        warning = true;
+                    if (!ops[i]->maximizeJob()->run(*reports[i])) {
+                        reports[i]->line() << xi18nc("@info:status", "<warning>Maximizing file system on target partition <filename>%1</filename> to the size of the partition failed.</warning>", ops[i]->copiedPartition().deviceNode());
+                        warning[i] = true;
                     }
+                } else if (rescue) {
+                    // what could be rescued is on the target even if its file system is damaged
+                    reports[i]->line() << xi18nc("@info:status", "<warning>Checking target partition <filename>%1</filename> after rescuing failed.</warning>", ops[i]->copiedPartition().deviceNode());
+                    ok[i] = true;
+                    warning[i] = true;
                 } else
-                    report->line() << xi18nc("@info:status", "Checking target partition <filename>%1</filename> after copy failed.", copiedPartition().deviceNode());
+                    reports[i]->line() << xi18nc("@info:status", "Checking target partition <filename>%1</filename> after copy failed.", ops[i]->copiedPartition().deviceNode());
             } else {
-                if (createPartitionJob()) {
-                    DeletePartitionJob deleteJob(targetDevice(), copiedPartition());
-                    deleteJob.run(*report);
+                if (ops[i]->createPartitionJob()) {
+                    DeletePartitionJob deleteJob(ops[i]->targetDevice(), ops[i]->copiedPartition());
+                    deleteJob.run(*reports[i]);
                 }
 
-                report->line() << xi18nc("@info:status", "Copying source to target partition failed.");
+                reports[i]->line() << xi18nc("@info:status", "Copying source to target partition failed.");
+                ok[i] = false;
             }
-        } else
-            report->line() << xi18nc("@info:status", "Creating target partition for copying failed.");
+        }
     } else
-        report->line() << xi18nc("@info:status", "Checking source partition <filename>%1</filename> failed.", sourcePartition().deviceNode());
+        for (qint32 i = 0; i < ops.size(); i++)
+            reports[i]->line() << xi18nc("@info:status", "Checking source partition <filename>%1</filename> failed.", ops[i]->sourcePartition().deviceNode());
+
+    bool rval = true;
 
-    if (rval)
-        setStatus(warning ? StatusFinishedWarning : StatusFinishedSuccess);
-    else
-        setStatus(StatusError);
+    for (qint32 i = 0; i < ops.size(); i++) {
+        if (ok[i])
+            ops[i]->setStatus(warning[i] ? StatusFinishedWarning : StatusFinishedSuccess);
+        else
+            ops[i]->setStatus(StatusError);
 
-    report->setStatus(xi18nc("@info:status (success, error, warning...) of operation", "%1: %2", description(), statusText()));
+        reports[i]->setStatus(xi18nc("@info:status (success, error, warning...) of operation", "%1: %2", ops[i]->description(), ops[i]->statusText()));
+
+        rval = rval && ok[i];
+    }
 
     return rval;
 }
 
+/** Creates the target Partition, unless an existing one is overwritten.
+    @param report the Report to write information to
+    @return true on success
+*/
+bool CopyOperation::createTarget(Report& report)
+{
+    // At this point, if the target partition is to be created and not overwritten, it
+    // will still have the wrong device path (the one of the source device). We need
+    // to adjust that before we're creating it.
+    copiedPartition().setDevicePath(targetDevice().deviceNode());
+
+    // either we have no partition to create (because we're overwriting) or creating
+    // must be successful
+    if (createPartitionJob() && !createPartitionJob()->run(report)) {
+        report.line() << xi18nc("@info:status", "Creating target partition for copying failed.");
+        return false;
+    }
+
+    // set the state of the target partition from StateCopy to StateNone or checking
+    // it will fail (because its deviceNode() will still be "Copy of sdXn"). This is
+    // only required for overwritten partitions, but doesn't hurt in any case.
+    copiedPartition().setState(Partition::StateNone);
+
+    // if we have overwritten a partition, reset device path and number
+    if (overwrittenPartition()) {
+        copiedPartition().setDevicePath(overwrittenPartition()->devicePath());
+        copiedPartition().setPartitionPath(overwrittenPartition()->partitionPath());
+    }
+
+    return true;
+}
+
+/** Can this CopyOperation run together with another one?
+
+    This is the case if both copy the same source Partition with the core copy code and
+    neither overwrites the Partition the other one creates.
+
+    @param other the other CopyOperation
+    @return true if both can be run at once with execute(Report&, const QList<CopyOperation*>&)
+*/
+bool CopyOperation::canCopyWith(const CopyOperation& other) const
+{
+    return &other != this &&
+           &other.sourceDevice() == &sourceDevice() &&
+           &other.sourcePartition() == &sourcePartition() &&
+           sourcePartition().fileSystem().supportCopy() == FileSystem::cmdSupportCore &&
+           other.overwrittenPartition() != &copiedPartition() &&
+           overwrittenPartition() != &other.copiedPartition() &&
+           &other.copiedPartition() != &copiedPartition() &&
+           other.rescue() == rescue();
+}
+
+/** @return true if the copy goes on past sectors of the source that cannot be read */
+bool CopyOperation::rescue() const
+{
+    return m_CopyFSJob->rescue();
+}
+
+/** Makes the copy go on past sectors of the source that cannot be read.
+
+    A rescue copy does not check the source, copies what can be read first and records
+    its progress, so that running it again continues where it stopped.
+
+    @param rescue true to rescue a failing source
+    @see Job::rescueBlocks
+*/
+void CopyOperation::setRescue(bool rescue)
+{
+    m_CopyFSJob->setRescue(rescue);
+}
+
 QString CopyOperation::updateDescription() const
 {
     if (overwrittenPartition()) {
@@ -24,6 +24,7 @@
 
 #include "ops/operation.h"
 
+#include <QList>
 #include <QString>
 
 class Partition;
@@ -62,6 +63,11 @@ public:
     }
 
     bool execute(Report& parent) override;
+    static bool execute(Report& parent, const QList<CopyOperation*>& ops);
+    bool canCopyWith(const CopyOperation& other) const;
+
+    bool rescue() const;
+    void setRescue(bool rescue);
     void preview() override;
     void undo() override;
 
@@ -135,6 +141,8 @@ protected:
         return m_MaximizeJob;
     }
 
+    bool createTarget(Report& report);
+
     QString updateDescription() const;
 
 private:
@@ -36,13 +36,16 @@
 /** Creates a new DeleteOperation
     @param d the Device to delete a Partition on
     @param p pointer to the Partition to delete. May not be nullptr
+    @param shred how to shred the Partition's FileSystem before deleting it
+    @param shredPattern the passes to shred with if @p shred is PatternShred, e.g. "random,zero,verify"
 */
-DeleteOperation::DeleteOperation(Device& d, Partition* p, ShredAction shred) :
+DeleteOperation::DeleteOperation(Device& d, Partition* p, ShredAction shred, const QString& shredPattern) :
     Operation(),
     m_TargetDevice(d),
     m_DeletedPartition(p),
     m_ShredAction(shred),
-    m_DeletePartitionJob(new DeletePartitionJob(targetDevice(), deletedPartition()))
+    m_ShredPattern(shredPattern),
+    m_DeletePartitionJob(new DeletePartitionJob(targetDevice(), deletedPartition(), shred != NoShred))
 {
     switch (shredAction()) {
     case NoShred:
@@ -53,6 +56,9 @@ DeleteOperation::DeleteOperation(Device& d, Partition* p, ShredAction shred) :
         break;
     case RandomShred:
         m_DeleteFileSystemJob = static_cast<Job*>(new ShredFileSystemJob(targetDevice(), deletedPartition(), true));
+        break;
+    case PatternShred:
+        m_DeleteFileSystemJob = static_cast<Job*>(new ShredFileSystemJob(targetDevice(), deletedPartition(), ShredFileSystemJob::passesFromString(shredPattern)));
     }
 
     addJob(deleteFileSystemJob());
@@ -46,10 +46,11 @@ public:
     enum ShredAction {
         NoShred = 0,
         ZeroShred,
-        RandomShred
+        RandomShred,
+        PatternShred
     };
 
-    DeleteOperation(Device& d, Partition* p, ShredAction shred = NoShred);
+    DeleteOperation(Device& d, Partition* p, ShredAction shred = NoShred, const QString& shredPattern = QString());
     ~DeleteOperation();
 
 public:
@@ -64,6 +65,9 @@ public:
     ShredAction shredAction() const {
         return m_ShredAction;
     }
+    const QString& shredPattern() const {
+        return m_ShredPattern;    /**< @return the passes to shred with for PatternShred, see ShredFileSystemJob::passesFromString() */
+    }
 
     bool targets(const Device& d) const override;
     bool targets(const Partition& p) const override;
@@ -102,6 +106,7 @@ private:
     Device& m_TargetDevice;
     Partition* m_DeletedPartition;
     ShredAction m_ShredAction;
+    QString m_ShredPattern;
     Job* m_DeleteFileSystemJob;
     DeletePartitionJob* m_DeletePartitionJob;
 };
@@ -39,14 +39,22 @@
 #include "fs/lvm2_pv.h"
 
 #include "util/globallog.h"
-#include "util/externalcommand.h"
+#include "util/blkidprobe.h"
 #include "util/helpers.h"
+#include "util/topologysnapshot.h"
 
-#include <blkid/blkid.h>
 
 #include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QString>
 #include <QStringList>
+#include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QVector>
 
 #include <KLocalizedString>
 #include <KDiskFreeSpaceInfo>
@@ -56,7 +64,15 @@
 
 K_PLUGIN_FACTORY_WITH_JSON(LibPartedBackendFactory, "pmlibpartedbackendplugin.json", registerPlugin<LibPartedBackend>();)
 
-static QString s_lastPartedExceptionMessage;
+// libparted calls its exception handler in the thread that made the failing call, so
+// each thread keeps the last message of its own calls.
+static QThreadStorage<QString> s_lastPartedExceptionMessage;
+
+// libparted keeps global state, such as its list of devices, that must not be used from
+// several threads at once. Devices are scanned in parallel, so all libparted calls while
+// scanning are made holding this lock. It is recursive because scanning a device asks
+// libparted for the same device again.
+static QMutex s_PartedMutex(QMutex::Recursive);
 
 /** Callback to handle exceptions from libparted
     @param e the libparted exception to handle
@@ -64,10 +80,20 @@ static QString s_lastPartedExceptionMessage;
 static PedExceptionOption pedExceptionHandler(PedException* e)
 {
     Log(Log::error) << xi18nc("@info:status", "LibParted Exception: %1", QString::fromLocal8Bit(e->message));
-    s_lastPartedExceptionMessage = QString::fromLocal8Bit(e->message);
+    s_lastPartedExceptionMessage.setLocalData(QString::fromLocal8Bit(e->message));
     return PED_EXCEPTION_UNHANDLED;
 }
 
+/** What scanning needs to know of a partition, read from libparted */
+struct PedPartitionInfo {
+    PedPartitionType type;
+    qint64 start;
+    qint64 end;
+    QString path;
+    PartitionTable::Flags availableFlags;
+    PartitionTable::Flags activeFlags;
+};
+
 // --------------------------------------------------------------------------
 
 // The following structs and the typedef come from libparted's internal gpt sources.
@@ -167,6 +193,7 @@ static qint64 readSectorsUsedLibParted(PedDisk* pedDisk, const Partition& p)
 
     qint64 rval = -1;
 
+    QMutexLocker locker(&s_PartedMutex);
     PedPartition* pedPartition = ped_disk_get_partition_by_sector(pedDisk, p.firstSector());
 
     if (pedPartition) {
@@ -247,6 +274,52 @@ static PartitionTable::Flags availableFlags(PedPartition* p)
     return flags;
 }
 
+/** Maps what libblkid found on a device to a FileSystem type
+    @param probe the probe result for the device
+    @return the detected FileSystem type (FileSystem::Unknown if not detected)
+*/
+static FileSystem::Type fileSystemType(const BlkidProbe& probe)
+{
+    FileSystem::Type rval = FileSystem::Unknown;
+
+    if (!probe.isValid())
+        return rval;
+
+    const QString& s = probe.type();
+
+    if (s == QStringLiteral("ext2")) rval = FileSystem::Ext2;
+    else if (s == QStringLiteral("ext3")) rval = FileSystem::Ext3;
+    else if (s.startsWith(QStringLiteral("ext4"))) rval = FileSystem::Ext4;
+    else if (s == QStringLiteral("swap")) rval = FileSystem::LinuxSwap;
+    else if (s == QStringLiteral("ntfs")) rval = FileSystem::Ntfs;
+    else if (s == QStringLiteral("reiserfs")) rval = FileSystem::ReiserFS;
+    else if (s == QStringLiteral("reiser4")) rval = FileSystem::Reiser4;
+    else if (s == QStringLiteral("xfs")) rval = FileSystem::Xfs;
+    else if (s == QStringLiteral("jfs")) rval = FileSystem::Jfs;
+    else if (s == QStringLiteral("hfs")) rval = FileSystem::Hfs;
+    else if (s == QStringLiteral("hfsplus")) rval = FileSystem::HfsPlus;
+    else if (s == QStringLiteral("ufs")) rval = FileSystem::Ufs;
+    else if (s == QStringLiteral("vfat")) {
+        // libblkid uses SEC_TYPE to distinguish between FAT16 and FAT32
+        if (probe.secType() == QStringLiteral("msdos"))
+            rval = FileSystem::Fat16;
+        else
+            rval = FileSystem::Fat32;
+    } else if (s == QStringLiteral("btrfs")) rval = FileSystem::Btrfs;
+    else if (s == QStringLiteral("ocfs2")) rval = FileSystem::Ocfs2;
+    else if (s == QStringLiteral("zfs_member")) rval = FileSystem::Zfs;
+    else if (s == QStringLiteral("hpfs")) rval = FileSystem::Hpfs;
+    else if (s == QStringLiteral("crypto_LUKS")) rval = FileSystem::Luks;
+    else if (s == QStringLiteral("exfat")) rval = FileSystem::Exfat;
+    else if (s == QStringLiteral("nilfs2")) rval = FileSystem::Nilfs2;
+    else if (s == QStringLiteral("LVM2_member")) rval = FileSystem::Lvm2_PV;
+    else if (s == QStringLiteral("f2fs")) rval = FileSystem::F2fs;
+    else
+        qWarning() << "blkid: unknown file system type " << s << " on " << probe.deviceNode();
+
+    return rval;
+}
+
 /** Constructs a LibParted object. */
 LibPartedBackend::LibPartedBackend(QObject*, const QList<QVariant>&) :
     CoreBackend()
@@ -291,23 +364,38 @@ void LibPartedBackend::scanDevicePartitions(Device& d, PedDisk* pedDisk)
     Q_ASSERT(pedDisk);
     Q_ASSERT(d.partitionTable());
 
-    PedPartition* pedPartition = nullptr;
+    // The partitions are read from libparted first, so that the lock is not held while
+    // they are probed, which is what takes long.
+    QVector<PedPartitionInfo> pedPartitions;
 
-    QList<Partition*> partitions;
+    {
+        QMutexLocker locker(&s_PartedMutex);
+        PedPartition* pedPartition = nullptr;
 
-    while ((pedPartition = ped_disk_next_partition(pedDisk, pedPartition))) {
-        if (pedPartition->num < 1)
-            continue;
+        while ((pedPartition = ped_disk_next_partition(pedDisk, pedPartition))) {
+            if (pedPartition->num < 1)
+                continue;
+
+            char* pedPath = ped_partition_get_path(pedPartition);
+            const PedPartitionInfo info = { pedPartition->type, pedPartition->geom.start, pedPartition->geom.end, pedPath ? QString::fromUtf8(pedPath) : QString(), availableFlags(pedPartition), activeFlags(pedPartition) };
+            free(pedPath);
+
+            pedPartitions.append(info);
+        }
+    }
+
+    QList<Partition*> partitions;
 
+    for (const auto &pedPartition : pedPartitions) {
         PartitionRole::Roles r = PartitionRole::None;
 
-        FileSystem::Type type = FileSystem::Unknown;
-        char* pedPath = ped_partition_get_path(pedPartition);
-        const QString partitionNode = pedPath ? QString::fromUtf8(pedPath) : QString();
-        free(pedPath);
-        type = detectFileSystem(partitionNode);
+        const QString partitionNode = pedPartition.path;
 
-        switch (pedPartition->type) {
+        // one superblock read answers the type here and the label and UUID lookups below
+        const BlkidProbe probe = BlkidProbe::of(partitionNode);
+        FileSystem::Type type = fileSystemType(probe);
+
+        switch (pedPartition.type) {
         case PED_PARTITION_NORMAL:
             r = PartitionRole::Primary;
             break;
@@ -326,13 +414,13 @@ void LibPartedBackend::scanDevicePartitions(Device& d, PedDisk* pedDisk)
         }
 
         // Find an extended partition this partition is in.
-        PartitionNode* parent = d.partitionTable()->findPartitionBySector(pedPartition->geom.start, PartitionRole(PartitionRole::Extended));
+        PartitionNode* parent = d.partitionTable()->findPartitionBySector(pedPartition.start, PartitionRole(PartitionRole::Extended));
 
         // None found, so it's a primary in the device's partition table.
         if (parent == nullptr)
             parent = d.partitionTable();
 
-        FileSystem* fs = FileSystemFactory::create(type, pedPartition->geom.start, pedPartition->geom.end);
+        FileSystem* fs = FileSystemFactory::create(type, pedPartition.start, pedPartition.end);
         fs->scan(partitionNode);
         QString mountPoint;
         bool mounted;
@@ -350,7 +438,7 @@ void LibPartedBackend::scanDevicePartitions(Device& d, PedDisk* pedDisk)
             mounted = FileSystem::detectMountStatus(fs, partitionNode);
         }
 
-        Partition* part = new Partition(parent, d, PartitionRole(r), fs, pedPartition->geom.start, pedPartition->geom.end, partitionNode, availableFlags(pedPartition), mountPoint, mounted, activeFlags(pedPartition));
+        Partition* part = new Partition(parent, d, PartitionRole(r), fs, pedPartition.start, pedPartition.end, partitionNode, pedPartition.availableFlags, mountPoint, mounted, pedPartition.activeFlags);
 
         if (!part->roles().has(PartitionRole::Luks))
             readSectorsUsed(pedDisk, d, *part, mountPoint);
@@ -359,8 +447,10 @@ void LibPartedBackend::scanDevicePartitions(Device& d, PedDisk* pedDisk)
             fs->setLabel(fs->readLabel(part->deviceNode()));
 
         // GPT partitions support partition labels and partition UUIDs
-        if(d.partitionTable()->type() == PartitionTable::TableType::gpt)
-            fs->setLabel(fs->readLabel(part->deviceNode()));
+        if (d.partitionTable()->type() == PartitionTable::TableType::gpt) {
+            part->setLabel(probe.partLabel());
+            part->setUUID(probe.partUUID());
+        }
 
         if (fs->supportGetUUID() != FileSystem::cmdSupportNone)
             fs->setUUID(fs->readUUID(part->deviceNode()));
@@ -384,6 +474,8 @@ void LibPartedBackend::scanDevicePartitions(Device& d, PedDisk* pedDisk)
 */
 Device* LibPartedBackend::scanDevice(const QString& deviceNode)
 {
+    TopologySnapshot::Scope topologyScope;
+    QMutexLocker locker(&s_PartedMutex);
     PedDevice* pedDevice = ped_device_get(deviceNode.toLocal8Bit().constData());
 
     if (pedDevice == nullptr) {
@@ -402,50 +494,94 @@ Device* LibPartedBackend::scanDevice(const QString& deviceNode)
         CoreBackend::setPartitionTableForDevice(*d, new PartitionTable(type, firstUsableSector(*d), lastUsableSector(*d)));
         CoreBackend::setPartitionTableMaxPrimaries(*d->partitionTable(), ped_disk_get_max_primary_partition_count(pedDisk));
 
+        // scanDevicePartitions() takes the lock itself, only while it asks libparted
+        locker.unlock();
         scanDevicePartitions(*d, pedDisk);
+        locker.relock();
+
+        ped_disk_destroy(pedDisk);
     }
 
     ped_device_destroy(pedDevice);
     return d;
 }
 
+/** Scans one device on the thread pool */
+class DeviceScanTask : public QRunnable
+{
+public:
+    DeviceScanTask(LibPartedBackend& backend, const QString& deviceNode, QMutex& mutex, QStringList& finished, QSemaphore& done) :
+        m_Backend(backend),
+        m_DeviceNode(deviceNode),
+        m_Device(nullptr),
+        m_Mutex(mutex),
+        m_Finished(finished),
+        m_Done(done)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+        m_Device = m_Backend.scanDevice(m_DeviceNode);
+
+        QMutexLocker locker(&m_Mutex);
+        m_Finished.append(m_DeviceNode);
+        m_Done.release();
+    }
+
+    LibPartedBackend& m_Backend;
+    const QString m_DeviceNode;
+    Device* m_Device;
+    QMutex& m_Mutex;
+    QStringList& m_Finished;
+    QSemaphore& m_Done;
+};
+
 QList<Device*> LibPartedBackend::scanDevices(bool excludeReadOnly)
 {
     QList<Device*> result;
-    // linux.git/tree/Documentation/devices.txt
-    QString blockDeviceMajorNumbers = QStringLiteral(
-        "3,22,33,34,56,57,88,89,90,91,128,129,130,131,132,133,134,135," // MFM, RLL and IDE hard disk/CD-ROM interface
-        // "7," // loop devices TODO: add another bool option for loopDevices
-        "8,65,66,67,68,69,70,71," // SCSI disk devices
-        "80,81,82,83,84,85,86,87," // I2O hard disk
-        "179," // MMC block devices
-        "253," // Virtio KVM devices (e.g. /dev/vda)
-        "259" // Block Extended Major (include NVMe)
-    );
-    ExternalCommand cmd(QStringLiteral("lsblk"), {
-                          QStringLiteral("--nodeps"),
-                          QStringLiteral("--noheadings"),
-                          QStringLiteral("--output"), QString::fromLatin1("name"),
-                          QStringLiteral("--paths"),
-                          QStringLiteral("--include"), blockDeviceMajorNumbers});
-    if (cmd.run(-1) && cmd.exitCode() == 0) {
-        QStringList devices = cmd.output().split(QString::fromLatin1("\n"));
-        devices.removeLast();
-        quint32 totalDevices = devices.length();
-        for (quint32 i = 0; i < totalDevices; ++i) {
-            if (excludeReadOnly) {
-                QFile f(QStringLiteral("/sys/block/%1/ro").arg(QString(devices[i]).remove(QStringLiteral("/dev/"))));
-                if (f.open(QIODevice::ReadOnly))
-                    if (f.readLine().trimmed().toInt() == 1)
-                        continue;
-            }
 
-            emitScanProgress(devices[i], i * 100 / totalDevices);
-            Device* device = scanDevice(devices[i]);
-            if(device != nullptr) {
-                result.append(device);
-            }
-        }
+    // one snapshot answers the disk list here and the mount and mapper lookups of every partition
+    TopologySnapshot::Scope topologyScope;
+    const QSharedPointer<const TopologySnapshot> topology = TopologySnapshot::current();
+
+    QStringList devices;
+    for (const TopologySnapshot::BlockDevice* d : topology->scannableDisks(excludeReadOnly))
+        devices.append(d->deviceNode());
+
+    // Probing a device's partitions waits mostly for the disk and for external tools,
+    // so the devices are scanned in parallel. The progress is reported here, in the
+    // caller's thread, as the devices are done.
+    QThreadPool pool;
+    QMutex mutex;
+    QStringList finished;
+    QSemaphore done;
+    QList<DeviceScanTask*> tasks;
+
+    pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount(), 8));
+
+    for (const auto &deviceNode : devices) {
+        tasks.append(new DeviceScanTask(*this, deviceNode, mutex, finished, done));
+        pool.start(tasks.last());
+    }
+
+    const int totalDevices = tasks.size();
+
+    for (int i = 0; i < totalDevices; ++i) {
+        done.acquire();
+
+        QMutexLocker locker(&mutex);
+        emitScanProgress(finished[i], (i + 1) * 100 / totalDevices);
+    }
+
+    pool.waitForDone();
+
+    // the devices are returned sorted by name, however fast each was scanned
+    for (DeviceScanTask* task : tasks) {
+        if (task->m_Device != nullptr)
+            result.append(task->m_Device);
+
+        delete task;
     }
 
     return result;
@@ -457,57 +593,7 @@ QList<Device*> LibPartedBackend::scanDevices(bool excludeReadOnly)
 */
 FileSystem::Type LibPartedBackend::detectFileSystem(const QString& partitionPath)
 {
-    FileSystem::Type rval = FileSystem::Unknown;
-
-    blkid_cache cache;
-    if (blkid_get_cache(&cache, nullptr) == 0) {
-        blkid_dev dev;
-
-        if ((dev = blkid_get_dev(cache,
-                                 partitionPath.toLocal8Bit().constData(),
-                                 BLKID_DEV_NORMAL)) != nullptr) {
-            char *string = blkid_get_tag_value(cache, "TYPE", partitionPath.toLocal8Bit().constData());
-            QString s = QString::fromUtf8(string);
-            free(string);
-
-            if (s == QStringLiteral("ext2")) rval = FileSystem::Ext2;
-            else if (s == QStringLiteral("ext3")) rval = FileSystem::Ext3;
-            else if (s.startsWith(QStringLiteral("ext4"))) rval = FileSystem::Ext4;
-            else if (s == QStringLiteral("swap")) rval = FileSystem::LinuxSwap;
-            else if (s == QStringLiteral("ntfs")) rval = FileSystem::Ntfs;
-            else if (s == QStringLiteral("reiserfs")) rval = FileSystem::ReiserFS;
-            else if (s == QStringLiteral("reiser4")) rval = FileSystem::Reiser4;
-            else if (s == QStringLiteral("xfs")) rval = FileSystem::Xfs;
-            else if (s == QStringLiteral("jfs")) rval = FileSystem::Jfs;
-            else if (s == QStringLiteral("hfs")) rval = FileSystem::Hfs;
-            else if (s == QStringLiteral("hfsplus")) rval = FileSystem::HfsPlus;
-            else if (s == QStringLiteral("ufs")) rval = FileSystem::Ufs;
-            else if (s == QStringLiteral("vfat")) {
-                // libblkid uses SEC_TYPE to distinguish between FAT16 and FAT32
-                string = blkid_get_tag_value(cache, "SEC_TYPE", partitionPath.toLocal8Bit().constData());
-                QString st = QString::fromUtf8(string);
-                free(string);
-                if (st == QStringLiteral("msdos"))
-                    rval = FileSystem::Fat16;
-                else
-                    rval = FileSystem::Fat32;
-            } else if (s == QStringLiteral("btrfs")) rval = FileSystem::Btrfs;
-            else if (s == QStringLiteral("ocfs2")) rval = FileSystem::Ocfs2;
-            else if (s == QStringLiteral("zfs_member")) rval = FileSystem::Zfs;
-            else if (s == QStringLiteral("hpfs")) rval = FileSystem::Hpfs;
-            else if (s == QStringLiteral("crypto_LUKS")) rval = FileSystem::Luks;
-            else if (s == QStringLiteral("exfat")) rval = FileSystem::Exfat;
-            else if (s == QStringLiteral("nilfs2")) rval = FileSystem::Nilfs2;
-            else if (s == QStringLiteral("LVM2_member")) rval = FileSystem::Lvm2_PV;
-            else if (s == QStringLiteral("f2fs")) rval = FileSystem::F2fs;
-            else
-                qWarning() << "blkid: unknown file system type " << s << " on " << partitionPath;
-        }
-
-        blkid_put_cache(cache);
-    }
-
-    return rval;
+    return fileSystemType(BlkidProbe::of(partitionPath));
 }
 
 CoreBackendDevice* LibPartedBackend::openDevice(const QString& deviceNode)
@@ -550,7 +636,7 @@ PedPartitionFlag LibPartedBackend::getPedFlag(PartitionTable::Flag flag)
 
 QString LibPartedBackend::lastPartedExceptionMessage()
 {
-    return s_lastPartedExceptionMessage;
+    return s_lastPartedExceptionMessage.localData();
 }
 
 #include "libpartedbackend.moc"
@@ -0,0 +1,80 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/blkidprobe.h"
+#include "util/topologysnapshot.h"
+
+#include <blkid/blkid.h>
+
+static QString lookupValue(blkid_probe pr, const char* name)
+{
+    const char* data = nullptr;
+
+    if (blkid_probe_lookup_value(pr, name, &data, nullptr) != 0 || data == nullptr)
+        return QString();
+
+    return QString::fromUtf8(data);
+}
+
+/** Probes a device.
+    @param deviceNode the device to probe
+    @param partitionEntry true to also look up the partition name and UUID in the parent's
+           partition table; callers that know them already can skip that read
+*/
+BlkidProbe::BlkidProbe(const QString& deviceNode, bool partitionEntry) :
+    m_DeviceNode(deviceNode),
+    m_Valid(false)
+{
+    blkid_probe pr = blkid_new_probe_from_filename(deviceNode.toLocal8Bit().constData());
+
+    if (pr == nullptr)
+        return;
+
+    blkid_probe_enable_superblocks(pr, 1);
+    blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE | BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID);
+
+    blkid_probe_enable_partitions(pr, partitionEntry ? 1 : 0);
+    if (partitionEntry)
+        blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+
+    // 1 means nothing was found, which is still a valid answer
+    m_Valid = blkid_do_safeprobe(pr) >= 0;
+
+    if (m_Valid) {
+        m_Type = lookupValue(pr, "TYPE");
+        m_SecType = lookupValue(pr, "SEC_TYPE");
+        m_Label = lookupValue(pr, "LABEL");
+        m_UUID = lookupValue(pr, "UUID");
+
+        if (partitionEntry) {
+            m_PartLabel = lookupValue(pr, "PART_ENTRY_NAME");
+            m_PartUUID = lookupValue(pr, "PART_ENTRY_UUID");
+        }
+    }
+
+    blkid_free_probe(pr);
+}
+
+/** Probes a device, or returns the probe of the current scan if it already has one.
+    @param deviceNode the device to probe
+    @return the probe result
+*/
+BlkidProbe BlkidProbe::of(const QString& deviceNode)
+{
+    const QSharedPointer<const TopologySnapshot> topology = TopologySnapshot::scoped();
+    return topology ? topology->probe(deviceNode) : BlkidProbe(deviceNode);
+}
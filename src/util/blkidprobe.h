@@ -0,0 +1,71 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLKIDPROBE__H)
+
+#define BLKIDPROBE__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QString>
+
+/** What one low-level libblkid probe found on a device.
+
+    Looking up TYPE, LABEL and UUID through the blkid cache costs a cache load, a device
+    verification and a cache write for each tag. A BlkidProbe reads the superblock once and
+    keeps every value the scan needs.
+
+    During a scan, use of() to share one probe per device between the file system
+    detection and the label and UUID lookups.
+
+    @see TopologySnapshot::probe
+*/
+class LIBKPMCORE_EXPORT BlkidProbe
+{
+public:
+    BlkidProbe() : m_Valid(false) {}
+    explicit BlkidProbe(const QString& deviceNode, bool partitionEntry = true);
+
+public:
+    static BlkidProbe of(const QString& deviceNode);
+
+    const QString& deviceNode() const { return m_DeviceNode; } /**< @return the probed device */
+    bool isValid() const { return m_Valid; } /**< @return true if the device could be probed */
+
+    const QString& type() const { return m_Type; } /**< @return the blkid file system type, like ext4 or crypto_LUKS */
+    const QString& secType() const { return m_SecType; } /**< @return the secondary type, like msdos for FAT16 */
+    const QString& label() const { return m_Label; } /**< @return the file system label */
+    const QString& uuid() const { return m_UUID; } /**< @return the file system UUID */
+    const QString& partLabel() const { return m_PartLabel; } /**< @return the GPT partition name */
+    const QString& partUUID() const { return m_PartUUID; } /**< @return the partition UUID */
+
+    /** @param label the partition name
+        @param uuid the partition UUID */
+    void setPartitionEntry(const QString& label, const QString& uuid) { m_PartLabel = label; m_PartUUID = uuid; }
+
+private:
+    QString m_DeviceNode;
+    bool m_Valid;
+    QString m_Type;
+    QString m_SecType;
+    QString m_Label;
+    QString m_UUID;
+    QString m_PartLabel;
+    QString m_PartUUID;
+};
+
+#endif
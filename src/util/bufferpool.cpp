@@ -0,0 +1,121 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/bufferpool.h"
+
+#include <QMutexLocker>
+
+#include <cstdlib>
+
+/** Buffers beyond this many free bytes are given back to the system on release(). */
+static const qint64 maxFreeBytes = 512 * 1024 * 1024;
+
+BufferPool::BufferPool() :
+    m_Mutex(),
+    m_Free(),
+    m_Used(),
+    m_FreeBytes(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    trim();
+}
+
+/** @return the BufferPool shared by all copies */
+BufferPool& BufferPool::instance()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+/** Gets a buffer from the pool, allocating a new one if no free buffer fits.
+    @param size the size of the buffer in bytes
+    @param alignment the alignment of the buffer's address in bytes, a power of two
+    @return the buffer or nullptr if it could not be allocated
+*/
+void* BufferPool::acquire(qint64 size, qint32 alignment)
+{
+    Q_ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    QMutexLocker locker(&m_Mutex);
+
+    for (qint32 i = 0; i < m_Free.size(); i++) {
+        const Buffer buffer = m_Free[i];
+
+        if (buffer.size == size && buffer.alignment % alignment == 0) {
+            m_Free.removeAt(i);
+            m_FreeBytes -= buffer.size;
+            m_Used.insert(buffer.data, buffer);
+            return buffer.data;
+        }
+    }
+
+    alignment = qMax(alignment, static_cast<qint32>(sizeof(void*)));
+
+    void* data = nullptr;
+    if (posix_memalign(&data, alignment, size) != 0)
+        return nullptr;
+
+    Buffer buffer = { data, size, alignment };
+    m_Used.insert(data, buffer);
+
+    return data;
+}
+
+/** Hands a buffer back to the pool.
+    @param buffer a buffer returned by acquire() or nullptr
+*/
+void BufferPool::release(void* buffer)
+{
+    if (buffer == nullptr)
+        return;
+
+    QMutexLocker locker(&m_Mutex);
+
+    Q_ASSERT(m_Used.contains(buffer));
+
+    const Buffer b = m_Used.take(buffer);
+
+    if (m_FreeBytes + b.size > maxFreeBytes) {
+        free(b.data);
+        return;
+    }
+
+    m_Free.append(b);
+    m_FreeBytes += b.size;
+}
+
+/** Gives all free buffers back to the system. Buffers in use are not affected. */
+void BufferPool::trim()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    for (const auto &b : m_Free)
+        free(b.data);
+
+    m_Free.clear();
+    m_FreeBytes = 0;
+}
+
+/** @return the number of bytes in free buffers kept for reuse */
+qint64 BufferPool::freeBytes() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_FreeBytes;
+}
@@ -0,0 +1,69 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BUFFERPOOL__H)
+
+#define BUFFERPOOL__H
+
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <QtGlobal>
+
+/** A pool of aligned memory buffers.
+
+    Bulk copies need large buffers whose addresses are aligned to the device's physical
+    sector size so that they can be used for unbuffered (O_DIRECT) I/O. Allocating and
+    faulting in buffers of that size for every copy is wasteful, so buffers handed back
+    with release() are kept and reused by later calls to acquire() until trim() is called.
+
+    BufferPool is thread-safe.
+
+    @see CopyPipeline
+*/
+class BufferPool
+{
+    Q_DISABLE_COPY(BufferPool)
+
+protected:
+    BufferPool();
+    ~BufferPool();
+
+public:
+    static BufferPool& instance();
+
+    void* acquire(qint64 size, qint32 alignment);
+    void release(void* buffer);
+    void trim();
+
+    qint64 freeBytes() const;
+
+protected:
+    struct Buffer {
+        void* data;
+        qint64 size;
+        qint32 alignment;
+    };
+
+private:
+    mutable QMutex m_Mutex;
+    QVector<Buffer> m_Free;
+    QHash<void*, Buffer> m_Used;
+    qint64 m_FreeBytes;
+};
+
+#endif
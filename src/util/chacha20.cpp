@@ -0,0 +1,225 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/chacha20.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static inline quint32 load32(const quint8* p)
+{
+    return quint32(p[0]) | quint32(p[1]) << 8 | quint32(p[2]) << 16 | quint32(p[3]) << 24;
+}
+
+static inline void store32(quint8* p, quint32 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+#define CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA_QUARTERROUND(x, a, b, c, d) \
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = CHACHA_ROTL(x[d], 16); \
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = CHACHA_ROTL(x[b], 12); \
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = CHACHA_ROTL(x[d], 8); \
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = CHACHA_ROTL(x[b], 7)
+
+/** Runs the 20 rounds on a state. Works on single words as well as on vectors of them. */
+template<typename T>
+static inline void chachaRounds(T* x)
+{
+    for (int i = 0; i < 10; i++) {
+        CHACHA_QUARTERROUND(x, 0, 4, 8, 12);
+        CHACHA_QUARTERROUND(x, 1, 5, 9, 13);
+        CHACHA_QUARTERROUND(x, 2, 6, 10, 14);
+        CHACHA_QUARTERROUND(x, 3, 7, 11, 15);
+        CHACHA_QUARTERROUND(x, 0, 5, 10, 15);
+        CHACHA_QUARTERROUND(x, 1, 6, 11, 12);
+        CHACHA_QUARTERROUND(x, 2, 7, 8, 13);
+        CHACHA_QUARTERROUND(x, 3, 4, 9, 14);
+    }
+}
+
+/** Sets up the state for a block of the stream */
+static inline void chachaState(quint32* state, const quint32* key, quint64 nonce, quint64 counter)
+{
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    memcpy(state + 4, key, 8 * sizeof(quint32));
+    state[12] = counter;
+    state[13] = counter >> 32;
+    state[14] = nonce;
+    state[15] = nonce >> 32;
+}
+
+/** Computes one block of the stream */
+static void chachaBlock(quint8* out, const quint32* key, quint64 nonce, quint64 counter)
+{
+    quint32 state[16];
+    quint32 x[16];
+
+    chachaState(state, key, nonce, counter);
+    memcpy(x, state, sizeof(x));
+
+    chachaRounds(x);
+
+    for (int i = 0; i < 16; i++)
+        store32(out + 4 * i, x[i] + state[i]);
+}
+
+#if defined(__GNUC__)
+typedef quint32 ChaChaVector __attribute__((vector_size(16)));
+
+/** Computes four consecutive blocks of the stream at once, one in each lane of the vectors */
+static void chachaBlocks4(quint8* out, const quint32* key, quint64 nonce, quint64 counter)
+{
+    quint32 state[4][16];
+    ChaChaVector x[16];
+    ChaChaVector s[16];
+
+    for (int lane = 0; lane < 4; lane++)
+        chachaState(state[lane], key, nonce, counter + lane);
+
+    for (int i = 0; i < 16; i++) {
+        s[i] = ChaChaVector{ state[0][i], state[1][i], state[2][i], state[3][i] };
+        x[i] = s[i];
+    }
+
+    chachaRounds(x);
+
+    for (int i = 0; i < 16; i++)
+        x[i] += s[i];
+
+    for (int lane = 0; lane < 4; lane++)
+        for (int i = 0; i < 16; i++)
+            store32(out + lane * ChaCha20::blockSize() + 4 * i, x[i][lane]);
+}
+#endif
+
+/** Creates a generator with an all zero key. Call seed() or setKey() before using it. */
+ChaCha20::ChaCha20() :
+    m_Key(),
+    m_Nonce(0)
+{
+}
+
+/** Seeds the generator with a new random key from the kernel.
+    @return true on success
+*/
+bool ChaCha20::seed()
+{
+    quint8 seed[40];
+    size_t done = 0;
+
+#if defined(SYS_getrandom)
+    while (done < sizeof(seed)) {
+        const long n = syscall(SYS_getrandom, seed + done, sizeof(seed) - done, 0);
+
+        if (n > 0)
+            done += n;
+        else if (n < 0 && errno != EINTR)
+            break;
+    }
+#endif
+
+    // kernels older than 3.17 have no getrandom()
+    if (done < sizeof(seed)) {
+        const int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+            return false;
+
+        done = 0;
+        while (done < sizeof(seed)) {
+            const ssize_t n = read(fd, seed + done, sizeof(seed) - done);
+
+            if (n > 0)
+                done += n;
+            else if (n == 0 || errno != EINTR)
+                break;
+        }
+
+        close(fd);
+
+        if (done < sizeof(seed))
+            return false;
+    }
+
+    quint64 nonce = 0;
+    for (int i = 0; i < 8; i++)
+        nonce |= quint64(seed[32 + i]) << (8 * i);
+
+    setKey(seed, nonce);
+    memset(seed, 0, sizeof(seed));
+
+    return true;
+}
+
+/** Sets the key and the nonce.
+    @param key the 32 byte key
+    @param nonce the nonce
+*/
+void ChaCha20::setKey(const quint8* key, quint64 nonce)
+{
+    for (int i = 0; i < 8; i++)
+        m_Key[i] = load32(key + 4 * i);
+
+    m_Nonce = nonce;
+}
+
+/** Computes a part of the stream. May be called from several threads at once.
+    @param buffer the buffer to fill
+    @param size the number of bytes to compute
+    @param position the position of the first byte in the stream, a multiple of blockSize()
+*/
+void ChaCha20::generate(void* buffer, qint64 size, quint64 position) const
+{
+    Q_ASSERT(position % blockSize() == 0);
+
+    quint8* out = static_cast<quint8*>(buffer);
+    quint64 counter = position / blockSize();
+
+#if defined(__GNUC__)
+    while (size >= 4 * blockSize()) {
+        chachaBlocks4(out, m_Key, m_Nonce, counter);
+        out += 4 * blockSize();
+        size -= 4 * blockSize();
+        counter += 4;
+    }
+#endif
+
+    while (size >= blockSize()) {
+        chachaBlock(out, m_Key, m_Nonce, counter++);
+        out += blockSize();
+        size -= blockSize();
+    }
+
+    if (size > 0) {
+        quint8 block[blockSize()];
+        chachaBlock(block, m_Key, m_Nonce, counter);
+        memcpy(out, block, size);
+    }
+}
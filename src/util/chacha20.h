@@ -0,0 +1,49 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(CHACHA20__H)
+
+#define CHACHA20__H
+
+#include <QtGlobal>
+
+/** The ChaCha20 stream cipher as a fast random number generator.
+
+    Produces a key stream that cannot be told apart from random data without the key. Any
+    part of the stream can be computed on its own, so a buffer can be filled in parallel and
+    the same data can be produced again later, for instance to verify what has been written.
+*/
+class ChaCha20
+{
+public:
+    ChaCha20();
+
+public:
+    bool seed();
+    void setKey(const quint8* key, quint64 nonce);
+    void generate(void* buffer, qint64 size, quint64 position) const;
+
+    static constexpr qint32 blockSize() {
+        return 64;    /**< @return the number of bytes the stream is computed in */
+    }
+
+private:
+    quint32 m_Key[8];
+    quint64 m_Nonce;
+};
+
+#endif
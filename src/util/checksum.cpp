@@ -0,0 +1,131 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/checksum.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+/** Lookup tables for computing the CRC eight bytes at a time without hardware support */
+struct Crc32cTables {
+    quint32 table[8][256];
+
+    Crc32cTables() {
+        for (quint32 i = 0; i < 256; i++) {
+            quint32 crc = i;
+
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+
+            table[0][i] = crc;
+        }
+
+        for (quint32 i = 0; i < 256; i++)
+            for (int n = 1; n < 8; n++)
+                table[n][i] = (table[n - 1][i] >> 8) ^ table[0][table[n - 1][i] & 0xff];
+    }
+};
+
+static quint32 crc32cScalar(quint32 crc, const uchar* p, qint64 size)
+{
+    static const Crc32cTables tables;
+    const quint32 (*t)[256] = tables.table;
+
+    while (size >= 8) {
+        quint32 lo;
+        quint32 hi;
+        memcpy(&lo, p, sizeof(lo));
+        memcpy(&hi, p + 4, sizeof(hi));
+
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+
+        p += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+#if defined(CHECKSUM_X86)
+
+__attribute__((target("sse4.2")))
+static quint32 crc32cSse42(quint32 crc, const uchar* p, qint64 size)
+{
+    quint64 crc64 = crc;
+
+    while (size >= 8) {
+        quint64 word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        size -= 8;
+    }
+
+    crc = static_cast<quint32>(crc64);
+
+    while (size-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+
+#endif
+
+typedef quint32 (*Crc32cFunction)(quint32, const uchar*, qint64);
+
+static Crc32cFunction selectCrc32c()
+{
+#if defined(CHECKSUM_X86)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32cSse42;
+#endif
+
+    return crc32cScalar;
+}
+
+/** Computes the CRC-32C (Castagnoli) checksum of a buffer.
+
+    Uses the SSE4.2 crc32 instruction if the CPU supports it, which checksums data
+    many times faster than it can be read from a disk.
+
+    @param data the buffer to checksum
+    @param size the size of the buffer in bytes
+    @param crc the checksum of the data before this buffer to continue from, 0 to start a new one
+    @return the checksum of all data up to the end of this buffer
+*/
+quint32 crc32c(const void* data, qint64 size, quint32 crc)
+{
+    static const Crc32cFunction compute = selectCrc32c();
+
+    return ~compute(~crc, static_cast<const uchar*>(data), size);
+}
@@ -35,7 +35,8 @@ ExternalCommand::ExternalCommand(const QString& cmd, const QStringList& args) :
     m_Command(cmd),
     m_Args(args),
     m_ExitCode(-1),
-    m_Output()
+    m_Output(),
+    m_IoPriority()
 {
     setup();
 }
@@ -51,7 +52,8 @@ ExternalCommand::ExternalCommand(Report& report, const QString& cmd, const QStri
     m_Command(cmd),
     m_Args(args),
     m_ExitCode(-1),
-    m_Output()
+    m_Output(),
+    m_IoPriority()
 {
     setup();
 }
@@ -65,12 +67,26 @@ void ExternalCommand::setup()
     connect(this, &ExternalCommand::readyReadStandardOutput, this, &ExternalCommand::onReadOutput);
 }
 
+/** Sets the child's I/O priority. Called in the child process between fork and exec. */
+void ExternalCommand::setupChildProcess()
+{
+    if (ioPriority().isSet())
+        ioPriority().applyToThread();
+}
+
 /** Starts the external command.
+
+    Unless an I/O priority has been set, the command runs at that of the calling thread, so
+    that a file system check started by a throttled Job is throttled alike.
+
     @param timeout timeout to wait for the process to start
     @return true on success
 */
 bool ExternalCommand::start(int timeout)
 {
+    if (!ioPriority().isSet())
+        setIoPriority(IoPriority::ofThread());
+
     QProcess::start(command(), args());
 
     if (report()) {
@@ -19,6 +19,7 @@
 
 #define EXTERNALCOMMAND__H
 
+#include "util/iopriority.h"
 #include "util/libpartitionmanagerexport.h"
 
 #include <vector>
@@ -53,6 +54,9 @@ public:
     const QStringList& args() const { return m_Args; } /**< @return the arguments */
     void setArgs(const QStringList& args) { m_Args = args; } /**< @param args the new arguments */
 
+    const IoPriority& ioPriority() const { return m_IoPriority; } /**< @return the I/O priority the command runs at */
+    void setIoPriority(const IoPriority& prio) { m_IoPriority = prio; } /**< @param prio the I/O priority to run the command at */
+
     bool start(int timeout = 30000);
     bool waitFor(int timeout = 30000);
     bool run(int timeout = 30000);
@@ -74,6 +78,7 @@ protected:
         m_ExitCode = i;
     }
     void setup();
+    void setupChildProcess() override;
 
     void onFinished(int exitCode, QProcess::ExitStatus exitStatus);
     void onReadOutput();
@@ -84,6 +89,7 @@ private:
     QStringList m_Args;
     int m_ExitCode;
     QString m_Output;
+    IoPriority m_IoPriority;
 };
 
 #endif
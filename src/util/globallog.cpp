@@ -19,18 +19,17 @@
 
 GlobalLog* GlobalLog::instance()
 {
-    static GlobalLog* p = nullptr;
-
-    if (p == nullptr)
-        p = new GlobalLog();
+    static GlobalLog* p = new GlobalLog();
 
     return p;
 }
 
 void GlobalLog::flush(Log::Level lev)
 {
-    emit newMessage(lev, msg);
-    msg.clear();
+    const QString s = msg.localData();
+    msg.localData().clear();
+
+    emit newMessage(lev, s);
 }
 
 // --------------------------------------------------------------------------
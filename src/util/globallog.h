@@ -23,6 +23,7 @@
 
 #include <QString>
 #include <QObject>
+#include <QThreadStorage>
 #include <QtGlobal>
 
 class LIBKPMCORE_EXPORT Log
@@ -68,12 +69,13 @@ public:
 
 private:
     void append(const QString& s) {
-        msg += s;
+        msg.localData() += s;
     }
     void flush(Log::Level level);
 
 private:
-    QString msg;
+    // each thread builds its own message, so that messages logged at once do not mix
+    QThreadStorage<QString> msg;
 };
 
 inline Log operator<<(Log l, const QString& s)
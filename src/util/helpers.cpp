@@ -17,8 +17,8 @@
  *************************************************************************/
 
 #include "util/helpers.h"
-#include "util/externalcommand.h"
 #include "util/globallog.h"
+#include "util/topologysnapshot.h"
 
 #include "ops/operation.h"
 
@@ -71,17 +71,7 @@ void showColumnsContextMenu(const QPoint& p, QTreeWidget& tree)
 
 bool isMounted(const QString& deviceNode)
 {
-    ExternalCommand cmd(QStringLiteral("lsblk"),
-                        { QStringLiteral("--noheadings"),
-                          QStringLiteral("--nodeps"),
-                          QStringLiteral("--output"),
-                          QStringLiteral("mountpoint"),
-                          deviceNode });
-
-    if (cmd.run(-1) && cmd.exitCode() == 0) {
-        return !cmd.output().trimmed().isEmpty();
-    }
-    return false;
+    return TopologySnapshot::current()->isMounted(deviceNode);
 }
 
 KAboutData aboutKPMcore()
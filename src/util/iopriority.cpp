@@ -0,0 +1,79 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/iopriority.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// from linux/ioprio.h, which older kernel headers do not install
+static const int IOPRIO_CLASS_SHIFT = 13;
+static const int IOPRIO_WHO_PROCESS = 1;
+
+/** Creates a new IoPriority.
+    @param c the scheduling class
+    @param level the level within the class, 0 (highest) to 7 (lowest); ignored for the idle class
+*/
+IoPriority::IoPriority(Class c, qint32 level) :
+    m_Class(c),
+    m_Level(c == Idle || c == NoClass ? 0 : qBound(0, level, 7))
+{
+}
+
+/** @return the priority encoded the way ioprio_set(2) and io_uring expect it */
+quint16 IoPriority::value() const
+{
+    return isSet() ? static_cast<quint16>((m_Class << IOPRIO_CLASS_SHIFT) | m_Level) : 0;
+}
+
+/** Decodes a priority as returned by ioprio_get(2).
+    @param v the encoded priority
+    @return the IoPriority
+*/
+IoPriority IoPriority::fromValue(quint16 v)
+{
+    const qint32 c = v >> IOPRIO_CLASS_SHIFT;
+
+    if (c < RealTime || c > Idle)
+        return IoPriority();
+
+    return IoPriority(static_cast<Class>(c), v & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+}
+
+/** @return the priority of the calling thread */
+IoPriority IoPriority::ofThread()
+{
+#if defined(SYS_ioprio_get)
+    const long rval = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    if (rval >= 0)
+        return fromValue(static_cast<quint16>(rval));
+#endif
+
+    return IoPriority();
+}
+
+/** Sets the priority of the calling thread. An unset priority resets the thread to the default.
+    @return true on success
+*/
+bool IoPriority::applyToThread() const
+{
+#if defined(SYS_ioprio_set)
+    return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, static_cast<int>(value())) == 0;
+#else
+    return false;
+#endif
+}
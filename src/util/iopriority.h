@@ -0,0 +1,69 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(IOPRIORITY__H)
+
+#define IOPRIORITY__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QtGlobal>
+
+/** An I/O scheduling class and level as used by ioprio_set(2).
+
+    Jobs run their I/O at an IoPriority, so that a long copy in the background can be kept
+    from starving interactive use of the same disks. The priority applies to the calling
+    thread; child processes inherit it across fork.
+
+    @see Job::setIoPriority, OperationRunner::setIoPriority
+*/
+class LIBKPMCORE_EXPORT IoPriority
+{
+public:
+    /** I/O scheduling classes */
+    enum Class {
+        NoClass = 0,    /**< no priority set, the kernel derives one from the CPU nice value */
+        RealTime = 1,   /**< served first; needs CAP_SYS_ADMIN */
+        BestEffort = 2, /**< the default class */
+        Idle = 3        /**< served only if no other process needs the disk */
+    };
+
+public:
+    IoPriority() : m_Class(NoClass), m_Level(0) {}
+    IoPriority(Class c, qint32 level = 4);
+
+public:
+    Class ioClass() const { return m_Class; } /**< @return the scheduling class */
+    qint32 level() const { return m_Level; } /**< @return the level within the class, 0 (highest) to 7 (lowest) */
+    bool isSet() const { return m_Class != NoClass; } /**< @return true if a class has been set */
+
+    quint16 value() const;
+
+    bool applyToThread() const;
+
+    static IoPriority ofThread();
+    static IoPriority fromValue(quint16 v);
+
+    bool operator==(const IoPriority& other) const { return m_Class == other.m_Class && m_Level == other.m_Level; }
+    bool operator!=(const IoPriority& other) const { return !(*this == other); }
+
+private:
+    Class m_Class;
+    qint32 m_Level;
+};
+
+#endif
@@ -0,0 +1,521 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/topologysnapshot.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+static QMutex s_ScopeMutex;
+static QSharedPointer<const TopologySnapshot> s_ScopeSnapshot;
+static qint32 s_ScopeDepth = 0;
+
+static QString sysfsBlockPath()
+{
+    return QStringLiteral("/sys/class/block/");
+}
+
+/** Reads the first line of a small file, as found in sysfs. */
+static QString readLine(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    return QString::fromLocal8Bit(file.readLine()).trimmed();
+}
+
+/** Reads a whole file from /proc or /run, which report a size of zero and must be read to the end. */
+static QList<QByteArray> readLines(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return QList<QByteArray>();
+
+    return file.readAll().split('\n');
+}
+
+/** Undoes the octal escapes (like \040 for a space) of /proc/self/mountinfo, /proc/swaps and /etc/fstab. */
+static QString unescape(const QByteArray& field)
+{
+    if (!field.contains('\\'))
+        return QString::fromLocal8Bit(field);
+
+    QByteArray result;
+    result.reserve(field.size());
+
+    for (qint32 i = 0; i < field.size(); i++) {
+        if (field[i] == '\\' && i + 3 < field.size() && field[i + 1] >= '0' && field[i + 1] <= '3') {
+            bool ok = false;
+            const char c = static_cast<char>(field.mid(i + 1, 3).toInt(&ok, 8));
+            if (ok) {
+                result += c;
+                i += 3;
+                continue;
+            }
+        }
+        result += field[i];
+    }
+
+    return QString::fromLocal8Bit(result);
+}
+
+/** Undoes the \x escapes udev uses for values like ID_PART_ENTRY_NAME. */
+static QString decodeUdev(const QString& value)
+{
+    if (!value.contains(QStringLiteral("\\x")))
+        return value;
+
+    QByteArray result;
+    const QByteArray encoded = value.toUtf8();
+
+    for (qint32 i = 0; i < encoded.size(); i++) {
+        if (encoded[i] == '\\' && i + 3 < encoded.size() && encoded[i + 1] == 'x') {
+            bool ok = false;
+            const char c = static_cast<char>(encoded.mid(i + 2, 2).toInt(&ok, 16));
+            if (ok) {
+                result += c;
+                i += 3;
+                continue;
+            }
+        }
+        result += encoded[i];
+    }
+
+    return QString::fromUtf8(result);
+}
+
+/** Parses a "major:minor" pair as found in sysfs and mountinfo. */
+static quint64 parseDevno(const QString& s)
+{
+    const qint32 colon = s.indexOf(QLatin1Char(':'));
+
+    if (colon < 0)
+        return 0;
+
+    bool majorOk = false;
+    bool minorOk = false;
+    const quint32 major = s.left(colon).toUInt(&majorOk);
+    const quint32 minor = s.mid(colon + 1).toUInt(&minorOk);
+
+    return majorOk && minorOk ? TopologySnapshot::makeDevno(major, minor) : 0;
+}
+
+/** Creates a new, empty TopologySnapshot. Use current() to get one that describes the system. */
+TopologySnapshot::TopologySnapshot()
+{
+}
+
+/** @return the snapshot of the enclosing Scope, or a newly read one if there is none */
+QSharedPointer<const TopologySnapshot> TopologySnapshot::current()
+{
+    {
+        QMutexLocker locker(&s_ScopeMutex);
+        if (s_ScopeSnapshot)
+            return s_ScopeSnapshot;
+    }
+
+    QSharedPointer<TopologySnapshot> snapshot(new TopologySnapshot());
+    snapshot->read();
+    return snapshot;
+}
+
+/** @return the snapshot of the enclosing Scope or a null pointer if no scan is running */
+QSharedPointer<const TopologySnapshot> TopologySnapshot::scoped()
+{
+    QMutexLocker locker(&s_ScopeMutex);
+    return s_ScopeSnapshot;
+}
+
+/** Reads a snapshot for current() to hand out, unless an enclosing Scope already has. */
+TopologySnapshot::Scope::Scope()
+{
+    QMutexLocker locker(&s_ScopeMutex);
+
+    if (s_ScopeDepth++ == 0) {
+        QSharedPointer<TopologySnapshot> snapshot(new TopologySnapshot());
+        snapshot->read();
+        s_ScopeSnapshot = snapshot;
+    }
+}
+
+/** Drops the snapshot if this is the outermost Scope. Callers still holding it keep it alive. */
+TopologySnapshot::Scope::~Scope()
+{
+    QMutexLocker locker(&s_ScopeMutex);
+
+    if (--s_ScopeDepth == 0)
+        s_ScopeSnapshot.clear();
+}
+
+/** Fills the snapshot from the running system. */
+void TopologySnapshot::read()
+{
+    readSysfs();
+    readMountInfo();
+    readSwaps();
+    readFstab();
+}
+
+/** Reads all block devices with their holders and slaves from sysfs and their properties from udev. */
+void TopologySnapshot::readSysfs()
+{
+    const QStringList names = QDir(sysfsBlockPath()).entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot, QDir::Name);
+
+    m_Devices.reserve(names.size());
+
+    for (const QString& entry : names) {
+        const QString base = sysfsBlockPath() + entry + QLatin1Char('/');
+
+        BlockDevice d;
+        // sysfs replaces the slashes of names like cciss/c0d0 with exclamation marks
+        d.name = QString(entry).replace(QLatin1Char('!'), QLatin1Char('/'));
+        d.devno = parseDevno(readLine(base + QStringLiteral("dev")));
+
+        if (d.devno == 0)
+            continue;
+
+        d.partition = QFile::exists(base + QStringLiteral("partition"));
+        if (d.partition)
+            d.parent = QFileInfo(QFileInfo(base + QStringLiteral("dev")).canonicalPath()).dir().dirName().replace(QLatin1Char('!'), QLatin1Char('/'));
+
+        d.readOnly = readLine(base + QStringLiteral("ro")) == QStringLiteral("1");
+        d.removable = readLine(sysfsBlockPath() + (d.partition ? QString(d.parent).replace(QLatin1Char('/'), QLatin1Char('!')) : entry) + QStringLiteral("/removable")) == QStringLiteral("1");
+        d.mapperName = readLine(base + QStringLiteral("dm/name"));
+        d.holders = QDir(base + QStringLiteral("holders")).entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot, QDir::Name);
+        d.slaves = QDir(base + QStringLiteral("slaves")).entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot, QDir::Name);
+
+        readUdev(d);
+
+        const qint32 index = m_Devices.size();
+        m_ByName.insert(d.name, index);
+        m_ByDevno.insert(d.devno, index);
+
+        if (!d.mapperName.isEmpty())
+            m_ByName.insert(QStringLiteral("mapper/") + d.mapperName, index);
+
+        const QString fsUuid = d.properties.value(QStringLiteral("ID_FS_UUID"));
+        if (!fsUuid.isEmpty() && !m_ByFsUuid.contains(fsUuid))
+            m_ByFsUuid.insert(fsUuid, index);
+
+        const QString partUuid = d.properties.value(QStringLiteral("ID_PART_ENTRY_UUID"));
+        if (!partUuid.isEmpty())
+            m_ByPartUuid.insert(partUuid.toLower(), index);
+
+        m_Devices.append(d);
+    }
+}
+
+/** Reads the udev properties of a device straight from the udev database in /run/udev/data.
+    @param d the device to read the properties of
+*/
+void TopologySnapshot::readUdev(BlockDevice& d) const
+{
+    const QList<QByteArray> lines = readLines(QStringLiteral("/run/udev/data/b%1:%2").arg(d.devMajor()).arg(d.devMinor()));
+
+    for (const QByteArray& line : lines) {
+        if (!line.startsWith("E:"))
+            continue;
+
+        const qint32 equals = line.indexOf('=');
+        if (equals > 2)
+            d.properties.insert(QString::fromLatin1(line.mid(2, equals - 2)), QString::fromLocal8Bit(line.mid(equals + 1)));
+    }
+}
+
+/** Reads the current mounts from /proc/self/mountinfo. */
+void TopologySnapshot::readMountInfo()
+{
+    const QList<QByteArray> lines = readLines(QStringLiteral("/proc/self/mountinfo"));
+
+    for (const QByteArray& line : lines) {
+        // id parent major:minor root mount-point options [optional fields...] - type source super-options
+        const QList<QByteArray> fields = line.split(' ');
+        const qint32 separator = fields.indexOf("-");
+
+        if (fields.size() < 5 || separator < 0)
+            continue;
+
+        BlockDevice* d = nullptr;
+
+        // btrfs and a few others report an anonymous devno, their source names the device
+        const qint32 index = m_ByDevno.value(parseDevno(QString::fromLatin1(fields[2])), -1);
+        if (index >= 0)
+            d = &m_Devices[index];
+        else if (separator + 2 < fields.size() && fields[separator + 2].startsWith("/dev/"))
+            d = findMutable(unescape(fields[separator + 2]));
+
+        if (d)
+            d->mountPoints.append(unescape(fields[4]));
+    }
+}
+
+/** Reads the active swap areas from /proc/swaps. */
+void TopologySnapshot::readSwaps()
+{
+    const QList<QByteArray> lines = readLines(QStringLiteral("/proc/swaps"));
+
+    // the first line is a header
+    for (qint32 i = 1; i < lines.size(); i++) {
+        const qint32 end = lines[i].indexOf(' ');
+
+        if (end <= 0)
+            continue;
+
+        BlockDevice* d = findMutable(unescape(lines[i].left(end)));
+        if (d)
+            d->swap = true;
+    }
+}
+
+/** Reads the mount points /etc/fstab assigns to devices, resolving UUID= and PARTUUID= from udev. */
+void TopologySnapshot::readFstab()
+{
+    const QList<QByteArray> lines = readLines(QStringLiteral("/etc/fstab"));
+
+    for (const QByteArray& l : lines) {
+        const QByteArray line = l.simplified();
+
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        const QList<QByteArray> fields = line.split(' ');
+        if (fields.size() < 2)
+            continue;
+
+        const QString spec = unescape(fields[0]);
+        qint32 index = -1;
+        BlockDevice* d = nullptr;
+
+        if (spec.startsWith(QStringLiteral("UUID=")))
+            index = m_ByFsUuid.value(spec.mid(5), -1);
+        else if (spec.startsWith(QStringLiteral("PARTUUID=")))
+            index = m_ByPartUuid.value(spec.mid(9).toLower(), -1);
+
+        if (index >= 0)
+            d = &m_Devices[index];
+        else if (spec.startsWith(QStringLiteral("LABEL=")))
+            d = findMutable(QStringLiteral("/dev/disk/by-label/") + spec.mid(6));
+        else if (spec.startsWith(QStringLiteral("PARTLABEL=")))
+            d = findMutable(QStringLiteral("/dev/disk/by-partlabel/") + spec.mid(10));
+        else if (spec.startsWith(QStringLiteral("UUID=")))
+            d = findMutable(QStringLiteral("/dev/disk/by-uuid/") + spec.mid(5));
+        else if (spec.startsWith(QStringLiteral("PARTUUID=")))
+            d = findMutable(QStringLiteral("/dev/disk/by-partuuid/") + spec.mid(9));
+        else if (spec.startsWith(QStringLiteral("/dev/")))
+            d = findMutable(spec);
+
+        if (d && d->fstabMountPoint.isEmpty())
+            d->fstabMountPoint = unescape(fields[1]);
+    }
+}
+
+TopologySnapshot::BlockDevice* TopologySnapshot::findMutable(const QString& path)
+{
+    return const_cast<BlockDevice*>(find(path));
+}
+
+/** Looks up a block device by any path that names it.
+
+    Paths below /dev that match a kernel or mapper name are found without touching the
+    file system, anything else (like /dev/disk/by-uuid links or /dev/vg/lv) is resolved
+    with a stat call.
+
+    @param path the device node or a link to it
+    @return the device or nullptr if the path does not name a block device in the snapshot
+*/
+const TopologySnapshot::BlockDevice* TopologySnapshot::find(const QString& path) const
+{
+    if (path.startsWith(QStringLiteral("/dev/"))) {
+        const BlockDevice* d = findByName(path.mid(5));
+        if (d)
+            return d;
+    }
+
+    struct stat st;
+    if (path.isEmpty() || stat(path.toLocal8Bit().constData(), &st) != 0 || !S_ISBLK(st.st_mode))
+        return nullptr;
+
+    return findByDevno(makeDevno(major(st.st_rdev), minor(st.st_rdev)));
+}
+
+/** @param name the kernel name, like sda1, or mapper/ followed by a device mapper name
+    @return the device or nullptr if there is none by that name
+*/
+const TopologySnapshot::BlockDevice* TopologySnapshot::findByName(const QString& name) const
+{
+    const qint32 index = m_ByName.value(name, -1);
+    return index >= 0 ? &m_Devices[index] : nullptr;
+}
+
+/** @param devno the device number, see makeDevno()
+    @return the device or nullptr if there is none with that number
+*/
+const TopologySnapshot::BlockDevice* TopologySnapshot::findByDevno(quint64 devno) const
+{
+    const qint32 index = m_ByDevno.value(devno, -1);
+    return index >= 0 ? &m_Devices[index] : nullptr;
+}
+
+/** @return all whole disks, that is every device that is not a partition, sorted by name */
+QList<const TopologySnapshot::BlockDevice*> TopologySnapshot::disks() const
+{
+    QList<const BlockDevice*> result;
+
+    for (const BlockDevice& d : m_Devices)
+        if (!d.partition)
+            result.append(&d);
+
+    return result;
+}
+
+/** Lists the disks a scan looks at: whole disks of the kinds a partition table can be
+    created on, but no loop, RAM, zram or optical devices.
+    @param excludeReadOnly true to leave out disks the kernel marks read-only
+    @return the disks, sorted by name
+*/
+QList<const TopologySnapshot::BlockDevice*> TopologySnapshot::scannableDisks(bool excludeReadOnly) const
+{
+    QList<const BlockDevice*> result;
+
+    for (const BlockDevice* d : disks())
+        if (isScannableMajor(d->devMajor()) && !(excludeReadOnly && d->readOnly))
+            result.append(d);
+
+    return result;
+}
+
+/** @param deviceNode the device to check
+    @param excludeReadOnly true if disks the kernel marks read-only are not scanned
+    @return true if the device is one of the scannableDisks()
+*/
+bool TopologySnapshot::isScannableDisk(const QString& deviceNode, bool excludeReadOnly) const
+{
+    const BlockDevice* d = find(deviceNode);
+    return d && !d->partition && isScannableMajor(d->devMajor()) && !(excludeReadOnly && d->readOnly);
+}
+
+/** @param major a block device major number
+    @return true if disks with this major number are scanned
+*/
+bool TopologySnapshot::isScannableMajor(quint32 major)
+{
+    // linux.git/tree/Documentation/devices.txt
+    static const QSet<quint32> majors = {
+        3, 22, 33, 34, 56, 57, 88, 89, 90, 91, 128, 129, 130, 131, 132, 133, 134, 135, // MFM, RLL and IDE hard disk/CD-ROM interface
+        // 7, // loop devices TODO: add another bool option for loopDevices
+        8, 65, 66, 67, 68, 69, 70, 71, // SCSI disk devices
+        80, 81, 82, 83, 84, 85, 86, 87, // I2O hard disk
+        179, // MMC block devices
+        253, // Virtio KVM devices (e.g. /dev/vda)
+        259 // Block Extended Major (include NVMe)
+    };
+
+    return majors.contains(major);
+}
+
+/** @param deviceNode the device to check
+    @return true if the device is mounted somewhere or is an active swap area
+*/
+bool TopologySnapshot::isMounted(const QString& deviceNode) const
+{
+    const BlockDevice* d = find(deviceNode);
+    return d && (!d->mountPoints.isEmpty() || d->swap);
+}
+
+/** @param deviceNode the device to look up
+    @return where the device is mounted or, if it is not, where /etc/fstab would mount it
+*/
+QString TopologySnapshot::mountPoint(const QString& deviceNode) const
+{
+    const BlockDevice* d = find(deviceNode);
+
+    if (!d)
+        return QString();
+
+    return d->mountPoints.isEmpty() ? d->fstabMountPoint : d->mountPoints.first();
+}
+
+/** @param deviceNode a device with a device mapper device on top of it, like an open LUKS container
+    @return the /dev/mapper node of the first device mapper holder or an empty string if there is none
+*/
+QString TopologySnapshot::mapperNode(const QString& deviceNode) const
+{
+    const BlockDevice* d = find(deviceNode);
+
+    if (d) {
+        for (const QString& holder : d->holders) {
+            const BlockDevice* h = findByName(holder);
+            if (h && !h->mapperName.isEmpty())
+                return QStringLiteral("/dev/mapper/") + h->mapperName;
+        }
+    }
+
+    return QString();
+}
+
+/** @param deviceNode the device to look up
+    @param key the udev property, like ID_FS_TYPE
+    @return the value of the property or an empty string if the device does not have it
+*/
+QString TopologySnapshot::property(const QString& deviceNode, const QString& key) const
+{
+    const BlockDevice* d = find(deviceNode);
+    return d ? d->properties.value(key) : QString();
+}
+
+/** Probes a device with libblkid, once per snapshot.
+
+    Partition names and UUIDs are taken from udev when it knows them, which saves reading
+    the parent's partition table for every partition.
+
+    @param deviceNode the device to probe
+    @return the probe result
+*/
+BlkidProbe TopologySnapshot::probe(const QString& deviceNode) const
+{
+    {
+        QMutexLocker locker(&m_ProbeMutex);
+        if (m_Probes.contains(deviceNode))
+            return m_Probes.value(deviceNode);
+    }
+
+    const BlockDevice* d = find(deviceNode);
+    const bool wholeDisk = d && !d->partition;
+    const bool partitionFromUdev = d && d->partition && d->properties.contains(QStringLiteral("ID_PART_ENTRY_UUID"));
+
+    // probing runs unlocked so that the scan threads can read their disks in parallel
+    BlkidProbe result(deviceNode, !wholeDisk && !partitionFromUdev);
+
+    if (partitionFromUdev)
+        result.setPartitionEntry(decodeUdev(d->properties.value(QStringLiteral("ID_PART_ENTRY_NAME"))),
+                                 d->properties.value(QStringLiteral("ID_PART_ENTRY_UUID")));
+
+    QMutexLocker locker(&m_ProbeMutex);
+    m_Probes.insert(deviceNode, result);
+
+    return result;
+}
@@ -0,0 +1,135 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(TOPOLOGYSNAPSHOT__H)
+
+#define TOPOLOGYSNAPSHOT__H
+
+#include "util/blkidprobe.h"
+#include "util/libpartitionmanagerexport.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/** A snapshot of the system's block devices, mounts and swaps.
+
+    A scan asks many small questions per partition: is it mounted, where, what is the
+    mapper device of this LUKS container, which disks exist. Answering each of them with
+    an lsblk call or a fresh parse of the mount tables does not scale to systems with
+    hundreds of devices. A TopologySnapshot reads sysfs, /proc/self/mountinfo, /proc/swaps,
+    /etc/fstab and the udev database once and answers all of these from hash lookups.
+
+    While a TopologySnapshot::Scope is alive, current() hands out the same snapshot to
+    every caller on every thread. Outside of a scope, current() reads a new one, so code
+    that runs between scans (like jobs checking whether a device is mounted) never sees
+    stale data. The snapshot of a scope also keeps the BlkidProbe of every device it was
+    asked about, so a scan reads each superblock once.
+
+    @see DeviceScanner::scan, LibPartedBackend::scanDevices
+*/
+class LIBKPMCORE_EXPORT TopologySnapshot
+{
+public:
+    /** One block device as seen in /sys/class/block */
+    struct BlockDevice
+    {
+        BlockDevice() : devno(0), partition(false), readOnly(false), removable(false), swap(false) {}
+
+        QString name; /**< kernel name, like sda1 or dm-0 */
+        quint64 devno; /**< major and minor number, see makeDevno() */
+        QString parent; /**< for a partition, the kernel name of its disk */
+        bool partition; /**< true if this is a partition of another block device */
+        bool readOnly; /**< true if the kernel marks the device read-only */
+        bool removable; /**< true if the device has removable media */
+        bool swap; /**< true if the device is an active swap area */
+        QString mapperName; /**< for a device mapper device, its name below /dev/mapper */
+        QStringList holders; /**< kernel names of devices stacked on top of this one */
+        QStringList slaves; /**< kernel names of devices this one is stacked on */
+        QStringList mountPoints; /**< where the device is mounted right now */
+        QString fstabMountPoint; /**< where /etc/fstab would mount the device */
+        QHash<QString, QString> properties; /**< udev properties, like ID_FS_TYPE */
+
+        QString deviceNode() const { return QStringLiteral("/dev/") + name; } /**< @return the device node */
+        quint32 devMajor() const { return static_cast<quint32>(devno >> 32); } /**< @return the major number */
+        quint32 devMinor() const { return static_cast<quint32>(devno); } /**< @return the minor number */
+    };
+
+    /** Shares one snapshot with everything that runs while the Scope is alive.
+
+        Scopes nest: only the outermost one reads the snapshot and only its end drops it.
+    */
+    class LIBKPMCORE_EXPORT Scope
+    {
+        Q_DISABLE_COPY(Scope)
+
+    public:
+        Scope();
+        ~Scope();
+    };
+
+public:
+    TopologySnapshot();
+
+public:
+    static QSharedPointer<const TopologySnapshot> current();
+    static QSharedPointer<const TopologySnapshot> scoped();
+    static quint64 makeDevno(quint32 major, quint32 minor) { return (static_cast<quint64>(major) << 32) | minor; } /**< @return a devno from its parts */
+
+    const BlockDevice* find(const QString& path) const;
+    const BlockDevice* findByName(const QString& name) const;
+    const BlockDevice* findByDevno(quint64 devno) const;
+
+    QList<const BlockDevice*> disks() const;
+    QList<const BlockDevice*> scannableDisks(bool excludeReadOnly) const;
+    bool isScannableDisk(const QString& deviceNode, bool excludeReadOnly) const;
+
+    static bool isScannableMajor(quint32 major);
+
+    bool isMounted(const QString& deviceNode) const;
+    QString mountPoint(const QString& deviceNode) const;
+    QString mapperNode(const QString& deviceNode) const;
+    QString property(const QString& deviceNode, const QString& key) const;
+    BlkidProbe probe(const QString& deviceNode) const;
+
+    const QVector<BlockDevice>& devices() const { return m_Devices; } /**< @return all block devices, sorted by name */
+
+protected:
+    void read();
+    void readSysfs();
+    void readUdev(BlockDevice& d) const;
+    void readMountInfo();
+    void readSwaps();
+    void readFstab();
+
+    BlockDevice* findMutable(const QString& path);
+
+private:
+    QVector<BlockDevice> m_Devices;
+    QHash<QString, qint32> m_ByName;
+    QHash<quint64, qint32> m_ByDevno;
+    QHash<QString, qint32> m_ByFsUuid;
+    QHash<QString, qint32> m_ByPartUuid;
+
+    mutable QMutex m_ProbeMutex;
+    mutable QHash<QString, BlkidProbe> m_Probes;
+};
+
+#endif
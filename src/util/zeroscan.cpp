@@ -0,0 +1,125 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by KPMcore developers                             *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/zeroscan.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ZEROSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static bool isAllZeroScalar(const char* p, qint64 size)
+{
+    qint64 i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        quint64 word;
+        memcpy(&word, p + i, sizeof(word));
+
+        if (word != 0)
+            return false;
+    }
+
+    for (; i < size; i++)
+        if (p[i] != 0)
+            return false;
+
+    return true;
+}
+
+#if defined(ZEROSCAN_X86)
+
+__attribute__((target("sse2")))
+static bool isAllZeroSse2(const char* p, qint64 size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    qint64 i = 0;
+
+    for (; i + 64 <= size; i += 64) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 32));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 48));
+        const __m128i v = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff)
+            return false;
+    }
+
+    return isAllZeroScalar(p + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static bool isAllZeroAvx2(const char* p, qint64 size)
+{
+    qint64 i = 0;
+
+    for (; i + 128 <= size; i += 128) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 32));
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 64));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 96));
+        const __m256i v = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+
+        if (!_mm256_testz_si256(v, v))
+            return false;
+    }
+
+    return isAllZeroScalar(p + i, size - i);
+}
+
+#endif
+
+typedef bool (*ZeroScanFunction)(const char*, qint64);
+
+static ZeroScanFunction selectZeroScan()
+{
+#if defined(ZEROSCAN_X86)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return isAllZeroAvx2;
+
+    if (__builtin_cpu_supports("sse2"))
+        return isAllZeroSse2;
+#endif
+
+    return isAllZeroScalar;
+}
+
+/** Checks if a buffer contains only zero bytes.
+
+    Uses AVX2 or SSE2 if the CPU supports them. The scan stops at the first chunk that
+    is not zero, so buffers with data are usually rejected after a few bytes.
+
+    @param data the buffer to check
+    @param size the size of the buffer in bytes
+    @return true if all bytes in the buffer are zero
+*/
+bool isAllZero(const void* data, qint64 size)
+{
+    static const ZeroScanFunction scan = selectZeroScan();
+    const char* p = static_cast<const char*>(data);
+
+    // most buffers that are not zero already fail on their first bytes
+    if (size >= 16 && !isAllZeroScalar(p, 16))
+        return false;
+
+    return scan(p, size);
+}